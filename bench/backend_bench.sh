@@ -0,0 +1,28 @@
+#!/bin/sh
+# Compare service backends over loopback: requests/sec and server CPU per request.
+# Usage: bench/backend_bench.sh [conns] [seconds] [uri]
+
+CONNS=${1:-64}
+SECONDS_RUN=${2:-5}
+URI=${3:-/hello}
+PORT=18000
+TICKS=$(getconf CLK_TCK)
+
+cd "$(dirname "$0")/.." || exit 1
+
+for engine in thread epoll uring; do
+    ./lws_tool -s -e $engine -p $PORT -l 2 > /dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+
+    cpu0=$(awk '{print $14 + $15}' /proc/$pid/stat)
+    rps=$(./lws_bench -p $PORT -c $CONNS -d $SECONDS_RUN $URI | awk '/requests/ {r = $2} /throughput/ {print r, $2}')
+    cpu1=$(awk '{print $14 + $15}' /proc/$pid/stat)
+
+    kill $pid
+    wait $pid 2> /dev/null
+
+    echo "$rps $cpu0 $cpu1" | awk -v e=$engine -v t=$TICKS \
+        '{ printf "%-8s %10d req/s %8.2f us cpu/req\n", e, $2, ($4 - $3) * 1e6 / t / ($1 ? $1 : 1) }'
+    PORT=$((PORT + 1))
+done
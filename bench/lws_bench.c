@@ -0,0 +1,640 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "lws_log.h"
+#include "lws_http.h"
+
+/*
+ * lws_bench - HTTP load generator
+ *
+ * Closed loop (default): every connection keeps `pipeline` requests in
+ * flight and sends the next one as soon as a response arrives.
+ * Open loop (-r rate): requests are scheduled at fixed intervals whether
+ * or not the server keeps up, and latency is measured from the scheduled
+ * time, so a stalled server is not hidden by a stalled client
+ * (coordinated omission). Closed loop results are additionally corrected
+ * the HdrHistogram way with the mean interval as expected interval.
+ */
+
+#define BENCH_MAX_PIPELINE      64
+#define BENCH_RECV_SIZE         (64 * 1024)
+#define BENCH_MAX_EVENTS        256
+#define BENCH_MAX_URIS          16
+
+/* latency histogram: 1us .. ~18min, 32 linear sub-buckets per power of 2 */
+#define BENCH_HIST_MIN_SHIFT    10
+#define BENCH_HIST_SUB_BITS     5
+#define BENCH_HIST_MAGNITUDES   31
+#define BENCH_HIST_BUCKETS      (2 + BENCH_HIST_MAGNITUDES * (1 << BENCH_HIST_SUB_BITS))
+
+#define BENCH_CONN_IDLE         0
+#define BENCH_CONN_CONNECTING   1
+#define BENCH_CONN_READY        2
+
+typedef struct _bench_hist_t_ {
+    uint64_t buckets[BENCH_HIST_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+    double sum;
+} bench_hist_t;
+
+typedef struct _bench_conn_t_ {
+    int sockfd;
+    int state;
+    int uri_index;
+    int code;                           /* status of response being read */
+    char rbuf[BENCH_RECV_SIZE];
+    int rlen;
+    long long body_left;                /* -1: until close */
+    int inflight;                       /* sent, waiting for response */
+    int queued;                         /* due, not yet sent */
+    uint64_t start[BENCH_MAX_PIPELINE]; /* intended start of in-flight + queued */
+    int head;
+    uint64_t next_due;                  /* open loop schedule */
+    uint64_t interval;                  /* open loop ns per request */
+    char *wbuf;
+    int wlen;
+    int woff;
+} bench_conn_t;
+
+typedef struct _bench_thread_t_ {
+    pthread_t tid;
+    int index;
+    int conns;
+    bench_conn_t *conn;
+    bench_hist_t hist;
+    uint64_t responses;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t non2xx;
+    uint64_t connects;
+} bench_thread_t;
+
+/* options */
+static struct sockaddr_in bench_addr;
+static const char *bench_host = "127.0.0.1";
+static int bench_port = 8000;
+static int bench_connections = 32;
+static int bench_threads = 1;
+static int bench_seconds = 10;
+static double bench_rate = 0;           /* 0: closed loop */
+static int bench_pipeline = 1;
+static int bench_keepalive = 1;
+static int bench_fastopen = 0;
+static int bench_json = 0;
+static const char *bench_uris[BENCH_MAX_URIS];
+static int bench_uri_count = 0;
+static char *bench_requests[BENCH_MAX_URIS];
+static int bench_request_lens[BENCH_MAX_URIS];
+static int bench_request_max = 0;
+static uint64_t bench_deadline;
+
+static uint64_t bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_hist_bucket(uint64_t ns)
+{
+    int msb, magnitude, sub;
+
+    if (ns < (1ULL << BENCH_HIST_MIN_SHIFT))
+        return 0;
+
+    msb = 63 - __builtin_clzll(ns);
+    magnitude = msb - BENCH_HIST_MIN_SHIFT;
+    if (magnitude >= BENCH_HIST_MAGNITUDES)
+        return BENCH_HIST_BUCKETS - 1;
+
+    sub = (ns >> (msb - BENCH_HIST_SUB_BITS)) & ((1 << BENCH_HIST_SUB_BITS) - 1);
+    return 1 + (magnitude << BENCH_HIST_SUB_BITS) + sub;
+}
+
+/* midpoint of bucket in nanoseconds */
+static double bench_hist_value(int bucket)
+{
+    int magnitude, sub;
+    double low, width;
+
+    if (bucket == 0)
+        return (1 << BENCH_HIST_MIN_SHIFT) / 2.0;
+
+    magnitude = (bucket - 1) >> BENCH_HIST_SUB_BITS;
+    sub = (bucket - 1) & ((1 << BENCH_HIST_SUB_BITS) - 1);
+    width = (double)(1ULL << (magnitude + BENCH_HIST_MIN_SHIFT - BENCH_HIST_SUB_BITS));
+    low = (double)(1ULL << (magnitude + BENCH_HIST_MIN_SHIFT)) + sub * width;
+    return low + width / 2;
+}
+
+static void bench_hist_record(bench_hist_t *hist, uint64_t ns)
+{
+    hist->buckets[bench_hist_bucket(ns)]++;
+    hist->count++;
+    hist->sum += ns;
+    if (ns > hist->max)
+        hist->max = ns;
+}
+
+static void bench_hist_merge(bench_hist_t *to, bench_hist_t *from)
+{
+    int b;
+
+    for (b = 0; b < BENCH_HIST_BUCKETS; b++)
+        to->buckets[b] += from->buckets[b];
+    to->count += from->count;
+    to->sum += from->sum;
+    if (from->max > to->max)
+        to->max = from->max;
+}
+
+/* replay samples a stalled closed loop client never sent */
+static void bench_hist_correct(bench_hist_t *to, bench_hist_t *from, double expected)
+{
+    double value, missing;
+    uint64_t n;
+    int b;
+
+    memcpy(to, from, sizeof(bench_hist_t));
+    if (expected <= 0)
+        return;
+
+    for (b = 0; b < BENCH_HIST_BUCKETS; b++) {
+        n = from->buckets[b];
+        if (n == 0)
+            continue;
+
+        value = bench_hist_value(b);
+        for (missing = value - expected; missing >= expected; missing -= expected) {
+            to->buckets[bench_hist_bucket((uint64_t)missing)] += n;
+            to->count += n;
+            to->sum += missing * n;
+        }
+    }
+}
+
+static double bench_hist_percentile(bench_hist_t *hist, double percentile)
+{
+    uint64_t target, seen = 0;
+    int b;
+
+    if (hist->count == 0)
+        return 0;
+
+    target = (uint64_t)(hist->count * percentile / 100.0);
+    if (target >= hist->count)
+        target = hist->count - 1;
+
+    for (b = 0; b < BENCH_HIST_BUCKETS; b++) {
+        seen += hist->buckets[b];
+        if (seen > target)
+            return bench_hist_value(b);
+    }
+
+    return hist->max;
+}
+
+static void bench_close(bench_thread_t *t, bench_conn_t *c, int epfd)
+{
+    if (c->sockfd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->sockfd, NULL);
+        close(c->sockfd);
+    }
+
+    c->sockfd = -1;
+    c->state = BENCH_CONN_IDLE;
+    c->rlen = 0;
+    c->body_left = 0;
+    c->wlen = c->woff = 0;
+
+    /* responses lost with the connection are resent */
+    c->queued += c->inflight;
+    c->inflight = 0;
+}
+
+static int bench_connect(bench_thread_t *t, bench_conn_t *c, int epfd)
+{
+    struct epoll_event ev;
+    int opt = 1;
+
+    c->sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->sockfd < 0)
+        return -1;
+
+    setsockopt(c->sockfd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    /* connect returns at once, the first request goes out with the SYN once a cookie is known */
+    if (bench_fastopen)
+        setsockopt(c->sockfd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &opt, sizeof(opt));
+    if (connect(c->sockfd, (struct sockaddr *)&bench_addr, sizeof(bench_addr)) && errno != EINPROGRESS) {
+        close(c->sockfd);
+        c->sockfd = -1;
+        return -1;
+    }
+
+    c->state = BENCH_CONN_CONNECTING;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c->sockfd, &ev);
+    t->connects++;
+    return 0;
+}
+
+static int bench_flush(bench_conn_t *c)
+{
+    ssize_t n;
+
+    while (c->woff < c->wlen) {
+        n = send(c->sockfd, c->wbuf + c->woff, c->wlen - c->woff, MSG_NOSIGNAL);
+        if (n < 0)
+            return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+        c->woff += n;
+    }
+
+    c->woff = c->wlen = 0;
+    return 0;
+}
+
+/* move queued requests on the wire while pipeline allows */
+static int bench_send(bench_thread_t *t, bench_conn_t *c, int epfd)
+{
+    int n, len;
+
+    if (c->queued == 0)
+        return 0;
+
+    if (c->state == BENCH_CONN_IDLE)
+        return bench_connect(t, c, epfd);
+
+    if (c->state != BENCH_CONN_READY || c->wlen)
+        return 0;
+
+    n = bench_keepalive ? bench_pipeline - c->inflight : 1 - c->inflight;
+    if (n > c->queued)
+        n = c->queued;
+    if (n <= 0)
+        return 0;
+
+    len = bench_request_lens[c->uri_index];
+    while (n-- > 0) {
+        memcpy(c->wbuf + c->wlen, bench_requests[c->uri_index], len);
+        c->wlen += len;
+        c->queued--;
+        c->inflight++;
+    }
+
+    return bench_flush(c);
+}
+
+/* complete response, record latency from intended start */
+static void bench_response(bench_thread_t *t, bench_conn_t *c, int code, uint64_t now)
+{
+    bench_hist_record(&t->hist, now - c->start[c->head]);
+    c->head = (c->head + 1) % BENCH_MAX_PIPELINE;
+    c->inflight--;
+    t->responses++;
+    if (code < 200 || code >= 300)
+        t->non2xx++;
+
+    if (bench_uri_count > 1)
+        c->uri_index = (c->uri_index + 1) % bench_uri_count;
+
+    /* closed loop: next request right away */
+    if (bench_rate <= 0 && now < bench_deadline) {
+        c->start[(c->head + c->inflight + c->queued) % BENCH_MAX_PIPELINE] = now;
+        c->queued++;
+    }
+}
+
+static int bench_read(bench_thread_t *t, bench_conn_t *c, int epfd)
+{
+    struct http_message hm;
+    long long chunk;
+    ssize_t n;
+    int len, off;
+
+    while (1) {
+        n = recv(c->sockfd, c->rbuf + c->rlen, BENCH_RECV_SIZE - c->rlen, 0);
+        if (n < 0)
+            return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+        if (n == 0) {
+            /* body delimited by close */
+            if (c->inflight && c->body_left < 0)
+                bench_response(t, c, c->code, bench_now());
+            return -1;
+        }
+
+        t->bytes += n;
+        c->rlen += n;
+        off = 0;
+
+        while (off < c->rlen) {
+            if (c->body_left != 0) {
+                if (c->body_left < 0) {
+                    off = c->rlen;
+                    break;
+                }
+
+                chunk = c->rlen - off;
+                if (chunk > c->body_left)
+                    chunk = c->body_left;
+                c->body_left -= chunk;
+                off += chunk;
+                if (c->body_left == 0 && c->inflight)
+                    bench_response(t, c, c->code, bench_now());
+                continue;
+            }
+
+            len = lws_parse_http(c->rbuf + off, c->rlen - off, &hm, 0);
+            if (len < 0) {
+                return -1;
+            } else if (len == 0) {
+                if (off == 0 && c->rlen == BENCH_RECV_SIZE)
+                    return -1;
+                break;
+            }
+
+            c->code = hm.resp_code;
+            off += len;
+            c->body_left = (hm.body.len == (size_t) ~0) ? -1 : (long long)hm.body.len;
+            if (c->body_left == 0 && c->inflight)
+                bench_response(t, c, c->code, bench_now());
+        }
+
+        c->rlen -= off;
+        memmove(c->rbuf, c->rbuf + off, c->rlen);
+
+        if (!bench_keepalive && c->inflight == 0 && c->body_left == 0)
+            return -1;
+    }
+}
+
+static void *bench_worker(void *arg)
+{
+    bench_thread_t *t = arg;
+    struct epoll_event events[BENCH_MAX_EVENTS];
+    bench_conn_t *c;
+    uint64_t now, wake;
+    int epfd, nfds, i, timeout, err;
+    socklen_t errlen;
+
+    epfd = epoll_create1(0);
+    now = bench_now();
+
+    for (i = 0; i < t->conns; i++) {
+        c = &t->conn[i];
+        c->sockfd = -1;
+        c->uri_index = (t->index + i) % bench_uri_count;
+        c->wbuf = malloc(BENCH_MAX_PIPELINE * bench_request_max);
+
+        if (bench_rate > 0) {
+            c->interval = (uint64_t)(1e9 * bench_connections / bench_rate);
+            /* spread first requests over one interval */
+            c->next_due = now + c->interval * (t->index * t->conns + i) / bench_connections;
+        } else {
+            /* closed loop: fill the pipeline */
+            for (c->queued = 0; c->queued < (bench_keepalive ? bench_pipeline : 1); c->queued++)
+                c->start[c->queued] = now;
+        }
+
+        if (bench_rate <= 0)
+            bench_send(t, c, epfd);
+    }
+
+    while ((now = bench_now()) < bench_deadline) {
+        /* open loop: release due requests, find next wakeup */
+        wake = bench_deadline;
+        if (bench_rate > 0) {
+            for (i = 0; i < t->conns; i++) {
+                c = &t->conn[i];
+                while (c->next_due <= now) {
+                    if (c->inflight + c->queued < BENCH_MAX_PIPELINE) {
+                        c->start[(c->head + c->inflight + c->queued) % BENCH_MAX_PIPELINE] = c->next_due;
+                        c->queued++;
+                    } else {
+                        t->errors++;    /* client side overflow, server far behind */
+                    }
+                    c->next_due += c->interval;
+                }
+                if (c->queued && bench_send(t, c, epfd))
+                    bench_close(t, c, epfd);
+                if (c->next_due < wake)
+                    wake = c->next_due;
+            }
+        }
+
+        timeout = (int)((wake - now + 999999) / 1000000);
+        nfds = epoll_wait(epfd, events, BENCH_MAX_EVENTS, timeout);
+        for (i = 0; i < nfds; i++) {
+            c = events[i].data.ptr;
+
+            if (c->state == BENCH_CONN_CONNECTING) {
+                errlen = sizeof(err);
+                if (getsockopt(c->sockfd, SOL_SOCKET, SO_ERROR, &err, &errlen) || err) {
+                    t->errors++;
+                    bench_close(t, c, epfd);
+                    continue;
+                }
+                c->state = BENCH_CONN_READY;
+            }
+
+            if ((events[i].events & EPOLLIN) && bench_read(t, c, epfd)) {
+                if (c->inflight)
+                    t->errors++;
+                bench_close(t, c, epfd);
+            }
+
+            if (c->sockfd >= 0 && c->wlen && bench_flush(c)) {
+                t->errors++;
+                bench_close(t, c, epfd);
+            }
+
+            if (bench_send(t, c, epfd)) {
+                t->errors++;
+                bench_close(t, c, epfd);
+            }
+        }
+
+        /* closed loop: reconnect what was closed or failed to connect */
+        if (bench_rate <= 0) {
+            for (i = 0; i < t->conns; i++) {
+                c = &t->conn[i];
+                if (c->state == BENCH_CONN_IDLE && c->queued && bench_send(t, c, epfd))
+                    t->errors++;
+            }
+        }
+    }
+
+    for (i = 0; i < t->conns; i++) {
+        bench_close(t, &t->conn[i], epfd);
+        free(t->conn[i].wbuf);
+    }
+    close(epfd);
+    return NULL;
+}
+
+static void bench_usage(void)
+{
+    printf("Usage: lws_bench [options...] [uri...]\n");
+    printf("Options:\n");
+    printf("    -H host  server address, default is 127.0.0.1\n");
+    printf("    -p port  server port, default is 8000\n");
+    printf("    -c conns  connection count, default is 32\n");
+    printf("    -t threads  worker threads, default is 1\n");
+    printf("    -d seconds  test duration, default is 10\n");
+    printf("    -r rate  open loop total requests/sec, default closed loop\n");
+    printf("    -P depth  pipelined requests per connection, default is 1\n");
+    printf("    -k 0|1  keep-alive, default is 1\n");
+    printf("    -F  connect with TCP Fast Open\n");
+    printf("    -j  print json report\n");
+    printf("    -h  print usage information\n");
+    printf("    uri  request uri, several are used round robin, default is /hello\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bench_thread_t *threads;
+    bench_hist_t hist, corrected;
+    struct addrinfo hints, *res;
+    uint64_t responses = 0, bytes = 0, errors = 0, non2xx = 0, connects = 0;
+    double seconds, expected;
+    double percentiles[] = {50, 90, 99, 99.9, 99.99};
+    int i, per, conn_base;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "H:p:c:t:d:r:P:k:Fjh")) != -1) {
+        switch (ch) {
+            case 'H': bench_host = optarg; break;
+            case 'p': bench_port = atoi(optarg); break;
+            case 'c': bench_connections = atoi(optarg); break;
+            case 't': bench_threads = atoi(optarg); break;
+            case 'd': bench_seconds = atoi(optarg); break;
+            case 'r': bench_rate = atof(optarg); break;
+            case 'P': bench_pipeline = atoi(optarg); break;
+            case 'k': bench_keepalive = atoi(optarg); break;
+            case 'F': bench_fastopen = 1; break;
+            case 'j': bench_json = 1; break;
+            case 'h':
+            default:
+                bench_usage();
+                return -1;
+        }
+    }
+
+    for (; optind < argc && bench_uri_count < BENCH_MAX_URIS; optind++)
+        bench_uris[bench_uri_count++] = argv[optind];
+    if (bench_uri_count == 0)
+        bench_uris[bench_uri_count++] = "/hello";
+
+    if (bench_connections <= 0 || bench_threads <= 0 || bench_seconds <= 0 ||
+        bench_pipeline <= 0 || bench_pipeline > BENCH_MAX_PIPELINE) {
+        bench_usage();
+        return -1;
+    }
+    if (bench_threads > bench_connections)
+        bench_threads = bench_connections;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(bench_host, NULL, &hints, &res)) {
+        printf("resolve %s failed\n", bench_host);
+        return -1;
+    }
+    memcpy(&bench_addr, res->ai_addr, sizeof(bench_addr));
+    bench_addr.sin_port = htons(bench_port);
+    freeaddrinfo(res);
+
+    for (i = 0; i < bench_uri_count; i++) {
+        bench_requests[i] = malloc(strlen(bench_uris[i]) + 128);
+        bench_request_lens[i] = sprintf(bench_requests[i],
+                "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                bench_uris[i], bench_host, bench_keepalive ? "keep-alive" : "close");
+        if (bench_request_lens[i] > bench_request_max)
+            bench_request_max = bench_request_lens[i];
+    }
+
+    /* parser logs stay quiet */
+    lws_set_log_level(LOG_LEVEL_ERR);
+
+    threads = calloc(bench_threads, sizeof(bench_thread_t));
+    bench_deadline = bench_now() + (uint64_t)bench_seconds * 1000000000ULL;
+    for (i = 0, conn_base = 0; i < bench_threads; i++) {
+        per = bench_connections / bench_threads + (i < bench_connections % bench_threads ? 1 : 0);
+        threads[i].index = conn_base;
+        threads[i].conns = per;
+        threads[i].conn = calloc(per, sizeof(bench_conn_t));
+        conn_base += per;
+        pthread_create(&threads[i].tid, NULL, bench_worker, &threads[i]);
+    }
+
+    memset(&hist, 0, sizeof(hist));
+    for (i = 0; i < bench_threads; i++) {
+        pthread_join(threads[i].tid, NULL);
+        bench_hist_merge(&hist, &threads[i].hist);
+        responses += threads[i].responses;
+        bytes += threads[i].bytes;
+        errors += threads[i].errors;
+        non2xx += threads[i].non2xx;
+        connects += threads[i].connects;
+        free(threads[i].conn);
+    }
+    seconds = bench_seconds;
+
+    /* closed loop: every connection slot is expected to issue a request per mean latency */
+    expected = 0;
+    if (bench_rate <= 0 && hist.count)
+        expected = hist.sum / hist.count;
+    bench_hist_correct(&corrected, &hist, bench_rate > 0 ? 0 : expected);
+
+    if (bench_json) {
+        printf("{\"mode\":\"%s\",\"connections\":%d,\"threads\":%d,\"pipeline\":%d,\"keepalive\":%d,",
+               bench_rate > 0 ? "open" : "closed", bench_connections, bench_threads, bench_pipeline, bench_keepalive);
+        printf("\"target_rate\":%.0f,\"seconds\":%.3f,\"requests\":%llu,\"rps\":%.1f,\"bytes\":%llu,",
+               bench_rate, seconds, (unsigned long long)responses, responses / seconds, (unsigned long long)bytes);
+        printf("\"errors\":%llu,\"non2xx\":%llu,\"connects\":%llu,\"latency_us\":{",
+               (unsigned long long)errors, (unsigned long long)non2xx, (unsigned long long)connects);
+        printf("\"mean\":%.1f,", hist.count ? hist.sum / hist.count / 1e3 : 0);
+        for (i = 0; i < (int)ARRAY_SIZE(percentiles); i++)
+            printf("\"p%g\":%.1f,", percentiles[i], bench_hist_percentile(&corrected, percentiles[i]) / 1e3);
+        printf("\"max\":%.1f}}\n", hist.max / 1e3);
+        return 0;
+    }
+
+    printf("%s loop, %d connections, %d threads, pipeline %d, keep-alive %s",
+           bench_rate > 0 ? "open" : "closed", bench_connections, bench_threads,
+           bench_pipeline, bench_keepalive ? "on" : "off");
+    if (bench_rate > 0)
+        printf(", target %.0f req/s", bench_rate);
+    printf("\n");
+    printf("  requests      %llu in %.2fs, %llu errors, %llu non-2xx, %llu connects\n",
+           (unsigned long long)responses, seconds, (unsigned long long)errors,
+           (unsigned long long)non2xx, (unsigned long long)connects);
+    printf("  throughput    %.1f req/s, %.2f MB/s\n", responses / seconds, bytes / seconds / 1e6);
+    printf("  latency       mean %.1fus, max %.1fus (%s)\n",
+           hist.count ? hist.sum / hist.count / 1e3 : 0, hist.max / 1e3,
+           bench_rate > 0 ? "from scheduled start" : "corrected for coordinated omission");
+    for (i = 0; i < (int)ARRAY_SIZE(percentiles); i++) {
+        printf("  p%-12g %.1fus (raw %.1fus)\n", percentiles[i],
+               bench_hist_percentile(&corrected, percentiles[i]) / 1e3,
+               bench_hist_percentile(&hist, percentiles[i]) / 1e3);
+    }
+
+    return 0;
+}
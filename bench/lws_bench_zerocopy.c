@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+
+/*
+ * lws_bench_zerocopy - MSG_ZEROCOPY against copying sends
+ *
+ * Streams a buffer of each size over TCP with plain send() and with
+ * MSG_ZEROCOPY, reaping completions as the server does, and reports sender
+ * cpu per byte and throughput. The crossover is the smallest size from which
+ * zero-copy costs less cpu at every larger size, without the kernel copying
+ * it after all. The sink runs on loopback unless -a names a remote one
+ * started with -s. Loopback copies every zerocopy send on delivery, out of
+ * the sender's cpu time, so only a real NIC gives a crossover.
+ */
+
+#define ZC_MIN_SIZE         4096
+#define ZC_MAX_SIZE         (8 * 1024 * 1024)
+#define ZC_SINK_BUF         (256 * 1024)
+#define ZC_MAX_INFLIGHT     256             /* sends waiting for completion before blocking on them */
+#define ZC_POINTS           12
+#define ZC_COPIED_MAX       0.5             /* more copied zerocopy sends do not count as a win */
+
+typedef struct _zc_result_t_ {
+    int size;
+    double cpu_ns_per_kb[2];                /* copy, zerocopy */
+    double gbps[2];
+    double copied;                          /* zerocopy sends the kernel copied anyway */
+} zc_result_t;
+
+static struct sockaddr_storage zc_addr;
+static socklen_t zc_addrlen;
+
+static uint64_t zc_clock(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *zc_sink_conn(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    char *buf = malloc(ZC_SINK_BUF);
+
+    while (buf && recv(fd, buf, ZC_SINK_BUF, 0) > 0)
+        ;
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+static void *zc_sink(void *arg)
+{
+    int listenfd = (int)(intptr_t)arg;
+    pthread_t tid;
+    int fd;
+
+    while ((fd = accept(listenfd, NULL, NULL)) >= 0) {
+        if (pthread_create(&tid, NULL, zc_sink_conn, (void *)(intptr_t)fd) == 0)
+            pthread_detach(tid);
+        else
+            close(fd);
+    }
+    return NULL;
+}
+
+static int zc_sink_listen(int port)
+{
+    struct sockaddr_in sin;
+    int fd, on = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = port ? htonl(INADDR_ANY) : htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) || listen(fd, 16)) {
+        close(fd);
+        return -1;
+    }
+
+    zc_addrlen = sizeof(zc_addr);
+    getsockname(fd, (struct sockaddr *)&zc_addr, &zc_addrlen);
+    return fd;
+}
+
+/* completions reaped, copied counts the ones the kernel copied anyway */
+static void zc_reap(int fd, uint64_t *done, uint64_t *copied)
+{
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+    struct sock_extended_err *serr;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return;
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+                continue;
+            *done += serr->ee_data - serr->ee_info + 1;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                *copied += serr->ee_data - serr->ee_info + 1;
+        }
+    }
+}
+
+static void zc_wait(int fd, int timeout_ms)
+{
+    struct pollfd pfd = {fd, 0, 0};
+
+    poll(&pfd, 1, timeout_ms);
+}
+
+/* stream one size for duration_ns, one connection per run */
+static int zc_run(int size, int zerocopy, uint64_t duration_ns, zc_result_t *res)
+{
+    uint64_t sends = 0, done = 0, copied = 0, bytes = 0;
+    uint64_t start, cpu_start, elapsed, cpu;
+    int fd, on = 1, off;
+    ssize_t n;
+    char *buf;
+
+    if (posix_memalign((void **)&buf, 4096, size))
+        return -1;
+    memset(buf, 'z', size);
+
+    fd = socket(zc_addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&zc_addr, zc_addrlen)) {
+        perror("connect");
+        free(buf);
+        return -1;
+    }
+    if (zerocopy && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on))) {
+        perror("SO_ZEROCOPY");
+        close(fd);
+        free(buf);
+        return -1;
+    }
+
+    start = zc_clock(CLOCK_MONOTONIC);
+    cpu_start = zc_clock(CLOCK_THREAD_CPUTIME_ID);
+    while (zc_clock(CLOCK_MONOTONIC) - start < duration_ns) {
+        for (off = 0; off < size; off += n) {
+            n = send(fd, buf + off, size - off, zerocopy ? MSG_ZEROCOPY : 0);
+            if (n < 0 && errno == ENOBUFS) {
+                /* pinned memory or notifications ran out, wait for completions */
+                zc_wait(fd, 10);
+                zc_reap(fd, &done, &copied);
+                n = 0;
+                continue;
+            }
+            if (n <= 0) {
+                perror("send");
+                close(fd);
+                free(buf);
+                return -1;
+            }
+            sends += zerocopy;
+        }
+        bytes += size;
+
+        /* the buffer is rewritten by nobody here, a server must wait for completions */
+        if (zerocopy) {
+            zc_reap(fd, &done, &copied);
+            while (sends - done >= ZC_MAX_INFLIGHT) {
+                zc_wait(fd, 10);
+                zc_reap(fd, &done, &copied);
+            }
+        }
+    }
+
+    while (zerocopy && done < sends) {
+        zc_wait(fd, 100);
+        zc_reap(fd, &done, &copied);
+    }
+    cpu = zc_clock(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    elapsed = zc_clock(CLOCK_MONOTONIC) - start;
+
+    res->cpu_ns_per_kb[zerocopy] = (double)cpu * 1024 / bytes;
+    res->gbps[zerocopy] = (double)bytes * 8 / elapsed;
+    if (zerocopy)
+        res->copied = sends ? (double)copied / sends : 0;
+
+    close(fd);
+    free(buf);
+    return 0;
+}
+
+static int zc_resolve(const char *target)
+{
+    struct addrinfo hints, *ai;
+    char host[256];
+    const char *colon = strrchr(target, ':');
+
+    if (colon == NULL || colon - target >= (int)sizeof(host))
+        return -1;
+    memcpy(host, target, colon - target);
+    host[colon - target] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, colon + 1, &hints, &ai))
+        return -1;
+
+    memcpy(&zc_addr, ai->ai_addr, ai->ai_addrlen);
+    zc_addrlen = ai->ai_addrlen;
+    freeaddrinfo(ai);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    zc_result_t results[ZC_POINTS];
+    const char *report = "bench-zerocopy.json";
+    const char *target = NULL;
+    uint64_t duration_ns = 500000000ULL;
+    int sink_port = 0, listenfd;
+    int i, ch, count = 0, crossover = -1;
+    pthread_t tid;
+    FILE *fp;
+
+    while ((ch = getopt(argc, argv, "a:s:d:o:h")) != -1) {
+        switch (ch) {
+            case 'a':
+                target = optarg;
+                break;
+            case 's':
+                sink_port = atoi(optarg);
+                break;
+            case 'd':
+                duration_ns = (uint64_t)atoi(optarg) * 1000000ULL;
+                break;
+            case 'o':
+                report = optarg;
+                break;
+            default:
+                printf("Usage: lws_bench_zerocopy [-a host:port] [-d ms] [-o report.json]\n");
+                printf("       lws_bench_zerocopy -s port    remote sink for -a\n");
+                return -1;
+        }
+    }
+
+    if (sink_port) {
+        listenfd = zc_sink_listen(sink_port);
+        if (listenfd < 0) {
+            perror("listen");
+            return -1;
+        }
+        zc_sink((void *)(intptr_t)listenfd);
+        return 0;
+    }
+
+    if (target) {
+        if (zc_resolve(target)) {
+            printf("cannot resolve %s\n", target);
+            return -1;
+        }
+    } else {
+        listenfd = zc_sink_listen(0);
+        if (listenfd < 0 || pthread_create(&tid, NULL, zc_sink, (void *)(intptr_t)listenfd)) {
+            perror("sink");
+            return -1;
+        }
+    }
+
+    printf("%10s %14s %14s %10s %10s %8s\n", "size", "copy ns/KB", "zc ns/KB", "copy Gb/s", "zc Gb/s", "copied");
+    for (i = 0; i < ZC_POINTS && (ZC_MIN_SIZE << i) <= ZC_MAX_SIZE; i++) {
+        memset(&results[i], 0, sizeof(results[i]));
+        results[i].size = ZC_MIN_SIZE << i;
+        if (zc_run(results[i].size, 0, duration_ns, &results[i]) ||
+            zc_run(results[i].size, 1, duration_ns, &results[i]))
+            return -1;
+        count++;
+
+        printf("%10d %14.1f %14.1f %10.2f %10.2f %7.0f%%\n", results[i].size,
+               results[i].cpu_ns_per_kb[0], results[i].cpu_ns_per_kb[1],
+               results[i].gbps[0], results[i].gbps[1], results[i].copied * 100);
+    }
+
+    /* smallest size from which zero-copy stays cheaper */
+    for (i = count - 1; i >= 0 && results[i].cpu_ns_per_kb[1] < results[i].cpu_ns_per_kb[0] &&
+         results[i].copied < ZC_COPIED_MAX; i--)
+        crossover = results[i].size;
+
+    if (crossover > 0)
+        printf("crossover: %d bytes, run the server with -Z %d\n", crossover, crossover);
+    else if (count && results[count - 1].copied >= ZC_COPIED_MAX)
+        printf("crossover: none, the kernel copied the zerocopy sends%s\n",
+               target ? "" : ", loopback always does, use -a against a remote sink");
+    else
+        printf("crossover: none, zero-copy never saved cpu\n");
+
+    fp = fopen(report, "w");
+    if (fp == NULL) {
+        printf("open %s failed\n", report);
+        return -1;
+    }
+
+    fprintf(fp, "{\"target\":\"%s\",\"crossover_bytes\":%d,\"points\":[", target ? target : "loopback", crossover);
+    for (i = 0; i < count; i++)
+        fprintf(fp, "%s{\"size\":%d,\"copy_cpu_ns_per_kb\":%.2f,\"zerocopy_cpu_ns_per_kb\":%.2f,"
+                "\"copy_gbps\":%.3f,\"zerocopy_gbps\":%.3f,\"copied_ratio\":%.3f}",
+                i ? "," : "", results[i].size, results[i].cpu_ns_per_kb[0], results[i].cpu_ns_per_kb[1],
+                results[i].gbps[0], results[i].gbps[1], results[i].copied);
+    fprintf(fp, "]}\n");
+    fclose(fp);
+
+    printf("report: %s\n", report);
+    return 0;
+}
@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+"""
+Reverse proxy checks against lws_tool on loopback.
+
+Stand-in upstreams run in this process and record what reaches them. Per
+engine the test checks least-conn and hash selection, failover past an
+upstream that is down, reuse of pooled keep-alive connections, the retry
+after a pooled connection went stale, chunked, fixed length and close
+delimited responses, and request bodies larger than the connection buffer.
+
+Usage: bench/proxy_test.py [-e engine...]
+"""
+
+import argparse
+import hashlib
+import http.client
+import os
+import socket
+import socketserver
+import subprocess
+import sys
+import threading
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+PORT = 18450
+UPSTREAM_PORT = 18460
+
+# larger than the 4 KB connection buffer, streamed to the upstream
+POST_SIZE = 3 * 1024 * 1024
+FIXED_SIZE = 2 * 1024 * 1024
+
+
+def payload(size):
+    return bytes((i * 7) & 0xff for i in range(256)) * (size // 256)
+
+
+class Upstream(socketserver.ThreadingTCPServer):
+    """HTTP/1.1 stand-in, answers with its name and counts connections."""
+
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, name, port, stale=False):
+        super().__init__(("127.0.0.1", port), UpstreamHandler)
+        self.name = name
+        self.port = port
+        self.stale = stale          # the second request on a connection is dropped unanswered
+        self.lock = threading.Lock()
+        self.conns = 0
+        self.requests = 0
+        threading.Thread(target=self.serve_forever, daemon=True).start()
+
+    def reset(self):
+        with self.lock:
+            self.conns = 0
+            self.requests = 0
+
+
+class UpstreamHandler(socketserver.StreamRequestHandler):
+    def read_request(self):
+        try:
+            line = self.rfile.readline()
+        except ConnectionError:
+            return None
+        if not line:
+            return None
+        method, path, _ = line.decode().split(" ", 2)
+        headers = {}
+        while True:
+            h = self.rfile.readline().decode()
+            if h in ("\r\n", "\n", ""):
+                break
+            name, _, value = h.partition(":")
+            headers[name.strip().lower()] = value.strip()
+        body = self.rfile.read(int(headers.get("content-length", "0")))
+        return method, path, headers, body
+
+    def respond(self, body, headers=(), length=True):
+        head = "HTTP/1.1 200 OK\r\nX-Upstream: %s\r\n" % self.server.name
+        head += "".join("%s: %s\r\n" % h for h in headers)
+        if length:
+            head += "Content-Length: %d\r\n" % len(body)
+        self.wfile.write(head.encode() + b"\r\n" + body)
+
+    def handle(self):
+        with self.server.lock:
+            self.server.conns += 1
+        served = 0
+        while True:
+            req = self.read_request()
+            if req is None:
+                return
+            if self.server.stale and served == 1:
+                return
+            served += 1
+            with self.server.lock:
+                self.server.requests += 1
+
+            method, path, headers, body = req
+            if path.endswith("/sleep"):
+                time.sleep(1)
+            if method == "POST":
+                self.respond(("%d %s" % (len(body), hashlib.sha256(body).hexdigest())).encode())
+            elif path.endswith("/chunked"):
+                data = payload(FIXED_SIZE)
+                self.wfile.write(("HTTP/1.1 200 OK\r\nX-Upstream: %s\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                  % self.server.name).encode())
+                for i in range(0, len(data), 100000):
+                    piece = data[i:i + 100000]
+                    self.wfile.write(b"%x\r\n" % len(piece) + piece + b"\r\n")
+                self.wfile.write(b"0\r\n\r\n")
+            elif path.endswith("/fixed"):
+                self.respond(payload(FIXED_SIZE))
+            elif path.endswith("/eof"):
+                self.respond(payload(FIXED_SIZE), [("Connection", "close")], length=False)
+                return
+            elif path.endswith("/bighead"):
+                # within the proxy's 3584 byte head limit, over 4 KB once relayed as "a: b"
+                self.wfile.write(b"HTTP/1.1 200 OK\r\n" + b"a:b\r\n" * 690 + b"Content-Length: 2\r\n\r\nok")
+            else:
+                self.respond(self.server.name.encode())
+
+
+def wait_listen(port, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port), 0.2).close()
+            return True
+        except OSError:
+            time.sleep(0.05)
+    return False
+
+
+def request(port, method, uri, body=None):
+    """One request on a new connection, returns (status, upstream name, body)."""
+    conn = http.client.HTTPConnection("127.0.0.1", port, timeout=10)
+    try:
+        conn.request(method, uri, body=body)
+        resp = conn.getresponse()
+        return resp.status, resp.getheader("X-Upstream"), resp.read()
+    except (OSError, http.client.HTTPException):
+        return 0, None, b""
+    finally:
+        conn.close()
+
+
+def check(name, ok, detail=""):
+    print("%-7s %-32s %s" % ("ok" if ok else "FAIL", name, detail))
+    return ok
+
+
+def run_engine(engine, port, up):
+    a, b, dead, stale, pool = up
+    addr = lambda u: "127.0.0.1:%d" % u.port
+    server = subprocess.Popen([os.path.join(ROOT, "lws_tool"), "-s", "-e", engine, "-p", str(port),
+                               "-x", "/lc=%s,%s" % (addr(a), addr(b)),
+                               "-b", "hash", "-x", "/hash=%s,%s" % (addr(a), addr(b)),
+                               "-b", "leastconn", "-x", "/fail=127.0.0.1:%d,%s" % (dead, addr(a)),
+                               "-x", "/stale=%s" % addr(stale),
+                               "-x", "/pool=%s" % addr(pool)],
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    ok = True
+    try:
+        if not wait_listen(port):
+            return check("%s listen" % engine, False)
+
+        # one upstream busy with a slow request, the quick ones go to the other
+        slow = {}
+        t = threading.Thread(target=lambda: slow.update(r=request(port, "GET", "/lc/sleep")))
+        t.start()
+        time.sleep(0.3)
+        quick = [request(port, "GET", "/lc/%d" % i)[1] for i in range(6)]
+        t.join()
+        busy = slow["r"][1]
+        ok &= check("%s leastconn" % engine, slow["r"][0] == 200 and busy and busy not in quick and
+                    len(set(quick)) == 1, "slow on %s, quick on %s" % (busy, ",".join(sorted(set(quick)))))
+
+        # a path keeps its upstream, different paths spread over both
+        first = {i: request(port, "GET", "/hash/%d" % i)[1] for i in range(20)}
+        again = {i: request(port, "GET", "/hash/%d" % i)[1] for i in range(20)}
+        ok &= check("%s hash" % engine, first == again and set(first.values()) == {"a", "b"},
+                    "%d of 20 paths on a" % list(first.values()).count("a"))
+
+        # the refused upstream is skipped, nothing fails
+        got = [request(port, "GET", "/fail/%d" % i)[:2] for i in range(6)]
+        ok &= check("%s failover" % engine, all(r == (200, "a") for r in got))
+
+        # sequential requests share one pooled upstream connection
+        pool.reset()
+        got = [request(port, "GET", "/pool/%d" % i)[0] for i in range(5)]
+        ok &= check("%s pool reuse" % engine, got == [200] * 5 and pool.conns == 1,
+                    "%d requests, %d upstream connections" % (pool.requests, pool.conns))
+
+        # the pooled connection drops the next request: GET is retried once on a new one, POST is not
+        stale.reset()
+        got = [request(port, "GET", "/stale/%d" % i)[0] for i in range(2)]
+        ok &= check("%s stale retry" % engine, got == [200, 200] and stale.conns == 2,
+                    "%d upstream connections" % stale.conns)
+        request(port, "GET", "/stale/prime")
+        status = request(port, "POST", "/stale/post", b"x")[0]
+        ok &= check("%s no retry for POST" % engine, status == 502, "status %d" % status)
+
+        # response framings, relayed through pipes or read into memory
+        want = hashlib.sha256(payload(FIXED_SIZE)).hexdigest()
+        for path in ("fixed", "chunked", "eof"):
+            status, _, body = request(port, "GET", "/pool/" + path)
+            ok &= check("%s %s response" % (engine, path),
+                        status == 200 and hashlib.sha256(body).hexdigest() == want, "%d bytes" % len(body))
+
+        status = request(port, "GET", "/pool/bighead")[0]
+        ok &= check("%s oversized response head" % engine, status == 502, "status %d" % status)
+
+        # request body far beyond the connection buffer
+        data = os.urandom(POST_SIZE)
+        status, _, body = request(port, "POST", "/pool/post", data)
+        ok &= check("%s streamed request body" % engine,
+                    status == 200 and body.decode() == "%d %s" % (len(data), hashlib.sha256(data).hexdigest()),
+                    "%d bytes" % len(data))
+    finally:
+        server.terminate()
+        server.wait()
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-e", dest="engines", action="append", help="engine, default thread and epoll")
+    args = parser.parse_args()
+
+    if not os.path.exists(os.path.join(ROOT, "lws_tool")):
+        print("build lws_tool first")
+        return 1
+
+    up = (Upstream("a", UPSTREAM_PORT), Upstream("b", UPSTREAM_PORT + 1), UPSTREAM_PORT + 2,
+          Upstream("stale", UPSTREAM_PORT + 3, stale=True), Upstream("pool", UPSTREAM_PORT + 4))
+
+    ok = True
+    for i, engine in enumerate(args.engines or ["thread", "epoll"]):
+        ok &= run_engine(engine, PORT + i, up)
+
+    print("proxy test %s" % ("passed" if ok else "FAILED"))
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""
+End to end scenarios against lws_tool on loopback.
+
+Every scenario starts a fresh server, drives it with lws_bench -j and
+samples the server process while the load runs. Results are compared with
+a stored baseline; a metric that regresses by more than the threshold fails
+the run.
+
+Usage: bench/scenario_bench.py [-e engine] [-d seconds] [-t threshold]
+                               [-b baseline.json] [-u] [-o report.json]
+                               [scenario...]
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# name, lws_bench options, uris
+SCENARIOS = [
+    ("idle_keepalive", ["-c", "10000", "-r", "200"], ["/hello"]),
+    ("small_get", ["-c", "64"], ["/hello"]),
+    ("large_download", ["-c", "8"], ["/download/document/README.pdf"]),
+    ("dir_listing", ["-c", "32"], ["/download", "/download/picture", "/download/document"]),
+    ("pipelined", ["-c", "32", "-P", "16"], ["/hello"]),
+]
+
+# metric, True if higher is better
+METRICS = [
+    ("rps", True),
+    ("p50_us", False),
+    ("p99_us", False),
+    ("p999_us", False),
+    ("rss_kb", False),
+    ("threads", False),
+    ("cpu_us_per_req", False),
+]
+
+# latencies below this are scheduler noise on loopback, never fail on them
+LATENCY_FLOOR_US = 50.0
+
+
+def proc_sample(pid):
+    rss = threads = 0
+    with open("/proc/%d/status" % pid) as f:
+        for line in f:
+            if line.startswith("VmRSS:"):
+                rss = int(line.split()[1])
+            elif line.startswith("Threads:"):
+                threads = int(line.split()[1])
+    return rss, threads
+
+
+def proc_cpu_ticks(pid):
+    with open("/proc/%d/stat" % pid) as f:
+        fields = f.read().rsplit(")", 1)[1].split()
+    # utime and stime, fields 14 and 15 counted from pid
+    return int(fields[11]) + int(fields[12])
+
+
+def wait_listen(port, timeout=5.0):
+    import socket
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port), 0.2).close()
+            return True
+        except OSError:
+            time.sleep(0.05)
+    return False
+
+
+def run_scenario(name, opts, uris, args, port):
+    server = subprocess.Popen(["./lws_tool", "-s", "-e", args.engine, "-p", str(port), "-l", "2"],
+                              cwd=ROOT, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        if not wait_listen(port):
+            raise RuntimeError("%s: server did not start" % name)
+
+        ticks = os.sysconf("SC_CLK_TCK")
+        cpu0 = proc_cpu_ticks(server.pid)
+        bench = subprocess.Popen(["./lws_bench", "-j", "-p", str(port), "-d", str(args.duration)] + opts + uris,
+                                 cwd=ROOT, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+        rss = threads = 0
+        while bench.poll() is None:
+            r, t = proc_sample(server.pid)
+            rss, threads = max(rss, r), max(threads, t)
+            time.sleep(0.1)
+        cpu1 = proc_cpu_ticks(server.pid)
+        out = bench.stdout.read()
+    finally:
+        server.kill()
+        server.wait()
+
+    try:
+        report = json.loads(out.strip().splitlines()[-1])
+    except (ValueError, IndexError):
+        raise RuntimeError("%s: lws_bench produced no report" % name)
+
+    lat = report["latency_us"]
+    requests = report["requests"] or 1
+    return {
+        "rps": report["rps"],
+        "p50_us": lat["p50"],
+        "p99_us": lat["p99"],
+        "p999_us": lat["p99.9"],
+        "rss_kb": rss,
+        "threads": threads,
+        "cpu_us_per_req": (cpu1 - cpu0) * 1e6 / ticks / requests,
+        "errors": report["errors"],
+        "connections": report["connections"],
+    }
+
+
+def compare(name, result, base, threshold):
+    failures = []
+    if result["errors"]:
+        failures.append("%s: %d errors" % (name, result["errors"]))
+    if base is None:
+        return failures
+
+    for metric, higher_better in METRICS:
+        old, new = base.get(metric), result[metric]
+        if not old:
+            continue
+        if metric.endswith("_us") and max(old, new) < LATENCY_FLOOR_US:
+            continue
+        change = (new - old) / old
+        if (higher_better and change < -threshold) or (not higher_better and change > threshold):
+            failures.append("%s: %s %.1f -> %.1f (%+.0f%%)" % (name, metric, old, new, change * 100))
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description="lws end to end scenario benchmarks")
+    parser.add_argument("-e", "--engine", default="epoll", help="service engine, thread|epoll|uring")
+    parser.add_argument("-d", "--duration", type=int, default=5, help="seconds per scenario")
+    parser.add_argument("-t", "--threshold", type=float, default=0.25, help="allowed regression, default 0.25")
+    parser.add_argument("-b", "--baseline", default=os.path.join(ROOT, "bench", "scenario_baseline.json"))
+    parser.add_argument("-u", "--update", action="store_true", help="store results as the new baseline")
+    parser.add_argument("-o", "--output", help="write json report")
+    parser.add_argument("-p", "--port", type=int, default=18100)
+    parser.add_argument("scenario", nargs="*", help="run only these scenarios")
+    args = parser.parse_args()
+
+    baseline = {}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f).get(args.engine, {})
+
+    results = {}
+    failures = []
+    print("%-16s %10s %9s %9s %9s %9s %7s %10s" %
+          ("scenario", "req/s", "p50 us", "p99 us", "p999 us", "rss kB", "threads", "cpu us/req"))
+    for i, (name, opts, uris) in enumerate(SCENARIOS):
+        if args.scenario and name not in args.scenario:
+            continue
+        try:
+            r = run_scenario(name, opts, uris, args, args.port + i)
+        except RuntimeError as e:
+            failures.append(str(e))
+            print(e)
+            continue
+        results[name] = r
+        print("%-16s %10.0f %9.1f %9.1f %9.1f %9d %7d %10.2f" %
+              (name, r["rps"], r["p50_us"], r["p99_us"], r["p999_us"], r["rss_kb"], r["threads"], r["cpu_us_per_req"]))
+        failures += compare(name, r, baseline.get(name), args.threshold)
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump({"engine": args.engine, "duration": args.duration, "scenarios": results}, f, indent=1)
+
+    if args.update:
+        stored = {}
+        if os.path.exists(args.baseline):
+            with open(args.baseline) as f:
+                stored = json.load(f)
+        stored.setdefault(args.engine, {}).update(results)
+        with open(args.baseline, "w") as f:
+            json.dump(stored, f, indent=1, sort_keys=True)
+            f.write("\n")
+        print("baseline updated: %s" % args.baseline)
+        return 0
+
+    if not baseline:
+        print("no %s baseline in %s, nothing compared" % (args.engine, args.baseline))
+    for f in failures:
+        print("FAIL " + f)
+    print("%s (threshold %.0f%%)" % ("FAIL" if failures else "PASS", args.threshold * 100))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""
+TLS termination checks against lws_tool on loopback.
+
+Generates a throwaway self-signed certificate and, per engine, checks the
+handshake, session resumption on reconnect, and a file download that goes
+through lws_tls_sendfile. The server log tells whether the download used
+kTLS; a kernel without the tls module falls back to user space encryption,
+which is reported but does not fail the run unless -k is given.
+
+Usage: bench/tls_test.py [-e engine...] [-k]
+"""
+
+import argparse
+import hashlib
+import os
+import re
+import shutil
+import socket
+import ssl
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+PORT = 18400
+
+# above the 4 MB limit of lws_pack, so it is served from disk, not the bundle
+FILE_SIZE = 6 * 1024 * 1024
+
+
+def wait_listen(port, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port), 0.2).close()
+            return True
+        except OSError:
+            time.sleep(0.05)
+    return False
+
+
+def make_cert(workdir):
+    cert = os.path.join(workdir, "cert.pem")
+    key = os.path.join(workdir, "key.pem")
+    subprocess.run(["openssl", "req", "-x509", "-newkey", "ec", "-pkeyopt", "ec_paramgen_curve:P-256",
+                    "-nodes", "-keyout", key, "-out", cert, "-days", "1", "-subj", "/CN=localhost"],
+                   check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return cert, key
+
+
+def get(ctx, port, uri, session=None):
+    """One request on a new TLS connection, returns (status, body, ssl socket info)."""
+    raw = socket.create_connection(("127.0.0.1", port), 5)
+    conn = ctx.wrap_socket(raw, server_hostname="localhost", session=session)
+    conn.sendall(("GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n" % uri).encode())
+    data = b""
+    while True:
+        chunk = conn.recv(262144)
+        if not chunk:
+            break
+        data += chunk
+    head, _, body = data.partition(b"\r\n\r\n")
+    status = int(head.split(b" ", 2)[1]) if head else 0
+    info = (conn.version(), conn.session, conn.session_reused)
+    conn.close()
+    return status, body, info
+
+
+def check(name, ok, detail=""):
+    print("%-7s %-28s %s" % ("ok" if ok else "FAIL", name, detail))
+    return ok
+
+
+def run_engine(engine, port, workdir, cert, key, digest, args):
+    log = os.path.join(workdir, "server-%s.log" % engine)
+    # stdout to a file is block buffered, terminate would lose the last lines
+    line = ["stdbuf", "-oL"] if shutil.which("stdbuf") else []
+    with open(log, "w") as out:
+        server = subprocess.Popen(line + [os.path.join(ROOT, "lws_tool"), "-s", "-e", engine, "-p", str(port),
+                                          "-c", cert, "-k", key, "-l", "4"],
+                                  cwd=workdir, stdout=out, stderr=subprocess.STDOUT)
+    ok = True
+    try:
+        if not wait_listen(port):
+            return check("%s listen" % engine, False)
+
+        ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+        ctx.load_verify_locations(cert)
+
+        status, body, (version, session, _) = get(ctx, port, "/hello")
+        ok &= check("%s handshake" % engine, status == 200 and b"Hello" in body, version)
+
+        status, body, (_, _, reused) = get(ctx, port, "/hello", session)
+        ok &= check("%s resumption" % engine, status == 200 and reused)
+
+        status, body, _ = get(ctx, port, "/download/tls_test.bin")
+        ok &= check("%s sendfile download" % engine,
+                    status == 200 and hashlib.sha256(body).hexdigest() == digest, "%d bytes" % len(body))
+    finally:
+        server.terminate()
+        server.wait()
+
+    # the server logs every TLS connection when it is released
+    with open(log) as f:
+        text = f.read()
+    conns = re.findall(r"ktls send: (\d), recv: \d, reused: (\d)", text)
+    ok &= check("%s server saw resumption" % engine, any(r == "1" for _, r in conns))
+    ktls = any(s == "1" for s, _ in conns)
+    if args.ktls:
+        ok &= check("%s ktls send" % engine, ktls)
+    else:
+        check("%s ktls send" % engine, True, "used" if ktls else "unavailable, user space fallback tested")
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-e", dest="engines", action="append", help="engine, default thread and epoll")
+    parser.add_argument("-k", dest="ktls", action="store_true", help="fail if kTLS is not used")
+    args = parser.parse_args()
+
+    if not os.path.exists(os.path.join(ROOT, "lws_tool")):
+        print("build lws_tool first")
+        return 1
+    if shutil.which("openssl") is None:
+        print("openssl command not found")
+        return 1
+
+    workdir = tempfile.mkdtemp(prefix="lws-tls-")
+    try:
+        cert, key = make_cert(workdir)
+        os.mkdir(os.path.join(workdir, "load"))
+        data = os.urandom(FILE_SIZE)
+        with open(os.path.join(workdir, "load", "tls_test.bin"), "wb") as f:
+            f.write(data)
+        digest = hashlib.sha256(data).hexdigest()
+
+        ok = True
+        for i, engine in enumerate(args.engines or ["thread", "epoll"]):
+            ok &= run_engine(engine, PORT + i, workdir, cert, key, digest, args)
+    finally:
+        shutil.rmtree(workdir)
+
+    print("tls test %s" % ("passed" if ok else "FAILED"))
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lws_log.h"
+#include "lws_http.h"
+#include "lws_metrics.h"
+#include "lws_admit.h"
+
+/* limits, set once before the service starts */
+static int lws_admit_max_requests = 0;
+static uint64_t lws_admit_target_ns = 0;
+static uint64_t lws_admit_interval_ns = 0;
+
+/* prebuilt responses */
+static char lws_admit_header[32] = "Retry-After: 1";
+static char lws_admit_reject[2][256];           /* keep-alive, close */
+static int lws_admit_reject_len[2] = {0, 0};
+
+/* requests in handlers of every thread */
+static int lws_admit_requests = 0;
+
+/*
+ * Adaptive limit state, shared by every thread so a worker that falls behind
+ * sheds as soon as the window shows a standing queue. Races only blur the
+ * minimum by a request or two.
+ */
+static uint64_t lws_admit_window_end = 0;
+static uint64_t lws_admit_window_min = UINT64_MAX;
+static int lws_admit_overloaded = 0;
+
+static __thread uint64_t lws_admit_stamp_ns = 0;
+
+/**
+ * @func    lws_admit_init
+ * @brief   set request admission limits before the service starts, and
+ *          build the 503 response sent to shed load
+ *
+ * @param   max_requests[in] requests in handlers at once, 0 is unlimited
+ * @param   target_ms[in] queueing delay target of the adaptive limit, 0 is off
+ * @param   retry_after[in] Retry-After seconds of the 503 responses
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_admit_init(int max_requests, int target_ms, int retry_after)
+{
+    int interval_ms, i;
+
+    if (max_requests < 0 || target_ms < 0 || retry_after < 0)
+        return -1;
+
+    lws_admit_max_requests = max_requests;
+    lws_admit_target_ns = (uint64_t)target_ms * 1000000ULL;
+    interval_ms = target_ms * LWS_ADMIT_INTERVAL_MUL;
+    if (interval_ms < LWS_ADMIT_INTERVAL_MS)
+        interval_ms = LWS_ADMIT_INTERVAL_MS;
+    lws_admit_interval_ns = (uint64_t)interval_ms * 1000000ULL;
+
+    snprintf(lws_admit_header, sizeof(lws_admit_header), "Retry-After: %d", retry_after);
+    for (i = 0; i < 2; i++)
+        lws_admit_reject_len[i] = snprintf(lws_admit_reject[i], sizeof(lws_admit_reject[i]),
+                                           "%s %d ServiceUnavailable\r\nHost: %s %s\r\nContent-Length: 0\r\n"
+                                           "Content-Type: %s\r\n%s\r\nConnection: %s\r\n\r\n",
+                                           LWS_HTTP_PROTO, HTTP_SERVICE_UNAVAILABLE, LWS_HTTP_HOST, LWS_HTTP_VERSION,
+                                           LWS_HTTP_HTML_TYPE, lws_admit_header, i ? "close" : "keep-alive");
+
+    if (target_ms)
+        lws_log(3, "shed requests queued over %d ms while the minimum delay of %d ms stays above it\n",
+                target_ms, interval_ms);
+    return 0;
+}
+
+/**
+ * @func    lws_admit_delay_enabled
+ * @brief   check if the adaptive limit runs, backends then ask the kernel
+ *          for receive timestamps
+ *
+ * @return  1 if enabled, or 0.
+ */
+int lws_admit_delay_enabled(void)
+{
+    return lws_admit_target_ns != 0;
+}
+
+/**
+ * @func    lws_admit_stamp
+ * @brief   record when the data next passed to lws_http_conn_recv on this
+ *          thread arrived, the backend calls it before each recv
+ *
+ * @param   ns[in] arrival on the lws_metrics_now clock
+ * @return  void
+ */
+void lws_admit_stamp(uint64_t ns)
+{
+    lws_admit_stamp_ns = ns;
+}
+
+/**
+ * @func    lws_admit_arrival
+ * @brief   arrival of the data being received on this thread
+ *
+ * @return  the last lws_admit_stamp, or now if the backend never stamps.
+ */
+uint64_t lws_admit_arrival(void)
+{
+    return lws_admit_stamp_ns ? lws_admit_stamp_ns : lws_metrics_now();
+}
+
+/*
+ * The minimum delay of a window is the standing queue, bursts drain within
+ * it. While it exceeds the target, requests queued over the target are
+ * shed, so the ones still served meet it, otherwise only requests queued
+ * over a whole window, their clients most likely gave up already.
+ */
+static int lws_admit_delay(uint64_t delay, uint64_t now)
+{
+    uint64_t end = __atomic_load_n(&lws_admit_window_end, __ATOMIC_RELAXED);
+    uint64_t min = __atomic_load_n(&lws_admit_window_min, __ATOMIC_RELAXED);
+
+    if (delay < min)
+        __atomic_store_n(&lws_admit_window_min, delay, __ATOMIC_RELAXED);
+
+    /* one thread closes the window, an idle gap longer than a window resets it */
+    if (now >= end && __atomic_compare_exchange_n(&lws_admit_window_end, &end, now + lws_admit_interval_ns,
+                                                  0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        min = __atomic_exchange_n(&lws_admit_window_min, UINT64_MAX, __ATOMIC_RELAXED);
+        if (delay < min)
+            min = delay;
+        __atomic_store_n(&lws_admit_overloaded,
+                         now < end + lws_admit_interval_ns && min > lws_admit_target_ns, __ATOMIC_RELAXED);
+    }
+
+    if (__atomic_load_n(&lws_admit_overloaded, __ATOMIC_RELAXED))
+        return delay > lws_admit_target_ns;
+
+    return delay > lws_admit_interval_ns;
+}
+
+/**
+ * @func    lws_admit_request
+ * @brief   admit a request about to run its handler. The adaptive limit
+ *          sheds requests that queued longer than the target once the
+ *          minimum delay of a whole window stayed above it, CoDel style,
+ *          and requests that queued longer than the window anyway.
+ *
+ * @param   arrival_ns[in] when the request arrived
+ * @param   now[in] current lws_metrics_now
+ * @return  0 if admitted, call lws_admit_done after the handler, or -1 to shed.
+ */
+int lws_admit_request(uint64_t arrival_ns, uint64_t now)
+{
+    if (lws_admit_target_ns && lws_admit_delay(now > arrival_ns ? now - arrival_ns : 0, now)) {
+        lws_metrics_shed(LWS_METRICS_SHED_DELAY);
+        return -1;
+    }
+
+    if (lws_admit_max_requests &&
+        __atomic_add_fetch(&lws_admit_requests, 1, __ATOMIC_RELAXED) > lws_admit_max_requests) {
+        __atomic_sub_fetch(&lws_admit_requests, 1, __ATOMIC_RELAXED);
+        lws_metrics_shed(LWS_METRICS_SHED_REQUESTS);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @func    lws_admit_done
+ * @brief   release the slot of an admitted request
+ *
+ * @return  void
+ */
+void lws_admit_done(void)
+{
+    if (lws_admit_max_requests)
+        __atomic_sub_fetch(&lws_admit_requests, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @func    lws_admit_retry_after
+ * @brief   extra header of the 503 sent to a shed http/2 stream
+ *
+ * @return  "Retry-After: n" header line without CRLF.
+ */
+char *lws_admit_retry_after(void)
+{
+    return lws_admit_header;
+}
+
+/**
+ * @func    lws_admit_response
+ * @brief   prebuilt HTTP/1.1 503, sent as is to a shed request and to a
+ *          connection refused at accept
+ *
+ * @param   close_flag[in] the connection closes after it
+ * @param   len[out] response length
+ * @return  response bytes, len is 0 before lws_admit_init.
+ */
+const char *lws_admit_response(int close_flag, int *len)
+{
+    close_flag = close_flag ? 1 : 0;
+    *len = lws_admit_reject_len[close_flag];
+    return lws_admit_reject[close_flag];
+}
@@ -0,0 +1,89 @@
+#ifndef _LWS_ADMIT_H_
+#define _LWS_ADMIT_H_
+
+#include <stdint.h>
+
+#define LWS_ADMIT_INTERVAL_MS       100         /* minimum queueing delay window */
+#define LWS_ADMIT_INTERVAL_MUL      20          /* window is at least 20 targets long */
+#define LWS_ADMIT_RETRY_AFTER       1           /* default Retry-After seconds */
+
+/**
+ * @func    lws_admit_init
+ * @brief   set request admission limits before the service starts, and
+ *          build the 503 response sent to shed load
+ *
+ * @param   max_requests[in] requests in handlers at once, 0 is unlimited
+ * @param   target_ms[in] queueing delay target of the adaptive limit, 0 is off
+ * @param   retry_after[in] Retry-After seconds of the 503 responses
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_admit_init(int max_requests, int target_ms, int retry_after);
+
+/**
+ * @func    lws_admit_delay_enabled
+ * @brief   check if the adaptive limit runs, backends then ask the kernel
+ *          for receive timestamps
+ *
+ * @return  1 if enabled, or 0.
+ */
+extern int lws_admit_delay_enabled(void);
+
+/**
+ * @func    lws_admit_stamp
+ * @brief   record when the data next passed to lws_http_conn_recv on this
+ *          thread arrived, the backend calls it before each recv
+ *
+ * @param   ns[in] arrival on the lws_metrics_now clock
+ * @return  void
+ */
+extern void lws_admit_stamp(uint64_t ns);
+
+/**
+ * @func    lws_admit_arrival
+ * @brief   arrival of the data being received on this thread
+ *
+ * @return  the last lws_admit_stamp, or now if the backend never stamps.
+ */
+extern uint64_t lws_admit_arrival(void);
+
+/**
+ * @func    lws_admit_request
+ * @brief   admit a request about to run its handler. The adaptive limit
+ *          sheds requests that queued longer than the target once the
+ *          minimum delay of a whole window stayed above it, CoDel style,
+ *          and requests that queued longer than the window anyway.
+ *
+ * @param   arrival_ns[in] when the request arrived
+ * @param   now[in] current lws_metrics_now
+ * @return  0 if admitted, call lws_admit_done after the handler, or -1 to shed.
+ */
+extern int lws_admit_request(uint64_t arrival_ns, uint64_t now);
+
+/**
+ * @func    lws_admit_done
+ * @brief   release the slot of an admitted request
+ *
+ * @return  void
+ */
+extern void lws_admit_done(void);
+
+/**
+ * @func    lws_admit_retry_after
+ * @brief   extra header of the 503 sent to a shed http/2 stream
+ *
+ * @return  "Retry-After: n" header line without CRLF.
+ */
+extern char *lws_admit_retry_after(void);
+
+/**
+ * @func    lws_admit_response
+ * @brief   prebuilt HTTP/1.1 503, sent as is to a shed request and to a
+ *          connection refused at accept
+ *
+ * @param   close_flag[in] the connection closes after it
+ * @param   len[out] response length
+ * @return  response bytes, len is 0 before lws_admit_init.
+ */
+extern const char *lws_admit_response(int close_flag, int *len);
+
+#endif // _LWS_ADMIT_H_
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "lws_log.h"
+#include "lws_http.h"
+#include "lws_bundle.h"
+
+/* next comma separated list element of [*p, end), blanks trimmed */
+static const char *lws_bundle_token(const char **p, const char *end, int *len)
+{
+    const char *start, *stop;
+
+    while (*p < end && (**p == ' ' || **p == '\t' || **p == ','))
+        (*p)++;
+    if (*p >= end)
+        return NULL;
+
+    start = *p;
+    while (*p < end && **p != ',')
+        (*p)++;
+    stop = *p;
+    while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t'))
+        stop--;
+
+    *len = stop - start;
+    return start;
+}
+
+/* Accept-Encoding lists gzip, or *, without q=0 */
+static int lws_bundle_accepts_gzip(struct http_message *hm)
+{
+    struct lws_str *accept;
+    const char *p, *end, *token, *param;
+    int len, name_len;
+
+    accept = lws_get_http_header(hm, "Accept-Encoding");
+    if (accept == NULL)
+        return 0;
+
+    p = accept->p;
+    end = accept->p + accept->len;
+    while ((token = lws_bundle_token(&p, end, &len)) != NULL) {
+        param = memchr(token, ';', len);
+        name_len = param ? param - token : len;
+        while (name_len > 0 && (token[name_len - 1] == ' ' || token[name_len - 1] == '\t'))
+            name_len--;
+
+        if (!((name_len == 4 && strncasecmp(token, "gzip", 4) == 0) ||
+              (name_len == 6 && strncasecmp(token, "x-gzip", 6) == 0) ||
+              (name_len == 1 && token[0] == '*')))
+            continue;
+
+        /* q=0, q=0.0 ... turn the coding down */
+        if (param) {
+            param++;
+            while (param < token + len && (*param == ' ' || *param == '\t'))
+                param++;
+            if (token + len - param >= 3 && strncasecmp(param, "q=0", 3) == 0) {
+                for (param += 3; param < token + len && (*param == '.' || *param == '0'); param++)
+                    ;
+                if (param == token + len)
+                    continue;
+            }
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+/* If-None-Match holds etag, compared weakly as RFC 7232 asks, or is * */
+static int lws_bundle_not_modified(struct http_message *hm, const char *etag)
+{
+    struct lws_str *match;
+    const char *p, *end, *token;
+    int len, etag_len = strlen(etag);
+
+    match = lws_get_http_header(hm, "If-None-Match");
+    if (match == NULL)
+        return 0;
+
+    p = match->p;
+    end = match->p + match->len;
+    while ((token = lws_bundle_token(&p, end, &len)) != NULL) {
+        if (len == 1 && token[0] == '*')
+            return 1;
+        if (len > 2 && token[0] == 'W' && token[1] == '/') {
+            token += 2;
+            len -= 2;
+        }
+        if (len == etag_len && memcmp(token, etag, len) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @func    lws_bundle_find
+ * @brief   look up a packed file, two hashes and one compare
+ *
+ * @param   path[in] path below the packed directory, "/picture/show.jpg"
+ * @param   len[in] path length
+ * @return  entry, or NULL if the file is not in the bundle.
+ */
+const lws_bundle_entry_t *lws_bundle_find(const char *path, int len)
+{
+    const lws_bundle_entry_t *e;
+    int d, slot;
+
+    if (lws_bundle_count == 0 || path == NULL || len <= 0)
+        return NULL;
+
+    d = lws_bundle_disp[lws_bundle_hash(0, path, len) % lws_bundle_count];
+    if (d < 0)
+        slot = -d - 1;
+    else
+        slot = lws_bundle_hash(d, path, len) % lws_bundle_count;
+
+    /* any path lands on some slot, only the one stored there matches */
+    e = &lws_bundle_entries[slot];
+    if (e->path_len != len || memcmp(e->path, path, len) != 0)
+        return NULL;
+
+    return e;
+}
+
+/**
+ * @func    lws_bundle_respond
+ * @brief   answer a request with a packed file from memory, gzip encoded if
+ *          the client accepts it and the variant exists, or a 304 if the
+ *          client holds the current ETag
+ *
+ * @param   c[in] http connection
+ * @param   hm[in] request
+ * @param   e[in] entry of lws_bundle_find
+ * @param   extra_headers[in] further header lines, or NULL
+ * @return  HTTP_OK
+ */
+int lws_bundle_respond(lws_http_conn_t *c, struct http_message *hm, const lws_bundle_entry_t *e,
+                       const char *extra_headers)
+{
+    char headers[512];
+    const char *etag;
+    lws_chain_t body;
+    int gzip;
+
+    gzip = e->gzip_size > 0 && lws_bundle_accepts_gzip(hm);
+    etag = gzip ? e->gzip_etag : e->etag;
+
+    /* the encodings are different representations, each with its own validator */
+    snprintf(headers, sizeof(headers), "ETag: %s%s%s%s%s", etag,
+             e->gzip_size > 0 ? "\r\nVary: Accept-Encoding" : "",
+             gzip ? "\r\nContent-Encoding: gzip" : "",
+             extra_headers ? "\r\n" : "", extra_headers ? extra_headers : "");
+
+    if (lws_bundle_not_modified(hm, etag)) {
+        lws_http_respond_base(c, HTTP_NOT_MODIFIED, NULL, headers, c->close_flag, NULL, 0);
+        return HTTP_OK;
+    }
+
+    lws_log(4, "bundle: %.*s, %s\n", e->path_len, e->path, gzip ? "gzip" : "identity");
+    lws_chain_init(&body);
+    if (gzip)
+        lws_chain_add_static(&body, (const char *)lws_bundle_blob + e->gzip_offset, e->gzip_size);
+    else
+        lws_chain_add_static(&body, (const char *)lws_bundle_blob + e->offset, e->size);
+
+    lws_http_respond_chain(c, HTTP_OK, c->close_flag, (char *)e->content_type, headers, &body);
+    lws_chain_free(&body);
+    return HTTP_OK;
+}
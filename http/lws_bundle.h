@@ -0,0 +1,68 @@
+#ifndef _LWS_BUNDLE_H_
+#define _LWS_BUNDLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lws_http.h"
+
+/**
+ * file packed into the binary by lws_pack, its data and gzip variant are
+ * slices of lws_bundle_blob. The index is a minimal perfect hash over the
+ * paths: entries are stored in the slot their path hashes to.
+**/
+typedef struct _lws_bundle_entry_t_ {
+    const char *path;                   /* "/picture/show.jpg", relative to the packed directory */
+    int path_len;
+    const char *content_type;
+    const char *etag;                   /* strong validator, quoted */
+    const char *gzip_etag;              /* of the gzip variant, or NULL */
+    int offset;
+    int size;
+    int gzip_offset;
+    int gzip_size;                      /* 0 without a gzip variant */
+} lws_bundle_entry_t;
+
+/* generated by lws_pack, see the Makefile */
+extern const unsigned char lws_bundle_blob[];
+extern const lws_bundle_entry_t lws_bundle_entries[];
+extern const int lws_bundle_disp[];     /* displacement per bucket, or -slot - 1 */
+extern const int lws_bundle_count;
+
+/* FNV-1a seeded with the displacement, lws_pack builds the index with it */
+static inline uint32_t lws_bundle_hash(uint32_t seed, const char *key, int len)
+{
+    uint32_t h = seed ? seed : 0x811c9dc5;
+    int i;
+
+    for (i = 0; i < len; i++)
+        h = (h ^ (unsigned char)key[i]) * 0x01000193;
+    return h;
+}
+
+/**
+ * @func    lws_bundle_find
+ * @brief   look up a packed file, two hashes and one compare
+ *
+ * @param   path[in] path below the packed directory, "/picture/show.jpg"
+ * @param   len[in] path length
+ * @return  entry, or NULL if the file is not in the bundle.
+ */
+extern const lws_bundle_entry_t *lws_bundle_find(const char *path, int len);
+
+/**
+ * @func    lws_bundle_respond
+ * @brief   answer a request with a packed file from memory, gzip encoded if
+ *          the client accepts it and the variant exists, or a 304 if the
+ *          client holds the current ETag
+ *
+ * @param   c[in] http connection
+ * @param   hm[in] request
+ * @param   e[in] entry of lws_bundle_find
+ * @param   extra_headers[in] further header lines, or NULL
+ * @return  HTTP_OK
+ */
+extern int lws_bundle_respond(lws_http_conn_t *c, struct http_message *hm, const lws_bundle_entry_t *e,
+                              const char *extra_headers);
+
+#endif // _LWS_BUNDLE_H_
@@ -0,0 +1,866 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "lws_log.h"
+#include "lws_http.h"
+#include "lws_cache.h"
+#include "lws_metrics.h"
+#include "lws_coro.h"
+
+#define LWS_CACHE_KEY_SIZE          2048        /* longer keys are not cached */
+
+static const char lws_cache_keep_alive[] = "Connection: keep-alive\r\n\r\n";
+static const char lws_cache_close[] = "Connection: close\r\n\r\n";
+
+/* key of the request being dispatched, lives on the stack of lws_cache_handle */
+typedef struct _lws_cache_req_t_ {
+    lws_cache_flight_t *flight;         /* led by this request, or NULL */
+    uint64_t hash;
+    int key_len;
+    char key[LWS_CACHE_KEY_SIZE];
+} lws_cache_req_t;
+
+/*
+ * Everything below changes under the lock. Entries are only freed once
+ * unlinked, a hit sends its wire buffer outside the lock with a reference.
+ */
+static pthread_mutex_t lws_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static long lws_cache_capacity = 0;
+static lws_cache_entry_t **lws_cache_table = NULL;
+static uint64_t lws_cache_table_mask = 0;
+static lws_cache_list_t lws_cache_lists[2];     /* LWS_CACHE_PROBATION, LWS_CACHE_PROTECTED */
+
+/* requests whose handler is running for coalesced waiters */
+static pthread_mutex_t lws_cache_flight_lock = PTHREAD_MUTEX_INITIALIZER;
+static lws_cache_flight_t *lws_cache_flights = NULL;
+
+/* vary header names, set once at init */
+static char *lws_cache_vary[LWS_CACHE_MAX_VARY];
+static int lws_cache_vary_count = 0;
+
+/* TinyLFU count-min sketch of request frequencies, halved every sample_max increments */
+static uint8_t *lws_cache_sketch = NULL;
+static uint64_t lws_cache_sketch_mask = 0;
+static uint64_t lws_cache_samples = 0;
+static uint64_t lws_cache_sample_max = 0;
+
+static uint64_t lws_cache_hash(const char *s, int len)
+{
+    uint64_t h = 14695981039346656037ull;
+
+    while (len-- > 0) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ull;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t lws_cache_pow2(uint64_t n)
+{
+    uint64_t size = 1;
+
+    while (size < n)
+        size <<= 1;
+    return size;
+}
+
+/* row i of the sketch, double hashing of the two key hash halves */
+static uint8_t *lws_cache_sketch_counter(uint64_t hash, int i)
+{
+    uint64_t h1 = (uint32_t)hash;
+    uint64_t h2 = (hash >> 32) | 1;
+
+    return &lws_cache_sketch[(lws_cache_sketch_mask + 1) * i + ((h1 + i * h2) & lws_cache_sketch_mask)];
+}
+
+static int lws_cache_frequency(uint64_t hash)
+{
+    int i, freq = LWS_CACHE_SKETCH_MAX;
+    uint8_t *counter;
+
+    for (i = 0; i < LWS_CACHE_SKETCH_DEPTH; i++) {
+        counter = lws_cache_sketch_counter(hash, i);
+        if (*counter < freq)
+            freq = *counter;
+    }
+
+    return freq;
+}
+
+static void lws_cache_increment(uint64_t hash)
+{
+    uint64_t i, size;
+    uint8_t *counter;
+    int freq = lws_cache_frequency(hash);
+
+    /* conservative update, only the minimum counters grow */
+    for (i = 0; i < LWS_CACHE_SKETCH_DEPTH; i++) {
+        counter = lws_cache_sketch_counter(hash, i);
+        if (*counter == freq && freq < LWS_CACHE_SKETCH_MAX)
+            (*counter)++;
+    }
+
+    /* aging, old popularity fades so new hot keys get admitted */
+    if (++lws_cache_samples >= lws_cache_sample_max) {
+        size = (lws_cache_sketch_mask + 1) * LWS_CACHE_SKETCH_DEPTH;
+        for (i = 0; i < size; i++)
+            lws_cache_sketch[i] >>= 1;
+        lws_cache_samples /= 2;
+    }
+}
+
+static void lws_cache_list_remove(lws_cache_entry_t *e)
+{
+    lws_cache_list_t *list = &lws_cache_lists[e->segment];
+
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        list->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        list->tail = e->prev;
+
+    list->bytes -= e->size;
+    e->prev = e->next = NULL;
+}
+
+static void lws_cache_list_push(lws_cache_entry_t *e, int segment)
+{
+    lws_cache_list_t *list = &lws_cache_lists[segment];
+
+    e->segment = segment;
+    e->prev = NULL;
+    e->next = list->head;
+    if (list->head)
+        list->head->prev = e;
+    else
+        list->tail = e;
+    list->head = e;
+    list->bytes += e->size;
+}
+
+static lws_cache_entry_t *lws_cache_find(uint64_t hash, const char *key, int key_len)
+{
+    lws_cache_entry_t *e;
+
+    for (e = lws_cache_table[hash & lws_cache_table_mask]; e; e = e->hnext) {
+        if (e->hash == hash && e->key_len == key_len && memcmp(e->key, key, key_len) == 0)
+            return e;
+    }
+
+    return NULL;
+}
+
+static void lws_cache_remove(lws_cache_entry_t *e)
+{
+    lws_cache_entry_t **pp = &lws_cache_table[e->hash & lws_cache_table_mask];
+
+    while (*pp != e)
+        pp = &(*pp)->hnext;
+    *pp = e->hnext;
+
+    lws_cache_list_remove(e);
+    lws_buf_unref(e->wire);
+    free(e);
+}
+
+/* a hit moves probation entries to the protected segment, whose overflow goes back to probation */
+static void lws_cache_touch(lws_cache_entry_t *e)
+{
+    long protected_max = lws_cache_capacity / 100 * LWS_CACHE_PROTECTED_PCT;
+    lws_cache_entry_t *victim;
+
+    lws_cache_list_remove(e);
+    lws_cache_list_push(e, LWS_CACHE_PROTECTED);
+
+    while (lws_cache_lists[LWS_CACHE_PROTECTED].bytes > protected_max) {
+        victim = lws_cache_lists[LWS_CACHE_PROTECTED].tail;
+        if (victim == e)
+            break;
+        lws_cache_list_remove(victim);
+        lws_cache_list_push(victim, LWS_CACHE_PROBATION);
+    }
+}
+
+/*
+ * TinyLFU admission: the candidate only replaces entries requested less
+ * often than itself. Victims are taken from the probation tail first, and
+ * expired entries always make room.
+ */
+static int lws_cache_admit(uint64_t hash, int size, time_t now)
+{
+    long used = lws_cache_lists[0].bytes + lws_cache_lists[1].bytes;
+    long freed = 0;
+    int freq = lws_cache_frequency(hash);
+    lws_cache_entry_t *victim;
+    int segment;
+
+    if (used + size <= lws_cache_capacity)
+        return 0;
+
+    for (segment = LWS_CACHE_PROBATION; segment <= LWS_CACHE_PROTECTED && used - freed + size > lws_cache_capacity; segment++) {
+        for (victim = lws_cache_lists[segment].tail; victim && used - freed + size > lws_cache_capacity; victim = victim->prev) {
+            if (victim->expires > now && lws_cache_frequency(victim->hash) >= freq)
+                return -1;
+            freed += victim->size;
+        }
+    }
+
+    /* the same walk again, now evicting */
+    while (lws_cache_lists[0].bytes + lws_cache_lists[1].bytes + size > lws_cache_capacity) {
+        victim = lws_cache_lists[LWS_CACHE_PROBATION].tail;
+        if (victim == NULL)
+            victim = lws_cache_lists[LWS_CACHE_PROTECTED].tail;
+        lws_log(4, "cache evict: %.*s\n", victim->key_len, victim->key);
+        lws_cache_remove(victim);
+    }
+
+    return 0;
+}
+
+static int lws_cache_is_vary(const char *name, int len)
+{
+    int i;
+
+    for (i = 0; i < lws_cache_vary_count; i++) {
+        if ((int)strlen(lws_cache_vary[i]) == len && strncasecmp(lws_cache_vary[i], name, len) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* find a header in CRLF separated lines, return its value */
+static const char *lws_cache_header(const char *headers, const char *name, int *value_len)
+{
+    int len = strlen(name);
+    const char *line, *end;
+
+    for (line = headers; line && *line; line = end ? end + 2 : NULL) {
+        end = strstr(line, "\r\n");
+        if (strncasecmp(line, name, len) == 0 && line[len] == ':') {
+            line += len + 1;
+            while (*line == ' ' || *line == '\t')
+                line++;
+            *value_len = end ? end - line : (int)strlen(line);
+            return line;
+        }
+    }
+
+    return NULL;
+}
+
+/* next comma separated token of a header value, trimmed */
+static const char *lws_cache_token(const char **p, const char *end, int *len)
+{
+    const char *s = *p, *e;
+
+    while (s < end && (*s == ',' || *s == ' ' || *s == '\t'))
+        s++;
+    if (s >= end)
+        return NULL;
+
+    for (e = s; e < end && *e != ','; e++);
+    *p = e;
+    while (e > s && (e[-1] == ' ' || e[-1] == '\t'))
+        e--;
+    *len = e - s;
+    return s;
+}
+
+/*
+ * Freshness lifetime from Cache-Control, s-maxage wins over max-age.
+ * Return 0 if the response must not be stored, -1 if it is private.
+ */
+static int lws_cache_max_age(const char *extra_headers)
+{
+    const char *value, *token, *end;
+    int len, value_len;
+    int max_age = 0, s_maxage = -1, no_store = 0;
+
+    if (extra_headers == NULL)
+        return 0;
+
+    value = lws_cache_header(extra_headers, "Cache-Control", &value_len);
+    if (value == NULL)
+        return 0;
+
+    end = value + value_len;
+    while ((token = lws_cache_token(&value, end, &len)) != NULL) {
+        if (len == 7 && strncasecmp(token, "private", 7) == 0)
+            return -1;
+        if ((len == 8 && strncasecmp(token, "no-store", 8) == 0) ||
+            (len == 8 && strncasecmp(token, "no-cache", 8) == 0))
+            no_store = 1;
+        else if (len > 8 && strncasecmp(token, "max-age=", 8) == 0)
+            max_age = atoi(token + 8);
+        else if (len > 9 && strncasecmp(token, "s-maxage=", 9) == 0)
+            s_maxage = atoi(token + 9);
+    }
+
+    if (s_maxage >= 0)
+        max_age = s_maxage;
+    return (max_age > 0 && !no_store) ? max_age : 0;
+}
+
+/* Vary of the response must be covered by the key */
+static int lws_cache_vary_covered(const char *extra_headers)
+{
+    const char *value, *token, *end;
+    int len, value_len;
+
+    if (extra_headers == NULL)
+        return 1;
+
+    value = lws_cache_header(extra_headers, "Vary", &value_len);
+    if (value == NULL)
+        return 1;
+
+    end = value + value_len;
+    while ((token = lws_cache_token(&value, end, &len)) != NULL) {
+        if (!lws_cache_is_vary(token, len))
+            return 0;
+    }
+
+    return 1;
+}
+
+static int lws_cache_status_cacheable(int http_code)
+{
+    switch (http_code) {
+    case HTTP_OK:
+    case HTTP_NON_AUTHORATATIVE:
+    case HTTP_NO_CONTENT:
+    case HTTP_MOVED_PERMANENTLY:
+    case HTTP_NOT_FOUND:
+    case HTTP_METHOD_NOT_ALLOWED:
+    case HTTP_GONE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Method, uri, query string and the vary request header values, NUL
+ * separated. Return -1 if the request bypasses the cache.
+ */
+static int lws_cache_key(struct http_message *hm, lws_cache_req_t *req)
+{
+    struct lws_str *value;
+    int i, len;
+
+    if (!((hm->method.len == 3 && memcmp(hm->method.p, "GET", 3) == 0) ||
+          (hm->method.len == 4 && memcmp(hm->method.p, "HEAD", 4) == 0)))
+        return -1;
+
+    /* a shared cache never answers authenticated requests */
+    if (lws_get_http_header(hm, "Authorization"))
+        return -1;
+
+    len = snprintf(req->key, sizeof(req->key), "%.*s %.*s?%.*s", (int)hm->method.len, hm->method.p,
+                   (int)hm->uri.len, hm->uri.p, (int)hm->query_string.len, hm->query_string.p);
+    for (i = 0; i < lws_cache_vary_count && len < (int)sizeof(req->key); i++) {
+        value = lws_get_http_header(hm, lws_cache_vary[i]);
+        len += snprintf(req->key + len, sizeof(req->key) - len, "%c%.*s", 0,
+                        value ? (int)value->len : 0, value ? value->p : "");
+    }
+
+    if (len >= (int)sizeof(req->key))
+        return -1;
+
+    req->key_len = len;
+    req->hash = lws_cache_hash(req->key, len);
+    return 0;
+}
+
+/* request asks to revalidate, the handler runs and refreshes the entry */
+static int lws_cache_no_cache(struct http_message *hm)
+{
+    struct lws_str *value;
+
+    value = lws_get_http_header(hm, "Cache-Control");
+    if (value && memmem(value->p, value->len, "no-cache", 8))
+        return 1;
+
+    value = lws_get_http_header(hm, "Pragma");
+    return value && memmem(value->p, value->len, "no-cache", 8);
+}
+
+/*
+ * send the stored bytes, a closing request gets its own Connection line.
+ * With send_chain the backend references the entry instead of copying it.
+ */
+static int lws_cache_send(lws_http_conn_t *c, lws_buf_t *wire, int conn_offset, int body_offset)
+{
+    lws_chain_t chain;
+    int ret;
+
+    if (c->send_chain) {
+        lws_chain_init(&chain);
+        if (!c->close_flag) {
+            ret = lws_chain_add_buf(&chain, wire, 0, wire->length);
+        } else {
+            ret = lws_chain_add_buf(&chain, wire, 0, conn_offset);
+            ret |= lws_chain_add_static(&chain, lws_cache_close, sizeof(lws_cache_close) - 1);
+            ret |= lws_chain_add_buf(&chain, wire, body_offset, wire->length - body_offset);
+        }
+        if (ret == 0)
+            ret = c->send_chain(c->sockfd, NULL, 0, &chain);
+        lws_chain_free(&chain);
+        return ret;
+    }
+
+    if (!c->close_flag)
+        return c->send(c->sockfd, wire->data, wire->length);
+
+    ret = c->send(c->sockfd, wire->data, conn_offset);
+    if (ret <= 0 || c->send(c->sockfd, (char *)lws_cache_close, sizeof(lws_cache_close) - 1) <= 0)
+        return -1;
+    if (wire->length > body_offset && c->send(c->sockfd, wire->data + body_offset, wire->length - body_offset) <= 0)
+        return -1;
+
+    return wire->length - body_offset + conn_offset + sizeof(lws_cache_close) - 1;
+}
+
+/**
+ * @func    lws_cache_init
+ * @brief   put a response cache in front of endpoint handlers. Responses of
+ *          GET and HEAD requests with a Cache-Control max-age are stored
+ *          and answered from memory until they expire.
+ *
+ * @param   capacity[in] memory bound in bytes
+ * @param   vary[in] "Header[,Header...]" request headers added to the key,
+ *          responses varying on other headers are not stored, or NULL
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_cache_init(long capacity, const char *vary)
+{
+    const char *p, *token;
+    uint64_t entries;
+    int len;
+
+    if (capacity <= 0 || lws_cache_table)
+        return -1;
+
+    if (vary) {
+        p = vary;
+        while ((token = lws_cache_token(&p, vary + strlen(vary), &len)) != NULL) {
+            if (lws_cache_vary_count == LWS_CACHE_MAX_VARY) {
+                lws_log(2, "cache varies on at most %d headers\n", LWS_CACHE_MAX_VARY);
+                return -1;
+            }
+            lws_cache_vary[lws_cache_vary_count++] = strndup(token, len);
+        }
+    }
+
+    /* sized for small responses, chains only get longer below 1 KB per entry */
+    entries = lws_cache_pow2(capacity / 1024 > 1024 ? capacity / 1024 : 1024);
+    lws_cache_table = calloc(entries, sizeof(lws_cache_entry_t *));
+    lws_cache_sketch = calloc(entries, LWS_CACHE_SKETCH_DEPTH);
+    if (lws_cache_table == NULL || lws_cache_sketch == NULL) {
+        free(lws_cache_table);
+        free(lws_cache_sketch);
+        lws_cache_table = NULL;
+        lws_cache_sketch = NULL;
+        return -1;
+    }
+
+    lws_cache_table_mask = entries - 1;
+    lws_cache_sketch_mask = entries - 1;
+    lws_cache_sample_max = entries * 10;
+    lws_cache_capacity = capacity;
+    lws_log(3, "response cache enabled, capacity: %ld, vary: %s\n", capacity, vary ? vary : "none");
+    return 0;
+}
+
+/**
+ * @func    lws_cache_enabled
+ * @brief   check if lws_cache_init succeeded
+ *
+ * @return  1 if enabled, or 0.
+ */
+int lws_cache_enabled(void)
+{
+    return lws_cache_table != NULL;
+}
+
+/* the leader publishes its response and wakes the waiters, the last one frees the flight */
+static void lws_cache_flight_put(lws_cache_flight_t *f)
+{
+    if (--f->refcount > 0)
+        return;
+
+    lws_buf_unref(f->wire);
+    free(f);
+}
+
+/*
+ * Wait for the leader of f, called with the flight lock held and returns
+ * with it held. A handler in a coroutine yields to its event loop until
+ * the eventfd is signalled, one on a thread of its own blocks in poll.
+ */
+static void lws_cache_flight_wait(lws_cache_flight_t *f)
+{
+    lws_cache_waiter_t waiter, **pp;
+
+    waiter.eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (waiter.eventfd < 0) {
+        lws_log(3, "flight eventfd failed, %s\n", strerror(errno));
+        return;
+    }
+    waiter.next = f->waiters;
+    f->waiters = &waiter;
+    pthread_mutex_unlock(&lws_cache_flight_lock);
+
+    /* a stuck leader only delays its waiters, they run the handler themselves then */
+    lws_coro_wait(waiter.eventfd, POLLIN, LWS_CACHE_FLIGHT_TIMEOUT_SEC * 1000);
+
+    pthread_mutex_lock(&lws_cache_flight_lock);
+    for (pp = &f->waiters; *pp; pp = &(*pp)->next) {
+        if (*pp == &waiter) {
+            *pp = waiter.next;
+            break;
+        }
+    }
+    close(waiter.eventfd);
+}
+
+/*
+ * Join the flight of an identical request whose handler is running, or
+ * start one. A waiter returns with the shared response in f, the leader
+ * with f NULL and *leader set. A request that must not block its thread,
+ * on an event loop without a coroutine to park, gets neither and runs
+ * uncoalesced.
+ */
+static lws_cache_flight_t *lws_cache_flight_join(lws_http_conn_t *c, lws_cache_req_t *req, lws_cache_flight_t **leader)
+{
+    lws_cache_flight_t *f;
+
+    *leader = NULL;
+    pthread_mutex_lock(&lws_cache_flight_lock);
+    for (f = lws_cache_flights; f; f = f->next) {
+        if (f->hash == req->hash && f->key_len == req->key_len && memcmp(f->key, req->key, req->key_len) == 0)
+            break;
+    }
+
+    if (f == NULL) {
+        f = calloc(1, sizeof(lws_cache_flight_t) + req->key_len);
+        if (f) {
+            f->hash = req->hash;
+            f->refcount = 1;
+            f->key_len = req->key_len;
+            memcpy(f->key, req->key, req->key_len);
+            f->next = lws_cache_flights;
+            lws_cache_flights = f;
+            *leader = f;
+        }
+        pthread_mutex_unlock(&lws_cache_flight_lock);
+        return NULL;
+    }
+
+    if (lws_coro_self() == NULL && !c->blocking) {
+        pthread_mutex_unlock(&lws_cache_flight_lock);
+        return NULL;
+    }
+
+    f->refcount++;
+    lws_cache_flight_wait(f);
+    if (!f->done) {
+        lws_cache_flight_put(f);
+        f = NULL;
+    }
+    pthread_mutex_unlock(&lws_cache_flight_lock);
+    return f;
+}
+
+static void lws_cache_flight_done(lws_cache_flight_t *f, int ret)
+{
+    lws_cache_flight_t **pp;
+    lws_cache_waiter_t *waiter;
+
+    pthread_mutex_lock(&lws_cache_flight_lock);
+    for (pp = &lws_cache_flights; *pp; pp = &(*pp)->next) {
+        if (*pp == f) {
+            *pp = f->next;
+            break;
+        }
+    }
+
+    f->ret = ret;
+    f->done = 1;
+    if (f->refcount > 1)
+        lws_log(4, "coalesced %d requests: %.*s\n", f->refcount - 1, f->key_len, f->key);
+
+    /* waiters unlink themselves under the lock, each one listed is still parked */
+    for (waiter = f->waiters; waiter; waiter = waiter->next)
+        eventfd_write(waiter->eventfd, 1);
+    lws_cache_flight_put(f);
+    pthread_mutex_unlock(&lws_cache_flight_lock);
+}
+
+/* wire bytes of the leader response, kept by the flight for its waiters */
+static void lws_cache_flight_publish(lws_cache_flight_t *f, lws_buf_t *wire, int http_code, int conn_offset)
+{
+    pthread_mutex_lock(&lws_cache_flight_lock);
+    f->wire = lws_buf_ref(wire);
+    f->http_code = http_code;
+    f->conn_offset = conn_offset;
+    f->body_offset = conn_offset + sizeof(lws_cache_keep_alive) - 1;
+    pthread_mutex_unlock(&lws_cache_flight_lock);
+}
+
+static void lws_cache_insert(lws_cache_req_t *req, lws_buf_t *wire, int http_code, int conn_offset, int max_age)
+{
+    lws_cache_entry_t *e, *old;
+    time_t now = time(NULL);
+    int size;
+
+    size = sizeof(lws_cache_entry_t) + req->key_len + sizeof(lws_buf_t) + wire->length;
+    if (size > lws_cache_capacity / LWS_CACHE_MAX_ENTRY_DIV)
+        return;
+
+    e = malloc(sizeof(lws_cache_entry_t) + req->key_len);
+    if (e == NULL)
+        return;
+
+    e->wire = lws_buf_ref(wire);
+    e->hash = req->hash;
+    e->expires = now + max_age;
+    e->http_code = http_code;
+    e->conn_offset = conn_offset;
+    e->body_offset = conn_offset + sizeof(lws_cache_keep_alive) - 1;
+    e->size = size;
+    e->key_len = req->key_len;
+    memcpy(e->key, req->key, req->key_len);
+
+    pthread_mutex_lock(&lws_cache_lock);
+    old = lws_cache_find(e->hash, e->key, e->key_len);
+    if (old)
+        lws_cache_remove(old);
+
+    if (lws_cache_admit(e->hash, size, now) < 0) {
+        pthread_mutex_unlock(&lws_cache_lock);
+        lws_buf_unref(e->wire);
+        free(e);
+        return;
+    }
+
+    e->hnext = lws_cache_table[e->hash & lws_cache_table_mask];
+    lws_cache_table[e->hash & lws_cache_table_mask] = e;
+    lws_cache_list_push(e, LWS_CACHE_PROBATION);
+    lws_log(4, "cache store: %.*s, max-age: %d, size: %d\n", e->key_len, e->key, max_age, size);
+    pthread_mutex_unlock(&lws_cache_lock);
+}
+
+/**
+ * @func    lws_cache_handle
+ * @brief   answer a request from the cache, or from the response of an
+ *          identical request in flight, otherwise call handler and keep
+ *          its response if it is cacheable
+ *
+ * @param   c[in] http connection
+ * @param   hm[in] request
+ * @param   handler[in] endpoint handler
+ * @param   coalesce[in] identical concurrent requests wait for one handler run
+ * @return  the handler status, HTTP_OK when answered from memory.
+ */
+int lws_cache_handle(lws_http_conn_t *c, struct http_message *hm, lws_event_handler_t handler, int coalesce)
+{
+    lws_cache_req_t req;
+    lws_cache_entry_t *e;
+    lws_cache_flight_t *f = NULL;
+    lws_buf_t *wire = NULL;
+    int http_code = 0, conn_offset = 0, body_offset = 0;
+    uint64_t send_start;
+    time_t now;
+    int ret = HTTP_OK;
+
+    /* http/2 responses are framed per stream, only HTTP/1.1 bytes are shared */
+    if (c->h2 || c->send == NULL || lws_cache_key(hm, &req) < 0)
+        return handler(c, LWS_EV_HTTP_REQUEST, (void *)hm);
+
+    if (lws_cache_enabled()) {
+        now = time(NULL);
+        pthread_mutex_lock(&lws_cache_lock);
+        lws_cache_increment(req.hash);
+        e = lws_cache_find(req.hash, req.key, req.key_len);
+        if (e && e->expires <= now) {
+            lws_cache_remove(e);
+            e = NULL;
+        }
+        if (e && !lws_cache_no_cache(hm)) {
+            lws_cache_touch(e);
+            wire = lws_buf_ref(e->wire);
+            http_code = e->http_code;
+            conn_offset = e->conn_offset;
+            body_offset = e->body_offset;
+        }
+        pthread_mutex_unlock(&lws_cache_lock);
+    }
+
+    req.flight = NULL;
+    if (wire == NULL && coalesce) {
+        f = lws_cache_flight_join(c, &req, &req.flight);
+        if (f) {
+            /* the leader failed or sent a body that is not in memory */
+            if (f->wire == NULL && f->ret != HTTP_OK)
+                ret = f->ret;
+            else if (f->wire)
+                wire = lws_buf_ref(f->wire);
+            http_code = f->http_code;
+            conn_offset = f->conn_offset;
+            body_offset = f->body_offset;
+
+            pthread_mutex_lock(&lws_cache_flight_lock);
+            lws_cache_flight_put(f);
+            pthread_mutex_unlock(&lws_cache_flight_lock);
+            if (wire == NULL && ret != HTTP_OK)
+                return ret;
+        }
+    }
+
+    if (wire) {
+        lws_log(4, "%s hit: %.*s\n", f ? "flight" : "cache", req.key_len, req.key);
+        send_start = lws_metrics_now();
+        ret = lws_cache_send(c, wire, conn_offset, body_offset);
+        lws_buf_unref(wire);
+        if (ret > 0)
+            lws_metrics_send(http_code, ret, lws_metrics_now() - send_start);
+        return HTTP_OK;
+    }
+
+    c->cache = &req;
+    ret = handler(c, LWS_EV_HTTP_REQUEST, (void *)hm);
+    c->cache = NULL;
+
+    if (req.flight)
+        lws_cache_flight_done(req.flight, ret);
+    return ret;
+}
+
+/**
+ * @func    lws_cache_shares_body
+ * @brief   check if the response being generated on c is shared with
+ *          coalesced requests, a file body is then worth reading once
+ *
+ * @param   c[in] http connection
+ * @param   size[in] body size
+ * @return  1 if the body should be handed over in memory, or 0.
+ */
+int lws_cache_shares_body(lws_http_conn_t *c, int size)
+{
+    lws_cache_req_t *req = c->cache;
+
+    return req && req->flight && size >= 0 && size <= LWS_CACHE_SHARED_FILE_MAX;
+}
+
+/**
+ * @func    lws_cache_store
+ * @brief   called by lws_http_respond_base while c->cache is set, hand the
+ *          response to coalesced requests and store it if its headers allow
+ *          it. c->cache is cleared, only the first response of a request is
+ *          considered.
+ *
+ * @param   c[in] http connection
+ * @param   http_code[in] response status
+ * @param   head[in] serialized header up to the Connection line
+ * @param   head_len[in] head length
+ * @param   extra_headers[in] handler headers, CRLF separated, or NULL
+ * @param   content[in] body
+ * @param   content_length[in] body length
+ * @return  void
+ */
+void lws_cache_store(lws_http_conn_t *c, int http_code, const char *head, int head_len,
+                     const char *extra_headers, const char *content, int content_length)
+{
+    lws_chain_t body;
+
+    if (content_length < 0 || (content == NULL && content_length > 0)) {
+        c->cache = NULL;
+        return;
+    }
+
+    /* the body is only copied into the entry, the chain does not outlive the call */
+    lws_chain_init(&body);
+    if (lws_chain_add_static(&body, content, content_length) == 0)
+        lws_cache_store_chain(c, http_code, head, head_len, extra_headers, &body);
+    c->cache = NULL;
+    lws_chain_free(&body);
+}
+
+/**
+ * @func    lws_cache_store_chain
+ * @brief   lws_cache_store of a response sent with lws_http_respond_chain,
+ *          the chain is flattened into the entry only if it is kept
+ *
+ * @param   c[in] http connection
+ * @param   http_code[in] response status
+ * @param   head[in] serialized header up to the Connection line
+ * @param   head_len[in] head length
+ * @param   extra_headers[in] handler headers, CRLF separated, or NULL
+ * @param   body[in] body chain
+ * @return  void
+ */
+void lws_cache_store_chain(lws_http_conn_t *c, int http_code, const char *head, int head_len,
+                           const char *extra_headers, lws_chain_t *body)
+{
+    lws_cache_req_t *req = c->cache;
+    int max_age, wire_len;
+    int content_length = body->length;
+    lws_buf_t *wire;
+    int i;
+
+    c->cache = NULL;
+    if (req == NULL)
+        return;
+
+    /* large files keep going out with sendfile, as with lws_http_respond_file */
+    for (i = 0; i < body->count && content_length > LWS_CACHE_SHARED_FILE_MAX; i++) {
+        if (body->segs[i].type == LWS_CHAIN_FILE)
+            return;
+    }
+
+    /* private responses are never shared, no-store ones only with requests in flight */
+    max_age = lws_cache_max_age(extra_headers);
+    if (max_age < 0 || !lws_cache_vary_covered(extra_headers))
+        return;
+
+    if (!lws_cache_enabled() || !lws_cache_status_cacheable(http_code))
+        max_age = 0;
+    if (max_age == 0 && req->flight == NULL)
+        return;
+
+    wire_len = head_len + sizeof(lws_cache_keep_alive) - 1 + content_length;
+    wire = lws_buf_new(wire_len);
+    if (wire == NULL)
+        return;
+
+    memcpy(wire->data, head, head_len);
+    memcpy(wire->data + head_len, lws_cache_keep_alive, sizeof(lws_cache_keep_alive) - 1);
+    if (lws_chain_copy(body, wire->data + head_len + sizeof(lws_cache_keep_alive) - 1) < 0) {
+        lws_buf_unref(wire);
+        return;
+    }
+    wire->length = wire_len;
+
+    if (req->flight)
+        lws_cache_flight_publish(req->flight, wire, http_code, head_len);
+    if (max_age > 0)
+        lws_cache_insert(req, wire, http_code, head_len, max_age);
+    lws_buf_unref(wire);
+}
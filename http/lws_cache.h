@@ -0,0 +1,157 @@
+#ifndef _LWS_CACHE_H_
+#define _LWS_CACHE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "lws_http.h"
+#include "lws_buf.h"
+#include "lws_chain.h"
+
+#define LWS_CACHE_MAX_VARY          8           /* request headers that can be part of the key */
+#define LWS_CACHE_PROTECTED_PCT     80          /* share of the memory for entries hit twice */
+#define LWS_CACHE_MAX_ENTRY_DIV     8           /* an entry never takes more than 1/8 of the memory */
+#define LWS_CACHE_SKETCH_DEPTH      4
+#define LWS_CACHE_SKETCH_MAX        15          /* 4 bit saturating counters */
+#define LWS_CACHE_FLIGHT_TIMEOUT_SEC 30         /* coalesced requests wait this long for the first */
+#define LWS_CACHE_SHARED_FILE_MAX   (1024 * 1024)   /* larger coalesced files keep sendfile */
+
+/* segments of the LRU */
+#define LWS_CACHE_PROBATION         0           /* admitted, not hit yet */
+#define LWS_CACHE_PROTECTED         1           /* hit at least once */
+
+/**
+ * cached response, ready to send wire bytes of an HTTP/1.1 keep-alive
+ * response. conn_offset is where its "Connection: keep-alive" line starts,
+ * so a request that closes the connection can splice in its own.
+**/
+typedef struct _lws_cache_entry_t_ {
+    struct _lws_cache_entry_t_ *hnext;          /* hash chain */
+    struct _lws_cache_entry_t_ *prev;           /* segment list, head is most recent */
+    struct _lws_cache_entry_t_ *next;
+    uint64_t hash;
+    time_t expires;
+    int segment;
+    int http_code;
+    int conn_offset;
+    int body_offset;
+    int size;                                   /* accounted memory */
+    lws_buf_t *wire;                            /* a reference is taken while sending */
+    int key_len;
+    char key[];
+} lws_cache_entry_t;
+
+/* segment of the LRU, bytes are accounted per segment */
+typedef struct _lws_cache_list_t_ {
+    lws_cache_entry_t *head;
+    lws_cache_entry_t *tail;
+    long bytes;
+} lws_cache_list_t;
+
+/* request parked on a flight, signalled through its eventfd once the leader is done */
+typedef struct _lws_cache_waiter_t_ {
+    struct _lws_cache_waiter_t_ *next;
+    int eventfd;
+} lws_cache_waiter_t;
+
+/**
+ * handler run shared by identical concurrent requests, the leader
+ * publishes its response here and waiters send it
+**/
+typedef struct _lws_cache_flight_t_ {
+    struct _lws_cache_flight_t_ *next;
+    lws_cache_waiter_t *waiters;                /* parked until done */
+    uint64_t hash;
+    int refcount;                               /* leader and waiters */
+    int done;
+    int ret;                                    /* handler status */
+    lws_buf_t *wire;                            /* NULL if the response was not in memory */
+    int http_code;
+    int conn_offset;
+    int body_offset;
+    int key_len;
+    char key[];
+} lws_cache_flight_t;
+
+/**
+ * @func    lws_cache_init
+ * @brief   put a response cache in front of endpoint handlers. Responses of
+ *          GET and HEAD requests with a Cache-Control max-age are stored
+ *          and answered from memory until they expire.
+ *
+ * @param   capacity[in] memory bound in bytes
+ * @param   vary[in] "Header[,Header...]" request headers added to the key,
+ *          responses varying on other headers are not stored, or NULL
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_cache_init(long capacity, const char *vary);
+
+/**
+ * @func    lws_cache_enabled
+ * @brief   check if lws_cache_init succeeded
+ *
+ * @return  1 if enabled, or 0.
+ */
+extern int lws_cache_enabled(void);
+
+/**
+ * @func    lws_cache_handle
+ * @brief   answer a request from the cache, or from the response of an
+ *          identical request in flight, otherwise call handler and keep
+ *          its response if it is cacheable
+ *
+ * @param   c[in] http connection
+ * @param   hm[in] request
+ * @param   handler[in] endpoint handler
+ * @param   coalesce[in] identical concurrent requests wait for one handler run
+ * @return  the handler status, HTTP_OK when answered from memory.
+ */
+extern int lws_cache_handle(lws_http_conn_t *c, struct http_message *hm, lws_event_handler_t handler, int coalesce);
+
+/**
+ * @func    lws_cache_shares_body
+ * @brief   check if the response being generated on c is shared with
+ *          coalesced requests, a file body is then worth reading once
+ *
+ * @param   c[in] http connection
+ * @param   size[in] body size
+ * @return  1 if the body should be handed over in memory, or 0.
+ */
+extern int lws_cache_shares_body(lws_http_conn_t *c, int size);
+
+/**
+ * @func    lws_cache_store
+ * @brief   called by lws_http_respond_base while c->cache is set, hand the
+ *          response to coalesced requests and store it if its headers allow
+ *          it. c->cache is cleared, only the first response of a request is
+ *          considered.
+ *
+ * @param   c[in] http connection
+ * @param   http_code[in] response status
+ * @param   head[in] serialized header up to the Connection line
+ * @param   head_len[in] head length
+ * @param   extra_headers[in] handler headers, CRLF separated, or NULL
+ * @param   content[in] body
+ * @param   content_length[in] body length
+ * @return  void
+ */
+extern void lws_cache_store(lws_http_conn_t *c, int http_code, const char *head, int head_len,
+                            const char *extra_headers, const char *content, int content_length);
+
+/**
+ * @func    lws_cache_store_chain
+ * @brief   lws_cache_store of a response sent with lws_http_respond_chain,
+ *          the chain is flattened into the entry only if it is kept
+ *
+ * @param   c[in] http connection
+ * @param   http_code[in] response status
+ * @param   head[in] serialized header up to the Connection line
+ * @param   head_len[in] head length
+ * @param   extra_headers[in] handler headers, CRLF separated, or NULL
+ * @param   body[in] body chain
+ * @return  void
+ */
+extern void lws_cache_store_chain(lws_http_conn_t *c, int http_code, const char *head, int head_len,
+                                  const char *extra_headers, lws_chain_t *body);
+
+#endif // _LWS_CACHE_H_
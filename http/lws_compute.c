@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "lws_log.h"
+#include "lws_http.h"
+#include "lws_metrics.h"
+#include "lws_coro.h"
+#include "lws_compute.h"
+
+/* finished requests of one event loop thread, pushed by pool threads, newest first */
+typedef struct _lws_compute_queue_t_ {
+    struct _lws_compute_job_t_ *head;
+    int eventfd;                            /* written when head was empty */
+} lws_compute_queue_t;
+
+/*
+ * Request handed to the pool, it lives on the stack of the suspended handler
+ * coroutine. The handler runs against a copy of the connection whose sends
+ * are captured, the event loop thread writes them out once it resumes.
+ */
+typedef struct _lws_compute_job_t_ {
+    struct _lws_compute_job_t_ *next;
+    lws_compute_queue_t *owner;
+    lws_http_conn_t *conn;
+    lws_http_conn_t shadow;
+    lws_event_handler_t handler;
+    struct http_message *hm;
+    lws_metrics_req_t *metrics;
+    int endpoint;
+    int ret;
+    int done;
+    uint64_t submit_ns;
+    char *out;                              /* captured response */
+    int out_length;
+    int out_size;
+    char send_buf[LWS_HTTP_BUF_SIZE];
+} lws_compute_job_t;
+
+/* submission queue, bounded, pool threads take from the head */
+static pthread_mutex_t lws_compute_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lws_compute_cond = PTHREAD_COND_INITIALIZER;
+static lws_compute_job_t *lws_compute_head = NULL;
+static lws_compute_job_t *lws_compute_tail = NULL;
+static int lws_compute_queued = 0;
+static int lws_compute_queue_max = 0;
+static int lws_compute_threads = 0;
+
+static __thread lws_compute_queue_t *lws_compute_self = NULL;  /* event loop threads */
+static __thread lws_compute_job_t *lws_compute_current = NULL; /* pool threads */
+
+/* send callback of the handler side, the response is collected for the event loop */
+static int lws_compute_send(int sockfd, char *data, int size)
+{
+    lws_compute_job_t *job = lws_compute_current;
+    char *out;
+    int out_size;
+
+    if (job == NULL || data == NULL || size < 0)
+        return -1;
+
+    if (size > job->out_size - job->out_length) {
+        out_size = job->out_size ? job->out_size : LWS_HTTP_BUF_SIZE;
+        while (out_size - job->out_length < size)
+            out_size *= 2;
+
+        out = realloc(job->out, out_size);
+        if (out == NULL)
+            return -1;
+        job->out = out;
+        job->out_size = out_size;
+    }
+
+    memcpy(job->out + job->out_length, data, size);
+    job->out_length += size;
+    return size;
+}
+
+static void lws_compute_run(lws_compute_job_t *job)
+{
+    lws_metrics_req_t *prev;
+    uint64_t start;
+
+    start = lws_metrics_now();
+    lws_compute_current = job;
+    prev = lws_metrics_swap(job->metrics);
+    job->ret = job->handler(&job->shadow, LWS_EV_HTTP_REQUEST, (void *)job->hm);
+    lws_metrics_swap(prev);
+    lws_compute_current = NULL;
+
+    lws_metrics_compute(job->endpoint, start - job->submit_ns, lws_metrics_now() - start);
+}
+
+/*
+ * Lock-free push onto the completion queue of the owner thread. Only the
+ * owner takes from it, all at once, so a push cannot race a pop of the same
+ * node. The job belongs to its coroutine again once it is pushed.
+ */
+static void lws_compute_complete(lws_compute_job_t *job)
+{
+    lws_compute_queue_t *q = job->owner;
+    lws_compute_job_t *head;
+    uint64_t one = 1;
+
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELAXED);
+    head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    do {
+        job->next = head;
+    } while (!__atomic_compare_exchange_n(&q->head, &head, job, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    /* the loop takes every queued job on one wakeup, only the first push writes */
+    if (head == NULL && write(q->eventfd, &one, sizeof(one)) < 0)
+        lws_log(2, "compute wakeup failed, %s\n", strerror(errno));
+}
+
+static void *lws_compute_thread(void *arg)
+{
+    lws_compute_job_t *job;
+
+    while (1) {
+        pthread_mutex_lock(&lws_compute_lock);
+        while (lws_compute_head == NULL)
+            pthread_cond_wait(&lws_compute_cond, &lws_compute_lock);
+
+        job = lws_compute_head;
+        lws_compute_head = job->next;
+        if (lws_compute_head == NULL)
+            lws_compute_tail = NULL;
+        lws_compute_queued--;
+        pthread_mutex_unlock(&lws_compute_lock);
+
+        lws_compute_run(job);
+        lws_compute_complete(job);
+    }
+
+    return NULL;
+}
+
+/* queue job for the pool, fails when the queue is full */
+static int lws_compute_submit(lws_compute_job_t *job)
+{
+    pthread_mutex_lock(&lws_compute_lock);
+    if (lws_compute_queued >= lws_compute_queue_max) {
+        pthread_mutex_unlock(&lws_compute_lock);
+        return -1;
+    }
+
+    job->next = NULL;
+    if (lws_compute_tail)
+        lws_compute_tail->next = job;
+    else
+        lws_compute_head = job;
+    lws_compute_tail = job;
+    lws_compute_queued++;
+    pthread_cond_signal(&lws_compute_cond);
+    pthread_mutex_unlock(&lws_compute_lock);
+    return 0;
+}
+
+/**
+ * @func    lws_compute_init
+ * @brief   start the compute pool, handlers of LWS_ENDPOINT_COMPUTE endpoints
+ *          run there instead of on the event loop
+ *
+ * @param   threads[in] pool threads
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_compute_init(int threads)
+{
+    sigset_t mask, omask;
+    pthread_t tid;
+    int i;
+
+    if (threads <= 0 || threads > LWS_COMPUTE_MAX_THREADS) {
+        lws_log(2, "compute threads out of range: %d\n", threads);
+        return -1;
+    }
+
+    /* pool threads never take signals, an upgrade signal must not interrupt a handler */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, &omask);
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&tid, NULL, lws_compute_thread, NULL)) {
+            lws_log(2, "create compute thread failed, %s\n", strerror(errno));
+            break;
+        }
+        pthread_detach(tid);
+    }
+    pthread_sigmask(SIG_SETMASK, &omask, NULL);
+
+    if (i == 0)
+        return -1;
+
+    lws_compute_threads = i;
+    lws_compute_queue_max = i * LWS_COMPUTE_QUEUE_PER_THREAD;
+    lws_log(3, "compute pool: %d threads, queue: %d\n", i, lws_compute_queue_max);
+    return 0;
+}
+
+/**
+ * @func    lws_compute_attach
+ * @brief   create the completion queue of the calling event loop thread,
+ *          its eventfd turns readable when handlers finished
+ *
+ * @return  eventfd, or -1 if there is no pool.
+ */
+int lws_compute_attach(void)
+{
+    lws_compute_queue_t *q;
+
+    if (lws_compute_threads == 0)
+        return -1;
+
+    if (lws_compute_self)
+        return lws_compute_self->eventfd;
+
+    q = calloc(1, sizeof(lws_compute_queue_t));
+    if (q == NULL)
+        return -1;
+
+    q->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (q->eventfd < 0) {
+        lws_log(2, "compute eventfd failed, %s\n", strerror(errno));
+        free(q);
+        return -1;
+    }
+
+    lws_compute_self = q;
+    return q->eventfd;
+}
+
+/**
+ * @func    lws_compute_reap
+ * @brief   take the finished handlers of the calling thread, resume is
+ *          called with the connection of each, oldest first
+ *
+ * @param   resume[in] continues the suspended handler of a connection
+ * @return  void
+ */
+void lws_compute_reap(void (*resume)(lws_http_conn_t *c))
+{
+    lws_compute_queue_t *q = lws_compute_self;
+    lws_compute_job_t *job, *next, *done = NULL;
+    uint64_t count;
+
+    if (q == NULL)
+        return;
+
+    /* reset the eventfd first, a push after the exchange writes it again */
+    if (read(q->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        lws_log(2, "compute eventfd read failed, %s\n", strerror(errno));
+
+    job = __atomic_exchange_n(&q->head, NULL, __ATOMIC_ACQUIRE);
+    while (job) {
+        next = job->next;
+        job->next = done;
+        done = job;
+        job = next;
+    }
+
+    /* a resumed handler returns and takes its job along */
+    while (done) {
+        next = done->next;
+        resume(done->conn);
+        done = next;
+    }
+}
+
+/**
+ * @func    lws_compute_handler
+ * @brief   stands in for the handler of a LWS_ENDPOINT_COMPUTE endpoint,
+ *          hands the request to the pool and suspends the calling handler
+ *          coroutine until it is done. Without a pool, outside of
+ *          coroutines and on threads without a completion queue the
+ *          endpoint handler runs right away.
+ */
+int lws_compute_handler(lws_http_conn_t *c, int ev, void *p)
+{
+    struct http_message *hm = p;
+    lws_http_plugins_t *plugin;
+    lws_compute_job_t job;
+
+    if (hm == NULL)
+        return HTTP_BAD_REQUEST;
+
+    plugin = lws_http_get_endpoint(hm->uri.p, hm->uri.len);
+    if (plugin == NULL)
+        return HTTP_NOT_FOUND;
+
+    if (ev != LWS_EV_HTTP_REQUEST || lws_compute_self == NULL || lws_coro_self() == NULL || c->h2)
+        return plugin->handler(c, ev, p);
+
+    /* the handler side only gets the plain send, files and chains are flattened */
+    job.shadow = *c;
+    job.shadow.send = lws_compute_send;
+    job.shadow.send_shared = NULL;
+    job.shadow.send_file = NULL;
+    job.shadow.send_pipe = NULL;
+    job.shadow.recv_pipe = NULL;
+    job.shadow.send_chain = NULL;
+    job.shadow.send_buf = job.send_buf;
+    job.shadow.send_length = 0;
+    job.shadow.coro = NULL;
+
+    job.owner = lws_compute_self;
+    job.conn = c;
+    job.handler = plugin->handler;
+    job.hm = hm;
+    job.metrics = lws_metrics_swap(NULL);
+    lws_metrics_swap(job.metrics);
+    job.endpoint = plugin->index;
+    job.ret = HTTP_INTERNAL_SERVER_ERROR;
+    job.done = 0;
+    job.out = NULL;
+    job.out_length = 0;
+    job.out_size = 0;
+    job.submit_ns = lws_metrics_now();
+
+    if (lws_compute_submit(&job)) {
+        lws_metrics_shed(LWS_METRICS_SHED_COMPUTE);
+        lws_http_respond_shed(c);
+        return HTTP_OK;
+    }
+
+    /* resumed by the event loop once the job is on the completion queue */
+    while (!__atomic_load_n(&job.done, __ATOMIC_ACQUIRE))
+        lws_coro_yield();
+
+    c->close_flag |= job.shadow.close_flag;
+    if (job.out_length > 0 && c->send(c->sockfd, job.out, job.out_length) < 0)
+        c->close_flag = 1;
+    free(job.out);
+
+    return job.ret;
+}
@@ -0,0 +1,48 @@
+#ifndef _LWS_COMPUTE_H_
+#define _LWS_COMPUTE_H_
+
+#include "lws_http.h"
+
+#define LWS_COMPUTE_MAX_THREADS     256
+#define LWS_COMPUTE_QUEUE_PER_THREAD 64     /* queued requests per pool thread, more are shed */
+
+/**
+ * @func    lws_compute_init
+ * @brief   start the compute pool, handlers of LWS_ENDPOINT_COMPUTE endpoints
+ *          run there instead of on the event loop
+ *
+ * @param   threads[in] pool threads
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_compute_init(int threads);
+
+/**
+ * @func    lws_compute_attach
+ * @brief   create the completion queue of the calling event loop thread,
+ *          its eventfd turns readable when handlers finished
+ *
+ * @return  eventfd, or -1 if there is no pool.
+ */
+extern int lws_compute_attach(void);
+
+/**
+ * @func    lws_compute_reap
+ * @brief   take the finished handlers of the calling thread, resume is
+ *          called with the connection of each, oldest first
+ *
+ * @param   resume[in] continues the suspended handler of a connection
+ * @return  void
+ */
+extern void lws_compute_reap(void (*resume)(lws_http_conn_t *c));
+
+/**
+ * @func    lws_compute_handler
+ * @brief   stands in for the handler of a LWS_ENDPOINT_COMPUTE endpoint,
+ *          hands the request to the pool and suspends the calling handler
+ *          coroutine until it is done. Without a pool, outside of
+ *          coroutines and on threads without a completion queue the
+ *          endpoint handler runs right away.
+ */
+extern int lws_compute_handler(lws_http_conn_t *c, int ev, void *p);
+
+#endif // _LWS_COMPUTE_H_
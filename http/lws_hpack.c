@@ -0,0 +1,553 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lws_log.h"
+#include "lws_hpack.h"
+
+typedef struct _lws_hpack_static_t_ {
+    const char *name;
+    const char *value;
+} lws_hpack_static_t;
+
+/* RFC 7541 appendix A, index 1 is the first entry */
+static const lws_hpack_static_t lws_hpack_static[] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+    {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""},
+};
+
+#define LWS_HPACK_STATIC_COUNT  ((int)(sizeof(lws_hpack_static) / sizeof(lws_hpack_static[0])))
+
+/* RFC 7541 appendix B, code of every symbol, EOS is 256 */
+static const uint32_t lws_hpack_huff_codes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff,
+};
+
+static const uint8_t lws_hpack_huff_lens[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+/* symbols in canonical code order */
+static const uint16_t lws_hpack_huff_syms[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+    45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+    95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+    58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+    106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+    88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+    0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+    167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+    132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+    173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+    151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+    183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+    171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+    255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+    246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+    6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+    249, 10, 13, 22, 256,
+};
+
+/* per code length: first code, symbol count and offset into syms */
+static const uint32_t lws_hpack_huff_first[31] = {
+    0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x14, 0x5c,
+    0xf8, 0x0, 0x3f8, 0x7fa, 0xffa, 0x1ff8, 0x3ffc, 0x7ffc,
+    0x0, 0x0, 0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8,
+    0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0, 0x3ffffffc,
+};
+
+static const uint16_t lws_hpack_huff_count[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+    0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4,
+};
+
+static const uint16_t lws_hpack_huff_offset[31] = {
+    0, 0, 0, 0, 0, 0, 10, 36, 68, 74, 74, 79, 82, 84, 90, 92,
+    95, 95, 95, 95, 98, 106, 119, 145, 174, 186, 190, 205, 224, 253, 253,
+};
+
+void lws_hpack_init(lws_hpack_t *hp)
+{
+    memset(hp, 0, sizeof(lws_hpack_t));
+    hp->max_size = LWS_HPACK_TABLE_SIZE;
+    hp->limit = LWS_HPACK_TABLE_SIZE;
+}
+
+static void lws_hpack_evict(lws_hpack_t *hp, int max_size)
+{
+    lws_hpack_entry_t *e;
+
+    while (hp->count > 0 && hp->size > max_size) {
+        e = &hp->entries[(hp->head + hp->count - 1) % LWS_HPACK_MAX_ENTRIES];
+        hp->size -= e->name_len + e->value_len + LWS_HPACK_ENTRY_OVERHEAD;
+        free(e->name);
+        e->name = e->value = NULL;
+        hp->count--;
+    }
+}
+
+void lws_hpack_free(lws_hpack_t *hp)
+{
+    lws_hpack_evict(hp, -1);
+    free(hp->scratch);
+    hp->scratch = NULL;
+    hp->scratch_size = 0;
+}
+
+static void lws_hpack_add(lws_hpack_t *hp, const char *name, int name_len, const char *value, int value_len)
+{
+    int entry_size = name_len + value_len + LWS_HPACK_ENTRY_OVERHEAD;
+    lws_hpack_entry_t *e;
+    char *p;
+
+    /* an entry larger than the table empties it and is not added */
+    if (entry_size > hp->max_size) {
+        lws_hpack_evict(hp, 0);
+        return;
+    }
+
+    lws_hpack_evict(hp, hp->max_size - entry_size);
+    if (hp->count == LWS_HPACK_MAX_ENTRIES)
+        lws_hpack_evict(hp, hp->size - 1);
+
+    p = malloc(name_len + value_len + 2);
+    if (p == NULL) {
+        lws_hpack_evict(hp, 0);
+        return;
+    }
+
+    memcpy(p, name, name_len);
+    p[name_len] = '\0';
+    memcpy(p + name_len + 1, value, value_len);
+    p[name_len + 1 + value_len] = '\0';
+
+    hp->head = (hp->head + LWS_HPACK_MAX_ENTRIES - 1) % LWS_HPACK_MAX_ENTRIES;
+    e = &hp->entries[hp->head];
+    e->name = p;
+    e->name_len = name_len;
+    e->value = p + name_len + 1;
+    e->value_len = value_len;
+    hp->count++;
+    hp->size += entry_size;
+}
+
+static int lws_hpack_lookup(lws_hpack_t *hp, uint32_t index, const char **name, int *name_len,
+                            const char **value, int *value_len)
+{
+    lws_hpack_entry_t *e;
+
+    if (index == 0) {
+        return -1;
+    } else if (index <= LWS_HPACK_STATIC_COUNT) {
+        *name = lws_hpack_static[index - 1].name;
+        *name_len = strlen(*name);
+        *value = lws_hpack_static[index - 1].value;
+        *value_len = strlen(*value);
+        return 0;
+    }
+
+    index -= LWS_HPACK_STATIC_COUNT + 1;
+    if (index >= (uint32_t)hp->count)
+        return -1;
+
+    e = &hp->entries[(hp->head + index) % LWS_HPACK_MAX_ENTRIES];
+    *name = e->name;
+    *name_len = e->name_len;
+    *value = e->value;
+    *value_len = e->value_len;
+    return 0;
+}
+
+static int lws_hpack_get_int(const uint8_t **pp, const uint8_t *end, int prefix, uint32_t *value)
+{
+    const uint8_t *p = *pp;
+    uint32_t mask = (1 << prefix) - 1;
+    uint32_t v;
+    int shift = 0;
+
+    if (p >= end)
+        return -1;
+
+    v = *p++ & mask;
+    if (v == mask) {
+        do {
+            if (p >= end || shift > 21)
+                return -1;
+            v += (uint32_t)(*p & 0x7f) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+    }
+
+    *pp = p;
+    *value = v;
+    return 0;
+}
+
+static int lws_hpack_put_int(uint8_t *out, uint8_t first, int prefix, uint32_t value)
+{
+    uint32_t mask = (1 << prefix) - 1;
+    int n = 0;
+
+    if (value < mask) {
+        out[n++] = first | value;
+        return n;
+    }
+
+    out[n++] = first | mask;
+    value -= mask;
+    while (value >= 0x80) {
+        out[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = value;
+    return n;
+}
+
+static int lws_hpack_scratch(lws_hpack_t *hp, int size)
+{
+    char *p;
+
+    if (size <= hp->scratch_size)
+        return 0;
+
+    size = size < 1024 ? 1024 : size * 2;
+    p = realloc(hp->scratch, size);
+    if (p == NULL)
+        return -1;
+
+    hp->scratch = p;
+    hp->scratch_size = size;
+    return 0;
+}
+
+/* canonical code, walk one bit at a time and match per code length */
+static int lws_hpack_huff_decode(const uint8_t *src, int size, char *dst)
+{
+    uint32_t code = 0;
+    uint32_t index;
+    int bits = 0;
+    int n = 0;
+    int i, b;
+
+    for (i = 0; i < size; i++) {
+        for (b = 7; b >= 0; b--) {
+            code = (code << 1) | ((src[i] >> b) & 1);
+            bits++;
+            index = code - lws_hpack_huff_first[bits];
+            if (index < lws_hpack_huff_count[bits]) {
+                index = lws_hpack_huff_syms[lws_hpack_huff_offset[bits] + index];
+                if (index == 256)
+                    return -1;
+                dst[n++] = index;
+                code = 0;
+                bits = 0;
+            } else if (bits == 30) {
+                return -1;
+            }
+        }
+    }
+
+    /* padding is a prefix of EOS, at most 7 one bits */
+    if (bits > 7 || code != (1u << bits) - 1)
+        return -1;
+
+    return n;
+}
+
+static int lws_hpack_huff_size(const char *src, int size)
+{
+    int bits = 0;
+    int i;
+
+    for (i = 0; i < size; i++)
+        bits += lws_hpack_huff_lens[(uint8_t)src[i]];
+
+    return (bits + 7) / 8;
+}
+
+static int lws_hpack_huff_encode(const char *src, int size, uint8_t *dst)
+{
+    uint64_t acc = 0;
+    int bits = 0;
+    int n = 0;
+    int i;
+    uint8_t c;
+
+    for (i = 0; i < size; i++) {
+        c = src[i];
+        acc = (acc << lws_hpack_huff_lens[c]) | lws_hpack_huff_codes[c];
+        bits += lws_hpack_huff_lens[c];
+        while (bits >= 8) {
+            bits -= 8;
+            dst[n++] = acc >> bits;
+        }
+    }
+
+    if (bits)
+        dst[n++] = (acc << (8 - bits)) | (0xff >> bits);
+
+    return n;
+}
+
+/* decode string literal into scratch at offset */
+static int lws_hpack_get_str(lws_hpack_t *hp, const uint8_t **pp, const uint8_t *end, int offset, int *len)
+{
+    const uint8_t *p = *pp;
+    uint32_t size;
+    int huffman;
+    int n;
+
+    if (p >= end)
+        return -1;
+
+    huffman = *p & 0x80;
+    if (lws_hpack_get_int(&p, end, 7, &size) < 0 || size > (uint32_t)(end - p))
+        return -1;
+
+    if (huffman) {
+        if (lws_hpack_scratch(hp, offset + size * 8 / 5 + 1) < 0)
+            return -1;
+        n = lws_hpack_huff_decode(p, size, hp->scratch + offset);
+        if (n < 0)
+            return -1;
+    } else {
+        if (lws_hpack_scratch(hp, offset + size) < 0)
+            return -1;
+        memcpy(hp->scratch + offset, p, size);
+        n = size;
+    }
+
+    *pp = p + size;
+    *len = n;
+    return 0;
+}
+
+int lws_hpack_decode(lws_hpack_t *hp, const uint8_t *data, int size, lws_hpack_header_cb cb, void *arg)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + size;
+    const char *name, *value;
+    int name_len, value_len;
+    int allow_update = 1;
+    int indexing;
+    uint32_t index;
+
+    while (p < end) {
+        /* indexed header field */
+        if (*p & 0x80) {
+            if (lws_hpack_get_int(&p, end, 7, &index) < 0 ||
+                lws_hpack_lookup(hp, index, &name, &name_len, &value, &value_len) < 0)
+                return -1;
+            if (cb(arg, name, name_len, value, value_len) < 0)
+                return -1;
+            allow_update = 0;
+            continue;
+        }
+
+        /* dynamic table size update, only at the start of a block */
+        if ((*p & 0xe0) == 0x20) {
+            if (!allow_update || lws_hpack_get_int(&p, end, 5, &index) < 0 || index > (uint32_t)hp->limit)
+                return -1;
+            hp->max_size = index;
+            lws_hpack_evict(hp, hp->max_size);
+            continue;
+        }
+
+        /* literal with incremental indexing, without indexing or never indexed */
+        allow_update = 0;
+        indexing = *p & 0x40;
+        if (lws_hpack_get_int(&p, end, indexing ? 6 : 4, &index) < 0)
+            return -1;
+
+        /* name is copied too, adding the entry may evict the one it came from */
+        if (index) {
+            if (lws_hpack_lookup(hp, index, &name, &name_len, &value, &value_len) < 0 ||
+                lws_hpack_scratch(hp, name_len) < 0)
+                return -1;
+            memcpy(hp->scratch, name, name_len);
+        } else if (lws_hpack_get_str(hp, &p, end, 0, &name_len) < 0) {
+            return -1;
+        }
+
+        if (lws_hpack_get_str(hp, &p, end, name_len, &value_len) < 0)
+            return -1;
+
+        if (indexing)
+            lws_hpack_add(hp, hp->scratch, name_len, hp->scratch + name_len, value_len);
+
+        if (cb(arg, hp->scratch, name_len, hp->scratch + name_len, value_len) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+void lws_hpack_set_limit(lws_hpack_t *hp, int limit)
+{
+    if (limit > LWS_HPACK_TABLE_SIZE)
+        limit = LWS_HPACK_TABLE_SIZE;
+
+    if (limit == hp->max_size)
+        return;
+
+    if (!hp->update || limit < hp->update_min)
+        hp->update_min = limit;
+    hp->update = 1;
+    hp->max_size = limit;
+    hp->limit = limit;
+    lws_hpack_evict(hp, limit);
+}
+
+int lws_hpack_encode_begin(lws_hpack_t *hp, uint8_t *out)
+{
+    int n = 0;
+
+    if (hp->update) {
+        if (hp->update_min < hp->max_size)
+            n += lws_hpack_put_int(out, 0x20, 5, hp->update_min);
+        n += lws_hpack_put_int(out + n, 0x20, 5, hp->max_size);
+        hp->update = 0;
+    }
+
+    return n;
+}
+
+static int lws_hpack_put_str(uint8_t *out, int size, const char *str, int len)
+{
+    int huff_len = lws_hpack_huff_size(str, len);
+    int n;
+
+    if (huff_len < len) {
+        if (huff_len + 5 > size)
+            return -1;
+        n = lws_hpack_put_int(out, 0x80, 7, huff_len);
+        return n + lws_hpack_huff_encode(str, len, out + n);
+    }
+
+    if (len + 5 > size)
+        return -1;
+    n = lws_hpack_put_int(out, 0x00, 7, len);
+    memcpy(out + n, str, len);
+    return n + len;
+}
+
+int lws_hpack_encode(lws_hpack_t *hp, uint8_t *out, int size, const char *name, int name_len,
+                     const char *value, int value_len, int flags)
+{
+    lws_hpack_entry_t *e;
+    int name_index = 0;
+    int n, ret;
+    int i;
+
+    if (size < 5)
+        return -1;
+
+    for (i = 0; i < LWS_HPACK_STATIC_COUNT; i++) {
+        if (strncmp(lws_hpack_static[i].name, name, name_len) || lws_hpack_static[i].name[name_len])
+            continue;
+        if (name_index == 0)
+            name_index = i + 1;
+        if (strncmp(lws_hpack_static[i].value, value, value_len) == 0 && lws_hpack_static[i].value[value_len] == '\0')
+            return lws_hpack_put_int(out, 0x80, 7, i + 1);
+    }
+
+    for (i = 0; i < hp->count; i++) {
+        e = &hp->entries[(hp->head + i) % LWS_HPACK_MAX_ENTRIES];
+        if (e->name_len != name_len || memcmp(e->name, name, name_len))
+            continue;
+        if (name_index == 0)
+            name_index = LWS_HPACK_STATIC_COUNT + 1 + i;
+        if (e->value_len == value_len && memcmp(e->value, value, value_len) == 0)
+            return lws_hpack_put_int(out, 0x80, 7, LWS_HPACK_STATIC_COUNT + 1 + i);
+    }
+
+    if (flags & LWS_HPACK_NO_INDEX)
+        n = lws_hpack_put_int(out, 0x00, 4, name_index);
+    else
+        n = lws_hpack_put_int(out, 0x40, 6, name_index);
+
+    if (name_index == 0) {
+        ret = lws_hpack_put_str(out + n, size - n, name, name_len);
+        if (ret < 0)
+            return -1;
+        n += ret;
+    }
+
+    ret = lws_hpack_put_str(out + n, size - n, value, value_len);
+    if (ret < 0)
+        return -1;
+    n += ret;
+
+    if (!(flags & LWS_HPACK_NO_INDEX))
+        lws_hpack_add(hp, name, name_len, value, value_len);
+
+    return n;
+}
@@ -0,0 +1,109 @@
+#ifndef _LWS_HPACK_H_
+#define _LWS_HPACK_H_
+
+#include <stdint.h>
+
+/* dynamic table size of both directions, the http/2 default */
+#define LWS_HPACK_TABLE_SIZE    4096
+#define LWS_HPACK_ENTRY_OVERHEAD    32
+#define LWS_HPACK_MAX_ENTRIES   (LWS_HPACK_TABLE_SIZE / LWS_HPACK_ENTRY_OVERHEAD)
+
+/* encode flags */
+#define LWS_HPACK_NO_INDEX      0x01    /* value changes often, keep it out of the table */
+
+typedef struct _lws_hpack_entry_t_ {
+    char *name;                         /* name and value share one allocation */
+    int name_len;
+    char *value;
+    int value_len;
+} lws_hpack_entry_t;
+
+/**
+ * hpack dynamic table, one per direction of a connection (RFC 7541)
+**/
+typedef struct _lws_hpack_t_ {
+    lws_hpack_entry_t entries[LWS_HPACK_MAX_ENTRIES];  /* ring, head is newest */
+    int head;
+    int count;
+    int size;                           /* sum of entry sizes */
+    int max_size;                       /* current table size */
+    int limit;                          /* size allowed by settings */
+    int update;                         /* encoder: size update pending */
+    int update_min;                     /* encoder: smallest size since last block */
+    char *scratch;                      /* decoder: literal and huffman output */
+    int scratch_size;
+} lws_hpack_t;
+
+typedef int (*lws_hpack_header_cb)(void *arg, const char *name, int name_len, const char *value, int value_len);
+
+/**
+ * @func    lws_hpack_init
+ * @brief   initialize hpack table with the default size
+ *
+ * @param   hp[in] hpack table
+ * @return  void
+ */
+extern void lws_hpack_init(lws_hpack_t *hp);
+
+/**
+ * @func    lws_hpack_free
+ * @brief   release hpack table entries
+ *
+ * @param   hp[in] hpack table
+ * @return  void
+ */
+extern void lws_hpack_free(lws_hpack_t *hp);
+
+/**
+ * @func    lws_hpack_set_limit
+ * @brief   apply peer SETTINGS_HEADER_TABLE_SIZE to the encoder table,
+ *          the size update is sent with the next header block
+ *
+ * @param   hp[in] encoder hpack table
+ * @param   limit[in] table size allowed by peer
+ * @return  void
+ */
+extern void lws_hpack_set_limit(lws_hpack_t *hp, int limit);
+
+/**
+ * @func    lws_hpack_decode
+ * @brief   decode a complete header block
+ *
+ * @param   hp[in] decoder hpack table
+ * @param   data[in] header block
+ * @param   size[in] header block size
+ * @param   cb[in] called for every header field, name and value are only
+ *          valid during the call
+ * @param   arg[in] callback argument
+ * @return  On success, return 0. On compression error, return -1.
+ */
+extern int lws_hpack_decode(lws_hpack_t *hp, const uint8_t *data, int size, lws_hpack_header_cb cb, void *arg);
+
+/**
+ * @func    lws_hpack_encode_begin
+ * @brief   start a header block, emits a pending table size update
+ *
+ * @param   hp[in] encoder hpack table
+ * @param   out[out] output buffer, at least 8 bytes
+ * @return  encoded bytes.
+ */
+extern int lws_hpack_encode_begin(lws_hpack_t *hp, uint8_t *out);
+
+/**
+ * @func    lws_hpack_encode
+ * @brief   encode one header field, name must be lower case
+ *
+ * @param   hp[in] encoder hpack table
+ * @param   out[out] output buffer
+ * @param   size[in] output buffer size
+ * @param   name[in] header name
+ * @param   name_len[in] header name length
+ * @param   value[in] header value
+ * @param   value_len[in] header value length
+ * @param   flags[in] LWS_HPACK_NO_INDEX or 0
+ * @return  On success, return encoded bytes. If out is too small, return -1.
+ */
+extern int lws_hpack_encode(lws_hpack_t *hp, uint8_t *out, int size, const char *name, int name_len,
+                            const char *value, int value_len, int flags);
+
+#endif // _LWS_HPACK_H_
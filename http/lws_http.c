@@ -3,9 +3,20 @@
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <fcntl.h>
 
 #include "lws_log.h"
 #include "lws_http.h"
+#include "lws_http2.h"
+#include "lws_ws.h"
+#include "lws_sse.h"
+#include "lws_metrics.h"
+#include "lws_cache.h"
+#include "lws_admit.h"
+#include "lws_coro.h"
+#include "lws_compute.h"
+#include "lws_disk.h"
+#include "lws_multipart.h"
 
 typedef struct _lws_http_status_t {
     int http_code;
@@ -58,7 +69,8 @@ static lws_http_status_t lws_http_status[] = {
 };
 
 /* http plugin */
-static lws_http_plugins_t lws_http_plugins = {NULL, NULL, 0, NULL};
+static lws_http_plugins_t lws_http_plugins = {NULL, NULL, 0, NULL, 0, 0};
+static int lws_http_plugins_count = 0;
 
 const char *lws_skip(const char *s, const char *end, const char *delims, struct lws_str *v)
 {
@@ -180,8 +192,8 @@ int lws_parse_http(const char *s, int n, struct http_message *hm, int is_req)
     * and method is not (PUT or POST) then reset body length to zero.
     */
     if (hm->body.len == (size_t) ~0 && is_req &&
-        strcmp(hm->method.p, "PUT") != 0 &&
-        strcmp(hm->method.p, "POST") != 0) {
+        !(hm->method.len == 3 && strncmp(hm->method.p, "PUT", 3) == 0) &&
+        !(hm->method.len == 4 && strncmp(hm->method.p, "POST", 4) == 0)) {
         hm->body.len = 0;
         hm->message.len = len;
     }
@@ -218,20 +230,16 @@ static char *lws_get_http_status(int http_code)
     return "unknow";
 }
 
-/**
- * http response interfaces
-**/
-int lws_http_respond_base(lws_http_conn_t *lws_http_conn, int http_code, char *content_type, 
-                          char *extra_headers, int close_flag, char *content, int content_length)
+/*
+ * Serialize an HTTP/1.1 response header into send_buf after send_length,
+ * conn_offset is where its Connection line starts. Returns the new length.
+ */
+static int lws_http_header(lws_http_conn_t *lws_http_conn, int http_code, char *content_type,
+                           char *extra_headers, int close_flag, int content_length, int *conn_offset)
 {
     int header_length = lws_http_conn->send_length;
     char *send_buf = lws_http_conn->send_buf;
-    int send_length = 0;
-
-    if (lws_http_conn->send == NULL)
-        return -1;
 
-    /* HTTP/1.1 */
     header_length += sprintf(send_buf + header_length, "%s %d %s\r\n", LWS_HTTP_PROTO, http_code, lws_get_http_status(http_code));
     header_length += sprintf(send_buf + header_length, "Host: %s %s\r\n", LWS_HTTP_HOST, LWS_HTTP_VERSION);
 
@@ -249,6 +257,7 @@ int lws_http_respond_base(lws_http_conn_t *lws_http_conn, int http_code, char *c
         header_length += sprintf(send_buf + header_length, "%s\r\n", extra_headers);
     }
 
+    *conn_offset = header_length;
     if (close_flag) {
         header_length += sprintf(send_buf + header_length, "Connection: %s\r\n", "close");
     } else {
@@ -257,12 +266,39 @@ int lws_http_respond_base(lws_http_conn_t *lws_http_conn, int http_code, char *c
 
     /* "\r\n\r\n" */
     header_length += sprintf(send_buf + header_length, "%s", "\r\n");
-    lws_http_conn->send_length = header_length;
+    return header_length;
+}
+
+/**
+ * http response interfaces
+**/
+int lws_http_respond_base(lws_http_conn_t *lws_http_conn, int http_code, char *content_type, 
+                          char *extra_headers, int close_flag, char *content, int content_length)
+{
+    char *send_buf = lws_http_conn->send_buf;
+    int head_start = lws_http_conn->send_length;
+    int conn_offset;
+    int send_length = 0;
+    uint64_t send_start;
+
+    /* websocket connections answer with lws_ws_send, event streams with lws_sse_publish */
+    if (lws_http_conn->send == NULL || lws_http_conn->ws || lws_http_conn->recv_buf == NULL)
+        return -1;
+
+    /* http/2 stream being dispatched */
+    if (lws_http_conn->h2)
+        return lws_http2_respond(lws_http_conn, http_code, content_type, extra_headers, content, content_length);
+
+    /* HTTP/1.1 */
+    lws_http_conn->send_length = lws_http_header(lws_http_conn, http_code, content_type, extra_headers,
+                                                 close_flag, content_length, &conn_offset);
 
     /* send header */
     lws_log(4, "Send: %.*s\n", lws_http_conn->send_length, lws_http_conn->send_buf);
+    send_start = lws_metrics_now();
     send_length += lws_http_conn->send(lws_http_conn->sockfd, lws_http_conn->send_buf, lws_http_conn->send_length);
     if (send_length <= 0) {
+        lws_http_conn->send_length = 0;
         return -1;
     } else {
         lws_http_conn->send_length = 0;
@@ -273,6 +309,12 @@ int lws_http_respond_base(lws_http_conn_t *lws_http_conn, int http_code, char *c
         send_length += lws_http_conn->send(lws_http_conn->sockfd, content, content_length);
     }
 
+    /* the header is still in send_buf, stored without its Connection line */
+    if (lws_http_conn->cache)
+        lws_cache_store(lws_http_conn, http_code, send_buf + head_start, conn_offset - head_start,
+                        extra_headers, content, content_length);
+
+    lws_metrics_send(http_code, send_length, lws_metrics_now() - send_start);
     return send_length;
 }
 
@@ -287,13 +329,147 @@ int lws_http_respond_header(lws_http_conn_t *lws_http_conn, int http_code, int c
     return lws_http_respond_base(lws_http_conn, http_code, LWS_HTTP_HTML_TYPE, NULL, close_flag, NULL, 0);
 }
 
+/*
+ * Answer a request shed by admission control with the prebuilt 503, only
+ * http/2 streams format their headers.
+ */
+int lws_http_respond_shed(lws_http_conn_t *lws_http_conn)
+{
+    const char *resp;
+    uint64_t send_start;
+    int len, ret;
+
+    if (lws_http_conn->h2 || lws_http_conn->send == NULL)
+        return lws_http_respond_base(lws_http_conn, HTTP_SERVICE_UNAVAILABLE, LWS_HTTP_HTML_TYPE,
+                                     lws_admit_retry_after(), lws_http_conn->close_flag, NULL, 0);
+
+    resp = lws_admit_response(lws_http_conn->close_flag, &len);
+    send_start = lws_metrics_now();
+    ret = lws_http_conn->send(lws_http_conn->sockfd, (char *)resp, len);
+    lws_metrics_send(HTTP_SERVICE_UNAVAILABLE, ret > 0 ? ret : 0, lws_metrics_now() - send_start);
+    return ret;
+}
+
+/*
+ * Respond with size bytes of an open file, fd is always closed. The body
+ * is handed to the backend send_file (sendfile, or kTLS) behind the header,
+ * backends without it and http/2 streams get it read into memory, as do
+ * small files read once for coalesced requests waiting on this one.
+ */
+int lws_http_respond_file(lws_http_conn_t *lws_http_conn, int http_code, int close_flag,
+                          char *content_type, int fd, int size)
+{
+    char *content;
+    int nread = 0;
+    int ret;
+
+    if (fd < 0 || size < 0) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    /* downloads are read front to back, the kernel may read further ahead */
+    if (size > LWS_DISK_WINDOW)
+        posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+
+    if (lws_http_conn->send_file == NULL || lws_http_conn->h2 || lws_cache_shares_body(lws_http_conn, size)) {
+        content = malloc(size > 0 ? size : 1);
+        if (content == NULL) {
+            close(fd);
+            return -1;
+        }
+
+        while (nread < size) {
+            ret = lws_disk_pread(fd, content + nread, size - nread, nread);
+            if (ret <= 0)
+                break;
+            nread += ret;
+        }
+        close(fd);
+
+        if (nread < size) {
+            free(content);
+            return -1;
+        }
+
+        ret = lws_http_respond(lws_http_conn, http_code, close_flag, content_type, content, size);
+        free(content);
+        return ret;
+    }
+
+    ret = lws_http_respond_base(lws_http_conn, http_code, content_type, NULL, close_flag, NULL, size);
+    if (ret < 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (lws_http_conn->send_file(lws_http_conn->sockfd, fd, 0, size) < 0)
+        return -1;
+
+    lws_metrics_bytes(0, size);
+    return ret + size;
+}
+
+/*
+ * Respond with a body chain, buffer slices, static memory and file ranges
+ * go to the backend send_chain behind the header and leave with writev and
+ * sendfile as they are. The chain is not released, the caller may reuse it.
+ * http/2 streams and backends without send_chain get it flattened.
+ */
+int lws_http_respond_chain(lws_http_conn_t *lws_http_conn, int http_code, int close_flag,
+                           char *content_type, char *extra_headers, lws_chain_t *body)
+{
+    char *send_buf = lws_http_conn->send_buf;
+    int head_start = lws_http_conn->send_length;
+    int header_length, conn_offset;
+    uint64_t send_start;
+    char *content;
+    int ret;
+
+    if (lws_http_conn->send == NULL || lws_http_conn->ws || lws_http_conn->recv_buf == NULL || body == NULL)
+        return -1;
+
+    if (lws_http_conn->h2 || lws_http_conn->send_chain == NULL) {
+        content = malloc(body->length > 0 ? body->length : 1);
+        if (content == NULL)
+            return -1;
+
+        if (lws_chain_copy(body, content) < 0) {
+            free(content);
+            return -1;
+        }
+
+        ret = lws_http_respond_base(lws_http_conn, http_code, content_type, extra_headers, close_flag,
+                                    content, body->length);
+        free(content);
+        return ret;
+    }
+
+    header_length = lws_http_header(lws_http_conn, http_code, content_type, extra_headers,
+                                    close_flag, body->length, &conn_offset);
+
+    lws_log(4, "Send: %.*s\n", header_length - head_start, send_buf + head_start);
+    send_start = lws_metrics_now();
+    ret = lws_http_conn->send_chain(lws_http_conn->sockfd, send_buf + head_start, header_length - head_start, body);
+    if (ret < 0)
+        return -1;
+
+    if (lws_http_conn->cache)
+        lws_cache_store_chain(lws_http_conn, http_code, send_buf + head_start, conn_offset - head_start,
+                              extra_headers, body);
+
+    lws_metrics_send(http_code, ret, lws_metrics_now() - send_start);
+    return ret;
+}
+
 /**
  * http plugin interfaces
 **/
-lws_event_handler_t lws_http_get_endpoint_handler(const char *uri, int uri_size)
+lws_http_plugins_t *lws_http_get_endpoint(const char *uri, int uri_size)
 {
     lws_http_plugins_t *plugin;
-    lws_event_handler_t hander = NULL;
+    lws_http_plugins_t *match = NULL;
     int max_size = 0;
 
     if (uri == NULL || uri_size <= 0)
@@ -304,20 +480,46 @@ lws_event_handler_t lws_http_get_endpoint_handler(const char *uri, int uri_size)
         if (strncmp(plugin->uri, uri, plugin->uri_size) == 0) {
             if (plugin->uri_size > max_size) {
                 max_size = plugin->uri_size;
-                hander = plugin->handler;
+                match = plugin;
             }
         }
 
         plugin = plugin->next;
     }
 
-    return hander;
+    return match;
+}
+
+lws_event_handler_t lws_http_get_endpoint_handler(const char *uri, int uri_size)
+{
+    lws_http_plugins_t *plugin;
+
+    plugin = lws_http_get_endpoint(uri, uri_size);
+    return plugin ? plugin->handler : NULL;
+}
+
+const char *lws_http_endpoint_uri(int index)
+{
+    lws_http_plugins_t *plugin;
+
+    for (plugin = &lws_http_plugins; plugin && plugin->uri; plugin = plugin->next) {
+        if (plugin->index == index)
+            return plugin->uri;
+    }
+
+    return NULL;
 }
 
 void lws_http_endpoint_register(const char *uri, int uri_size, lws_event_handler_t handler)
+{
+    lws_http_endpoint_register_flags(uri, uri_size, handler, 0);
+}
+
+/* register with LWS_ENDPOINT_* flags, a CPU-bound handler with LWS_ENDPOINT_COMPUTE */
+void lws_http_endpoint_register_flags(const char *uri, int uri_size, lws_event_handler_t handler, int flags)
 {
     lws_http_plugins_t *plugin;
-    lws_http_plugins_t *new_plugin;
+    lws_http_plugins_t *new_plugin = NULL;
 
     if (uri == NULL || uri_size <= 0 || handler == NULL)
         return ;
@@ -344,10 +546,28 @@ void lws_http_endpoint_register(const char *uri, int uri_size, lws_event_handler
         new_plugin->uri_size = uri_size;
         new_plugin->uri = strndup(uri, uri_size);
         new_plugin->next = NULL;
+        new_plugin->index = ++lws_http_plugins_count;
+        new_plugin->flags = flags;
         lws_log(3, "register endpoint: %.*s\n", uri_size, uri);
     }
 }
 
+/* add LWS_ENDPOINT_* flags to the endpoint registered exactly as uri, before the service starts */
+int lws_http_endpoint_set_flags(const char *uri, int uri_size, int flags)
+{
+    lws_http_plugins_t *plugin;
+
+    for (plugin = &lws_http_plugins; plugin && plugin->uri; plugin = plugin->next) {
+        if (plugin->uri_size == uri_size && strncmp(plugin->uri, uri, uri_size) == 0) {
+            plugin->flags |= flags;
+            return 0;
+        }
+    }
+
+    lws_log(2, "endpoint not registered: %.*s\n", uri_size, uri);
+    return -1;
+}
+
 char *lws_http_contenttype(char *filename)
 {
     unsigned int i;
@@ -362,15 +582,7 @@ char *lws_http_contenttype(char *filename)
     };
 
     static struct content_type_t ctts[] = {
-        {".jpg",  LWS_HTTP_JPEG_TYPE},
-        {".jpeg", LWS_HTTP_JPEG_TYPE},
-        {".png",  LWS_HTTP_PNG_TYPE},
-        {".gif",  LWS_HTTP_GIF_TYPE},
-        {".txt",  LWS_HTTP_PLAIN_TYPE},
-        {".htm",  LWS_HTTP_HTML_TYPE},
-        {".html", LWS_HTTP_HTML_TYPE},
-        {".pdf",  LWS_HTTP_PDF_TYPE},
-        {".xml",  LWS_HTTP_XML_TYPE},
+        LWS_HTTP_CONTENT_TYPES
     };
 
     if (filename) {
@@ -417,60 +629,405 @@ lws_http_conn_t *lws_http_conn_init(int sockfd)
     if (lws_http_conn == NULL)
         return NULL;
 
+    lws_http_conn->recv_buf = malloc(LWS_HTTP_BUF_SIZE);
+    lws_http_conn->send_buf = malloc(LWS_HTTP_BUF_SIZE);
+    if (lws_http_conn->recv_buf == NULL || lws_http_conn->send_buf == NULL) {
+        free(lws_http_conn->recv_buf);
+        free(lws_http_conn->send_buf);
+        free(lws_http_conn);
+        return NULL;
+    }
+
     lws_http_conn->sockfd = sockfd;
     lws_http_conn->send = NULL;
     lws_http_conn->send_length = 0;
     lws_http_conn->recv_length = 0;
+    lws_http_conn->close_flag = 0;
+    lws_http_conn->h2 = NULL;
+    lws_http_conn->ws = NULL;
+    lws_http_conn->sse = NULL;
+    lws_http_conn->send_shared = NULL;
+    lws_http_conn->send_file = NULL;
+    lws_http_conn->send_pipe = NULL;
+    lws_http_conn->recv_pipe = NULL;
+    lws_http_conn->send_chain = NULL;
+    lws_http_conn->cache = NULL;
+    lws_http_conn->arrival_ns = 0;
+    lws_http_conn->coro = NULL;
+    lws_http_conn->upload = NULL;
+    lws_http_conn->blocking = 0;
+    lws_metrics_conn(1);
     return lws_http_conn;
 }
 
 int lws_http_conn_exit(lws_http_conn_t *lws_http_conn)
 {
-    if (lws_http_conn)
+    if (lws_http_conn) {
+        lws_http2_free(lws_http_conn);
+        lws_ws_free(lws_http_conn);
+        lws_sse_free(lws_http_conn);
+        lws_multipart_free(lws_http_conn);
+        free(lws_http_conn->recv_buf);
+        free(lws_http_conn->send_buf);
         free(lws_http_conn);
+        lws_metrics_conn(-1);
+    }
 
     return 0;
 }
 
-int lws_http_conn_recv(lws_http_conn_t *lws_http_conn, char *data, size_t size)
+int lws_http_conn_dispatch(lws_http_conn_t *lws_http_conn, struct http_message *http_msg, uint64_t parse_ns)
 {
-    struct http_message http_msg;
-    lws_event_handler_t handler;
+    lws_http_plugins_t *plugin;
+    lws_event_handler_t handler = NULL;
+    lws_metrics_req_t metrics;
     struct lws_str *connect;
-    int len = 0;
+    uint64_t handler_start;
     int ret = 0;
 
-    if (lws_http_conn == NULL)
-        return -1;
-
-    lws_log(4, "start lws_parse_http size: %d\n", size);
-    len = lws_parse_http(data, size, &http_msg, 1);
-    if (len < 0) {
-        lws_log(2, "lws_parse_http failed, len: %d\n", len);
-        return -1;
-    }
-
     /* print http data */
-    lws_log(4, "lws_parse_http len: %d\n", len);
-    lws_http_conn_print(&http_msg);
+    lws_http_conn_print(http_msg);
 
-    /* parse Connection */
-    connect = lws_get_http_header(&http_msg, "Connection");
-    if (strncasecmp(connect->p, "close", connect->len) == 0) {
+    /* parse Connection, http/2 streams never close the connection */
+    connect = lws_get_http_header(http_msg, "Connection");
+    if (connect && lws_http_conn->h2 == NULL && strncasecmp(connect->p, "close", connect->len) == 0) {
         lws_http_conn->close_flag = 1;
     }
 
-    handler = lws_http_get_endpoint_handler(http_msg.uri.p, http_msg.uri.len);
-    if (handler) {
-        ret = handler(lws_http_conn, LWS_EV_HTTP_REQUEST, (void *)&http_msg);
+    plugin = lws_http_get_endpoint(http_msg->uri.p, http_msg->uri.len);
+    if (plugin)
+        handler = plugin->handler;
+
+    lws_metrics_request_begin(&metrics, plugin ? plugin->index : 0, parse_ns);
+    handler_start = lws_metrics_now();
+    if (handler && lws_admit_request(lws_http_conn->arrival_ns, handler_start) < 0) {
+        /* shed before any work, the connection stays usable for the retry */
+        lws_http_respond_shed(lws_http_conn);
+    } else if (handler) {
+        if (plugin->flags & LWS_ENDPOINT_COMPUTE)
+            handler = lws_compute_handler;
+        if (lws_cache_enabled() || (plugin->flags & LWS_ENDPOINT_COALESCE))
+            ret = lws_cache_handle(lws_http_conn, http_msg, handler, plugin->flags & LWS_ENDPOINT_COALESCE);
+        else
+            ret = handler(lws_http_conn, LWS_EV_HTTP_REQUEST, (void *)http_msg);
         if (ret != HTTP_OK) {
             lws_http_respond_header(lws_http_conn, ret, 1);
+            if (lws_http_conn->h2 == NULL)
+                lws_http_conn->close_flag = 1;
         }
+        lws_admit_done();
     } else {
-        lws_log(2, "Not found uri: %.*s\n", http_msg.uri.len, http_msg.uri.p);
+        lws_log(2, "Not found uri: %.*s\n", http_msg->uri.len, http_msg->uri.p);
         lws_http_respond_header(lws_http_conn, HTTP_NOT_FOUND, lws_http_conn->close_flag);
     }
+    lws_metrics_request_end(&metrics, lws_metrics_now() - handler_start);
 
-    return len;
+    /* a streamed body the handler left on the socket is in front of the next request */
+    if (http_msg->body_pending > 0)
+        lws_http_conn->close_flag = 1;
+
+    return 0;
+}
+
+/* request handed to a handler coroutine, lives on the coroutine stack while it runs */
+typedef struct _lws_http_task_t_ {
+    lws_http_conn_t *conn;
+    lws_coro_t *co;
+    struct http_message msg;            /* points into recv_buf, kept until the handler returns */
+    uint64_t parse_ns;
+    int msg_len;
+    lws_metrics_req_t *metrics;         /* current request of the handler while suspended */
+} lws_http_task_t;
+
+/* the request is handled, drop it and keep pipelined data */
+static void lws_http_conn_drop(lws_http_conn_t *lws_http_conn, int msg_len)
+{
+    /* subscribed to an event stream, the http buffers are not needed anymore */
+    if (lws_http_conn->sse) {
+        free(lws_http_conn->recv_buf);
+        free(lws_http_conn->send_buf);
+        lws_http_conn->recv_buf = NULL;
+        lws_http_conn->send_buf = NULL;
+        lws_http_conn->recv_length = 0;
+        return;
+    }
+
+    lws_http_conn->recv_length -= msg_len;
+    memmove(lws_http_conn->recv_buf, lws_http_conn->recv_buf + msg_len, lws_http_conn->recv_length);
+}
+
+static void lws_http_conn_task(void *arg)
+{
+    lws_http_task_t task = *(lws_http_task_t *)arg;
+    lws_http_conn_t *lws_http_conn = task.conn;
+
+    lws_http_conn->coro = &task;
+    lws_http_conn_dispatch(lws_http_conn, &task.msg, task.parse_ns);
+    lws_http_conn_drop(lws_http_conn, task.msg_len);
+    lws_http_conn->coro = NULL;
+}
+
+/* run the handler coroutine until it returns or waits, with its own current request */
+static void lws_http_conn_step(lws_http_conn_t *lws_http_conn, lws_coro_t *co, lws_metrics_req_t *metrics)
+{
+    lws_metrics_req_t *prev;
+
+    prev = lws_metrics_swap(metrics);
+    lws_coro_resume(co);
+    metrics = lws_metrics_swap(prev);
+
+    if (lws_http_conn->coro)
+        ((lws_http_task_t *)lws_http_conn->coro)->metrics = metrics;
+}
+
+/*
+ * Hand a complete http/1 request to its handler. On an event loop that can
+ * suspend coroutines the handler runs in one, so a handler waiting for an
+ * upstream leaves the worker to other connections until it is resumed;
+ * otherwise, and when no stack is left, it runs on the caller stack.
+ */
+static void lws_http_conn_run(lws_http_conn_t *lws_http_conn, struct http_message *http_msg,
+                              uint64_t parse_ns, int msg_len)
+{
+    lws_http_task_t task;
+    lws_coro_t *co = NULL;
+
+    if (lws_coro_enabled() && lws_coro_self() == NULL)
+        co = lws_coro_new(lws_http_conn_task, &task);
+
+    if (co == NULL) {
+        lws_http_conn_dispatch(lws_http_conn, http_msg, parse_ns);
+        lws_http_conn_drop(lws_http_conn, msg_len);
+        return;
+    }
+
+    task.conn = lws_http_conn;
+    task.co = co;
+    task.msg = *http_msg;
+    task.parse_ns = parse_ns;
+    task.msg_len = msg_len;
+    task.metrics = NULL;
+    lws_coro_set_data(co, lws_http_conn);
+    lws_http_conn_step(lws_http_conn, co, NULL);
+}
+
+/*
+ * A body larger than the buffer stays on the socket if the endpoint reads it
+ * itself with recv_pipe: the request goes to the handler with the body bytes
+ * received so far, hm->body_pending tells how many follow.
+ * Return 0 if the request streams, -1 if it has to be buffered.
+ */
+static int lws_http_conn_stream(lws_http_conn_t *lws_http_conn, struct http_message *hm)
+{
+    lws_http_plugins_t *plugin;
+    struct lws_str *expect;
+    char buf[64];
+    size_t buffered;
+    int len;
+
+    if (lws_http_conn->recv_pipe == NULL)
+        return -1;
+
+    plugin = lws_http_get_endpoint(hm->uri.p, hm->uri.len);
+    if (plugin == NULL || !(plugin->flags & LWS_ENDPOINT_STREAM))
+        return -1;
+
+    buffered = lws_http_conn->recv_length - (hm->body.p - lws_http_conn->recv_buf);
+    hm->body_pending = hm->body.len - buffered;
+    hm->body.len = buffered;
+    hm->message.len = lws_http_conn->recv_length;
+
+    expect = lws_get_http_header(hm, "Expect");
+    if (expect && expect->len == 12 && strncasecmp(expect->p, "100-continue", 12) == 0) {
+        len = sprintf(buf, "%s 100 Continue\r\n\r\n", LWS_HTTP_PROTO);
+        lws_http_conn->send(lws_http_conn->sockfd, buf, len);
+    }
+
+    lws_log(4, "sockfd[%d] request body streams, %zu bytes on the socket\n", lws_http_conn->sockfd,
+            hm->body_pending);
+    return 0;
+}
+
+/*
+ * Dispatch every complete request in the connection buffer, one at a time:
+ * a request whose handler is suspended holds back the pipelined ones.
+ * Return the number of consumed bytes, or -1 if the connection must close.
+ */
+static int lws_http_conn_parse(lws_http_conn_t *lws_http_conn)
+{
+    struct http_message http_msg;
+    struct lws_str *upgrade, *settings;
+    uint64_t parse_start;
+    int consumed = 0;
+    int len = 0;
+    int msg_len;
+
+    while (lws_http_conn->recv_length > 0 && lws_http_conn->close_flag == 0 && lws_http_conn->coro == NULL &&
+           lws_http_conn->upload == NULL) {
+        lws_log(4, "start lws_parse_http size: %d\n", lws_http_conn->recv_length);
+        parse_start = lws_metrics_now();
+        len = lws_parse_http(lws_http_conn->recv_buf, lws_http_conn->recv_length, &http_msg, 1);
+        if (len < 0) {
+            lws_log(2, "lws_parse_http failed, len: %d\n", len);
+            return -1;
+        } else if (len == 0) {
+            break;
+        }
+
+        /* multipart uploads stream to the endpoint, only their headers are buffered */
+        if (http_msg.body.len > 0 &&
+            lws_multipart_begin(lws_http_conn, &http_msg, lws_metrics_now() - parse_start) == 0) {
+            msg_len = len + lws_multipart_recv(lws_http_conn, lws_http_conn->recv_buf + len,
+                                               lws_http_conn->recv_length - len);
+            lws_http_conn_drop(lws_http_conn, msg_len);
+            consumed += msg_len;
+            continue;
+        }
+
+        /* wait until the whole body is buffered */
+        msg_len = (http_msg.body.len == (size_t) ~0) ? len : (int) http_msg.message.len;
+        if (msg_len > LWS_HTTP_BUF_SIZE && lws_http_conn_stream(lws_http_conn, &http_msg) == 0) {
+            msg_len = lws_http_conn->recv_length;
+            lws_http_conn_run(lws_http_conn, &http_msg, lws_metrics_now() - parse_start, msg_len);
+            consumed += msg_len;
+            continue;
+        } else if (msg_len > LWS_HTTP_BUF_SIZE) {
+            lws_log(2, "request body too large, length: %d\n", msg_len);
+            lws_http_respond_header(lws_http_conn, HTTP_REQ_ENTITY_TOO_LARGE, 1);
+            return -1;
+        } else if (msg_len > lws_http_conn->recv_length) {
+            break;
+        }
+
+        lws_log(4, "lws_parse_http len: %d\n", len);
+
+        /* h2c upgrade, the request becomes stream 1 and the rest is http/2 */
+        upgrade = lws_get_http_header(&http_msg, "Upgrade");
+        settings = lws_get_http_header(&http_msg, "HTTP2-Settings");
+        if (upgrade && settings && upgrade->len == 3 && strncasecmp(upgrade->p, "h2c", 3) == 0 &&
+            lws_http2_upgrade(lws_http_conn, &http_msg, settings) == 0) {
+            lws_http_conn->recv_length -= msg_len;
+            len = lws_http_conn->recv_length;
+            lws_http_conn->recv_length = 0;
+            if (len > 0)
+                lws_http2_recv(lws_http_conn, lws_http_conn->recv_buf + msg_len, len);
+            return consumed + msg_len + len;
+        }
+
+        /*
+         * websocket upgrade, the http buffers are released once frames
+         * following the handshake are parsed, an idle connection only
+         * keeps lws_ws_conn_t
+         */
+        if (upgrade && upgrade->len == 9 && strncasecmp(upgrade->p, "websocket", 9) == 0) {
+            if (lws_ws_upgrade(lws_http_conn, &http_msg) < 0)
+                return consumed + msg_len;
+            len = lws_http_conn->recv_length - msg_len;
+            lws_http_conn->recv_length = 0;
+            if (len > 0)
+                lws_ws_recv(lws_http_conn, lws_http_conn->recv_buf + msg_len, len);
+            free(lws_http_conn->recv_buf);
+            free(lws_http_conn->send_buf);
+            lws_http_conn->recv_buf = NULL;
+            lws_http_conn->send_buf = NULL;
+            return consumed + msg_len + len;
+        }
+
+        lws_http_conn_run(lws_http_conn, &http_msg, lws_metrics_now() - parse_start, msg_len);
+        consumed += msg_len;
+    }
+
+    return consumed;
+}
+
+/**
+ * @func    lws_http_conn_resume
+ * @brief   continue the handler suspended in a coroutine, once it returns
+ *          the requests buffered meanwhile are dispatched
+ *
+ * @param   lws_http_conn[in] http connection
+ * @return  Return the number of consumed bytes, or -1 if the connection must close.
+ */
+int lws_http_conn_resume(lws_http_conn_t *lws_http_conn)
+{
+    lws_http_task_t *task = lws_http_conn->coro;
+
+    if (task == NULL)
+        return 0;
+
+    lws_http_conn_step(lws_http_conn, task->co, task->metrics);
+    if (lws_http_conn->coro)
+        return 0;
+
+    return lws_http_conn_parse(lws_http_conn);
 }
 
+/*
+ * Append received data to the connection buffer and dispatch every complete
+ * request in it, so partial and pipelined requests are both handled. Data
+ * arriving while a handler is suspended is only buffered.
+ * Return the number of consumed bytes, or -1 if the connection must close.
+ */
+int lws_http_conn_recv(lws_http_conn_t *lws_http_conn, char *data, size_t size)
+{
+    int len = 0;
+
+    if (lws_http_conn == NULL)
+        return -1;
+
+    /* queueing delay of a request counts from its first byte, streams from their frames */
+    if (lws_http_conn->recv_length == 0 || lws_http_conn->h2)
+        lws_http_conn->arrival_ns = lws_admit_arrival();
+
+    if (lws_http_conn->ws) {
+        lws_metrics_bytes(size, 0);
+        return lws_ws_recv(lws_http_conn, data, size);
+    }
+
+    if (lws_http_conn->h2) {
+        lws_metrics_bytes(size, 0);
+        return lws_http2_recv(lws_http_conn, data, size);
+    }
+
+    /* body of a streaming upload, what follows it is the next request */
+    if (lws_http_conn->upload) {
+        len = lws_multipart_recv(lws_http_conn, data, size);
+        lws_metrics_bytes(len, 0);
+        if (len == (int)size || lws_http_conn->close_flag)
+            return len;
+        data += len;
+        size -= len;
+    }
+
+    /* event stream subscribers only listen */
+    if (lws_http_conn->recv_buf == NULL) {
+        lws_metrics_bytes(size, 0);
+        return size;
+    }
+
+    if (size > LWS_HTTP_BUF_SIZE - lws_http_conn->recv_length) {
+        lws_log(2, "request too large, buffered: %d, size: %d\n", lws_http_conn->recv_length, size);
+        lws_http_respond_header(lws_http_conn, HTTP_REQ_ENTITY_TOO_LARGE, 1);
+        return -1;
+    }
+
+    memcpy(lws_http_conn->recv_buf + lws_http_conn->recv_length, data, size);
+    lws_http_conn->recv_length += size;
+    lws_metrics_bytes(size, 0);
+
+    /* http/2 with prior knowledge */
+    if (lws_http_conn->recv_buf[0] == 'P') {
+        len = lws_http2_is_preface(lws_http_conn->recv_buf, lws_http_conn->recv_length);
+        if (len == 0) {
+            return 0;
+        } else if (len > 0) {
+            if (lws_http2_start(lws_http_conn) < 0)
+                return -1;
+            len = lws_http_conn->recv_length;
+            lws_http_conn->recv_length = 0;
+            return lws_http2_recv(lws_http_conn, lws_http_conn->recv_buf, len);
+        }
+    }
+
+    return lws_http_conn_parse(lws_http_conn);
+}
@@ -1,6 +1,12 @@
 #ifndef _LWS_HTTP_H_
 #define _LWS_HTTP_H_
 
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "lws_buf.h"
+#include "lws_chain.h"
+
 #ifndef LWS_MAX_HTTP_HEADERS
 #define LWS_MAX_HTTP_HEADERS    20
 #endif
@@ -27,11 +33,43 @@
 #define LWS_HTTP_MPEG_TYPE      "video/mpeg"
 #define LWS_HTTP_MP4_TYPE       "video/mp4"
 
+/* file extensions of lws_http_contenttype, the asset packer types files with them too */
+#define LWS_HTTP_CONTENT_TYPES              \
+    {".jpg",  LWS_HTTP_JPEG_TYPE},          \
+    {".jpeg", LWS_HTTP_JPEG_TYPE},          \
+    {".png",  LWS_HTTP_PNG_TYPE},           \
+    {".gif",  LWS_HTTP_GIF_TYPE},           \
+    {".txt",  LWS_HTTP_PLAIN_TYPE},         \
+    {".htm",  LWS_HTTP_HTML_TYPE},          \
+    {".html", LWS_HTTP_HTML_TYPE},          \
+    {".pdf",  LWS_HTTP_PDF_TYPE},           \
+    {".xml",  LWS_HTTP_XML_TYPE}
+
 /* HTTP and websocket events. void *ev_data is described in a comment. */
+#define LWS_EV_CLOSE            5       /* NULL, upgraded connection is closing, or
+                                           struct http_multipart_part * of an unfinished upload */
 #define LWS_EV_HTTP_REQUEST     100 /* struct http_message * */
 #define LWS_EV_HTTP_REPLY       101   /* struct http_message * */
 #define LWS_EV_HTTP_CHUNK       102   /* struct http_message * */
 #define LWS_EV_SSI_CALL         105     /* char * */
+#define LWS_EV_WEBSOCKET_HANDSHAKE_REQUEST 111  /* struct http_message *, HTTP_OK accepts */
+#define LWS_EV_WEBSOCKET_HANDSHAKE_DONE    112  /* NULL */
+#define LWS_EV_WEBSOCKET_FRAME             113  /* struct websocket_message * */
+#define LWS_EV_WEBSOCKET_CONTROL_FRAME     114  /* struct websocket_message * */
+#define LWS_EV_HTTP_MULTIPART_REQUEST      121  /* struct http_message *, HTTP_OK streams the parts */
+#define LWS_EV_HTTP_PART_BEGIN             122  /* struct http_multipart_part * */
+#define LWS_EV_HTTP_PART_DATA              123  /* struct http_multipart_part * */
+#define LWS_EV_HTTP_PART_END               124  /* struct http_multipart_part * */
+#define LWS_EV_HTTP_MULTIPART_REQUEST_END  125  /* struct http_multipart_part *, the handler responds */
+
+/* websocket opcodes, RFC 6455 5.2 */
+#define WEBSOCKET_OP_CONTINUE   0
+#define WEBSOCKET_OP_TEXT       1
+#define WEBSOCKET_OP_BINARY     2
+#define WEBSOCKET_OP_CLOSE      8
+#define WEBSOCKET_OP_PING       9
+#define WEBSOCKET_OP_PONG       10
+#define WEBSOCKET_DONT_FIN      0x100   /* lws_ws_send: more fragments follow */
 
 /* HTTP response status codes */
 #define HTTP_CONTINUE                       100
@@ -82,6 +120,23 @@ struct lws_str {
   size_t len;    /* Memory chunk length */
 };
 
+/* websocket message, a whole reassembled message or a control frame */
+struct websocket_message {
+  unsigned char *data;
+  size_t size;
+  unsigned char flags; /* WEBSOCKET_OP_* */
+};
+
+/* one part of a multipart/form-data upload, views valid until its PART_END */
+struct http_multipart_part {
+  struct lws_str name;         /* form field name */
+  struct lws_str filename;     /* empty unless the part is a file */
+  struct lws_str content_type; /* empty if the part has none */
+  struct lws_str data;         /* PART_DATA: the next bytes of the part */
+  int status;                  /* END events: 0, or -1 if the body is malformed or cut short */
+  void *user_data;             /* handler state, kept for the whole upload */
+};
+
 /* HTTP message */
 struct http_message {
   struct lws_str message; /* Whole message: request line + headers + body */
@@ -111,30 +166,62 @@ struct http_message {
 
   /* Message body */
   struct lws_str body; /* Zero-length for requests with no body */
+
+  /* Parts of the request buffer lws_query.h decoded in place */
+  int decoded; /* LWS_HTTP_URI_DECODED | LWS_HTTP_QUERY_DECODED */
+
+  /* Body bytes after body.len still on the socket, LWS_ENDPOINT_STREAM only */
+  size_t body_pending;
 };
 
+#define LWS_HTTP_URI_DECODED    0x01
+#define LWS_HTTP_QUERY_DECODED  0x02
+
 /**
  * http connection interfaces
 **/
+#define LWS_HTTP_BUF_SIZE       4096
+
 typedef struct _lws_http_conn_t_ {
     int sockfd;
     int close_flag;
-    char recv_buf[4096];
+    char *recv_buf;             /* LWS_HTTP_BUF_SIZE, released after websocket upgrade */
     int recv_length;
-    char send_buf[4096];
+    char *send_buf;             /* LWS_HTTP_BUF_SIZE, released after websocket upgrade */
     int send_length;
     int (*send)(int sockfd, char *data, int size);
     int (*recv)(int sockfd, char *data, int *size);
     int (*close)(int sockfd);
+    /* queue a shared buffer without blocking, buf NULL only asks; return unsent bytes or -1 */
+    int (*send_shared)(int sockfd, lws_buf_t *buf);
+    /* send a file range after the queued output, fd is always consumed; NULL if unsupported */
+    int (*send_file)(int sockfd, int fd, off_t offset, int size);
+    /* splice size bytes held in a pipe after the queued output, the read end is always consumed */
+    int (*send_pipe)(int sockfd, int pipefd, int size);
+    /* splice up to size bytes from the socket into a pipe with room for them, waiting at most timeout_ms; NULL if unsupported */
+    int (*recv_pipe)(int sockfd, int pipefd, int size, int timeout_ms);
+    /* send head, then the chain without flattening it, the chain is free to reuse on return; NULL if unsupported */
+    int (*send_chain)(int sockfd, const char *head, int head_len, lws_chain_t *chain);
+    void *h2;                   /* lws_http2_conn_t, NULL on http/1.1 */
+    void *ws;                   /* lws_ws_conn_t, NULL unless upgraded to websocket */
+    void *sse;                  /* lws_sse_sub_t, NULL unless subscribed to events */
+    void *cache;                /* key of a cacheable request while its handler runs, or NULL */
+    uint64_t arrival_ns;        /* when the first byte of the buffered request arrived */
+    void *coro;                 /* request whose handler is suspended in a coroutine, or NULL */
+    void *upload;               /* lws_multipart_t while a multipart body streams to its endpoint */
+    int blocking;               /* served by a thread of its own, a handler may block it */
 } lws_http_conn_t;
 
 extern lws_http_conn_t *lws_http_conn_init(int sockfd);
 extern int lws_http_conn_exit(lws_http_conn_t *lws_http_conn);
 extern int lws_http_conn_recv(lws_http_conn_t *lws_http_conn, char *data, size_t size);
+extern int lws_http_conn_resume(lws_http_conn_t *lws_http_conn);
+extern int lws_http_conn_dispatch(lws_http_conn_t *lws_http_conn, struct http_message *http_msg, uint64_t parse_ns);
 
 /**
  * http protocol interfaces
 **/
+extern int lws_parse_http(const char *s, int n, struct http_message *hm, int is_req);
 extern struct lws_str *lws_get_http_header(struct http_message *hm, const char *name);
 
 /**
@@ -145,21 +232,37 @@ extern int lws_http_respond_base(lws_http_conn_t *lws_http_conn, int http_code,
 extern int lws_http_respond(lws_http_conn_t *lws_http_conn, int http_code, int close_flag, 
                      char *content_type, char *content, int content_length);
 extern int lws_http_respond_header(lws_http_conn_t *lws_http_conn, int http_code, int close_flag);
+extern int lws_http_respond_shed(lws_http_conn_t *lws_http_conn);
+extern int lws_http_respond_file(lws_http_conn_t *lws_http_conn, int http_code, int close_flag,
+                          char *content_type, int fd, int size);
+extern int lws_http_respond_chain(lws_http_conn_t *lws_http_conn, int http_code, int close_flag,
+                           char *content_type, char *extra_headers, lws_chain_t *body);
 
 /**
  * http plugin interfaces
 **/
 typedef int (*lws_event_handler_t)(lws_http_conn_t *c, int ev, void *p);
 
+/* endpoint flags */
+#define LWS_ENDPOINT_COALESCE   0x1     /* identical concurrent requests share one handler run */
+#define LWS_ENDPOINT_COMPUTE    0x2     /* handler runs on the compute pool, off the event loop */
+#define LWS_ENDPOINT_STREAM     0x4     /* bodies larger than the buffer are left to the handler, see body_pending */
+
 typedef struct lws_http_plugins_t {
     struct lws_http_plugins_t *next;
     const char *uri;
     size_t uri_size;
     lws_event_handler_t handler;
+    int index;                      /* registration order, from 1 */
+    int flags;                      /* LWS_ENDPOINT_* */
 } lws_http_plugins_t;
 
+extern lws_http_plugins_t *lws_http_get_endpoint(const char *uri, int uri_size);
 extern lws_event_handler_t lws_http_get_endpoint_handler(const char *uri, int uri_size);
+extern const char *lws_http_endpoint_uri(int index);
 extern void lws_http_endpoint_register(const char *uri, int uri_size, lws_event_handler_t handler);
+extern void lws_http_endpoint_register_flags(const char *uri, int uri_size, lws_event_handler_t handler, int flags);
+extern int lws_http_endpoint_set_flags(const char *uri, int uri_size, int flags);
 extern char *lws_http_contenttype(char *filename);
 
 #endif // _LWS_HTTP_H_
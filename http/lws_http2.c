@@ -0,0 +1,1115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "lws_log.h"
+#include "lws_util.h"
+#include "lws_http.h"
+#include "lws_http2.h"
+#include "lws_metrics.h"
+
+#define LWS_HTTP2_WBUF_FLUSH        (64 * 1024)
+
+/* DATA payloads from this size are sent from the stream buffer directly */
+#define LWS_HTTP2_DIRECT_SIZE       4096
+
+/* decoding context of one header block */
+typedef struct _lws_http2_block_t_ {
+    lws_http2_stream_t *stream;         /* NULL: refused or trailers, discard */
+    char method[16];
+    char authority[256];
+    char *path;
+    int path_length;
+    int regular;                        /* regular header seen */
+    int malformed;
+    char *cookie;                       /* cookie crumbs joined with "; " */
+    int cookie_length;
+    int cookie_capacity;
+} lws_http2_block_t;
+
+/* session of the stream being dispatched, for handlers writing c->send */
+static __thread lws_http2_conn_t *lws_http2_dispatching = NULL;
+
+static int lws_http2_append(char **buf, int *length, int *capacity, const void *data, int size)
+{
+    char *p;
+    int cap;
+
+    if (*length + size > *capacity) {
+        cap = *capacity ? *capacity : 1024;
+        while (cap < *length + size)
+            cap *= 2;
+        p = realloc(*buf, cap);
+        if (p == NULL)
+            return -1;
+        *buf = p;
+        *capacity = cap;
+    }
+
+    memcpy(*buf + *length, data, size);
+    *length += size;
+    return 0;
+}
+
+static uint32_t lws_http2_get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void lws_http2_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* write pending frames to the connection */
+static int lws_http2_write(lws_http2_conn_t *h2)
+{
+    int ret = 0;
+
+    if (h2->wbuf_length > 0) {
+        ret = h2->send(h2->http->sockfd, h2->wbuf, h2->wbuf_length);
+        h2->wbuf_length = 0;
+        if (ret < 0)
+            h2->http->close_flag = 1;
+    }
+
+    return ret < 0 ? -1 : 0;
+}
+
+static int lws_http2_frame(lws_http2_conn_t *h2, int type, int flags, uint32_t stream_id, const void *payload, int size)
+{
+    uint8_t head[9];
+
+    head[0] = size >> 16;
+    head[1] = size >> 8;
+    head[2] = size;
+    head[3] = type;
+    head[4] = flags;
+    lws_http2_put32(head + 5, stream_id & 0x7fffffff);
+
+    if (lws_http2_append(&h2->wbuf, &h2->wbuf_length, &h2->wbuf_capacity, head, sizeof(head)) < 0)
+        return -1;
+
+    /* large payloads skip the frame buffer */
+    if (size >= LWS_HTTP2_DIRECT_SIZE) {
+        if (lws_http2_write(h2) < 0 || h2->send(h2->http->sockfd, (char *)payload, size) < 0) {
+            h2->http->close_flag = 1;
+            return -1;
+        }
+        return 0;
+    }
+
+    if (size > 0 && lws_http2_append(&h2->wbuf, &h2->wbuf_length, &h2->wbuf_capacity, payload, size) < 0)
+        return -1;
+
+    if (h2->wbuf_length >= LWS_HTTP2_WBUF_FLUSH)
+        return lws_http2_write(h2);
+
+    return 0;
+}
+
+static void lws_http2_goaway(lws_http2_conn_t *h2, uint32_t error)
+{
+    uint8_t payload[8];
+
+    if (h2->goaway)
+        return;
+
+    lws_log(3, "sockfd[%d] http2 goaway, error: %u\n", h2->http->sockfd, error);
+    lws_http2_put32(payload, h2->last_stream);
+    lws_http2_put32(payload + 4, error);
+    lws_http2_frame(h2, LWS_HTTP2_GOAWAY, 0, 0, payload, sizeof(payload));
+    h2->goaway = 1;
+    h2->http->close_flag = 1;
+}
+
+static void lws_http2_rst(lws_http2_conn_t *h2, uint32_t stream_id, uint32_t error)
+{
+    uint8_t payload[4];
+
+    lws_http2_put32(payload, error);
+    lws_http2_frame(h2, LWS_HTTP2_RST_STREAM, 0, stream_id, payload, sizeof(payload));
+}
+
+static void lws_http2_window_update(lws_http2_conn_t *h2, uint32_t stream_id, uint32_t increment)
+{
+    uint8_t payload[4];
+
+    lws_http2_put32(payload, increment);
+    lws_http2_frame(h2, LWS_HTTP2_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload));
+}
+
+static void lws_http2_send_settings(lws_http2_conn_t *h2)
+{
+    uint8_t payload[6];
+
+    payload[0] = 0;
+    payload[1] = 0x3;                   /* SETTINGS_MAX_CONCURRENT_STREAMS */
+    lws_http2_put32(payload + 2, LWS_HTTP2_MAX_STREAMS);
+    lws_http2_frame(h2, LWS_HTTP2_SETTINGS, 0, 0, payload, sizeof(payload));
+}
+
+/**
+ * stream management
+**/
+static lws_http2_stream_t *lws_http2_stream_get(lws_http2_conn_t *h2, uint32_t stream_id)
+{
+    lws_http2_stream_t *s;
+
+    for (s = h2->streams; s; s = s->next) {
+        if (s->id == stream_id)
+            return s;
+    }
+
+    return NULL;
+}
+
+static lws_http2_stream_t *lws_http2_stream_new(lws_http2_conn_t *h2, uint32_t stream_id)
+{
+    lws_http2_stream_t *s;
+
+    s = calloc(1, sizeof(lws_http2_stream_t));
+    if (s == NULL)
+        return NULL;
+
+    s->id = stream_id;
+    s->state = LWS_HTTP2_STREAM_OPEN;
+    s->send_window = h2->initial_window;
+    s->recv_window = LWS_HTTP2_WINDOW;
+    s->weight = 16;
+    s->next = h2->streams;
+    h2->streams = s;
+    h2->stream_count++;
+    return s;
+}
+
+static void lws_http2_stream_free(lws_http2_conn_t *h2, lws_http2_stream_t *s)
+{
+    lws_http2_stream_t **pp;
+    lws_http2_stream_t *child;
+
+    for (pp = &h2->streams; *pp; pp = &(*pp)->next) {
+        if (*pp == s) {
+            *pp = s->next;
+            break;
+        }
+    }
+
+    /* RFC 7540 5.3.4, children move to the parent of the closed stream */
+    for (child = h2->streams; child; child = child->next) {
+        if (child->depend == s->id)
+            child->depend = s->depend;
+    }
+
+    h2->stream_count--;
+    free(s->req);
+    free(s->out);
+    free(s);
+}
+
+/**
+ * priority
+**/
+static int lws_http2_depends_on(lws_http2_conn_t *h2, lws_http2_stream_t *s, uint32_t ancestor)
+{
+    int depth = h2->stream_count;
+
+    while (s && s->depend && depth-- > 0) {
+        if (s->depend == ancestor)
+            return 1;
+        s = lws_http2_stream_get(h2, s->depend);
+    }
+
+    return 0;
+}
+
+static void lws_http2_set_priority(lws_http2_conn_t *h2, lws_http2_stream_t *s, uint32_t depend, int exclusive, int weight)
+{
+    lws_http2_stream_t *parent, *other;
+
+    /* dependency on a closed or idle stream falls back to the root */
+    parent = depend ? lws_http2_stream_get(h2, depend) : NULL;
+    if (parent == NULL)
+        depend = 0;
+
+    /* moving below own descendant, the descendant takes our place first */
+    if (parent && lws_http2_depends_on(h2, parent, s->id))
+        parent->depend = s->depend;
+
+    if (exclusive) {
+        for (other = h2->streams; other; other = other->next) {
+            if (other != s && other->depend == depend)
+                other->depend = s->id;
+        }
+    }
+
+    s->depend = depend;
+    s->weight = weight;
+}
+
+/* stream has a frame to send now */
+static int lws_http2_stream_ready(lws_http2_conn_t *h2, lws_http2_stream_t *s)
+{
+    if (s->state != LWS_HTTP2_STREAM_HALF_CLOSED || !s->headers_sent || s->closed)
+        return 0;
+
+    if (s->out_offset < s->out_length)
+        return s->send_window > 0 && h2->send_window > 0;
+
+    return s->end_stream;
+}
+
+/*
+ * Pick the stream to send next: a ready stream whose ancestors have nothing
+ * to send, lowest weighted virtual finish time first.
+ */
+static lws_http2_stream_t *lws_http2_schedule_next(lws_http2_conn_t *h2)
+{
+    lws_http2_stream_t *s, *a, *best = NULL;
+    int depth;
+
+    for (s = h2->streams; s; s = s->next) {
+        if (!lws_http2_stream_ready(h2, s))
+            continue;
+        if (best && s->vtime >= best->vtime)
+            continue;
+
+        depth = h2->stream_count;
+        for (a = lws_http2_stream_get(h2, s->depend); a && depth-- > 0; a = lws_http2_stream_get(h2, a->depend)) {
+            if (lws_http2_stream_ready(h2, a))
+                break;
+        }
+
+        if (a == NULL || depth < 0)
+            best = s;
+    }
+
+    return best;
+}
+
+static void lws_http2_schedule(lws_http2_conn_t *h2)
+{
+    lws_http2_stream_t *s;
+    int pending, size, flags;
+
+    while (!h2->http->close_flag && (s = lws_http2_schedule_next(h2)) != NULL) {
+        pending = s->out_length - s->out_offset;
+        size = pending;
+        if (size > h2->max_frame_size)
+            size = h2->max_frame_size;
+        if (size > s->send_window)
+            size = s->send_window;
+        if (size > h2->send_window)
+            size = h2->send_window;
+
+        flags = (s->end_stream && size == pending) ? LWS_HTTP2_FLAG_END_STREAM : 0;
+        if (lws_http2_frame(h2, LWS_HTTP2_DATA, flags, s->id, s->out + s->out_offset, size) < 0)
+            break;
+
+        s->out_offset += size;
+        s->send_window -= size;
+        h2->send_window -= size;
+
+        h2->vclock = s->vtime;
+        s->vtime += ((uint64_t)(size + 1) << 8) / s->weight;
+
+        if (flags & LWS_HTTP2_FLAG_END_STREAM) {
+            s->closed = 1;
+            lws_http2_stream_free(h2, s);
+        } else if (s->out_offset == s->out_length) {
+            s->out_offset = s->out_length = 0;
+        }
+    }
+}
+
+/**
+ * request dispatch
+**/
+static int lws_http2_data_send(int sockfd, char *data, int size)
+{
+    lws_http2_conn_t *h2 = lws_http2_dispatching;
+    lws_http2_stream_t *s;
+
+    if (h2 == NULL || (s = h2->current) == NULL || !s->headers_sent || s->closed)
+        return -1;
+
+    if (lws_http2_append(&s->out, &s->out_length, &s->out_capacity, data, size) < 0)
+        return -1;
+
+    return size;
+}
+
+static void lws_http2_dispatch(lws_http2_conn_t *h2, lws_http2_stream_t *s)
+{
+    lws_http_conn_t *c = h2->http;
+    int (*send)(int sockfd, char *data, int size);
+    struct http_message hm;
+    uint64_t parse_start;
+    int len;
+
+    s->state = LWS_HTTP2_STREAM_HALF_CLOSED;
+    h2->current = s;
+
+    parse_start = lws_metrics_now();
+    len = lws_parse_http(s->req, s->header_length, &hm, 1);
+    if (len <= 0) {
+        lws_log(2, "sockfd[%d] http2 stream %u, bad request\n", c->sockfd, s->id);
+        lws_http2_respond(c, HTTP_BAD_REQUEST, LWS_HTTP_HTML_TYPE, NULL, NULL, 0);
+    } else {
+        hm.body.p = s->req + s->header_length;
+        hm.body.len = s->req_length - s->header_length;
+        hm.message.len = s->req_length;
+
+        /* handlers writing c->send directly append to the stream */
+        send = c->send;
+        c->send = lws_http2_data_send;
+        lws_http2_dispatching = h2;
+        lws_http_conn_dispatch(c, &hm, lws_metrics_now() - parse_start);
+        lws_http2_dispatching = NULL;
+        c->send = send;
+
+        if (!s->headers_sent)
+            lws_http2_respond(c, HTTP_INTERNAL_SERVER_ERROR, LWS_HTTP_HTML_TYPE, NULL, NULL, 0);
+    }
+
+    h2->current = NULL;
+    free(s->req);
+    s->req = NULL;
+    s->req_length = s->req_capacity = 0;
+
+    if (s->closed) {
+        lws_http2_stream_free(h2, s);
+        return;
+    }
+
+    s->end_stream = 1;
+    if (s->vtime < h2->vclock)
+        s->vtime = h2->vclock;
+}
+
+int lws_http2_respond(lws_http_conn_t *c, int http_code, char *content_type,
+                      char *extra_headers, char *content, int content_length)
+{
+    lws_http2_conn_t *h2 = c->h2;
+    lws_http2_stream_t *s;
+    uint8_t block[LWS_HTTP2_FRAME_SIZE];
+    char name[64];
+    char value[32];
+    const char *line, *colon, *eol, *v;
+    int n = 0, ret, size, flags, offset, i;
+
+    if (h2 == NULL || (s = h2->current) == NULL || s->headers_sent)
+        return -1;
+
+    n += lws_hpack_encode_begin(&h2->encoder, block);
+
+    size = snprintf(value, sizeof(value), "%d", http_code);
+    ret = lws_hpack_encode(&h2->encoder, block + n, sizeof(block) - n, ":status", 7, value, size, 0);
+    if (ret < 0)
+        return -1;
+    n += ret;
+
+    ret = lws_hpack_encode(&h2->encoder, block + n, sizeof(block) - n, "server", 6,
+                           LWS_HTTP_HOST "/" LWS_HTTP_VERSION, strlen(LWS_HTTP_HOST "/" LWS_HTTP_VERSION), 0);
+    if (ret < 0)
+        return -1;
+    n += ret;
+
+    if (content_length >= 0) {
+        size = snprintf(value, sizeof(value), "%d", content_length);
+        ret = lws_hpack_encode(&h2->encoder, block + n, sizeof(block) - n, "content-length", 14,
+                               value, size, LWS_HPACK_NO_INDEX);
+        if (ret < 0)
+            return -1;
+        n += ret;
+    }
+
+    if (content_type) {
+        ret = lws_hpack_encode(&h2->encoder, block + n, sizeof(block) - n, "content-type", 12,
+                               content_type, strlen(content_type), 0);
+        if (ret < 0)
+            return -1;
+        n += ret;
+    }
+
+    /* "Name: value\r\n" lines, names lower cased, connection headers dropped */
+    for (line = extra_headers; line && *line; line = *eol ? eol + 1 : eol) {
+        eol = line + strcspn(line, "\r\n");
+        colon = memchr(line, ':', eol - line);
+        if (colon == NULL || colon == line || colon - line >= (int)sizeof(name))
+            continue;
+
+        for (i = 0; i < colon - line; i++)
+            name[i] = tolower((unsigned char)line[i]);
+        name[i] = '\0';
+        if (!strcmp(name, "connection") || !strcmp(name, "keep-alive") || !strcmp(name, "transfer-encoding") ||
+            !strcmp(name, "upgrade") || !strcmp(name, "proxy-connection"))
+            continue;
+
+        for (v = colon + 1; v < eol && *v == ' '; v++);
+        ret = lws_hpack_encode(&h2->encoder, block + n, sizeof(block) - n, name, i, v, eol - v, 0);
+        if (ret < 0)
+            return -1;
+        n += ret;
+    }
+
+    /* HEADERS, then CONTINUATION beyond the peer frame size */
+    for (offset = 0; offset == 0 || offset < n; offset += size) {
+        size = n - offset;
+        if (size > h2->max_frame_size)
+            size = h2->max_frame_size;
+
+        flags = (offset + size == n) ? LWS_HTTP2_FLAG_END_HEADERS : 0;
+        if (offset == 0 && content_length == 0)
+            flags |= LWS_HTTP2_FLAG_END_STREAM;
+        if (lws_http2_frame(h2, offset ? LWS_HTTP2_CONTINUATION : LWS_HTTP2_HEADERS, flags,
+                            s->id, block + offset, size) < 0)
+            return -1;
+    }
+
+    s->headers_sent = 1;
+    s->closed = (content_length == 0);
+    if (content && content_length > 0 &&
+        lws_http2_append(&s->out, &s->out_length, &s->out_capacity, content, content_length) < 0)
+        return -1;
+
+    lws_metrics_send(http_code, n + (content_length > 0 ? content_length : 0), 0);
+    return n + (content_length > 0 ? content_length : 0);
+}
+
+/**
+ * header block
+**/
+static int lws_http2_header(void *arg, const char *name, int name_len, const char *value, int value_len)
+{
+    lws_http2_block_t *b = arg;
+    lws_http2_stream_t *s = b->stream;
+    char line[512];
+    int len;
+
+    if (s == NULL)
+        return 0;
+
+    if (name_len > 0 && name[0] == ':') {
+        if (b->regular) {
+            b->malformed = 1;
+        } else if (name_len == 7 && !memcmp(name, ":method", 7) && value_len < (int)sizeof(b->method)) {
+            memcpy(b->method, value, value_len);
+            b->method[value_len] = '\0';
+        } else if (name_len == 5 && !memcmp(name, ":path", 5) && b->path == NULL) {
+            b->path = strndup(value, value_len);
+            b->path_length = value_len;
+        } else if (name_len == 10 && !memcmp(name, ":authority", 10) && value_len < (int)sizeof(b->authority)) {
+            memcpy(b->authority, value, value_len);
+            b->authority[value_len] = '\0';
+        }
+        return 0;
+    }
+
+    /* request line and host go first, pseudo headers precede regular ones */
+    if (!b->regular) {
+        b->regular = 1;
+        if (b->method[0] == '\0' || b->path == NULL) {
+            b->malformed = 1;
+            return 0;
+        }
+        len = snprintf(line, sizeof(line), "%s ", b->method);
+        if (lws_http2_append(&s->req, &s->req_length, &s->req_capacity, line, len) < 0 ||
+            lws_http2_append(&s->req, &s->req_length, &s->req_capacity, b->path, b->path_length) < 0)
+            return -1;
+        len = snprintf(line, sizeof(line), " HTTP/2.0\r\n");
+        if (b->authority[0])
+            len += snprintf(line + len, sizeof(line) - len, "Host: %s\r\n", b->authority);
+        if (lws_http2_append(&s->req, &s->req_length, &s->req_capacity, line, len) < 0)
+            return -1;
+    }
+
+    if (name_len == 0)
+        return 0;
+
+    if ((name_len == 10 && !memcmp(name, "connection", 10)) || (name_len == 10 && !memcmp(name, "keep-alive", 10)) ||
+        (name_len == 7 && !memcmp(name, "upgrade", 7)) || (name_len == 17 && !memcmp(name, "transfer-encoding", 17)) ||
+        (name_len == 4 && !memcmp(name, "host", 4) && b->authority[0]))
+        return 0;
+
+    if (name_len == 6 && !memcmp(name, "cookie", 6)) {
+        if (b->cookie_length && lws_http2_append(&b->cookie, &b->cookie_length, &b->cookie_capacity, "; ", 2) < 0)
+            return -1;
+        return lws_http2_append(&b->cookie, &b->cookie_length, &b->cookie_capacity, value, value_len);
+    }
+
+    if (lws_http2_append(&s->req, &s->req_length, &s->req_capacity, name, name_len) < 0 ||
+        lws_http2_append(&s->req, &s->req_length, &s->req_capacity, ": ", 2) < 0 ||
+        lws_http2_append(&s->req, &s->req_length, &s->req_capacity, value, value_len) < 0 ||
+        lws_http2_append(&s->req, &s->req_length, &s->req_capacity, "\r\n", 2) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int lws_http2_headers_done(lws_http2_conn_t *h2)
+{
+    lws_http2_stream_t *s = lws_http2_stream_get(h2, h2->block_stream);
+    lws_http2_block_t b;
+    int ret;
+
+    memset(&b, 0, sizeof(b));
+    /* trailers are decoded for the table state only */
+    b.stream = (s && s->header_length == 0) ? s : NULL;
+
+    ret = lws_hpack_decode(&h2->decoder, (uint8_t *)h2->block, h2->block_length, lws_http2_header, &b);
+    h2->block_length = 0;
+    h2->block_stream = 0;
+
+    if (ret == 0 && b.stream && !b.regular)
+        ret = lws_http2_header(&b, "", 0, "", 0) < 0 ? -1 : 0;
+
+    if (ret == 0 && b.stream && b.cookie_length) {
+        if (lws_http2_append(&s->req, &s->req_length, &s->req_capacity, "cookie: ", 8) < 0 ||
+            lws_http2_append(&s->req, &s->req_length, &s->req_capacity, b.cookie, b.cookie_length) < 0 ||
+            lws_http2_append(&s->req, &s->req_length, &s->req_capacity, "\r\n", 2) < 0)
+            ret = -1;
+    }
+
+    free(b.path);
+    free(b.cookie);
+
+    if (ret < 0) {
+        lws_http2_goaway(h2, LWS_HTTP2_COMPRESSION_ERROR);
+        return -1;
+    }
+
+    if (s == NULL)
+        return 0;
+
+    if (b.stream) {
+        if (b.malformed || lws_http2_append(&s->req, &s->req_length, &s->req_capacity, "\r\n", 2) < 0) {
+            lws_http2_rst(h2, s->id, LWS_HTTP2_PROTOCOL_ERROR);
+            lws_http2_stream_free(h2, s);
+            return 0;
+        }
+        s->header_length = s->req_length;
+    }
+
+    if (h2->block_end_stream)
+        lws_http2_dispatch(h2, s);
+
+    return 0;
+}
+
+/**
+ * frames
+**/
+static int lws_http2_on_data(lws_http2_conn_t *h2, int flags, uint32_t stream_id, const uint8_t *p, int size)
+{
+    lws_http2_stream_t *s;
+    int frame_size = size;
+    int pad = 0;
+
+    if (stream_id == 0) {
+        lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+        return -1;
+    }
+
+    if (flags & LWS_HTTP2_FLAG_PADDED) {
+        if (size < 1 || p[0] >= size) {
+            lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+            return -1;
+        }
+        pad = p[0];
+        p++;
+        size -= 1 + pad;
+    }
+
+    /* connection window is returned at once, the request is buffered */
+    if (frame_size > 0)
+        lws_http2_window_update(h2, 0, frame_size);
+
+    s = lws_http2_stream_get(h2, stream_id);
+    if (s == NULL || s->state != LWS_HTTP2_STREAM_OPEN) {
+        if (stream_id > h2->last_stream) {
+            lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+            return -1;
+        }
+        lws_http2_rst(h2, stream_id, LWS_HTTP2_STREAM_CLOSED);
+        return 0;
+    }
+
+    s->recv_window -= frame_size;
+    if (s->recv_window < 0) {
+        lws_http2_rst(h2, stream_id, LWS_HTTP2_FLOW_CONTROL_ERROR);
+        lws_http2_stream_free(h2, s);
+        return 0;
+    }
+
+    if (s->req_length + size > LWS_HTTP2_MAX_REQUEST) {
+        lws_log(2, "sockfd[%d] http2 stream %u, request too large\n", h2->http->sockfd, stream_id);
+        s->state = LWS_HTTP2_STREAM_HALF_CLOSED;
+        h2->current = s;
+        lws_http2_respond(h2->http, HTTP_REQ_ENTITY_TOO_LARGE, LWS_HTTP_HTML_TYPE, NULL, NULL, 0);
+        h2->current = NULL;
+        lws_http2_rst(h2, stream_id, LWS_HTTP2_NO_ERROR);
+        lws_http2_stream_free(h2, s);
+        return 0;
+    }
+
+    if (size > 0 && lws_http2_append(&s->req, &s->req_length, &s->req_capacity, p, size) < 0) {
+        lws_http2_goaway(h2, LWS_HTTP2_INTERNAL_ERROR);
+        return -1;
+    }
+
+    if (flags & LWS_HTTP2_FLAG_END_STREAM) {
+        lws_http2_dispatch(h2, s);
+    } else if (frame_size > 0) {
+        lws_http2_window_update(h2, stream_id, frame_size);
+        s->recv_window += frame_size;
+    }
+
+    return 0;
+}
+
+static int lws_http2_on_headers(lws_http2_conn_t *h2, int flags, uint32_t stream_id, const uint8_t *p, int size)
+{
+    lws_http2_stream_t *s;
+    uint32_t depend = 0;
+    int exclusive = 0, weight = 16;
+    int pad = 0;
+
+    if (stream_id == 0 || (stream_id & 1) == 0) {
+        lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+        return -1;
+    }
+
+    if (flags & LWS_HTTP2_FLAG_PADDED) {
+        if (size < 1) {
+            lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+            return -1;
+        }
+        pad = p[0];
+        p++;
+        size--;
+    }
+
+    if (flags & LWS_HTTP2_FLAG_PRIORITY) {
+        if (size < 5) {
+            lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+            return -1;
+        }
+        depend = lws_http2_get32(p) & 0x7fffffff;
+        exclusive = p[0] >> 7;
+        weight = p[4] + 1;
+        p += 5;
+        size -= 5;
+    }
+
+    if (pad > size) {
+        lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+        return -1;
+    }
+    size -= pad;
+
+    s = lws_http2_stream_get(h2, stream_id);
+    if (s) {
+        /* trailers end the request */
+        if (s->state != LWS_HTTP2_STREAM_OPEN || !(flags & LWS_HTTP2_FLAG_END_STREAM)) {
+            lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+            return -1;
+        }
+    } else if (stream_id <= h2->last_stream) {
+        lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+        return -1;
+    } else {
+        h2->last_stream = stream_id;
+        if (h2->stream_count >= LWS_HTTP2_MAX_STREAMS || h2->goaway) {
+            lws_http2_rst(h2, stream_id, LWS_HTTP2_REFUSED_STREAM);
+        } else if ((s = lws_http2_stream_new(h2, stream_id)) == NULL) {
+            lws_http2_goaway(h2, LWS_HTTP2_INTERNAL_ERROR);
+            return -1;
+        }
+    }
+
+    if (s && (flags & LWS_HTTP2_FLAG_PRIORITY)) {
+        if (depend == stream_id) {
+            lws_http2_rst(h2, stream_id, LWS_HTTP2_PROTOCOL_ERROR);
+            lws_http2_stream_free(h2, s);
+            s = NULL;
+        } else {
+            lws_http2_set_priority(h2, s, depend, exclusive, weight);
+        }
+    }
+
+    /* the block is decoded even for refused streams, it updates the table */
+    h2->block_stream = stream_id;
+    h2->block_end_stream = flags & LWS_HTTP2_FLAG_END_STREAM;
+    if (lws_http2_append(&h2->block, &h2->block_length, &h2->block_capacity, p, size) < 0) {
+        lws_http2_goaway(h2, LWS_HTTP2_INTERNAL_ERROR);
+        return -1;
+    }
+
+    if (flags & LWS_HTTP2_FLAG_END_HEADERS)
+        return lws_http2_headers_done(h2);
+
+    return 0;
+}
+
+static int lws_http2_on_settings(lws_http2_conn_t *h2, int flags, const uint8_t *p, int size, int ack)
+{
+    lws_http2_stream_t *s;
+    uint32_t value;
+    int32_t delta;
+    int id;
+
+    if (flags & LWS_HTTP2_FLAG_ACK) {
+        if (size != 0) {
+            lws_http2_goaway(h2, LWS_HTTP2_FRAME_SIZE_ERROR);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (size % 6) {
+        lws_http2_goaway(h2, LWS_HTTP2_FRAME_SIZE_ERROR);
+        return -1;
+    }
+
+    for (; size > 0; p += 6, size -= 6) {
+        id = (p[0] << 8) | p[1];
+        value = lws_http2_get32(p + 2);
+
+        switch (id) {
+            case 0x1:                   /* SETTINGS_HEADER_TABLE_SIZE */
+                lws_hpack_set_limit(&h2->encoder, value > LWS_HPACK_TABLE_SIZE ? LWS_HPACK_TABLE_SIZE : value);
+                break;
+            case 0x2:                   /* SETTINGS_ENABLE_PUSH */
+                if (value > 1) {
+                    lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+                    return -1;
+                }
+                break;
+            case 0x4:                   /* SETTINGS_INITIAL_WINDOW_SIZE */
+                if (value > 0x7fffffff) {
+                    lws_http2_goaway(h2, LWS_HTTP2_FLOW_CONTROL_ERROR);
+                    return -1;
+                }
+                delta = value - h2->initial_window;
+                for (s = h2->streams; s; s = s->next) {
+                    if ((int64_t)s->send_window + delta > 0x7fffffff) {
+                        lws_http2_goaway(h2, LWS_HTTP2_FLOW_CONTROL_ERROR);
+                        return -1;
+                    }
+                    s->send_window += delta;
+                }
+                h2->initial_window = value;
+                break;
+            case 0x5:                   /* SETTINGS_MAX_FRAME_SIZE */
+                if (value < LWS_HTTP2_FRAME_SIZE || value > 0xffffff) {
+                    lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+                    return -1;
+                }
+                h2->max_frame_size = value;
+                break;
+            default:                    /* max streams and header list size only limit us */
+                break;
+        }
+    }
+
+    h2->settings = 1;
+    if (ack)
+        lws_http2_frame(h2, LWS_HTTP2_SETTINGS, LWS_HTTP2_FLAG_ACK, 0, NULL, 0);
+
+    return 0;
+}
+
+static int lws_http2_on_window_update(lws_http2_conn_t *h2, uint32_t stream_id, const uint8_t *p, int size)
+{
+    lws_http2_stream_t *s;
+    uint32_t increment;
+
+    if (size != 4) {
+        lws_http2_goaway(h2, LWS_HTTP2_FRAME_SIZE_ERROR);
+        return -1;
+    }
+
+    increment = lws_http2_get32(p) & 0x7fffffff;
+    if (stream_id == 0) {
+        if (increment == 0 || (int64_t)h2->send_window + increment > 0x7fffffff) {
+            lws_http2_goaway(h2, increment ? LWS_HTTP2_FLOW_CONTROL_ERROR : LWS_HTTP2_PROTOCOL_ERROR);
+            return -1;
+        }
+        h2->send_window += increment;
+        return 0;
+    }
+
+    s = lws_http2_stream_get(h2, stream_id);
+    if (s == NULL)
+        return 0;
+
+    if (increment == 0 || (int64_t)s->send_window + increment > 0x7fffffff) {
+        lws_http2_rst(h2, stream_id, increment ? LWS_HTTP2_FLOW_CONTROL_ERROR : LWS_HTTP2_PROTOCOL_ERROR);
+        lws_http2_stream_free(h2, s);
+        return 0;
+    }
+
+    s->send_window += increment;
+    return 0;
+}
+
+static int lws_http2_on_frame(lws_http2_conn_t *h2, int type, int flags, uint32_t stream_id, const uint8_t *p, int size)
+{
+    lws_http2_stream_t *s;
+
+    if (!h2->settings && type != LWS_HTTP2_SETTINGS) {
+        lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+        return -1;
+    }
+
+    /* nothing may interleave a header block */
+    if (h2->block_stream && (type != LWS_HTTP2_CONTINUATION || stream_id != h2->block_stream)) {
+        lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+        return -1;
+    }
+
+    switch (type) {
+        case LWS_HTTP2_DATA:
+            return lws_http2_on_data(h2, flags, stream_id, p, size);
+
+        case LWS_HTTP2_HEADERS:
+            return lws_http2_on_headers(h2, flags, stream_id, p, size);
+
+        case LWS_HTTP2_CONTINUATION:
+            if (h2->block_stream == 0 || h2->block_length + size > LWS_HTTP2_MAX_REQUEST) {
+                lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+                return -1;
+            }
+            if (lws_http2_append(&h2->block, &h2->block_length, &h2->block_capacity, p, size) < 0) {
+                lws_http2_goaway(h2, LWS_HTTP2_INTERNAL_ERROR);
+                return -1;
+            }
+            if (flags & LWS_HTTP2_FLAG_END_HEADERS)
+                return lws_http2_headers_done(h2);
+            return 0;
+
+        case LWS_HTTP2_PRIORITY:
+            if (stream_id == 0) {
+                lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+                return -1;
+            } else if (size != 5) {
+                lws_http2_rst(h2, stream_id, LWS_HTTP2_FRAME_SIZE_ERROR);
+                return 0;
+            }
+            s = lws_http2_stream_get(h2, stream_id);
+            if (s && (lws_http2_get32(p) & 0x7fffffff) != stream_id)
+                lws_http2_set_priority(h2, s, lws_http2_get32(p) & 0x7fffffff, p[0] >> 7, p[4] + 1);
+            return 0;
+
+        case LWS_HTTP2_RST_STREAM:
+            if (size != 4) {
+                lws_http2_goaway(h2, LWS_HTTP2_FRAME_SIZE_ERROR);
+                return -1;
+            } else if (stream_id == 0 || stream_id > h2->last_stream) {
+                lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+                return -1;
+            }
+            s = lws_http2_stream_get(h2, stream_id);
+            if (s)
+                lws_http2_stream_free(h2, s);
+            return 0;
+
+        case LWS_HTTP2_SETTINGS:
+            if (stream_id != 0) {
+                lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+                return -1;
+            }
+            return lws_http2_on_settings(h2, flags, p, size, 1);
+
+        case LWS_HTTP2_PING:
+            if (size != 8) {
+                lws_http2_goaway(h2, LWS_HTTP2_FRAME_SIZE_ERROR);
+                return -1;
+            } else if (stream_id != 0) {
+                lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+                return -1;
+            }
+            if (!(flags & LWS_HTTP2_FLAG_ACK))
+                lws_http2_frame(h2, LWS_HTTP2_PING, LWS_HTTP2_FLAG_ACK, 0, p, size);
+            return 0;
+
+        case LWS_HTTP2_GOAWAY:
+            lws_log(4, "sockfd[%d] http2 goaway from peer\n", h2->http->sockfd);
+            h2->goaway = 1;
+            h2->http->close_flag = 1;
+            return -1;
+
+        case LWS_HTTP2_WINDOW_UPDATE:
+            return lws_http2_on_window_update(h2, stream_id, p, size);
+
+        case LWS_HTTP2_PUSH_PROMISE:
+            lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+            return -1;
+
+        default:                        /* unknown frame types are ignored */
+            return 0;
+    }
+}
+
+/**
+ * connection
+**/
+int lws_http2_is_preface(const char *data, int size)
+{
+    int n = size < LWS_HTTP2_PREFACE_LEN ? size : LWS_HTTP2_PREFACE_LEN;
+
+    if (memcmp(data, LWS_HTTP2_PREFACE, n))
+        return -1;
+
+    return size >= LWS_HTTP2_PREFACE_LEN ? 1 : 0;
+}
+
+static lws_http2_conn_t *lws_http2_new(lws_http_conn_t *c)
+{
+    lws_http2_conn_t *h2;
+
+    h2 = calloc(1, sizeof(lws_http2_conn_t));
+    if (h2 == NULL)
+        return NULL;
+
+    h2->http = c;
+    h2->send = c->send;
+    h2->initial_window = LWS_HTTP2_WINDOW;
+    h2->send_window = LWS_HTTP2_WINDOW;
+    h2->max_frame_size = LWS_HTTP2_FRAME_SIZE;
+    lws_hpack_init(&h2->decoder);
+    lws_hpack_init(&h2->encoder);
+
+    c->h2 = h2;
+    lws_http2_send_settings(h2);
+    return h2;
+}
+
+int lws_http2_start(lws_http_conn_t *c)
+{
+    if (c->send == NULL || lws_http2_new(c) == NULL)
+        return -1;
+
+    lws_log(4, "sockfd[%d] http2 prior knowledge\n", c->sockfd);
+    return 0;
+}
+
+int lws_http2_upgrade(lws_http_conn_t *c, struct http_message *hm, struct lws_str *settings)
+{
+    static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\n"
+                                    "Connection: Upgrade\r\n"
+                                    "Upgrade: h2c\r\n\r\n";
+    lws_http2_conn_t *h2;
+    lws_http2_stream_t *s;
+    uint8_t payload[256];
+    int size;
+
+    /* a request body would have to be read before switching, keep http/1.1 */
+    if (c->send == NULL || hm->body.len > 0 || settings->len > sizeof(payload))
+        return -1;
+
+    size = lws_base64_decode(settings->p, settings->len, payload);
+    if (size < 0 || size % 6)
+        return -1;
+
+    if (c->send(c->sockfd, (char *)switching, sizeof(switching) - 1) < 0)
+        return -1;
+
+    h2 = lws_http2_new(c);
+    if (h2 == NULL)
+        return -1;
+
+    /* 101 acknowledges the HTTP2-Settings */
+    lws_http2_on_settings(h2, 0, payload, size, 0);
+    h2->settings = 0;
+
+    s = lws_http2_stream_new(h2, 1);
+    if (s == NULL || lws_http2_append(&s->req, &s->req_length, &s->req_capacity, hm->message.p, hm->message.len) < 0) {
+        lws_http2_goaway(h2, LWS_HTTP2_INTERNAL_ERROR);
+        lws_http2_write(h2);
+        return 0;
+    }
+
+    lws_log(4, "sockfd[%d] http2 upgrade\n", c->sockfd);
+    h2->last_stream = 1;
+    s->header_length = s->req_length;
+    lws_http2_dispatch(h2, s);
+    lws_http2_schedule(h2);
+    lws_http2_write(h2);
+    return 0;
+}
+
+int lws_http2_recv(lws_http_conn_t *c, const char *data, int size)
+{
+    lws_http2_conn_t *h2 = c->h2;
+    const uint8_t *p;
+    uint32_t length, stream_id;
+    int offset = 0;
+
+    if (h2 == NULL)
+        return -1;
+
+    if (lws_http2_append(&h2->in, &h2->in_length, &h2->in_capacity, data, size) < 0) {
+        lws_http2_goaway(h2, LWS_HTTP2_INTERNAL_ERROR);
+        lws_http2_write(h2);
+        return size;
+    }
+
+    if (!h2->preface) {
+        if (lws_http2_is_preface(h2->in, h2->in_length) < 0) {
+            lws_http2_goaway(h2, LWS_HTTP2_PROTOCOL_ERROR);
+        } else if (h2->in_length >= LWS_HTTP2_PREFACE_LEN) {
+            h2->preface = 1;
+            offset = LWS_HTTP2_PREFACE_LEN;
+        }
+    }
+
+    while (h2->preface && !c->close_flag && h2->in_length - offset >= 9) {
+        p = (uint8_t *)h2->in + offset;
+        length = (p[0] << 16) | (p[1] << 8) | p[2];
+        if (length > LWS_HTTP2_FRAME_SIZE) {
+            lws_http2_goaway(h2, LWS_HTTP2_FRAME_SIZE_ERROR);
+            break;
+        } else if (h2->in_length - offset < (int)(9 + length)) {
+            break;
+        }
+
+        stream_id = lws_http2_get32(p + 5) & 0x7fffffff;
+        if (lws_http2_on_frame(h2, p[3], p[4], stream_id, p + 9, length) < 0)
+            break;
+        offset += 9 + length;
+    }
+
+    h2->in_length -= offset;
+    memmove(h2->in, h2->in + offset, h2->in_length);
+
+    lws_http2_schedule(h2);
+    lws_http2_write(h2);
+    return size;
+}
+
+void lws_http2_free(lws_http_conn_t *c)
+{
+    lws_http2_conn_t *h2 = c->h2;
+
+    if (h2 == NULL)
+        return;
+
+    while (h2->streams)
+        lws_http2_stream_free(h2, h2->streams);
+
+    lws_hpack_free(&h2->decoder);
+    lws_hpack_free(&h2->encoder);
+    free(h2->in);
+    free(h2->wbuf);
+    free(h2->block);
+    free(h2);
+    c->h2 = NULL;
+}
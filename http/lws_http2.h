@@ -0,0 +1,181 @@
+#ifndef _LWS_HTTP2_H_
+#define _LWS_HTTP2_H_
+
+#include <stdint.h>
+
+#include "lws_http.h"
+#include "lws_hpack.h"
+
+#define LWS_HTTP2_PREFACE           "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define LWS_HTTP2_PREFACE_LEN       24
+
+/* local settings */
+#define LWS_HTTP2_MAX_STREAMS       100
+#define LWS_HTTP2_WINDOW            65535
+#define LWS_HTTP2_FRAME_SIZE        16384
+#define LWS_HTTP2_MAX_REQUEST       (64 * 1024)     /* request headers and body */
+
+/* frame types */
+#define LWS_HTTP2_DATA              0x0
+#define LWS_HTTP2_HEADERS           0x1
+#define LWS_HTTP2_PRIORITY          0x2
+#define LWS_HTTP2_RST_STREAM        0x3
+#define LWS_HTTP2_SETTINGS          0x4
+#define LWS_HTTP2_PUSH_PROMISE      0x5
+#define LWS_HTTP2_PING              0x6
+#define LWS_HTTP2_GOAWAY            0x7
+#define LWS_HTTP2_WINDOW_UPDATE     0x8
+#define LWS_HTTP2_CONTINUATION      0x9
+
+/* frame flags */
+#define LWS_HTTP2_FLAG_END_STREAM   0x01
+#define LWS_HTTP2_FLAG_ACK          0x01
+#define LWS_HTTP2_FLAG_END_HEADERS  0x04
+#define LWS_HTTP2_FLAG_PADDED       0x08
+#define LWS_HTTP2_FLAG_PRIORITY     0x20
+
+/* error codes */
+#define LWS_HTTP2_NO_ERROR          0x0
+#define LWS_HTTP2_PROTOCOL_ERROR    0x1
+#define LWS_HTTP2_INTERNAL_ERROR    0x2
+#define LWS_HTTP2_FLOW_CONTROL_ERROR    0x3
+#define LWS_HTTP2_STREAM_CLOSED     0x5
+#define LWS_HTTP2_FRAME_SIZE_ERROR  0x6
+#define LWS_HTTP2_REFUSED_STREAM    0x7
+#define LWS_HTTP2_CANCEL            0x8
+#define LWS_HTTP2_COMPRESSION_ERROR 0x9
+
+/* stream states */
+#define LWS_HTTP2_STREAM_OPEN       1   /* receiving request */
+#define LWS_HTTP2_STREAM_HALF_CLOSED 2  /* request complete, sending response */
+
+typedef struct _lws_http2_stream_t_ {
+    struct _lws_http2_stream_t_ *next;
+    uint32_t id;
+    int state;
+    int32_t send_window;
+    int32_t recv_window;
+
+    /* request rebuilt as http/1.1 text for lws_parse_http, body follows */
+    char *req;
+    int req_length;
+    int req_capacity;
+    int header_length;
+
+    /* response body waiting for flow control */
+    char *out;
+    int out_length;
+    int out_offset;
+    int out_capacity;
+    int headers_sent;
+    int end_stream;                     /* handler is done, END_STREAM after out */
+    int closed;                         /* END_STREAM sent */
+
+    /* RFC 7540 5.3 priority */
+    uint32_t depend;
+    int weight;                         /* 1-256 */
+    uint64_t vtime;                     /* weighted fair queueing finish time */
+} lws_http2_stream_t;
+
+/**
+ * http/2 session of one connection
+**/
+typedef struct _lws_http2_conn_t_ {
+    lws_http_conn_t *http;
+    int (*send)(int sockfd, char *data, int size);  /* raw connection send */
+    int preface;                        /* client preface received */
+    int settings;                       /* client SETTINGS received */
+    int goaway;
+
+    char *in;                           /* partial frame */
+    int in_length;
+    int in_capacity;
+
+    char *wbuf;                         /* frames of one recv pass */
+    int wbuf_length;
+    int wbuf_capacity;
+
+    lws_hpack_t decoder;
+    lws_hpack_t encoder;
+
+    /* header block of HEADERS + CONTINUATION */
+    char *block;
+    int block_length;
+    int block_capacity;
+    uint32_t block_stream;
+    int block_end_stream;
+
+    /* peer settings */
+    int32_t initial_window;
+    int max_frame_size;
+    int32_t send_window;
+
+    uint32_t last_stream;
+    int stream_count;
+    lws_http2_stream_t *streams;
+    lws_http2_stream_t *current;        /* stream being dispatched */
+    uint64_t vclock;
+} lws_http2_conn_t;
+
+/**
+ * @func    lws_http2_is_preface
+ * @brief   check buffered data against the client connection preface
+ *
+ * @param   data[in] buffered data
+ * @param   size[in] buffered data size
+ * @return  1 if preface complete, 0 if a partial preface, -1 if not http/2.
+ */
+extern int lws_http2_is_preface(const char *data, int size);
+
+/**
+ * @func    lws_http2_start
+ * @brief   switch connection to http/2 with prior knowledge
+ *
+ * @param   c[in] http connection
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_http2_start(lws_http_conn_t *c);
+
+/**
+ * @func    lws_http2_upgrade
+ * @brief   answer "Upgrade: h2c" with 101 and serve the request as stream 1
+ *
+ * @param   c[in] http connection
+ * @param   hm[in] upgrade request
+ * @param   settings[in] HTTP2-Settings header value
+ * @return  On success, return 0, if upgrade is refused, return -1 and the
+ *          request is served over http/1.1.
+ */
+extern int lws_http2_upgrade(lws_http_conn_t *c, struct http_message *hm, struct lws_str *settings);
+
+/**
+ * @func    lws_http2_recv
+ * @brief   process received frames
+ *
+ * @param   c[in] http connection in http/2 mode
+ * @param   data[in] received data
+ * @param   size[in] received data size
+ * @return  consumed bytes, on connection error GOAWAY is sent and
+ *          close_flag is set.
+ */
+extern int lws_http2_recv(lws_http_conn_t *c, const char *data, int size);
+
+/**
+ * @func    lws_http2_respond
+ * @brief   lws_http_respond_base of a stream, sends HEADERS and queues body
+ *
+ * @return  On success, return queued bytes, On error, return -1.
+ */
+extern int lws_http2_respond(lws_http_conn_t *c, int http_code, char *content_type,
+                             char *extra_headers, char *content, int content_length);
+
+/**
+ * @func    lws_http2_free
+ * @brief   release http/2 session of connection
+ *
+ * @param   c[in] http connection
+ * @return  void
+ */
+extern void lws_http2_free(lws_http_conn_t *c);
+
+#endif // _LWS_HTTP2_H_
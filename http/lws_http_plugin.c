@@ -3,35 +3,50 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <limits.h>
 
 #include "lws_log.h"
 #include "lws_http.h"
 #include "lws_http_plugin.h"
 #include "lws_util.h"
+#include "lws_ws.h"
+#include "lws_sse.h"
+#include "lws_bundle.h"
+#include "lws_query.h"
+
+/* ./load and the version rarely change, shared caches may keep their responses */
+#define LWS_PLUGIN_CACHE_CONTROL    "Cache-Control: max-age=60"
+
+#define LWS_UPLOAD_NAME_MAX         128         /* longer uploaded file names are refused */
+
+/* index page, sent from static memory */
+static const char lws_default_page[] =
+    "<html><body><h>Enjoy your webserver!</h><br/><br/>"
+    "<ul style=\"list-style-type:circle\">"
+    "<li><a href=\"/hello\"> echo hello message </a></li>"
+    "<li><a href=\"/version\"> echo lws version </a></li>"
+    "<li><a href=\"/download\"> downlad file </a></li>"
+    "</ul>"
+    "</body></html>";
 
 int lws_default_handler(lws_http_conn_t *c, int ev, void *p)
 {
     struct http_message *hm = p;
-    char data[1024] = {0};
+    lws_chain_t body;
 
     if (hm && ev == LWS_EV_HTTP_REQUEST) {
         if (c->send == NULL) {
             return HTTP_INTERNAL_SERVER_ERROR;
         }
 
-        sprintf(data, "%s",
-                  "<html><body><h>Enjoy your webserver!</h><br/><br/>"
-                  "<ul style=\"list-style-type:circle\">"
-                  "<li><a href=\"/hello\"> echo hello message </a></li>"
-                  "<li><a href=\"/version\"> echo lws version </a></li>"
-                  "<li><a href=\"/download\"> downlad file </a></li>"
-                  "</ul>"
-                  "</body></html>");
-
-        lws_http_respond(c, 200, c->close_flag, LWS_HTTP_HTML_TYPE, data, strlen(data));
+        lws_chain_init(&body);
+        lws_chain_add_static(&body, lws_default_page, sizeof(lws_default_page) - 1);
+        lws_http_respond_chain(c, 200, c->close_flag, LWS_HTTP_HTML_TYPE, NULL, &body);
+        lws_chain_free(&body);
     } else {
         return HTTP_BAD_REQUEST;
     }
@@ -74,7 +89,7 @@ int lws_version_handler(lws_http_conn_t *c, int ev, void *p)
         sprintf(data, "<html><body><h>LWS - version[%s]</h><br/><br/>"
                   "</body></html>", LWS_HTTP_VERSION);
 
-        lws_http_respond(c, 200, c->close_flag, LWS_HTTP_HTML_TYPE, data, strlen(data));
+        lws_http_respond_base(c, 200, LWS_HTTP_HTML_TYPE, LWS_PLUGIN_CACHE_CONTROL, c->close_flag, data, strlen(data));
     } else {
         return HTTP_BAD_REQUEST;
     }
@@ -82,96 +97,136 @@ int lws_version_handler(lws_http_conn_t *c, int ev, void *p)
     return HTTP_OK;
 }
 
-int lws_show_handler(lws_http_conn_t *c, int ev, void *p)
+/*
+ * Respond with ./load/<basename of the uri> as a file segment of a body
+ * chain, the backend sends it from the page cache without a user copy.
+ */
+static int lws_load_respond(lws_http_conn_t *c, struct http_message *hm, char *content_type)
 {
-    struct http_message *hm = p;
-    char *data = NULL;
     char *filename = NULL;
-    long filesize = 0;
-    int rlen = 0;
     char uri[128] = {0};
     char path[128] = {0};
+    struct stat s_buf;
+    lws_chain_t body;
+    int fd;
 
-    if (hm && ev == LWS_EV_HTTP_REQUEST) {
-        strncpy(uri, hm->uri.p, hm->uri.len);
-        filename = lws_basename(uri);
-        if (filename == NULL)
-            return HTTP_INTERNAL_SERVER_ERROR;
+    strncpy(uri, hm->uri.p, hm->uri.len < sizeof(uri) - 1 ? hm->uri.len : sizeof(uri) - 1);
+    filename = lws_basename(uri);
+    if (filename == NULL)
+        return HTTP_INTERNAL_SERVER_ERROR;
+
+    sprintf(path, "./load/%s", filename);
+    lws_log(4, "path: %s\n", path);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &s_buf) || !S_ISREG(s_buf.st_mode) || s_buf.st_size <= 0 || s_buf.st_size > INT_MAX) {
+        if (fd >= 0)
+            close(fd);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
 
-        sprintf(path, "./load/%s", filename);
-        lws_log(4, "path: %s\n", path);
-        filesize = lws_ftell_file(path);
-        if (filesize <= 0)
-            return HTTP_INTERNAL_SERVER_ERROR;
+    lws_log(4, "filesize: %ld\n", (long)s_buf.st_size);
+    lws_chain_init(&body);
+    if (lws_chain_add_file(&body, fd, 0, (int)s_buf.st_size))
+        return HTTP_INTERNAL_SERVER_ERROR;
 
-        lws_log(4, "filesize: %d\n", filesize);
-        data = malloc(filesize);
-        rlen = lws_read_file(path, data, filesize);
-        if (rlen != filesize) {
-            lws_log(2, "rlen: %d\n", rlen);
-            free(data);
-            return HTTP_INTERNAL_SERVER_ERROR;
-        }
+    lws_http_respond_chain(c, 200, c->close_flag, content_type, LWS_PLUGIN_CACHE_CONTROL, &body);
+    lws_chain_free(&body);
+    return HTTP_OK;
+}
 
-        lws_http_respond(c, 200, c->close_flag, LWS_HTTP_JPEG_TYPE, data, rlen);
-        free(data);
-    } else {
+int lws_show_handler(lws_http_conn_t *c, int ev, void *p)
+{
+    struct http_message *hm = p;
+
+    if (hm == NULL || ev != LWS_EV_HTTP_REQUEST)
         return HTTP_BAD_REQUEST;
-    }
 
-    return HTTP_OK;
+    return lws_load_respond(c, hm, LWS_HTTP_JPEG_TYPE);
 }
 
 int lws_binary_handler(lws_http_conn_t *c, int ev, void *p)
 {
     struct http_message *hm = p;
-    char *data = NULL;
-    char *filename = NULL;
-    long filesize = 0;
-    int rlen = 0;
-    char uri[128] = {0};
-    char path[128] = {0};
 
-    if (hm && ev == LWS_EV_HTTP_REQUEST) {
-        strncpy(uri, hm->uri.p, hm->uri.len);
-        filename = lws_basename(uri);
-        if (filename == NULL)
-            return HTTP_INTERNAL_SERVER_ERROR;
+    if (hm == NULL || ev != LWS_EV_HTTP_REQUEST)
+        return HTTP_BAD_REQUEST;
 
-        sprintf(path, "./load/%s", filename);
-        lws_log(4, "path: %s\n", path);
-        filesize = lws_ftell_file(path);
-        if (filesize <= 0)
-            return HTTP_INTERNAL_SERVER_ERROR;
+    return lws_load_respond(c, hm, LWS_HTTP_OCTET_STREAM);
+}
 
-        lws_log(4, "filesize: %d\n", filesize);
-        data = malloc(filesize);
-        rlen = lws_read_file(path, data, filesize);
-        if (rlen != filesize) {
-            lws_log(2, "rlen: %d\n", rlen);
-            free(data);
-            return HTTP_INTERNAL_SERVER_ERROR;
-        }
+/* directory listing page, grown as entries are added */
+typedef struct _lws_listing_t_ {
+    char *data;
+    int len;
+    int size;
+    int failed;                         /* out of memory, the page is not sent */
+} lws_listing_t;
 
-        lws_http_respond(c, 200, c->close_flag, LWS_HTTP_OCTET_STREAM, data, rlen);
-        free(data);
-    } else {
-        return HTTP_BAD_REQUEST;
+/* append text, HTML-escaped if escape is set; file names come from clients */
+static void lws_listing_put(lws_listing_t *l, const char *text, int escape)
+{
+    int n = strlen(text);
+    const char *esc;
+    char *data;
+    int size;
+
+    if (l->failed)
+        return;
+
+    /* "&quot;" is the longest escape */
+    if (l->len + n * 6 + 1 > l->size) {
+        for (size = l->size * 2; size < l->len + n * 6 + 1; size *= 2)
+            ;
+        data = realloc(l->data, size);
+        if (data == NULL) {
+            l->failed = 1;
+            return;
+        }
+        l->data = data;
+        l->size = size;
     }
 
-    return HTTP_OK;
+    for (; *text; text++) {
+        esc = NULL;
+        if (escape) {
+            switch (*text) {
+            case '<':
+                esc = "&lt;";
+                break;
+            case '>':
+                esc = "&gt;";
+                break;
+            case '&':
+                esc = "&amp;";
+                break;
+            case '"':
+                esc = "&quot;";
+                break;
+            case '\'':
+                esc = "&#39;";
+                break;
+            }
+        }
+        if (esc) {
+            memcpy(l->data + l->len, esc, strlen(esc));
+            l->len += strlen(esc);
+        } else {
+            l->data[l->len++] = *text;
+        }
+    }
 }
 
 int lws_download_handler(lws_http_conn_t *c, int ev, void *p)
 {
     struct http_message *hm = p;
+    const lws_bundle_entry_t *entry;
+    struct lws_str name;
     char uri[1024] = {0};
     char path[1024] = {0};
     char *filename;
     struct stat s_buf;
-    char *data = NULL;
-    long filesize = 0;
-    int rlen = 0;
+    lws_listing_t page;
+    int fd;
     DIR *dp = NULL;
     struct dirent *dir;
 
@@ -184,7 +239,19 @@ int lws_download_handler(lws_http_conn_t *c, int ev, void *p)
     }
 
     lws_log(4, "%.*s\n", hm->uri.len, hm->uri.p);
-    strncpy(uri, hm->uri.p, hm->uri.len);
+
+    /* encoded names are decoded, a path climbing out of ./load is refused */
+    if (lws_http_path(hm, &name) || name.len < strlen("/download")) {
+        lws_log(2, "Error, bad path: %.*s\n", hm->uri.len, hm->uri.p);
+        return HTTP_BAD_REQUEST;
+    }
+
+    /* files packed into the binary are sent from memory, the rest from ./load */
+    entry = lws_bundle_find(name.p + strlen("/download"), name.len - strlen("/download"));
+    if (entry)
+        return lws_bundle_respond(c, hm, entry, LWS_PLUGIN_CACHE_CONTROL);
+
+    strncpy(uri, name.p, name.len);
     filename = uri + strlen("/download");
     if (filename == NULL)
         sprintf(path, "./load");
@@ -201,44 +268,266 @@ int lws_download_handler(lws_http_conn_t *c, int ev, void *p)
     if (S_ISDIR(s_buf.st_mode)) {
         lws_log(4, "show dir: %s\n", path);
 
-        data = malloc(4 * 1024);
-        rlen += sprintf(data + rlen, "<html><head><title>%s</title></head><body>", path);
-        rlen += sprintf(data + rlen, "<h1>Index of %s</h1>", path);
+        /* names of uploaded files are neither short nor trusted */
+        page.size = 4 * 1024;
+        page.data = malloc(page.size);
+        page.len = 0;
+        page.failed = 0;
         dp = opendir(path);
+        if (page.data == NULL || dp == NULL) {
+            free(page.data);
+            if (dp)
+                closedir(dp);
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        lws_listing_put(&page, "<html><head><title>", 0);
+        lws_listing_put(&page, path, 1);
+        lws_listing_put(&page, "</title></head><body><h1>Index of ", 0);
+        lws_listing_put(&page, path, 1);
+        lws_listing_put(&page, "</h1>", 0);
         while ((dir = readdir(dp)) != NULL) {
             if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0)
                 continue;
 
-            if (dir->d_type == DT_DIR) {
-                rlen += sprintf(data + rlen, "<a href=\"%s/%s\">./%s</a></br>", uri, dir->d_name, dir->d_name);
-            } else {
-                rlen += sprintf(data + rlen, "<a href=\"%s/%s\">%s</a></br>", uri, dir->d_name, dir->d_name);
-            }
+            lws_listing_put(&page, "<a href=\"", 0);
+            lws_listing_put(&page, uri, 1);
+            lws_listing_put(&page, "/", 0);
+            lws_listing_put(&page, dir->d_name, 1);
+            lws_listing_put(&page, dir->d_type == DT_DIR ? "\">./" : "\">", 0);
+            lws_listing_put(&page, dir->d_name, 1);
+            lws_listing_put(&page, "</a></br>", 0);
         }
         closedir(dp);
-        rlen += sprintf(data + rlen, "</body></html>");
-        lws_log(4, "response: %.*s\n", rlen, data);
-        lws_http_respond(c, 200, c->close_flag, LWS_HTTP_HTML_TYPE, data, rlen);
-        free(data);
+        lws_listing_put(&page, "</body></html>", 0);
+        if (page.failed) {
+            free(page.data);
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        lws_log(4, "response: %.*s\n", page.len, page.data);
+        lws_http_respond_base(c, 200, LWS_HTTP_HTML_TYPE, LWS_PLUGIN_CACHE_CONTROL, c->close_flag, page.data, page.len);
+        free(page.data);
     } else if (S_ISREG(s_buf.st_mode)) {
         lws_log(4, "show file: %s\n", path);
-        filesize = lws_ftell_file(path);
-        if (filesize <= 0)
-            return HTTP_INTERNAL_SERVER_ERROR;
-
-        lws_log(4, "filesize: %d\n", filesize);
-        data = malloc(filesize);
-        rlen = lws_read_file(path, data, filesize);
-        if (rlen != filesize) {
-            lws_log(2, "rlen: %d\n", rlen);
-            free(data);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || fstat(fd, &s_buf) || s_buf.st_size <= 0 || s_buf.st_size > INT_MAX) {
+            if (fd >= 0)
+                close(fd);
             return HTTP_INTERNAL_SERVER_ERROR;
         }
 
-        lws_http_respond(c, 200, c->close_flag, lws_http_contenttype(path), data, rlen);
-        free(data);
+        /* the body goes out with sendfile, never through user space */
+        lws_log(4, "filesize: %ld\n", (long)s_buf.st_size);
+        lws_http_respond_file(c, 200, c->close_flag, lws_http_contenttype(path), fd, (int)s_buf.st_size);
+    }
+
+    return HTTP_OK;
+}
+
+/* websocket echo, every message is sent back with its opcode */
+int lws_echo_handler(lws_http_conn_t *c, int ev, void *p)
+{
+    struct websocket_message *wm = p;
+
+    switch (ev) {
+    case LWS_EV_WEBSOCKET_HANDSHAKE_REQUEST:
+    case LWS_EV_WEBSOCKET_HANDSHAKE_DONE:
+    case LWS_EV_WEBSOCKET_CONTROL_FRAME:
+    case LWS_EV_CLOSE:
+        break;
+    case LWS_EV_WEBSOCKET_FRAME:
+        lws_ws_send(c, wm->flags, (char *)wm->data, wm->size);
+        break;
+    default:
+        return HTTP_BAD_REQUEST;
     }
 
     return HTTP_OK;
 }
 
+/* publish the request body, or the query string of a GET, to the /events stream */
+int lws_publish_handler(lws_http_conn_t *c, int ev, void *p)
+{
+    struct http_message *hm = p;
+    struct lws_str *data;
+    char result[64];
+    int count;
+
+    if (hm == NULL || ev != LWS_EV_HTTP_REQUEST)
+        return HTTP_BAD_REQUEST;
+
+    data = (hm->body.len > 0 && hm->body.len != (size_t) ~0) ? &hm->body : &hm->query_string;
+    count = lws_sse_publish("/events", "message", data->p, data->len);
+    if (count < 0)
+        return HTTP_INTERNAL_SERVER_ERROR;
+
+    sprintf(result, "%d\n", count);
+    lws_http_respond(c, HTTP_OK, c->close_flag, LWS_HTTP_PLAIN_TYPE, result, strlen(result));
+    return HTTP_OK;
+}
+
+/* state of one /upload request, the file part being written goes to a temporary name */
+typedef struct _lws_upload_t_ {
+    int fd;                             /* file part being written, or -1 */
+    char tmp[64];
+    char path[PATH_MAX];
+    int files;
+    uint64_t bytes;                     /* of the stored files */
+    uint64_t written;                   /* of the open part, on disk */
+    int failed;                         /* error status of the response, 0 if all parts were stored */
+} lws_upload_t;
+
+/* last path element of a client file name, NULL if it is empty, hidden, long or holds markup */
+static const char *lws_upload_name(struct lws_str *filename, int *len)
+{
+    const char *p = filename->p, *end = filename->p + filename->len;
+    const char *s;
+
+    /* old browsers send the client path, with either separator */
+    for (s = end; s > p && s[-1] != '/' && s[-1] != '\\'; s--)
+        ;
+    if (s == end || s[0] == '.' || end - s > LWS_UPLOAD_NAME_MAX)
+        return NULL;
+    for (p = s; p < end; p++) {
+        if ((unsigned char)*p < 0x20 || *p == 0x7f || *p == '<' || *p == '"' || *p == '&')
+            return NULL;
+    }
+
+    *len = end - s;
+    return s;
+}
+
+static void lws_upload_discard(lws_upload_t *up)
+{
+    if (up->fd < 0)
+        return;
+    close(up->fd);
+    unlink(up->tmp);
+    up->fd = -1;
+}
+
+/*
+ * multipart/form-data upload, file parts are written to ./load as their
+ * data arrives and linked into place once complete, other fields are
+ * ignored. A name that exists is never replaced, the upload gets a 409.
+ * The response counts the stored files and bytes.
+ */
+int lws_upload_handler(lws_http_conn_t *c, int ev, void *p)
+{
+    struct http_multipart_part *part = p;
+    lws_upload_t *up;
+    const char *name;
+    char result[64];
+    int len, ret, off;
+
+    if (p == NULL)
+        return HTTP_BAD_REQUEST;
+
+    switch (ev) {
+    case LWS_EV_HTTP_REQUEST:
+        return HTTP_UNSUPPORTED_MEDIA_TYPE;
+    case LWS_EV_HTTP_MULTIPART_REQUEST:
+        return HTTP_OK;
+    case LWS_EV_HTTP_PART_BEGIN:
+        up = part->user_data;
+        if (up == NULL) {
+            up = calloc(1, sizeof(lws_upload_t));
+            if (up == NULL)
+                return HTTP_INTERNAL_SERVER_ERROR;
+            up->fd = -1;
+            part->user_data = up;
+        }
+        if (part->filename.len == 0)
+            break;
+
+        name = lws_upload_name(&part->filename, &len);
+        if (name == NULL) {
+            lws_log(2, "upload: bad file name: %.*s\n", (int)part->filename.len, part->filename.p);
+            up->failed = HTTP_BAD_REQUEST;
+            break;
+        }
+        snprintf(up->path, sizeof(up->path), "./load/%.*s", len, name);
+        strcpy(up->tmp, "./load/.upload-XXXXXX");
+        up->fd = mkstemp(up->tmp);
+        if (up->fd < 0) {
+            lws_log(2, "upload: create %s failed, %s\n", up->tmp, strerror(errno));
+            up->failed = HTTP_INTERNAL_SERVER_ERROR;
+            break;
+        }
+        fchmod(up->fd, 0644);
+        up->written = 0;
+        break;
+    case LWS_EV_HTTP_PART_DATA:
+        up = part->user_data;
+        if (up == NULL || up->fd < 0)
+            break;
+        for (off = 0; off < (int)part->data.len; off += ret) {
+            ret = write(up->fd, part->data.p + off, part->data.len - off);
+            if (ret < 0 && errno == EINTR) {
+                ret = 0;
+                continue;
+            }
+            if (ret < 0) {
+                /* the part is dropped here, its later data and PART_END find no file */
+                lws_log(2, "upload: write %s failed, %s\n", up->path, strerror(errno));
+                lws_upload_discard(up);
+                up->failed = HTTP_INTERNAL_SERVER_ERROR;
+                break;
+            }
+        }
+        up->written += off;
+        break;
+    case LWS_EV_HTTP_PART_END:
+        up = part->user_data;
+        if (up == NULL || up->fd < 0)
+            break;
+        if (part->status < 0) {
+            lws_upload_discard(up);
+            break;
+        }
+        close(up->fd);
+        up->fd = -1;
+        /* unlike rename, link never replaces a file being served */
+        ret = link(up->tmp, up->path);
+        if (ret < 0 && errno == EEXIST) {
+            lws_log(3, "upload: %s exists, not replaced\n", up->path);
+            up->failed = HTTP_CONFLICT;
+        } else if (ret < 0) {
+            lws_log(2, "upload: link to %s failed, %s\n", up->path, strerror(errno));
+            up->failed = HTTP_INTERNAL_SERVER_ERROR;
+        }
+        unlink(up->tmp);
+        if (ret < 0)
+            break;
+        lws_log(4, "upload: %s stored, %llu bytes\n", up->path, (unsigned long long)up->written);
+        up->files++;
+        up->bytes += up->written;
+        break;
+    case LWS_EV_HTTP_MULTIPART_REQUEST_END:
+    case LWS_EV_CLOSE:
+        /* a closing connection only releases, nothing can be sent anymore */
+        up = part->user_data;
+        ret = HTTP_OK;
+        if (ev == LWS_EV_HTTP_MULTIPART_REQUEST_END) {
+            if (part->status < 0) {
+                ret = HTTP_BAD_REQUEST;
+            } else if (up && up->failed) {
+                ret = up->failed;
+            } else {
+                sprintf(result, "files: %d, bytes: %llu\n", up ? up->files : 0,
+                        (unsigned long long)(up ? up->bytes : 0));
+                lws_http_respond(c, HTTP_CREATED, c->close_flag, LWS_HTTP_PLAIN_TYPE, result, strlen(result));
+            }
+        }
+        if (up) {
+            lws_upload_discard(up);
+            free(up);
+            part->user_data = NULL;
+        }
+        return ret;
+    default:
+        return HTTP_BAD_REQUEST;
+    }
+
+    return HTTP_OK;
+}
@@ -7,6 +7,9 @@ extern int lws_version_handler(lws_http_conn_t *c, int ev, void *p);
 extern int lws_show_handler(lws_http_conn_t *c, int ev, void *p);
 extern int lws_binary_handler(lws_http_conn_t *c, int ev, void *p);
 extern int lws_download_handler(lws_http_conn_t *c, int ev, void *p);
+extern int lws_echo_handler(lws_http_conn_t *c, int ev, void *p);
+extern int lws_publish_handler(lws_http_conn_t *c, int ev, void *p);
+extern int lws_upload_handler(lws_http_conn_t *c, int ev, void *p);
 
 #endif // _LWS_HTTP_PLUGIN_H_
 
@@ -0,0 +1,495 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "lws_log.h"
+#include "lws_http.h"
+#include "lws_metrics.h"
+
+/* response codes with their own counter, others go to index 0 */
+static const int lws_metrics_codes[LWS_METRICS_CODES] = {
+    0,   200, 201, 206, 301, 302, 304, 400, 403,
+    404, 405, 408, 413, 500, 501, 502, 503, 504
+};
+
+static const char *lws_metrics_phase_names[LWS_METRICS_PHASES] = {"parse", "handler", "send", "compute_queue", "compute"};
+static const char *lws_metrics_shed_names[LWS_METRICS_SHED_REASONS] = {"connections", "requests", "delay", "compute"};
+
+/* all slots ever created, exited threads leave theirs on the free list */
+static lws_metrics_slot_t *lws_metrics_slots = NULL;
+static lws_metrics_slot_t *lws_metrics_free = NULL;
+static pthread_mutex_t lws_metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t lws_metrics_key;
+static pthread_once_t lws_metrics_once = PTHREAD_ONCE_INIT;
+
+static __thread lws_metrics_slot_t *lws_metrics_self = NULL;
+static __thread lws_metrics_req_t *lws_metrics_current = NULL;
+
+/* scrape output buffer */
+typedef struct _lws_metrics_buf_t_ {
+    char *data;
+    int length;
+    int size;
+} lws_metrics_buf_t;
+
+static void lws_metrics_release(void *arg)
+{
+    lws_metrics_slot_t *slot = arg;
+
+    /* counters stay in the slot, next thread keeps adding to them */
+    pthread_mutex_lock(&lws_metrics_lock);
+    slot->free_next = lws_metrics_free;
+    lws_metrics_free = slot;
+    pthread_mutex_unlock(&lws_metrics_lock);
+}
+
+static void lws_metrics_key_init(void)
+{
+    pthread_key_create(&lws_metrics_key, lws_metrics_release);
+}
+
+static lws_metrics_slot_t *lws_metrics_slot(void)
+{
+    lws_metrics_slot_t *slot;
+
+    if (lws_metrics_self)
+        return lws_metrics_self;
+
+    pthread_once(&lws_metrics_once, lws_metrics_key_init);
+
+    pthread_mutex_lock(&lws_metrics_lock);
+    slot = lws_metrics_free;
+    if (slot) {
+        lws_metrics_free = slot->free_next;
+    } else if (posix_memalign((void **)&slot, 64, sizeof(lws_metrics_slot_t)) == 0) {
+        memset(slot, 0, sizeof(lws_metrics_slot_t));
+        slot->next = lws_metrics_slots;
+        __atomic_store_n(&lws_metrics_slots, slot, __ATOMIC_RELEASE);
+    } else {
+        slot = NULL;
+    }
+    pthread_mutex_unlock(&lws_metrics_lock);
+
+    if (slot) {
+        pthread_setspecific(lws_metrics_key, slot);
+        lws_metrics_self = slot;
+    }
+
+    return slot;
+}
+
+/* single writer, relaxed store keeps the scraping reader from tearing */
+static inline void lws_metrics_add(uint64_t *counter, uint64_t value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t lws_metrics_load(uint64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static int lws_metrics_code_index(int http_code)
+{
+    int i;
+
+    for (i = 1; i < LWS_METRICS_CODES; i++) {
+        if (lws_metrics_codes[i] == http_code)
+            return i;
+    }
+
+    return 0;
+}
+
+static int lws_metrics_bucket(uint64_t ns)
+{
+    int msb, magnitude, sub;
+
+    if (ns < (1ULL << LWS_METRICS_HIST_MIN_SHIFT))
+        return 0;
+
+    msb = 63 - __builtin_clzll(ns);
+    magnitude = msb - LWS_METRICS_HIST_MIN_SHIFT;
+    if (magnitude >= LWS_METRICS_HIST_MAGNITUDES)
+        return LWS_METRICS_HIST_BUCKETS - 1;
+
+    sub = (ns >> (msb - LWS_METRICS_HIST_SUB_BITS)) & ((1 << LWS_METRICS_HIST_SUB_BITS) - 1);
+    return 1 + (magnitude << LWS_METRICS_HIST_SUB_BITS) + sub;
+}
+
+/* upper bound of bucket in nanoseconds */
+static uint64_t lws_metrics_bucket_bound(int bucket)
+{
+    int magnitude, sub;
+
+    if (bucket == 0)
+        return 1ULL << LWS_METRICS_HIST_MIN_SHIFT;
+
+    magnitude = (bucket - 1) >> LWS_METRICS_HIST_SUB_BITS;
+    sub = (bucket - 1) & ((1 << LWS_METRICS_HIST_SUB_BITS) - 1);
+    return (1ULL << (magnitude + LWS_METRICS_HIST_MIN_SHIFT)) +
+           ((uint64_t)(sub + 1) << (magnitude + LWS_METRICS_HIST_MIN_SHIFT - LWS_METRICS_HIST_SUB_BITS));
+}
+
+/* row of endpoint in the calling thread slot, allocated on first use */
+static lws_metrics_row_t *lws_metrics_row(lws_metrics_slot_t *slot, int endpoint)
+{
+    lws_metrics_row_t *row = slot->rows[endpoint];
+
+    if (row)
+        return row;
+
+    if (posix_memalign((void **)&row, 64, sizeof(lws_metrics_row_t)))
+        return NULL;
+    memset(row, 0, sizeof(lws_metrics_row_t));
+
+    /* the scraping reader may walk the slot right now */
+    __atomic_store_n(&slot->rows[endpoint], row, __ATOMIC_RELEASE);
+    return row;
+}
+
+static void lws_metrics_record(lws_metrics_row_t *row, int phase, uint64_t ns)
+{
+    lws_metrics_hist_t *hist = &row->hist[phase];
+
+    lws_metrics_add(&hist->buckets[lws_metrics_bucket(ns)], 1);
+    lws_metrics_add(&hist->sum_ns, ns);
+}
+
+/**
+ * @func    lws_metrics_now
+ * @brief   monotonic clock in nanoseconds
+ *
+ * @param   void
+ * @return  nanoseconds.
+ */
+uint64_t lws_metrics_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void lws_metrics_conn(int delta)
+{
+    lws_metrics_slot_t *slot = lws_metrics_slot();
+
+    if (slot)
+        lws_metrics_add((uint64_t *)&slot->conns_open, (uint64_t)(int64_t)delta);
+}
+
+void lws_metrics_bytes(uint64_t in, uint64_t out)
+{
+    lws_metrics_slot_t *slot = lws_metrics_slot();
+
+    if (slot == NULL)
+        return;
+
+    if (in)
+        lws_metrics_add(&slot->bytes_in, in);
+    if (out)
+        lws_metrics_add(&slot->bytes_out, out);
+}
+
+void lws_metrics_request_begin(lws_metrics_req_t *req, int endpoint, uint64_t parse_ns)
+{
+    lws_metrics_slot_t *slot = lws_metrics_slot();
+    lws_metrics_row_t *row;
+
+    if (endpoint < 0 || endpoint >= LWS_METRICS_MAX_ENDPOINTS)
+        endpoint = 0;
+
+    req->endpoint = endpoint;
+    req->http_code = 0;
+    req->send_ns = 0;
+    lws_metrics_current = req;
+
+    if (slot == NULL)
+        return;
+
+    lws_metrics_add((uint64_t *)&slot->conns_active, 1);
+    row = lws_metrics_row(slot, endpoint);
+    if (row)
+        lws_metrics_record(row, LWS_METRICS_PHASE_PARSE, parse_ns);
+}
+
+void lws_metrics_request_end(lws_metrics_req_t *req, uint64_t handler_ns)
+{
+    lws_metrics_slot_t *slot = lws_metrics_slot();
+    lws_metrics_row_t *row;
+
+    lws_metrics_current = NULL;
+    if (slot == NULL)
+        return;
+
+    /* handler phase excludes the time its responses spent in send */
+    if (handler_ns > req->send_ns)
+        handler_ns -= req->send_ns;
+    else
+        handler_ns = 0;
+
+    lws_metrics_add((uint64_t *)&slot->conns_active, (uint64_t)(int64_t)-1);
+    row = lws_metrics_row(slot, req->endpoint);
+    if (row == NULL)
+        return;
+
+    lws_metrics_add(&row->requests[lws_metrics_code_index(req->http_code)], 1);
+    lws_metrics_record(row, LWS_METRICS_PHASE_HANDLER, handler_ns);
+    lws_metrics_record(row, LWS_METRICS_PHASE_SEND, req->send_ns);
+}
+
+lws_metrics_req_t *lws_metrics_swap(lws_metrics_req_t *req)
+{
+    lws_metrics_req_t *prev = lws_metrics_current;
+
+    lws_metrics_current = req;
+    return prev;
+}
+
+void lws_metrics_send(int http_code, uint64_t bytes, uint64_t send_ns)
+{
+    lws_metrics_req_t *req = lws_metrics_current;
+
+    if (req) {
+        /* first status line wins, later calls are body parts */
+        if (req->http_code == 0)
+            req->http_code = http_code;
+        req->send_ns += send_ns;
+    }
+
+    lws_metrics_bytes(0, bytes);
+}
+
+void lws_metrics_shed(int reason)
+{
+    lws_metrics_slot_t *slot = lws_metrics_slot();
+
+    if (slot && reason >= 0 && reason < LWS_METRICS_SHED_REASONS)
+        lws_metrics_add(&slot->shed[reason], 1);
+}
+
+void lws_metrics_compute(int endpoint, uint64_t queue_ns, uint64_t run_ns)
+{
+    lws_metrics_slot_t *slot = lws_metrics_slot();
+    lws_metrics_row_t *row;
+
+    if (slot == NULL || endpoint < 0 || endpoint >= LWS_METRICS_MAX_ENDPOINTS)
+        return;
+
+    row = lws_metrics_row(slot, endpoint);
+    if (row == NULL)
+        return;
+
+    lws_metrics_record(row, LWS_METRICS_PHASE_QUEUE, queue_ns);
+    lws_metrics_record(row, LWS_METRICS_PHASE_COMPUTE, run_ns);
+}
+
+static int lws_metrics_printf(lws_metrics_buf_t *buf, const char *format, ...)
+{
+    va_list ap;
+    char *data;
+    int len;
+
+    while (1) {
+        va_start(ap, format);
+        len = vsnprintf(buf->data + buf->length, buf->size - buf->length, format, ap);
+        va_end(ap);
+
+        if (len < buf->size - buf->length)
+            break;
+
+        data = realloc(buf->data, buf->size * 2);
+        if (data == NULL)
+            return -1;
+        buf->data = data;
+        buf->size *= 2;
+    }
+
+    buf->length += len;
+    return len;
+}
+
+/* merge every thread slot into one, total has every row allocated */
+static void lws_metrics_merge(lws_metrics_slot_t *total)
+{
+    lws_metrics_slot_t *slot;
+    lws_metrics_row_t *row, *sum;
+    int e, k, p, b;
+
+    for (slot = __atomic_load_n(&lws_metrics_slots, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+        total->conns_open += (int64_t)lws_metrics_load((uint64_t *)&slot->conns_open);
+        total->conns_active += (int64_t)lws_metrics_load((uint64_t *)&slot->conns_active);
+        total->bytes_in += lws_metrics_load(&slot->bytes_in);
+        total->bytes_out += lws_metrics_load(&slot->bytes_out);
+        for (k = 0; k < LWS_METRICS_SHED_REASONS; k++)
+            total->shed[k] += lws_metrics_load(&slot->shed[k]);
+
+        for (e = 0; e < LWS_METRICS_MAX_ENDPOINTS; e++) {
+            row = __atomic_load_n(&slot->rows[e], __ATOMIC_ACQUIRE);
+            if (row == NULL)
+                continue;
+
+            sum = total->rows[e];
+            for (k = 0; k < LWS_METRICS_CODES; k++)
+                sum->requests[k] += lws_metrics_load(&row->requests[k]);
+
+            for (p = 0; p < LWS_METRICS_PHASES; p++) {
+                sum->hist[p].sum_ns += lws_metrics_load(&row->hist[p].sum_ns);
+                for (b = 0; b < LWS_METRICS_HIST_BUCKETS; b++)
+                    sum->hist[p].buckets[b] += lws_metrics_load(&row->hist[p].buckets[b]);
+            }
+        }
+    }
+}
+
+static int lws_metrics_hist_empty(lws_metrics_hist_t *hist)
+{
+    int b;
+
+    for (b = 0; b < LWS_METRICS_HIST_BUCKETS; b++) {
+        if (hist->buckets[b])
+            return 0;
+    }
+
+    return 1;
+}
+
+static void lws_metrics_print_hist(lws_metrics_buf_t *buf, const char *endpoint, int phase, lws_metrics_hist_t *hist)
+{
+    uint64_t count = 0;
+    int b;
+
+    for (b = 0; b < LWS_METRICS_HIST_BUCKETS; b++) {
+        count += hist->buckets[b];
+        if (b == LWS_METRICS_HIST_BUCKETS - 1) {
+            lws_metrics_printf(buf, "lws_http_phase_seconds_bucket{endpoint=\"%s\",phase=\"%s\",le=\"+Inf\"} %llu\n",
+                               endpoint, lws_metrics_phase_names[phase], (unsigned long long)count);
+        } else {
+            lws_metrics_printf(buf, "lws_http_phase_seconds_bucket{endpoint=\"%s\",phase=\"%s\",le=\"%.9g\"} %llu\n",
+                               endpoint, lws_metrics_phase_names[phase],
+                               lws_metrics_bucket_bound(b) / 1e9, (unsigned long long)count);
+        }
+    }
+
+    lws_metrics_printf(buf, "lws_http_phase_seconds_sum{endpoint=\"%s\",phase=\"%s\"} %.9f\n",
+                       endpoint, lws_metrics_phase_names[phase], hist->sum_ns / 1e9);
+    lws_metrics_printf(buf, "lws_http_phase_seconds_count{endpoint=\"%s\",phase=\"%s\"} %llu\n",
+                       endpoint, lws_metrics_phase_names[phase], (unsigned long long)count);
+}
+
+/**
+ * @func    lws_metrics_handler
+ * @brief   /metrics endpoint, prometheus text exposition format
+ */
+int lws_metrics_handler(lws_http_conn_t *c, int ev, void *p)
+{
+    struct http_message *hm = p;
+    lws_metrics_slot_t *total;
+    lws_metrics_row_t *rows;
+    lws_metrics_buf_t buf;
+    const char *endpoint;
+    uint64_t count;
+    int e, k, ph;
+
+    if (hm == NULL || ev != LWS_EV_HTTP_REQUEST)
+        return HTTP_BAD_REQUEST;
+
+    if (posix_memalign((void **)&total, 64, sizeof(lws_metrics_slot_t)))
+        return HTTP_INTERNAL_SERVER_ERROR;
+
+    rows = calloc(LWS_METRICS_MAX_ENDPOINTS, sizeof(lws_metrics_row_t));
+    if (rows == NULL) {
+        free(total);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    memset(total, 0, sizeof(lws_metrics_slot_t));
+    for (e = 0; e < LWS_METRICS_MAX_ENDPOINTS; e++)
+        total->rows[e] = &rows[e];
+
+    buf.size = 64 * 1024;
+    buf.length = 0;
+    buf.data = malloc(buf.size);
+    if (buf.data == NULL) {
+        free(rows);
+        free(total);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    pthread_mutex_lock(&lws_metrics_lock);
+    lws_metrics_merge(total);
+    pthread_mutex_unlock(&lws_metrics_lock);
+
+    lws_metrics_printf(&buf, "# HELP lws_http_requests_total HTTP requests by endpoint and status code.\n");
+    lws_metrics_printf(&buf, "# TYPE lws_http_requests_total counter\n");
+    for (e = 0; e < LWS_METRICS_MAX_ENDPOINTS; e++) {
+        endpoint = e ? lws_http_endpoint_uri(e) : "none";
+        if (endpoint == NULL)
+            continue;
+
+        for (k = 0; k < LWS_METRICS_CODES; k++) {
+            if (total->rows[e]->requests[k] == 0)
+                continue;
+
+            if (k == 0) {
+                lws_metrics_printf(&buf, "lws_http_requests_total{endpoint=\"%s\",code=\"other\"} %llu\n",
+                                   endpoint, (unsigned long long)total->rows[e]->requests[k]);
+            } else {
+                lws_metrics_printf(&buf, "lws_http_requests_total{endpoint=\"%s\",code=\"%d\"} %llu\n",
+                                   endpoint, lws_metrics_codes[k], (unsigned long long)total->rows[e]->requests[k]);
+            }
+        }
+    }
+
+    lws_metrics_printf(&buf, "# HELP lws_http_received_bytes_total Bytes received from clients.\n");
+    lws_metrics_printf(&buf, "# TYPE lws_http_received_bytes_total counter\n");
+    lws_metrics_printf(&buf, "lws_http_received_bytes_total %llu\n", (unsigned long long)total->bytes_in);
+    lws_metrics_printf(&buf, "# HELP lws_http_sent_bytes_total Bytes sent to clients.\n");
+    lws_metrics_printf(&buf, "# TYPE lws_http_sent_bytes_total counter\n");
+    lws_metrics_printf(&buf, "lws_http_sent_bytes_total %llu\n", (unsigned long long)total->bytes_out);
+
+    lws_metrics_printf(&buf, "# HELP lws_http_shed_total Connections and requests turned away with 503.\n");
+    lws_metrics_printf(&buf, "# TYPE lws_http_shed_total counter\n");
+    for (k = 0; k < LWS_METRICS_SHED_REASONS; k++)
+        lws_metrics_printf(&buf, "lws_http_shed_total{reason=\"%s\"} %llu\n",
+                           lws_metrics_shed_names[k], (unsigned long long)total->shed[k]);
+
+    /* the scraping request itself is active */
+    lws_metrics_printf(&buf, "# HELP lws_http_connections Open connections, active ones are handling a request.\n");
+    lws_metrics_printf(&buf, "# TYPE lws_http_connections gauge\n");
+    lws_metrics_printf(&buf, "lws_http_connections{state=\"active\"} %lld\n", (long long)total->conns_active);
+    lws_metrics_printf(&buf, "lws_http_connections{state=\"idle\"} %lld\n",
+                       (long long)(total->conns_open - total->conns_active));
+
+    lws_metrics_printf(&buf, "# HELP lws_http_phase_seconds Request latency by endpoint and phase.\n");
+    lws_metrics_printf(&buf, "# TYPE lws_http_phase_seconds histogram\n");
+    for (e = 0; e < LWS_METRICS_MAX_ENDPOINTS; e++) {
+        endpoint = e ? lws_http_endpoint_uri(e) : "none";
+        if (endpoint == NULL)
+            continue;
+
+        for (count = 0, k = 0; k < LWS_METRICS_CODES; k++)
+            count += total->rows[e]->requests[k];
+        if (count == 0)
+            continue;
+
+        /* the compute phases only for endpoints that ran on the pool */
+        for (ph = 0; ph < LWS_METRICS_PHASES; ph++) {
+            if (ph >= LWS_METRICS_PHASE_QUEUE && lws_metrics_hist_empty(&total->rows[e]->hist[ph]))
+                continue;
+            lws_metrics_print_hist(&buf, endpoint, ph, &total->rows[e]->hist[ph]);
+        }
+    }
+
+    free(rows);
+    free(total);
+    lws_http_respond(c, HTTP_OK, c->close_flag, "text/plain; version=0.0.4", buf.data, buf.length);
+    free(buf.data);
+
+    return HTTP_OK;
+}
@@ -0,0 +1,168 @@
+#ifndef _LWS_METRICS_H_
+#define _LWS_METRICS_H_
+
+#include <stdint.h>
+
+#include "lws_http.h"
+
+#define LWS_METRICS_MAX_ENDPOINTS   32      /* index 0 is unmatched uri */
+#define LWS_METRICS_CODES           18      /* index 0 is other code */
+
+/*
+ * HDR style log-linear histogram over nanoseconds: bucket 0 holds values
+ * below 1us, then every power of two up to ~17s is split into 4 linear
+ * sub-buckets (max 25% relative error), last bucket is overflow.
+ */
+#define LWS_METRICS_HIST_MIN_SHIFT  10
+#define LWS_METRICS_HIST_SUB_BITS   2
+#define LWS_METRICS_HIST_MAGNITUDES 24
+#define LWS_METRICS_HIST_BUCKETS    (2 + LWS_METRICS_HIST_MAGNITUDES * (1 << LWS_METRICS_HIST_SUB_BITS))
+
+/* request phases */
+#define LWS_METRICS_PHASE_PARSE     0
+#define LWS_METRICS_PHASE_HANDLER   1
+#define LWS_METRICS_PHASE_SEND      2
+#define LWS_METRICS_PHASE_QUEUE     3       /* waiting for a compute pool thread */
+#define LWS_METRICS_PHASE_COMPUTE   4       /* handler run on a compute pool thread */
+#define LWS_METRICS_PHASES          5
+
+/* load shedding reasons */
+#define LWS_METRICS_SHED_CONNS      0       /* connection limit, refused at accept */
+#define LWS_METRICS_SHED_REQUESTS   1       /* in-flight request limit */
+#define LWS_METRICS_SHED_DELAY      2       /* queueing delay over target */
+#define LWS_METRICS_SHED_COMPUTE    3       /* compute pool queue full */
+#define LWS_METRICS_SHED_REASONS    4
+
+typedef struct _lws_metrics_hist_t_ {
+    uint64_t buckets[LWS_METRICS_HIST_BUCKETS];
+    uint64_t sum_ns;
+} lws_metrics_hist_t;
+
+/* counters of one endpoint, ~4KB */
+typedef struct _lws_metrics_row_t_ {
+    uint64_t requests[LWS_METRICS_CODES];
+    lws_metrics_hist_t hist[LWS_METRICS_PHASES];
+} lws_metrics_row_t;
+
+/**
+ * per-thread counters, written by the owner thread only and merged at
+ * scrape time. Slots are cache line aligned so two threads never share
+ * a line. Endpoint rows are allocated when the thread first accounts a
+ * request of that endpoint, a connection thread of the thread engine
+ * usually touches one or two of them.
+**/
+typedef struct _lws_metrics_slot_t_ {
+    struct _lws_metrics_slot_t_ *next;
+    struct _lws_metrics_slot_t_ *free_next;
+    int64_t conns_open;
+    int64_t conns_active;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t shed[LWS_METRICS_SHED_REASONS];
+    lws_metrics_row_t *rows[LWS_METRICS_MAX_ENDPOINTS];
+} __attribute__((aligned(64))) lws_metrics_slot_t;
+
+/* timing of the request being dispatched on this thread */
+typedef struct _lws_metrics_req_t_ {
+    int endpoint;
+    int http_code;
+    uint64_t send_ns;
+} lws_metrics_req_t;
+
+/**
+ * @func    lws_metrics_now
+ * @brief   monotonic clock in nanoseconds
+ *
+ * @param   void
+ * @return  nanoseconds.
+ */
+extern uint64_t lws_metrics_now(void);
+
+/**
+ * @func    lws_metrics_conn
+ * @brief   account connection open (+1) or close (-1)
+ *
+ * @param   delta[in] +1 or -1
+ * @return  void
+ */
+extern void lws_metrics_conn(int delta);
+
+/**
+ * @func    lws_metrics_bytes
+ * @brief   account received and sent bytes
+ *
+ * @param   in[in] received bytes
+ * @param   out[in] sent bytes
+ * @return  void
+ */
+extern void lws_metrics_bytes(uint64_t in, uint64_t out);
+
+/**
+ * @func    lws_metrics_request_begin
+ * @brief   mark request dispatch start, connection becomes active
+ *
+ * @param   req[in] request timing context, lives on caller stack
+ * @param   endpoint[in] endpoint index, 0 if no endpoint matched
+ * @param   parse_ns[in] time spent in lws_parse_http
+ * @return  void
+ */
+extern void lws_metrics_request_begin(lws_metrics_req_t *req, int endpoint, uint64_t parse_ns);
+
+/**
+ * @func    lws_metrics_request_end
+ * @brief   account finished request, connection becomes idle
+ *
+ * @param   req[in] request timing context
+ * @param   handler_ns[in] handler time including sends
+ * @return  void
+ */
+extern void lws_metrics_request_end(lws_metrics_req_t *req, uint64_t handler_ns);
+
+/**
+ * @func    lws_metrics_swap
+ * @brief   switch the current request of the calling thread, around a
+ *          handler that is suspended and resumed while others run
+ *
+ * @param   req[in] request timing context to make current, or NULL
+ * @return  the previous current request, or NULL.
+ */
+extern lws_metrics_req_t *lws_metrics_swap(lws_metrics_req_t *req);
+
+/**
+ * @func    lws_metrics_send
+ * @brief   account a response write of the current request
+ *
+ * @param   http_code[in] response status
+ * @param   bytes[in] sent bytes
+ * @param   send_ns[in] send time
+ * @return  void
+ */
+extern void lws_metrics_send(int http_code, uint64_t bytes, uint64_t send_ns);
+
+/**
+ * @func    lws_metrics_shed
+ * @brief   account a connection or request turned away with 503
+ *
+ * @param   reason[in] LWS_METRICS_SHED_CONNS, _REQUESTS, _DELAY or _COMPUTE
+ * @return  void
+ */
+extern void lws_metrics_shed(int reason);
+
+/**
+ * @func    lws_metrics_compute
+ * @brief   account a handler run on a compute pool thread, called there
+ *
+ * @param   endpoint[in] endpoint index
+ * @param   queue_ns[in] time from submission until a pool thread took it
+ * @param   run_ns[in] handler time on the pool thread
+ * @return  void
+ */
+extern void lws_metrics_compute(int endpoint, uint64_t queue_ns, uint64_t run_ns);
+
+/**
+ * @func    lws_metrics_handler
+ * @brief   /metrics endpoint, prometheus text exposition format
+ */
+extern int lws_metrics_handler(lws_http_conn_t *c, int ev, void *p);
+
+#endif // _LWS_METRICS_H_
@@ -0,0 +1,529 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <stdint.h>
+#include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "lws_log.h"
+#include "lws_http.h"
+#include "lws_multipart.h"
+#include "lws_metrics.h"
+#include "lws_admit.h"
+
+/* parser states */
+#define LWS_MULTIPART_PREAMBLE      0       /* before the first delimiter, skipped */
+#define LWS_MULTIPART_DELIM         1       /* after a delimiter, padding until CRLF or "--" */
+#define LWS_MULTIPART_DELIM_CR      2
+#define LWS_MULTIPART_DELIM_DASH    3
+#define LWS_MULTIPART_HEADERS       4
+#define LWS_MULTIPART_BODY          5
+#define LWS_MULTIPART_EPILOGUE      6       /* after the close delimiter, skipped */
+#define LWS_MULTIPART_ERROR         7       /* malformed, the rest is skipped */
+
+static void lws_multipart_fail(lws_http_conn_t *c, lws_multipart_t *mp, const char *reason)
+{
+    lws_log(2, "sockfd[%d] multipart: %s\n", c->sockfd, reason);
+    mp->state = LWS_MULTIPART_ERROR;
+}
+
+/* endpoint event, responses it sends are accounted to the upload */
+static int lws_multipart_call(lws_http_conn_t *c, lws_multipart_t *mp, int ev)
+{
+    lws_metrics_req_t *prev;
+    int code;
+
+    prev = lws_metrics_swap(&mp->metrics);
+    code = mp->plugin->handler(c, ev, &mp->part);
+    lws_metrics_swap(prev);
+    return code;
+}
+
+static void lws_multipart_data(lws_http_conn_t *c, lws_multipart_t *mp, const char *data, int size)
+{
+    if (mp->state != LWS_MULTIPART_BODY || size <= 0)
+        return;
+
+    mp->part.data.p = data;
+    mp->part.data.len = size;
+    lws_multipart_call(c, mp, LWS_EV_HTTP_PART_DATA);
+}
+
+static void lws_multipart_part_end(lws_http_conn_t *c, lws_multipart_t *mp, int status)
+{
+    if (!mp->part_open)
+        return;
+
+    mp->part.data.p = NULL;
+    mp->part.data.len = 0;
+    mp->part.status = status;
+    lws_multipart_call(c, mp, LWS_EV_HTTP_PART_END);
+
+    mp->part_open = 0;
+    memset(&mp->part.name, 0, sizeof(mp->part.name));
+    memset(&mp->part.filename, 0, sizeof(mp->part.filename));
+    memset(&mp->part.content_type, 0, sizeof(mp->part.content_type));
+}
+
+/* name and filename of "form-data; name="file"; filename="a.txt"", browsers escape '"' as %22 */
+static void lws_multipart_disposition(lws_multipart_t *mp, const char *p, const char *end)
+{
+    const char *key, *val;
+    int key_len, val_len;
+
+    /* disposition type, "form-data" */
+    p = memchr(p, ';', end - p);
+    if (p == NULL)
+        return;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ';'))
+            p++;
+        key = p;
+        while (p < end && *p != '=' && *p != ';')
+            p++;
+        key_len = p - key;
+        while (key_len > 0 && (key[key_len - 1] == ' ' || key[key_len - 1] == '\t'))
+            key_len--;
+        if (p >= end || *p == ';')
+            continue;
+
+        for (p++; p < end && (*p == ' ' || *p == '\t'); p++)
+            ;
+        if (p < end && *p == '"') {
+            val = ++p;
+            while (p < end && *p != '"')
+                p++;
+            val_len = p - val;
+            if (p < end)
+                p++;
+        } else {
+            val = p;
+            while (p < end && *p != ';' && *p != ' ' && *p != '\t')
+                p++;
+            val_len = p - val;
+        }
+
+        if (key_len == 4 && strncasecmp(key, "name", 4) == 0) {
+            mp->part.name.p = val;
+            mp->part.name.len = val_len;
+        } else if (key_len == 8 && strncasecmp(key, "filename", 8) == 0) {
+            mp->part.filename.p = val;
+            mp->part.filename.len = val_len;
+        }
+    }
+}
+
+/* headers of a part are complete in mp->header, hand the part to the endpoint */
+static void lws_multipart_part_begin(lws_http_conn_t *c, lws_multipart_t *mp)
+{
+    const char *p = mp->header, *end = mp->header + mp->header_len;
+    const char *eol, *colon, *v, *vend;
+
+    while (p < end && (eol = memchr(p, '\n', end - p)) != NULL) {
+        vend = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+        colon = memchr(p, ':', vend - p);
+        if (colon) {
+            for (v = colon + 1; v < vend && (*v == ' ' || *v == '\t'); v++)
+                ;
+            while (vend > v && (vend[-1] == ' ' || vend[-1] == '\t'))
+                vend--;
+
+            if (colon - p == 19 && strncasecmp(p, "Content-Disposition", 19) == 0) {
+                lws_multipart_disposition(mp, v, vend);
+            } else if (colon - p == 12 && strncasecmp(p, "Content-Type", 12) == 0) {
+                mp->part.content_type.p = v;
+                mp->part.content_type.len = vend - v;
+            }
+        }
+        p = eol + 1;
+    }
+
+    lws_log(4, "multipart part: %.*s, file: %.*s\n", (int)mp->part.name.len, mp->part.name.p,
+            (int)mp->part.filename.len, mp->part.filename.p);
+    mp->state = LWS_MULTIPART_BODY;
+    mp->part_open = 1;
+    mp->part.status = 0;
+    lws_multipart_call(c, mp, LWS_EV_HTTP_PART_BEGIN);
+}
+
+/* collect part headers up to the empty line, return consumed bytes */
+static int lws_multipart_header(lws_http_conn_t *c, lws_multipart_t *mp, const char *s, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (mp->header_len == LWS_MULTIPART_HEADER_SIZE) {
+            lws_multipart_fail(c, mp, "part headers too large");
+            return i;
+        }
+
+        mp->header[mp->header_len++] = s[i];
+        if (s[i] != '\n')
+            continue;
+
+        /* a part without headers starts with the empty line */
+        if ((mp->header_len == 2 && mp->header[0] == '\r') ||
+            (mp->header_len >= 4 && memcmp(mp->header + mp->header_len - 4, "\r\n\r\n", 4) == 0)) {
+            lws_multipart_part_begin(c, mp);
+            return i + 1;
+        }
+    }
+
+    return len;
+}
+
+/* one byte of the rest of a delimiter line: CRLF starts a part, "--" ends the body */
+static void lws_multipart_delim(lws_http_conn_t *c, lws_multipart_t *mp, char ch)
+{
+    switch (mp->state) {
+    case LWS_MULTIPART_DELIM:
+        if (ch == '-')
+            mp->state = LWS_MULTIPART_DELIM_DASH;
+        else if (ch == '\r')
+            mp->state = LWS_MULTIPART_DELIM_CR;
+        else if (ch != ' ' && ch != '\t')
+            lws_multipart_fail(c, mp, "bad delimiter line");
+        break;
+    case LWS_MULTIPART_DELIM_CR:
+        if (ch != '\n') {
+            lws_multipart_fail(c, mp, "bad delimiter line");
+            break;
+        }
+        mp->header_len = 0;
+        mp->state = LWS_MULTIPART_HEADERS;
+        break;
+    case LWS_MULTIPART_DELIM_DASH:
+        if (ch != '-') {
+            lws_multipart_fail(c, mp, "bad close delimiter");
+            break;
+        }
+        mp->state = LWS_MULTIPART_EPILOGUE;
+        break;
+    }
+}
+
+static void lws_multipart_delimiter(lws_http_conn_t *c, lws_multipart_t *mp)
+{
+    lws_multipart_part_end(c, mp, 0);
+    mp->state = LWS_MULTIPART_DELIM;
+}
+
+/*
+ * First delimiter in s, or -1. With SSE2 the first and the last byte of the
+ * delimiter are compared 16 windows at a time and only the windows where
+ * both match are compared in full; random file data rarely gets that far.
+ * The rest, and every window without SSE2, is searched Horspool style.
+ */
+static int lws_multipart_find(lws_multipart_t *mp, const char *s, int len)
+{
+    const char *d = mp->delim;
+    int n = mp->delim_len;
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128i first = _mm_set1_epi8(d[0]);
+    __m128i last = _mm_set1_epi8(d[n - 1]);
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + n - 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            int k = __builtin_ctz(mask);
+            if (memcmp(s + i + k + 1, d + 1, n - 2) == 0)
+                return i + k;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    while (i + n <= len) {
+        if (s[i + n - 1] == d[n - 1] && memcmp(s + i, d, n - 1) == 0)
+            return i;
+        i += mp->skip[(unsigned char)s[i + n - 1]];
+    }
+
+    return -1;
+}
+
+/*
+ * Hand on data up to the next delimiter. A tail that may begin a delimiter
+ * is carried to the next call; it always is a proper prefix of the
+ * delimiter. Return consumed bytes.
+ */
+static int lws_multipart_scan(lws_http_conn_t *c, lws_multipart_t *mp, const char *s, int len)
+{
+    const char *d = mp->delim;
+    int n = mp->delim_len, k = mp->carry_len;
+    int m, i;
+
+    if (k > 0) {
+        m = n - k < len ? n - k : len;
+        if (memcmp(s, d + k, m) == 0) {
+            if (k + m < n) {
+                memcpy(mp->carry + k, s, m);
+                mp->carry_len += m;
+                return m;
+            }
+            mp->carry_len = 0;
+            lws_multipart_delimiter(c, mp);
+            return m;
+        }
+
+        /* boundaries hold no CR, so no delimiter starts later in the carry */
+        mp->carry_len = 0;
+        lws_multipart_data(c, mp, mp->carry, k);
+    }
+
+    i = lws_multipart_find(mp, s, len);
+    if (i >= 0) {
+        lws_multipart_data(c, mp, s, i);
+        lws_multipart_delimiter(c, mp);
+        return i + n;
+    }
+
+    for (i = len > n - 1 ? len - (n - 1) : 0; i < len; i++) {
+        if (s[i] == '\r' && memcmp(s + i, d, len - i) == 0)
+            break;
+    }
+    lws_multipart_data(c, mp, s, i);
+    memcpy(mp->carry, s + i, len - i);
+    mp->carry_len = len - i;
+    return len;
+}
+
+static void lws_multipart_feed(lws_http_conn_t *c, lws_multipart_t *mp, const char *s, int len)
+{
+    int n;
+
+    while (len > 0) {
+        switch (mp->state) {
+        case LWS_MULTIPART_PREAMBLE:
+        case LWS_MULTIPART_BODY:
+            n = lws_multipart_scan(c, mp, s, len);
+            break;
+        case LWS_MULTIPART_HEADERS:
+            n = lws_multipart_header(c, mp, s, len);
+            break;
+        case LWS_MULTIPART_DELIM:
+        case LWS_MULTIPART_DELIM_CR:
+        case LWS_MULTIPART_DELIM_DASH:
+            lws_multipart_delim(c, mp, *s);
+            n = 1;
+            break;
+        default:
+            n = len;
+            break;
+        }
+        s += n;
+        len -= n;
+    }
+}
+
+/* the body is complete, the endpoint answers the upload as a whole */
+static void lws_multipart_end(lws_http_conn_t *c)
+{
+    lws_multipart_t *mp = c->upload;
+    lws_metrics_req_t *prev;
+    int status, code;
+
+    status = mp->state == LWS_MULTIPART_EPILOGUE ? 0 : -1;
+    if (status && mp->state != LWS_MULTIPART_ERROR)
+        lws_log(2, "sockfd[%d] multipart: body ends before the close delimiter\n", c->sockfd);
+    lws_multipart_part_end(c, mp, status);
+
+    prev = lws_metrics_swap(&mp->metrics);
+    mp->part.status = status;
+    code = mp->plugin->handler(c, LWS_EV_HTTP_MULTIPART_REQUEST_END, &mp->part);
+    if (code != HTTP_OK) {
+        lws_http_respond_header(c, code, 1);
+        c->close_flag = 1;
+    }
+    lws_admit_done();
+    /* handler time of an upload is the time it held its request slot */
+    lws_metrics_request_end(&mp->metrics, lws_metrics_now() - mp->start);
+    lws_metrics_swap(prev);
+
+    c->upload = NULL;
+    free(mp);
+}
+
+/**
+ * @func    lws_multipart_begin
+ * @brief   stream a multipart/form-data request to its endpoint if it
+ *          accepts LWS_EV_HTTP_MULTIPART_REQUEST; the body is then fed with
+ *          lws_multipart_recv instead of being buffered
+ *
+ * @param   c[in] http connection
+ * @param   hm[in] request, headers only
+ * @param   parse_ns[in] time spent in lws_parse_http
+ * @return  On success, return 0; an upload shed by admission control got
+ *          its 503 and the connection closes. If the request is not a
+ *          multipart upload or the endpoint refuses it, return -1 and
+ *          nothing is sent.
+ */
+int lws_multipart_begin(lws_http_conn_t *c, struct http_message *hm, uint64_t parse_ns)
+{
+    lws_http_plugins_t *plugin;
+    lws_multipart_t *mp;
+    lws_metrics_req_t *prev;
+    struct lws_str *type, *length, *expect;
+    const char *p, *end, *boundary = NULL, *stop;
+    char buf[64];
+    uint64_t size, now;
+    int boundary_len = 0;
+    int i, len;
+
+    type = lws_get_http_header(hm, "Content-Type");
+    if (type == NULL || type->len < 19 || strncasecmp(type->p, "multipart/form-data", 19) != 0)
+        return -1;
+
+    /* boundary parameter, quoted or not */
+    p = type->p + 19;
+    end = type->p + type->len;
+    while ((p = memchr(p, ';', end - p)) != NULL) {
+        for (p++; p < end && (*p == ' ' || *p == '\t'); p++)
+            ;
+        if (end - p <= 9 || strncasecmp(p, "boundary=", 9) != 0)
+            continue;
+
+        boundary = p + 9;
+        if (*boundary == '"') {
+            boundary++;
+            stop = memchr(boundary, '"', end - boundary);
+        } else {
+            for (stop = boundary; stop < end && *stop != ';' && *stop != ' ' && *stop != '\t'; stop++)
+                ;
+        }
+        boundary_len = stop ? stop - boundary : 0;
+        break;
+    }
+
+    /* the scan relies on CR occurring only as the first delimiter byte */
+    if (boundary_len <= 0 || boundary_len > LWS_MULTIPART_BOUNDARY_MAX)
+        return -1;
+    for (i = 0; i < boundary_len; i++) {
+        if (iscntrl((unsigned char)boundary[i]))
+            return -1;
+    }
+
+    length = lws_get_http_header(hm, "Content-Length");
+    if (length == NULL || !isdigit((unsigned char)length->p[0]))
+        return -1;
+    size = strtoull(length->p, NULL, 10);
+    if (size == 0)
+        return -1;
+
+    plugin = lws_http_get_endpoint(hm->uri.p, hm->uri.len);
+    if (plugin == NULL)
+        return -1;
+
+    mp = calloc(1, sizeof(lws_multipart_t));
+    if (mp == NULL)
+        return -1;
+
+    /* existing endpoints answer non-request events with an error */
+    if (plugin->handler(c, LWS_EV_HTTP_MULTIPART_REQUEST, hm) != HTTP_OK) {
+        free(mp);
+        return -1;
+    }
+
+    /* admitted like any request, before a body byte reaches the endpoint */
+    prev = lws_metrics_swap(NULL);
+    lws_metrics_request_begin(&mp->metrics, plugin->index, parse_ns);
+    now = lws_metrics_now();
+    if (lws_admit_request(c->arrival_ns, now) < 0) {
+        /* the body is still on the socket, the connection can not be reused */
+        c->close_flag = 1;
+        lws_http_respond_shed(c);
+        lws_metrics_request_end(&mp->metrics, lws_metrics_now() - now);
+        lws_metrics_swap(prev);
+        free(mp);
+        return 0;
+    }
+    lws_metrics_swap(prev);
+
+    mp->start = now;
+    mp->plugin = plugin;
+    mp->remaining = size;
+    mp->state = LWS_MULTIPART_PREAMBLE;
+    mp->delim_len = sprintf(mp->delim, "\r\n--%.*s", boundary_len, boundary);
+    for (i = 0; i < 256; i++)
+        mp->skip[i] = mp->delim_len;
+    for (i = 0; i < mp->delim_len - 1; i++)
+        mp->skip[(unsigned char)mp->delim[i]] = mp->delim_len - 1 - i;
+
+    /* the first delimiter opens the body without a CRLF before it */
+    memcpy(mp->carry, "\r\n", 2);
+    mp->carry_len = 2;
+    c->upload = mp;
+
+    expect = lws_get_http_header(hm, "Expect");
+    if (expect && expect->len == 12 && strncasecmp(expect->p, "100-continue", 12) == 0 && c->send) {
+        len = sprintf(buf, "%s 100 Continue\r\n\r\n", LWS_HTTP_PROTO);
+        c->send(c->sockfd, buf, len);
+    }
+
+    lws_log(4, "sockfd[%d] multipart upload, %llu bytes, boundary: %.*s\n", c->sockfd,
+            (unsigned long long)size, boundary_len, boundary);
+    return 0;
+}
+
+/**
+ * @func    lws_multipart_recv
+ * @brief   parse received body bytes, part events go to the endpoint; after
+ *          the last body byte LWS_EV_HTTP_MULTIPART_REQUEST_END is sent and
+ *          the connection returns to plain http
+ *
+ * @param   c[in] http connection
+ * @param   data[in] received data
+ * @param   size[in] received data size
+ * @return  consumed bytes, less than size if a pipelined request follows.
+ */
+int lws_multipart_recv(lws_http_conn_t *c, char *data, int size)
+{
+    lws_multipart_t *mp = c->upload;
+
+    if (mp == NULL)
+        return 0;
+
+    if ((uint64_t)size > mp->remaining)
+        size = mp->remaining;
+
+    lws_multipart_feed(c, mp, data, size);
+    mp->remaining -= size;
+    if (mp->remaining == 0)
+        lws_multipart_end(c);
+
+    return size;
+}
+
+/**
+ * @func    lws_multipart_free
+ * @brief   end an unfinished upload of a closing connection: an open part
+ *          gets PART_END and the endpoint LWS_EV_CLOSE, both with status -1
+ *
+ * @param   c[in] http connection
+ * @return  void
+ */
+void lws_multipart_free(lws_http_conn_t *c)
+{
+    lws_multipart_t *mp = c->upload;
+    lws_metrics_req_t *prev;
+
+    if (mp == NULL)
+        return;
+
+    lws_multipart_part_end(c, mp, -1);
+    prev = lws_metrics_swap(&mp->metrics);
+    mp->part.status = -1;
+    mp->plugin->handler(c, LWS_EV_CLOSE, &mp->part);
+    lws_admit_done();
+    lws_metrics_request_end(&mp->metrics, lws_metrics_now() - mp->start);
+    lws_metrics_swap(prev);
+    c->upload = NULL;
+    free(mp);
+}
@@ -0,0 +1,75 @@
+#ifndef _LWS_MULTIPART_H_
+#define _LWS_MULTIPART_H_
+
+#include <stdint.h>
+
+#include "lws_http.h"
+#include "lws_metrics.h"
+
+#define LWS_MULTIPART_BOUNDARY_MAX  70          /* RFC 2046 5.1.1 */
+#define LWS_MULTIPART_DELIM_MAX     (4 + LWS_MULTIPART_BOUNDARY_MAX)
+#define LWS_MULTIPART_HEADER_SIZE   1024        /* headers of one part */
+
+/**
+ * multipart/form-data body streaming to its endpoint. Part data is handed
+ * on straight from the received buffers, only a tail that may begin a
+ * delimiter is held back, so an upload takes this much memory whatever
+ * its size.
+**/
+typedef struct _lws_multipart_t_ {
+    lws_http_plugins_t *plugin;                 /* endpoint that accepted the upload */
+    lws_metrics_req_t metrics;                  /* current request while the endpoint runs */
+    uint64_t start;                             /* admitted, the upload holds a request slot */
+    struct http_multipart_part part;
+    uint64_t remaining;                         /* body bytes still to come */
+    int state;
+    int part_open;                              /* PART_BEGIN sent, PART_END not yet */
+    char delim[LWS_MULTIPART_DELIM_MAX];        /* "\r\n--" boundary */
+    int delim_len;
+    uint8_t skip[256];                          /* Horspool shift per last byte of a window */
+    char carry[LWS_MULTIPART_DELIM_MAX];        /* received tail that starts like delim */
+    int carry_len;
+    char header[LWS_MULTIPART_HEADER_SIZE];     /* headers of the current part */
+    int header_len;
+} lws_multipart_t;
+
+/**
+ * @func    lws_multipart_begin
+ * @brief   stream a multipart/form-data request to its endpoint if it
+ *          accepts LWS_EV_HTTP_MULTIPART_REQUEST; the body is then fed with
+ *          lws_multipart_recv instead of being buffered
+ *
+ * @param   c[in] http connection
+ * @param   hm[in] request, headers only
+ * @param   parse_ns[in] time spent in lws_parse_http
+ * @return  On success, return 0; an upload shed by admission control got
+ *          its 503 and the connection closes. If the request is not a
+ *          multipart upload or the endpoint refuses it, return -1 and
+ *          nothing is sent.
+ */
+extern int lws_multipart_begin(lws_http_conn_t *c, struct http_message *hm, uint64_t parse_ns);
+
+/**
+ * @func    lws_multipart_recv
+ * @brief   parse received body bytes, part events go to the endpoint; after
+ *          the last body byte LWS_EV_HTTP_MULTIPART_REQUEST_END is sent and
+ *          the connection returns to plain http
+ *
+ * @param   c[in] http connection
+ * @param   data[in] received data
+ * @param   size[in] received data size
+ * @return  consumed bytes, less than size if a pipelined request follows.
+ */
+extern int lws_multipart_recv(lws_http_conn_t *c, char *data, int size);
+
+/**
+ * @func    lws_multipart_free
+ * @brief   end an unfinished upload of a closing connection: an open part
+ *          gets PART_END and the endpoint LWS_EV_CLOSE, both with status -1
+ *
+ * @param   c[in] http connection
+ * @return  void
+ */
+extern void lws_multipart_free(lws_http_conn_t *c);
+
+#endif // _LWS_MULTIPART_H_
@@ -0,0 +1,951 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "lws_log.h"
+#include "lws_http.h"
+#include "lws_proxy.h"
+#include "lws_metrics.h"
+#include "lws_cache.h"
+#include "lws_coro.h"
+
+/* upstream heads larger than this are refused, the rest of send_buf is for our own headers */
+#define LWS_PROXY_HEAD_SIZE         (LWS_HTTP_BUF_SIZE - 512)
+
+/* routes are immutable once registered, pools and counters change under the lock */
+static pthread_mutex_t lws_proxy_lock = PTHREAD_MUTEX_INITIALIZER;
+static lws_proxy_route_t *lws_proxy_routes = NULL;
+
+/* framing of an upstream response */
+typedef struct _lws_proxy_resp_t_ {
+    int content_length;                 /* -1 if not given */
+    int chunked;
+    int close;                          /* upstream closes after the response */
+} lws_proxy_resp_t;
+
+/* hop-by-hop headers, never forwarded */
+static const char *lws_proxy_hop_headers[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer", "Transfer-Encoding", "Upgrade", NULL
+};
+
+/* FNV-1a with a murmur3 finalizer, ring points of similar names spread evenly */
+static uint32_t lws_proxy_hash(const char *s, int len)
+{
+    uint32_t h = 2166136261u;
+
+    while (len-- > 0) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static int lws_proxy_name_is(struct lws_str *name, const char *s)
+{
+    return name->len == strlen(s) && strncasecmp(name->p, s, name->len) == 0;
+}
+
+static int lws_proxy_is_hop(struct lws_str *name)
+{
+    int i;
+
+    for (i = 0; lws_proxy_hop_headers[i]; i++) {
+        if (lws_proxy_name_is(name, lws_proxy_hop_headers[i]))
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Next header line of a raw head, s starts after the request or status line.
+ * Return 0 at the blank line that ends the head. A line without a colon has
+ * an empty name.
+ */
+static int lws_proxy_header(const char **s, const char *end, struct lws_str *line,
+                            struct lws_str *name, struct lws_str *value)
+{
+    const char *p = *s, *eol, *e, *colon, *v;
+
+    eol = memchr(p, '\n', end - p);
+    if (eol == NULL)
+        return 0;
+
+    *s = eol + 1;
+    line->p = p;
+    line->len = eol + 1 - p;
+
+    e = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+    if (e == p)
+        return 0;
+
+    colon = memchr(p, ':', e - p);
+    if (colon == NULL) {
+        name->len = value->len = 0;
+        return 1;
+    }
+
+    for (v = colon + 1; v < e && (*v == ' ' || *v == '\t'); v++);
+    while (e > v && (e[-1] == ' ' || e[-1] == '\t'))
+        e--;
+
+    name->p = p;
+    name->len = colon - p;
+    value->p = v;
+    value->len = e - v;
+    return 1;
+}
+
+static const char *lws_proxy_head_start(const char *head, const char *end)
+{
+    const char *eol = memchr(head, '\n', end - head);
+
+    return eol ? eol + 1 : end;
+}
+
+/*
+ * wait for fd to become ready, return > 0, or 0 with errno ETIMEDOUT; a
+ * handler running as a coroutine yields to the event loop meanwhile
+ */
+static int lws_proxy_wait(int fd, short events)
+{
+    return lws_coro_wait(fd, events, LWS_PROXY_TIMEOUT_MS);
+}
+
+static int lws_proxy_connect(lws_proxy_upstream_t *u)
+{
+    socklen_t len = sizeof(int);
+    int fd, err = 0, one = 1;
+
+    fd = socket(u->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&u->addr, u->addrlen) < 0) {
+        if (errno != EINPROGRESS || lws_proxy_wait(fd, POLLOUT) <= 0 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+            lws_log(3, "proxy connect %s failed, %s\n", u->name, strerror(err ? err : errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+/* most recently used idle connection still open, or -1; called locked */
+static int lws_proxy_pool_get(lws_proxy_upstream_t *u, time_t now)
+{
+    char b;
+    int fd;
+
+    while (u->idle_count > 0) {
+        u->idle_count--;
+        fd = u->idle[u->idle_count];
+
+        /* an idle connection has nothing to read, EOF or data means it is gone */
+        if (now - u->idle_since[u->idle_count] < LWS_PROXY_IDLE_SEC &&
+            recv(fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && errno == EAGAIN)
+            return fd;
+        close(fd);
+    }
+
+    return -1;
+}
+
+/* keep a finished connection, expired ones at the bottom are closed; called locked */
+static void lws_proxy_pool_put(lws_proxy_upstream_t *u, int fd, time_t now)
+{
+    int expired = 0;
+
+    while (expired < u->idle_count && now - u->idle_since[expired] >= LWS_PROXY_IDLE_SEC)
+        close(u->idle[expired++]);
+    if (expired == 0 && u->idle_count == LWS_PROXY_POOL_SIZE)
+        close(u->idle[expired++]);
+
+    if (expired) {
+        u->idle_count -= expired;
+        memmove(u->idle, u->idle + expired, u->idle_count * sizeof(int));
+        memmove(u->idle_since, u->idle_since + expired, u->idle_count * sizeof(time_t));
+    }
+
+    u->idle[u->idle_count] = fd;
+    u->idle_since[u->idle_count] = now;
+    u->idle_count++;
+}
+
+/* upstream not tried yet, unreachable ones last, or -1; called locked */
+static int lws_proxy_pick(lws_proxy_route_t *r, uint32_t key, uint64_t tried, time_t now)
+{
+    lws_proxy_upstream_t *u, *b;
+    int n = r->count * LWS_PROXY_VNODES;
+    int lo = 0, hi = n, mid;
+    int i, j, best = -1;
+
+    if (r->policy == LWS_PROXY_HASH) {
+        /* first ring point at or after key, then clockwise */
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            if (r->ring[mid].hash < key)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        for (j = 0; j < n; j++) {
+            i = r->ring[(lo + j) % n].upstream;
+            if (tried & (1ULL << i))
+                continue;
+            if (r->upstreams[i].down_until <= now)
+                return i;
+            if (best < 0)
+                best = i;
+        }
+        return best;
+    }
+
+    for (j = 0; j < r->count; j++) {
+        i = (r->next_pick + j) % r->count;
+        if (tried & (1ULL << i))
+            continue;
+
+        u = &r->upstreams[i];
+        b = best >= 0 ? &r->upstreams[best] : NULL;
+        if (b == NULL || (u->down_until <= now && b->down_until > now) ||
+            ((u->down_until <= now) == (b->down_until <= now) && u->active < b->active))
+            best = i;
+    }
+
+    if (best >= 0)
+        r->next_pick = (best + 1) % r->count;
+    return best;
+}
+
+static char *lws_proxy_build_request(lws_http_conn_t *c, struct http_message *hm, int *length)
+{
+    const char *head = hm->message.p;
+    const char *end = hm->body.p;
+    const char *s, *target_end;
+    struct lws_str line, name, value, xff = {NULL, 0};
+    struct sockaddr_storage peer;
+    socklen_t peerlen = sizeof(peer);
+    char addr[INET6_ADDRSTRLEN] = "unknown";
+    size_t body_len = (hm->body.len == (size_t)~0) ? 0 : hm->body.len;
+    char *req;
+    int len;
+
+    if (getpeername(c->sockfd, (struct sockaddr *)&peer, &peerlen) == 0) {
+        if (peer.ss_family == AF_INET)
+            inet_ntop(AF_INET, &((struct sockaddr_in *)&peer)->sin_addr, addr, sizeof(addr));
+        else if (peer.ss_family == AF_INET6)
+            inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&peer)->sin6_addr, addr, sizeof(addr));
+    }
+
+    req = malloc((end - head) + body_len + 256);
+    if (req == NULL)
+        return NULL;
+
+    /* request target is the uri and its query, sent as http/1.1 whatever the client spoke */
+    target_end = hm->query_string.len ? hm->query_string.p + hm->query_string.len : hm->uri.p + hm->uri.len;
+    len = sprintf(req, "%.*s %.*s HTTP/1.1\r\n", (int)hm->method.len, hm->method.p,
+                  (int)(target_end - hm->uri.p), hm->uri.p);
+
+    for (s = lws_proxy_head_start(head, end); lws_proxy_header(&s, end, &line, &name, &value); ) {
+        if (name.len == 0 || lws_proxy_is_hop(&name) || lws_proxy_name_is(&name, "Expect"))
+            continue;
+        if (lws_proxy_name_is(&name, "X-Forwarded-For")) {
+            xff = value;
+            continue;
+        }
+        memcpy(req + len, line.p, line.len);
+        len += line.len;
+    }
+
+    len += sprintf(req + len, "X-Forwarded-For: %.*s%s%s\r\nConnection: keep-alive\r\n\r\n",
+                   (int)xff.len, xff.p ? xff.p : "", xff.len ? ", " : "", addr);
+    memcpy(req + len, hm->body.p, body_len);
+    *length = len + body_len;
+    return req;
+}
+
+static int lws_proxy_send(int fd, const char *data, int size)
+{
+    ssize_t n;
+    int sent = 0;
+
+    while (sent < size) {
+        n = send(fd, data + sent, size - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && errno == EAGAIN) {
+            if (lws_proxy_wait(fd, POLLOUT) <= 0)
+                return -1;
+        } else if (n < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+
+    return sent;
+}
+
+/*
+ * Stream the rest of a request body from the client socket to the upstream
+ * through a pipe, without copying it to user space.
+ * Return 0 once all of it is sent, -1 on error.
+ */
+static int lws_proxy_send_body(lws_http_conn_t *c, struct http_message *hm, int fd)
+{
+    int pfd[2];
+    int n, left;
+    ssize_t m;
+
+    if (c->recv_pipe == NULL || pipe2(pfd, O_CLOEXEC | O_NONBLOCK))
+        return -1;
+
+    while (hm->body_pending > 0) {
+        n = c->recv_pipe(c->sockfd, pfd[1], hm->body_pending < 65536 ? hm->body_pending : 65536,
+                         LWS_PROXY_TIMEOUT_MS);
+        if (n <= 0) {
+            if (n == 0)
+                errno = ECONNRESET;
+            lws_log(3, "proxy sockfd: %d, request body cut short, %s\n", c->sockfd, strerror(errno));
+            break;
+        }
+        hm->body_pending -= n;
+
+        for (left = n; left > 0; ) {
+            m = splice(pfd[0], NULL, fd, NULL, left, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (m > 0)
+                left -= m;
+            else if (m < 0 && errno == EINTR)
+                continue;
+            else if (m < 0 && errno == EAGAIN && lws_proxy_wait(fd, POLLOUT) > 0)
+                continue;
+            else
+                goto out;
+        }
+    }
+
+out:
+    close(pfd[0]);
+    close(pfd[1]);
+    return hm->body_pending > 0 ? -1 : 0;
+}
+
+/*
+ * Receive the response head only, peeking first so no body byte is read into
+ * user space. Return the head length, 0 if the upstream closed before
+ * answering, -1 on error.
+ */
+static int lws_proxy_recv_head(int fd, char *buf, int size, struct http_message *rm)
+{
+    int have = 0, len;
+    ssize_t n;
+
+    while (have < size) {
+        n = recv(fd, buf + have, size - have, MSG_PEEK);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN && lws_proxy_wait(fd, POLLIN) > 0)
+                continue;
+            return (have == 0 && errno == ECONNRESET) ? 0 : -1;
+        } else if (n == 0) {
+            errno = ECONNRESET;
+            return have == 0 ? 0 : -1;
+        }
+
+        len = lws_parse_http(buf, have + n, rm, 0);
+        if (len < 0) {
+            errno = EPROTO;
+            return -1;
+        }
+
+        /* the peeked bytes are there, take the head and leave the body */
+        n = (len > 0) ? len - have : n;
+        if (recv(fd, buf + have, n, 0) != n)
+            return -1;
+        have += n;
+        if (len > 0)
+            return len;
+    }
+
+    lws_log(3, "proxy response head larger than %d\n", size);
+    errno = E2BIG;
+    return -1;
+}
+
+static void lws_proxy_resp_framing(const char *head, int len, struct http_message *rm, lws_proxy_resp_t *resp)
+{
+    const char *s, *end = head + len;
+    struct lws_str line, name, value;
+    int keep_alive = 0;
+
+    resp->content_length = -1;
+    resp->chunked = 0;
+    resp->close = 0;
+
+    for (s = lws_proxy_head_start(head, end); lws_proxy_header(&s, end, &line, &name, &value); ) {
+        if (lws_proxy_name_is(&name, "Content-Length")) {
+            resp->content_length = atoi(value.p);
+        } else if (lws_proxy_name_is(&name, "Transfer-Encoding")) {
+            resp->chunked = memmem(value.p, value.len, "chunked", 7) != NULL;
+        } else if (lws_proxy_name_is(&name, "Connection")) {
+            if (memmem(value.p, value.len, "close", 5))
+                resp->close = 1;
+            else if (strncasecmp(value.p, "keep-alive", 10) == 0)
+                keep_alive = 1;
+        }
+    }
+
+    if (rm->proto.len == 8 && strncmp(rm->proto.p, "HTTP/1.0", 8) == 0 && !keep_alive)
+        resp->close = 1;
+    if (resp->chunked)
+        resp->content_length = -1;
+}
+
+/* append to out of size bytes at *len, return -1 and leave *len if it does not fit */
+static int lws_proxy_append(char *out, int size, int *len, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(out + *len, size - *len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || n >= size - *len)
+        return -1;
+    *len += n;
+    return 0;
+}
+
+/* append the end to end headers of the response as "Name: value\r\n" lines, -1 if they do not fit */
+static int lws_proxy_copy_headers(const char *head, int len, char *out, int size, int *out_len)
+{
+    const char *s, *end = head + len;
+    struct lws_str line, name, value;
+
+    for (s = lws_proxy_head_start(head, end); lws_proxy_header(&s, end, &line, &name, &value); ) {
+        if (name.len == 0 || lws_proxy_is_hop(&name) || lws_proxy_name_is(&name, "Content-Length"))
+            continue;
+        if (lws_proxy_append(out, size, out_len, "%.*s: %.*s\r\n", (int)name.len, name.p,
+                             (int)value.len, value.p))
+            return -1;
+    }
+
+    return 0;
+}
+
+static int lws_proxy_recv_more(int fd, char **buf, int *len, int *cap, int want)
+{
+    char *p;
+    ssize_t n;
+    int size;
+
+    if (*cap - *len < want) {
+        size = (*cap * 2 > *len + want) ? *cap * 2 : *len + want;
+        if (size > LWS_PROXY_MAX_BODY + 65536) {
+            lws_log(3, "proxy body larger than %d\n", LWS_PROXY_MAX_BODY);
+            return -1;
+        }
+        p = realloc(*buf, size);
+        if (p == NULL)
+            return -1;
+        *buf = p;
+        *cap = size;
+    }
+
+    while (1) {
+        n = recv(fd, *buf + *len, want, 0);
+        if (n >= 0) {
+            *len += n;
+            return n;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN || lws_proxy_wait(fd, POLLIN) <= 0)
+            return -1;
+    }
+}
+
+/*
+ * Read the response body into memory, a chunked body is decoded in place:
+ * buf holds the decoded bytes [0, out) and the raw ones [pos, len).
+ */
+static int lws_proxy_read_body(int fd, lws_proxy_resp_t *resp, char **body)
+{
+    char *buf = NULL, *eol;
+    int len = 0, cap = 0, pos = 0, out = 0;
+    int n, hdr, p;
+    long size;
+
+    if (!resp->chunked) {
+        while (resp->content_length < 0 || len < resp->content_length) {
+            n = lws_proxy_recv_more(fd, &buf, &len, &cap,
+                                    resp->content_length < 0 ? 65536 : resp->content_length - len);
+            if (n < 0 || (n == 0 && resp->content_length >= 0))
+                goto fail;
+            if (n == 0)
+                break;
+        }
+        *body = buf;
+        return len;
+    }
+
+    while (1) {
+        eol = memmem(buf + pos, len - pos, "\r\n", 2);
+        if (eol) {
+            size = strtol(buf + pos, NULL, 16);
+            hdr = eol + 2 - (buf + pos);
+            if (size < 0 || size > LWS_PROXY_MAX_BODY)
+                goto fail;
+
+            /* last chunk, trailers end with an empty line */
+            if (size == 0) {
+                for (p = pos + hdr; (eol = memmem(buf + p, len - p, "\r\n", 2)) != NULL && eol != buf + p; )
+                    p = eol + 2 - buf;
+                if (eol)
+                    break;
+            } else if (len - pos >= hdr + size + 2) {
+                memmove(buf + out, buf + pos + hdr, size);
+                out += size;
+                pos += hdr + size + 2;
+                continue;
+            }
+        }
+
+        if (lws_proxy_recv_more(fd, &buf, &len, &cap, 65536) <= 0)
+            goto fail;
+    }
+
+    *body = buf;
+    return out;
+
+fail:
+    free(buf);
+    return -1;
+}
+
+/*
+ * Splice what the upstream has, up to size bytes, into a new pipe and hand
+ * the pipe to the client connection. Return moved bytes, 0 at upstream EOF,
+ * -1 on error.
+ */
+static int lws_proxy_splice(lws_http_conn_t *c, int fd, int size)
+{
+    int pfd[2];
+    int filled = 0;
+    ssize_t n;
+
+    if (pipe2(pfd, O_CLOEXEC | O_NONBLOCK))
+        return -1;
+    if (size > 65536)
+        fcntl(pfd[1], F_SETPIPE_SZ, LWS_PROXY_PIPE_SIZE);
+
+    while (filled < size) {
+        n = splice(fd, NULL, pfd[1], NULL, size - filled, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            filled += n;
+            continue;
+        } else if (n == 0) {
+            break;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN) {
+            goto fail;
+        }
+
+        /* pipe full or upstream drained for now, the client gets what is there */
+        if (filled > 0)
+            break;
+        if (lws_proxy_wait(fd, POLLIN) <= 0)
+            goto fail;
+    }
+
+    close(pfd[1]);
+    if (filled == 0) {
+        close(pfd[0]);
+        return 0;
+    }
+
+    if (c->send_pipe(c->sockfd, pfd[0], filled) < 0)
+        return -1;
+    return filled;
+
+fail:
+    close(pfd[0]);
+    close(pfd[1]);
+    return -1;
+}
+
+/*
+ * status line and headers go first, the body follows through pipes. A head
+ * that does not fit fails with E2BIG before anything is sent.
+ */
+static int lws_proxy_relay_splice(lws_http_conn_t *c, int fd, char *head, int head_len,
+                                  struct http_message *rm, lws_proxy_resp_t *resp)
+{
+    char out[LWS_HTTP_BUF_SIZE];
+    uint64_t send_start = lws_metrics_now();
+    int left, len = 0, n = 0;
+    int total = 0;
+
+    /* without a length the body ends when the connection does */
+    if (resp->content_length < 0)
+        c->close_flag = 1;
+
+    if (lws_proxy_append(out, sizeof(out), &len, "%s %d %.*s\r\n", LWS_HTTP_PROTO, rm->resp_code,
+                         (int)rm->resp_status_msg.len, rm->resp_status_msg.p) ||
+        lws_proxy_copy_headers(head, head_len, out, sizeof(out), &len) ||
+        (resp->content_length >= 0 &&
+         lws_proxy_append(out, sizeof(out), &len, "Content-Length: %d\r\n", resp->content_length)) ||
+        lws_proxy_append(out, sizeof(out), &len, "Connection: %s\r\n\r\n",
+                         c->close_flag ? "close" : "keep-alive")) {
+        lws_log(3, "proxy sockfd: %d, response headers larger than %d\n", c->sockfd, (int)sizeof(out));
+        errno = E2BIG;
+        return -1;
+    }
+
+    if (c->send(c->sockfd, out, len) < len) {
+        c->close_flag = 1;
+        return -1;
+    }
+
+    left = resp->content_length < 0 ? LWS_PROXY_PIPE_SIZE : resp->content_length;
+    while (left > 0) {
+        n = lws_proxy_splice(c, fd, left < LWS_PROXY_PIPE_SIZE ? left : LWS_PROXY_PIPE_SIZE);
+        if (n <= 0)
+            break;
+        total += n;
+        if (resp->content_length >= 0)
+            left -= n;
+    }
+
+    lws_metrics_send(rm->resp_code, len + total, lws_metrics_now() - send_start);
+
+    /* a body cut short can only be signaled by closing */
+    if (left > 0 && !(resp->content_length < 0 && n == 0)) {
+        lws_log(3, "proxy sockfd: %d, response body cut short\n", c->sockfd);
+        c->close_flag = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * the body is read into memory: http/2 clients, chunked bodies, engines
+ * without send_pipe, coalesced requests. The headers go out in send_buf
+ * after ours, more than LWS_PROXY_HEAD_SIZE fail with E2BIG.
+ */
+static int lws_proxy_relay_memory(lws_http_conn_t *c, int fd, char *head, int head_len,
+                                  struct http_message *rm, lws_proxy_resp_t *resp, int no_body)
+{
+    char extra[LWS_PROXY_HEAD_SIZE];
+    char *body = NULL;
+    int body_len = 0;
+    int n = 0;
+
+    if (lws_proxy_copy_headers(head, head_len, extra, sizeof(extra), &n)) {
+        lws_log(3, "proxy sockfd: %d, response headers larger than %d\n", c->sockfd, (int)sizeof(extra));
+        errno = E2BIG;
+        return -1;
+    }
+
+    if (!no_body) {
+        body_len = lws_proxy_read_body(fd, resp, &body);
+        if (body_len < 0)
+            return -1;
+    }
+
+    if (n >= 2)
+        extra[n - 2] = '\0';
+
+    /* HEAD answers carry the upstream length without a body */
+    if (no_body && resp->content_length > 0 && c->h2 == NULL)
+        body_len = resp->content_length;
+
+    lws_http_respond_base(c, rm->resp_code, NULL, n > 0 ? extra : NULL, c->close_flag,
+                          no_body ? NULL : body, body_len);
+    free(body);
+    return 0;
+}
+
+static lws_proxy_route_t *lws_proxy_route_find(const char *uri)
+{
+    lws_proxy_route_t *route;
+
+    for (route = lws_proxy_routes; route; route = route->next) {
+        if (strcmp(route->uri, uri) == 0)
+            return route;
+    }
+
+    return NULL;
+}
+
+static int lws_proxy_handler(lws_http_conn_t *c, int ev, void *p)
+{
+    struct http_message *hm = p, rm;
+    lws_http_plugins_t *plugin;
+    lws_proxy_route_t *route;
+    lws_proxy_upstream_t *u = NULL;
+    lws_proxy_resp_t resp;
+    char head[LWS_PROXY_HEAD_SIZE];
+    uint64_t tried = 0;
+    uint32_t key;
+    time_t now;
+    char *req;
+    int req_len, head_len = -1;
+    int i, fd = -1, reused, fresh;
+    int idempotent, no_body, ret;
+    int code = HTTP_BAD_GATEWAY;
+
+    if (ev == LWS_EV_CLOSE)
+        return HTTP_OK;
+
+    if (hm == NULL || ev != LWS_EV_HTTP_REQUEST)
+        return HTTP_BAD_REQUEST;
+
+    plugin = lws_http_get_endpoint(hm->uri.p, hm->uri.len);
+    pthread_mutex_lock(&lws_proxy_lock);
+    route = plugin ? lws_proxy_route_find(plugin->uri) : NULL;
+    pthread_mutex_unlock(&lws_proxy_lock);
+    if (route == NULL)
+        return HTTP_NOT_FOUND;
+
+    req = lws_proxy_build_request(c, hm, &req_len);
+    if (req == NULL)
+        return HTTP_INTERNAL_SERVER_ERROR;
+
+    /* a streamed body can only be sent once, not retried after a pooled connection turned out stale */
+    fresh = (hm->body_pending > 0);
+
+    key = lws_proxy_hash(hm->uri.p, hm->uri.len);
+    idempotent = !(hm->method.len == 4 && strncmp(hm->method.p, "POST", 4) == 0) &&
+                 !(hm->method.len == 5 && strncmp(hm->method.p, "PATCH", 5) == 0);
+
+    while (1) {
+        now = time(NULL);
+        pthread_mutex_lock(&lws_proxy_lock);
+        i = lws_proxy_pick(route, key, tried, now);
+        if (i >= 0) {
+            u = &route->upstreams[i];
+            u->active++;
+            fd = fresh ? -1 : lws_proxy_pool_get(u, now);
+        }
+        pthread_mutex_unlock(&lws_proxy_lock);
+        if (i < 0)
+            break;
+
+        reused = (fd >= 0);
+        if (fd < 0)
+            fd = lws_proxy_connect(u);
+        if (fd < 0) {
+            pthread_mutex_lock(&lws_proxy_lock);
+            u->down_until = now + LWS_PROXY_RETRY_SEC;
+            u->active--;
+            pthread_mutex_unlock(&lws_proxy_lock);
+            tried |= 1ULL << i;
+            continue;
+        }
+
+        head_len = -1;
+        if (lws_proxy_send(fd, req, req_len) == req_len &&
+            (hm->body_pending == 0 || lws_proxy_send_body(c, hm, fd) == 0))
+            head_len = lws_proxy_recv_head(fd, head, sizeof(head), &rm);
+        else if (reused)
+            head_len = 0;
+        if (head_len > 0)
+            break;
+
+        close(fd);
+        fd = -1;
+        pthread_mutex_lock(&lws_proxy_lock);
+        u->active--;
+        pthread_mutex_unlock(&lws_proxy_lock);
+
+        /* the pooled connection was closed by the upstream meanwhile, once more on a new one */
+        if (head_len == 0 && reused && idempotent && !fresh) {
+            fresh = 1;
+            continue;
+        }
+
+        /* the request may have been processed, it goes nowhere else */
+        code = (errno == ETIMEDOUT) ? HTTP_GATEWAY_TIMEOUT : HTTP_BAD_GATEWAY;
+        lws_log(3, "proxy %s %.*s failed, %s\n", u->name, (int)hm->uri.len, hm->uri.p, strerror(errno));
+        break;
+    }
+    free(req);
+
+    if (fd < 0)
+        return code;
+
+    lws_proxy_resp_framing(head, head_len, &rm, &resp);
+    no_body = (hm->method.len == 4 && strncmp(hm->method.p, "HEAD", 4) == 0) ||
+              rm.resp_code < 200 || rm.resp_code == HTTP_NO_CONTENT || rm.resp_code == HTTP_NOT_MODIFIED;
+
+    if (rm.resp_code < 200) {
+        /* interim responses are not expected, Expect is not forwarded */
+        ret = -1;
+        code = HTTP_BAD_GATEWAY;
+    } else if (!no_body && !resp.chunked && c->send_pipe && c->h2 == NULL &&
+               !lws_cache_shares_body(c, resp.content_length)) {
+        ret = lws_proxy_relay_splice(c, fd, head, head_len, &rm, &resp);
+        code = (ret < 0 && errno == E2BIG) ? HTTP_BAD_GATEWAY : HTTP_OK;
+    } else {
+        ret = lws_proxy_relay_memory(c, fd, head, head_len, &rm, &resp, no_body);
+        code = (ret < 0) ? HTTP_BAD_GATEWAY : HTTP_OK;
+    }
+
+    pthread_mutex_lock(&lws_proxy_lock);
+    u->active--;
+    if (ret == 0 && !resp.close && (no_body || resp.chunked || resp.content_length >= 0))
+        lws_proxy_pool_put(u, fd, time(NULL));
+    else
+        close(fd);
+    pthread_mutex_unlock(&lws_proxy_lock);
+
+    return code;
+}
+
+static int lws_proxy_vnode_cmp(const void *a, const void *b)
+{
+    const lws_proxy_vnode_t *x = a, *y = b;
+
+    return (x->hash > y->hash) - (x->hash < y->hash);
+}
+
+static int lws_proxy_resolve(lws_proxy_upstream_t *u, const char *spec, int len)
+{
+    struct addrinfo hints, *res;
+    char host[256], *port;
+    int ret;
+
+    if (len <= 0 || len >= (int)sizeof(host) || len >= (int)sizeof(u->name))
+        return -1;
+
+    memcpy(u->name, spec, len);
+    u->name[len] = '\0';
+    memcpy(host, spec, len);
+    host[len] = '\0';
+
+    port = strrchr(host, ':');
+    if (port == NULL || port[1] == '\0')
+        return -1;
+    *port++ = '\0';
+
+    /* "[::1]:8080" */
+    if (host[0] == '[' && port - host >= 3 && port[-2] == ']') {
+        port[-2] = '\0';
+        memmove(host, host + 1, strlen(host));
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    ret = getaddrinfo(host, port, &hints, &res);
+    if (ret) {
+        lws_log(2, "proxy upstream %s: %s\n", u->name, gai_strerror(ret));
+        return -1;
+    }
+
+    memcpy(&u->addr, res->ai_addr, res->ai_addrlen);
+    u->addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+/**
+ * @func    lws_proxy_endpoint_register
+ * @brief   forward every request under uri to one of the upstream servers.
+ *          Response bodies, and request bodies larger than the connection
+ *          buffer, are spliced between the sockets through pipes, never
+ *          copied to user space.
+ *
+ * @param   uri[in] endpoint uri prefix, forwarded unchanged
+ * @param   uri_size[in] uri length
+ * @param   upstreams[in] "host:port[,host:port...]"
+ * @param   policy[in] LWS_PROXY_LEAST_CONN or LWS_PROXY_HASH
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_proxy_endpoint_register(const char *uri, int uri_size, const char *upstreams, int policy)
+{
+    lws_proxy_route_t *route;
+    const char *s, *comma;
+    char key[96];
+    int count, i, v, n;
+
+    if (uri == NULL || uri_size <= 0 || upstreams == NULL)
+        return -1;
+
+    for (count = 1, s = upstreams; (s = strchr(s, ',')) != NULL; s++)
+        count++;
+    if (count > LWS_PROXY_MAX_UPSTREAMS)
+        return -1;
+
+    route = calloc(1, sizeof(lws_proxy_route_t));
+    if (route == NULL)
+        return -1;
+
+    route->uri = strndup(uri, uri_size);
+    route->upstreams = calloc(count, sizeof(lws_proxy_upstream_t));
+    route->ring = malloc(count * LWS_PROXY_VNODES * sizeof(lws_proxy_vnode_t));
+    if (route->uri == NULL || route->upstreams == NULL || route->ring == NULL)
+        goto fail;
+
+    route->policy = policy;
+    route->count = count;
+    for (i = 0, s = upstreams; i < count; i++, s = comma + 1) {
+        comma = strchr(s, ',');
+        if (comma == NULL)
+            comma = s + strlen(s);
+        if (lws_proxy_resolve(&route->upstreams[i], s, comma - s)) {
+            lws_log(2, "proxy upstream invalid: %.*s\n", (int)(comma - s), s);
+            goto fail;
+        }
+
+        for (v = 0; v < LWS_PROXY_VNODES; v++) {
+            n = snprintf(key, sizeof(key), "%s#%d", route->upstreams[i].name, v);
+            route->ring[i * LWS_PROXY_VNODES + v].hash = lws_proxy_hash(key, n);
+            route->ring[i * LWS_PROXY_VNODES + v].upstream = i;
+        }
+    }
+    qsort(route->ring, count * LWS_PROXY_VNODES, sizeof(lws_proxy_vnode_t), lws_proxy_vnode_cmp);
+
+    pthread_mutex_lock(&lws_proxy_lock);
+    route->next = lws_proxy_routes;
+    lws_proxy_routes = route;
+    pthread_mutex_unlock(&lws_proxy_lock);
+
+    lws_http_endpoint_register_flags(route->uri, uri_size, lws_proxy_handler, LWS_ENDPOINT_STREAM);
+    lws_log(3, "proxy %s -> %s, %s\n", route->uri, upstreams, policy == LWS_PROXY_HASH ? "hash" : "leastconn");
+    return 0;
+
+fail:
+    free(route->uri);
+    free(route->upstreams);
+    free(route->ring);
+    free(route);
+    return -1;
+}
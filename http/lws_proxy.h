@@ -0,0 +1,80 @@
+#ifndef _LWS_PROXY_H_
+#define _LWS_PROXY_H_
+
+#include <time.h>
+#include <sys/socket.h>
+
+#include "lws_http.h"
+
+/* upstream selection policy */
+#define LWS_PROXY_LEAST_CONN        0   /* fewest requests in flight */
+#define LWS_PROXY_HASH              1   /* consistent hashing of the request path */
+
+#define LWS_PROXY_MAX_UPSTREAMS     64
+#define LWS_PROXY_VNODES            100         /* hash ring points per upstream */
+
+#ifndef LWS_PROXY_POOL_SIZE
+#define LWS_PROXY_POOL_SIZE         32          /* idle keep-alive connections per upstream */
+#endif
+
+#ifndef LWS_PROXY_IDLE_SEC
+#define LWS_PROXY_IDLE_SEC          30          /* pooled connections older than this are closed */
+#endif
+
+#ifndef LWS_PROXY_TIMEOUT_MS
+#define LWS_PROXY_TIMEOUT_MS        10000       /* connect, send and receive timeout */
+#endif
+
+#define LWS_PROXY_RETRY_SEC         5           /* an unreachable upstream is skipped this long */
+#define LWS_PROXY_PIPE_SIZE         (1024 * 1024)
+#define LWS_PROXY_MAX_BODY          (16 * 1024 * 1024)  /* bodies that have to be read into memory */
+
+/**
+ * upstream server and its pool of idle keep-alive connections
+**/
+typedef struct _lws_proxy_upstream_t_ {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    char name[64];                      /* host:port */
+    int active;                         /* requests in flight */
+    int idle_count;
+    int idle[LWS_PROXY_POOL_SIZE];      /* most recently used last */
+    time_t idle_since[LWS_PROXY_POOL_SIZE];
+    time_t down_until;                  /* skipped until then after a failed connect */
+} lws_proxy_upstream_t;
+
+/* hash ring point */
+typedef struct _lws_proxy_vnode_t_ {
+    uint32_t hash;
+    int upstream;
+} lws_proxy_vnode_t;
+
+/**
+ * proxied route, named by the uri prefix of its endpoint
+**/
+typedef struct _lws_proxy_route_t_ {
+    struct _lws_proxy_route_t_ *next;
+    char *uri;
+    int policy;
+    int count;
+    int next_pick;                      /* round robin among equally loaded upstreams */
+    lws_proxy_upstream_t *upstreams;
+    lws_proxy_vnode_t *ring;            /* sorted by hash, count * LWS_PROXY_VNODES */
+} lws_proxy_route_t;
+
+/**
+ * @func    lws_proxy_endpoint_register
+ * @brief   forward every request under uri to one of the upstream servers.
+ *          Response bodies, and request bodies larger than the connection
+ *          buffer, are spliced between the sockets through pipes, never
+ *          copied to user space.
+ *
+ * @param   uri[in] endpoint uri prefix, forwarded unchanged
+ * @param   uri_size[in] uri length
+ * @param   upstreams[in] "host:port[,host:port...]"
+ * @param   policy[in] LWS_PROXY_LEAST_CONN or LWS_PROXY_HASH
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_proxy_endpoint_register(const char *uri, int uri_size, const char *upstreams, int policy);
+
+#endif // _LWS_PROXY_H_
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "lws_log.h"
+#include "lws_http.h"
+#include "lws_query.h"
+
+static inline int lws_url_hex(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/* decoded byte of the escape at s, s[0] is '%', or -1 */
+static inline int lws_url_escape(const char *s, int len)
+{
+    int hi, lo;
+
+    if (len < 3 || (hi = lws_url_hex(s[1])) < 0 || (lo = lws_url_hex(s[2])) < 0)
+        return -1;
+    return hi << 4 | lo;
+}
+
+/*
+ * Length of the leading run without '%' or special. Request text is mostly
+ * plain, so 16 bytes are compared at once and the first hit is taken from
+ * the byte mask.
+ */
+static inline int lws_url_run(const char *s, int len, char special)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128i pct = _mm_set1_epi8('%');
+    __m128i sp = _mm_set1_epi8(special);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, pct), _mm_cmpeq_epi8(v, sp)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (s[i] == '%' || s[i] == special)
+            break;
+    }
+    return i;
+}
+
+/**
+ * @func    lws_url_decode
+ * @brief   percent-decode in place, runs without escapes are found and moved
+ *          16 bytes at a time
+ *
+ * @param   s[in,out] encoded text
+ * @param   len[in] text length
+ * @param   flags[in] LWS_URL_FORM, LWS_URL_STRICT
+ * @return  decoded length, or -1 on a malformed escape with LWS_URL_STRICT.
+ */
+int lws_url_decode(char *s, int len, int flags)
+{
+    char special = (flags & LWS_URL_FORM) ? '+' : '%';
+    int r = 0, w = 0, n, c;
+
+    /* nothing moves until the first escape */
+    r = w = lws_url_run(s, len, special);
+    while (r < len) {
+        if (s[r] == '+') {
+            s[w++] = ' ';
+            r++;
+        } else if ((c = lws_url_escape(s + r, len - r)) >= 0) {
+            s[w++] = c;
+            r += 3;
+        } else if (flags & LWS_URL_STRICT) {
+            return -1;
+        } else {
+            s[w++] = s[r++];
+        }
+
+        n = lws_url_run(s + r, len - r, special);
+        memmove(s + w, s + r, n);
+        r += n;
+        w += n;
+    }
+
+    return w;
+}
+
+/* FNV-1a */
+static inline uint32_t lws_query_hash(const char *key, int len)
+{
+    uint32_t h = 0x811c9dc5;
+    int i;
+
+    for (i = 0; i < len; i++)
+        h = (h ^ (unsigned char)key[i]) * 0x01000193;
+    return h;
+}
+
+static int lws_query_find(lws_query_t *q, const char *name, int len, uint32_t h)
+{
+    int slot, i;
+
+    for (slot = h & (LWS_QUERY_HASH_SIZE - 1); q->slots[slot]; slot = (slot + 1) & (LWS_QUERY_HASH_SIZE - 1)) {
+        i = q->slots[slot] - 1;
+        if ((int)q->names[i].len == len && memcmp(q->names[i].p, name, len) == 0)
+            return i;
+    }
+
+    /* free slot, negated so the caller can claim it */
+    return -slot - 1;
+}
+
+/**
+ * @func    lws_query_parse
+ * @brief   split the query string of a request into parameters and decode
+ *          them in place, once per request: hm->query_string holds decoded
+ *          fragments afterwards
+ *
+ * @param   q[out] parameters
+ * @param   hm[in] request
+ * @return  number of parameters, or -1 if the query string was parsed before.
+ */
+int lws_query_parse(lws_query_t *q, struct http_message *hm)
+{
+    char *p, *end, *amp, *eq;
+    struct lws_str *name, *value;
+    int i;
+
+    q->count = 0;
+    memset(q->slots, 0, sizeof(q->slots));
+
+    /* decoding twice would turn "%2541" into "A" */
+    if (hm->decoded & LWS_HTTP_QUERY_DECODED)
+        return -1;
+    hm->decoded |= LWS_HTTP_QUERY_DECODED;
+
+    /* the request buffer is the connection's, only the view is const */
+    p = (char *)hm->query_string.p;
+    end = p + hm->query_string.len;
+    for (; p < end; p = amp + 1) {
+        amp = memchr(p, '&', end - p);
+        if (amp == NULL)
+            amp = end;
+        if (amp == p)
+            continue;
+
+        if (q->count == LWS_QUERY_MAX_PARAMS) {
+            lws_log(3, "query: more than %d parameters, rest ignored\n", LWS_QUERY_MAX_PARAMS);
+            break;
+        }
+
+        name = &q->names[q->count];
+        value = &q->values[q->count];
+        eq = memchr(p, '=', amp - p);
+        name->p = p;
+        name->len = lws_url_decode(p, (eq ? eq : amp) - p, LWS_URL_FORM);
+        value->p = eq ? eq + 1 : amp;
+        value->len = eq ? lws_url_decode(eq + 1, amp - eq - 1, LWS_URL_FORM) : 0;
+
+        /* a repeated name keeps its first value in the index */
+        i = lws_query_find(q, name->p, name->len, lws_query_hash(name->p, name->len));
+        if (i < 0)
+            q->slots[-i - 1] = q->count + 1;
+        q->count++;
+    }
+
+    return q->count;
+}
+
+/**
+ * @func    lws_query_get
+ * @brief   look up a parameter by name
+ *
+ * @param   q[in] parameters of lws_query_parse
+ * @param   name[in] decoded name, case sensitive
+ * @return  value of the first occurrence, empty for "?name", or NULL.
+ */
+struct lws_str *lws_query_get(lws_query_t *q, const char *name)
+{
+    int len = strlen(name);
+    int i;
+
+    i = lws_query_find(q, name, len, lws_query_hash(name, len));
+    return i >= 0 ? &q->values[i] : NULL;
+}
+
+/**
+ * @func    lws_http_path
+ * @brief   decode the request path in place and normalize it in the same
+ *          pass: empty and "." segments are dropped, ".." is refused rather
+ *          than resolved, as are escaped '/' and NUL. hm->uri is updated,
+ *          later calls return it as is
+ *
+ * @param   hm[in] request
+ * @param   path[out] normalized path, starts with '/'
+ * @return  On success, return 0. If the path is malformed or leaves the
+ *          root, return -1.
+ */
+int lws_http_path(struct http_message *hm, struct lws_str *path)
+{
+    char *s = (char *)hm->uri.p;
+    int len = hm->uri.len;
+    int r, w, seg, n, c;
+
+    if (hm->decoded & LWS_HTTP_URI_DECODED) {
+        *path = hm->uri;
+        return 0;
+    }
+
+    if (len <= 0 || s[0] != '/')
+        return -1;
+
+    /*
+     * s[0, w) is the normalized output, seg the start of the segment being
+     * written. A segment is checked once it is complete, so an escaped dot
+     * counts like a literal one.
+     */
+    r = w = seg = 1;
+    while (1) {
+        n = lws_url_run(s + r, len - r, '/');
+        memmove(s + w, s + r, n);
+        r += n;
+        w += n;
+
+        if (r < len && s[r] == '%') {
+            c = lws_url_escape(s + r, len - r);
+            if (c <= 0 || c == '/')
+                return -1;
+            s[w++] = c;
+            r += 3;
+            continue;
+        }
+
+        if (w - seg == 1 && s[seg] == '.')
+            w = seg;
+        else if (w - seg == 2 && s[seg] == '.' && s[seg + 1] == '.')
+            return -1;
+
+        if (r == len)
+            break;
+
+        /* the separator before an empty or dropped segment is already out */
+        r++;
+        if (w > seg) {
+            s[w++] = '/';
+            seg = w;
+        }
+    }
+
+    hm->uri.len = w;
+    hm->decoded |= LWS_HTTP_URI_DECODED;
+    *path = hm->uri;
+    return 0;
+}
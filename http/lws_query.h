@@ -0,0 +1,75 @@
+#ifndef _LWS_QUERY_H_
+#define _LWS_QUERY_H_
+
+#include <stdint.h>
+
+#include "lws_http.h"
+
+#define LWS_QUERY_MAX_PARAMS    32
+#define LWS_QUERY_HASH_SIZE     64          /* power of two, twice the params */
+
+#define LWS_URL_FORM            0x01        /* '+' decodes to a space */
+#define LWS_URL_STRICT          0x02        /* a malformed escape is an error, not kept literally */
+
+/**
+ * parameters of one query string, views into the request buffer. Names and
+ * values without escapes are left where they are, the others are decoded in
+ * place and shrink within their own span. The first occurrence of a name is
+ * indexed in an open addressing table of parameter index + 1.
+**/
+typedef struct _lws_query_t_ {
+    struct lws_str names[LWS_QUERY_MAX_PARAMS];
+    struct lws_str values[LWS_QUERY_MAX_PARAMS];
+    int count;
+    uint8_t slots[LWS_QUERY_HASH_SIZE];
+} lws_query_t;
+
+/**
+ * @func    lws_url_decode
+ * @brief   percent-decode in place, runs without escapes are found and moved
+ *          16 bytes at a time
+ *
+ * @param   s[in,out] encoded text
+ * @param   len[in] text length
+ * @param   flags[in] LWS_URL_FORM, LWS_URL_STRICT
+ * @return  decoded length, or -1 on a malformed escape with LWS_URL_STRICT.
+ */
+extern int lws_url_decode(char *s, int len, int flags);
+
+/**
+ * @func    lws_query_parse
+ * @brief   split the query string of a request into parameters and decode
+ *          them in place, once per request: hm->query_string holds decoded
+ *          fragments afterwards
+ *
+ * @param   q[out] parameters
+ * @param   hm[in] request
+ * @return  number of parameters, or -1 if the query string was parsed before.
+ */
+extern int lws_query_parse(lws_query_t *q, struct http_message *hm);
+
+/**
+ * @func    lws_query_get
+ * @brief   look up a parameter by name
+ *
+ * @param   q[in] parameters of lws_query_parse
+ * @param   name[in] decoded name, case sensitive
+ * @return  value of the first occurrence, empty for "?name", or NULL.
+ */
+extern struct lws_str *lws_query_get(lws_query_t *q, const char *name);
+
+/**
+ * @func    lws_http_path
+ * @brief   decode the request path in place and normalize it in the same
+ *          pass: empty and "." segments are dropped, ".." is refused rather
+ *          than resolved, as are escaped '/' and NUL. hm->uri is updated,
+ *          later calls return it as is
+ *
+ * @param   hm[in] request
+ * @param   path[out] normalized path, starts with '/'
+ * @return  On success, return 0. If the path is malformed or leaves the
+ *          root, return -1.
+ */
+extern int lws_http_path(struct http_message *hm, struct lws_str *path);
+
+#endif // _LWS_QUERY_H_
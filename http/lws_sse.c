@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "lws_log.h"
+#include "lws_buf.h"
+#include "lws_http.h"
+#include "lws_sse.h"
+#include "lws_metrics.h"
+
+/* topics and subscriber lists, the thread engine publishes from any thread */
+static pthread_mutex_t lws_sse_lock = PTHREAD_MUTEX_INITIALIZER;
+static lws_sse_topic_t *lws_sse_topics = NULL;
+
+static lws_sse_topic_t *lws_sse_topic_find(const char *name, int len)
+{
+    lws_sse_topic_t *topic;
+
+    for (topic = lws_sse_topics; topic; topic = topic->next) {
+        if ((int)strlen(topic->name) == len && strncmp(topic->name, name, len) == 0)
+            return topic;
+    }
+
+    return NULL;
+}
+
+static void lws_sse_unlink(lws_sse_sub_t *sub)
+{
+    lws_sse_topic_t *topic = sub->topic;
+
+    if (sub->prev)
+        sub->prev->next = sub->next;
+    else
+        topic->subs = sub->next;
+    if (sub->next)
+        sub->next->prev = sub->prev;
+
+    topic->count--;
+    sub->conn->sse = NULL;
+}
+
+static int lws_sse_handler(lws_http_conn_t *c, int ev, void *p)
+{
+    struct http_message *hm = p;
+    lws_http_plugins_t *plugin;
+    lws_sse_topic_t *topic;
+    lws_sse_sub_t *sub;
+    char buf[256];
+    int len;
+
+    if (ev == LWS_EV_CLOSE)
+        return HTTP_OK;
+
+    if (hm == NULL || ev != LWS_EV_HTTP_REQUEST)
+        return HTTP_BAD_REQUEST;
+
+    /* the stream stays open, http/2 streams end with the handler */
+    if (c->h2 || c->send_shared == NULL)
+        return HTTP_NOT_IMPLEMENTED;
+
+    if (hm->method.len != 3 || strncmp(hm->method.p, "GET", 3) != 0)
+        return HTTP_METHOD_NOT_ALLOWED;
+
+    plugin = lws_http_get_endpoint(hm->uri.p, hm->uri.len);
+    pthread_mutex_lock(&lws_sse_lock);
+    topic = plugin ? lws_sse_topic_find(plugin->uri, plugin->uri_size) : NULL;
+    pthread_mutex_unlock(&lws_sse_lock);
+    if (topic == NULL)
+        return HTTP_NOT_FOUND;
+
+    sub = calloc(1, sizeof(lws_sse_sub_t));
+    if (sub == NULL)
+        return HTTP_INTERNAL_SERVER_ERROR;
+
+    len = sprintf(buf, "%s 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+                  "Connection: keep-alive\r\n\r\n", LWS_HTTP_PROTO);
+    if (c->send(c->sockfd, buf, len) < len) {
+        free(sub);
+        c->close_flag = 1;
+        return HTTP_OK;
+    }
+    lws_metrics_send(HTTP_OK, len, 0);
+
+    /* headers are out before the first event can be queued */
+    c->close_flag = 0;
+    sub->conn = c;
+    sub->topic = topic;
+    pthread_mutex_lock(&lws_sse_lock);
+    sub->next = topic->subs;
+    if (topic->subs)
+        topic->subs->prev = sub;
+    topic->subs = sub;
+    topic->count++;
+    c->sse = sub;
+    pthread_mutex_unlock(&lws_sse_lock);
+
+    lws_log(4, "sse sockfd: %d, subscribed %s, subscribers: %d\n", c->sockfd, topic->name, topic->count);
+    return HTTP_OK;
+}
+
+/* "id:", "event:" and one "data:" line per line of data, blank line ends the event */
+static lws_buf_t *lws_sse_serialize(uint64_t id, const char *event, const char *data, int size)
+{
+    lws_buf_t *buf;
+    const char *line, *end;
+    int lines = 1;
+    int i, len;
+
+    for (i = 0; i < size; i++) {
+        if (data[i] == '\n')
+            lines++;
+    }
+
+    buf = lws_buf_new(64 + (event ? strlen(event) : 0) + size + lines * 7);
+    if (buf == NULL)
+        return NULL;
+
+    len = sprintf(buf->data, "id: %llu\n", (unsigned long long)id);
+    if (event)
+        len += sprintf(buf->data + len, "event: %s\n", event);
+
+    for (line = data, end = data + size; ; line++) {
+        const char *nl = memchr(line, '\n', end - line);
+        int n = nl ? (int)(nl - line) : (int)(end - line);
+
+        memcpy(buf->data + len, "data: ", 6);
+        memcpy(buf->data + len + 6, line, n);
+        len += 6 + n;
+        buf->data[len++] = '\n';
+        if (nl == NULL)
+            break;
+        line = nl;
+    }
+
+    buf->data[len++] = '\n';
+    buf->length = len;
+    return buf;
+}
+
+int lws_sse_endpoint_register(const char *uri, int uri_size, int policy)
+{
+    lws_sse_topic_t *topic;
+
+    if (uri == NULL || uri_size <= 0)
+        return -1;
+
+    topic = calloc(1, sizeof(lws_sse_topic_t));
+    if (topic == NULL)
+        return -1;
+
+    topic->name = strndup(uri, uri_size);
+    if (topic->name == NULL) {
+        free(topic);
+        return -1;
+    }
+    topic->policy = policy;
+
+    pthread_mutex_lock(&lws_sse_lock);
+    topic->next = lws_sse_topics;
+    lws_sse_topics = topic;
+    pthread_mutex_unlock(&lws_sse_lock);
+
+    lws_http_endpoint_register(topic->name, uri_size, lws_sse_handler);
+    return 0;
+}
+
+int lws_sse_publish(const char *topic_name, const char *event, const char *data, int size)
+{
+    lws_sse_topic_t *topic;
+    lws_sse_sub_t *sub, *next;
+    lws_http_conn_t *c;
+    lws_buf_t *buf;
+    int backlog;
+    int count = 0;
+
+    if (topic_name == NULL || (data == NULL && size > 0) || size < 0)
+        return -1;
+
+    pthread_mutex_lock(&lws_sse_lock);
+    topic = lws_sse_topic_find(topic_name, strlen(topic_name));
+    if (topic == NULL) {
+        pthread_mutex_unlock(&lws_sse_lock);
+        return -1;
+    }
+
+    buf = lws_sse_serialize(++topic->last_id, event, data, size);
+    if (buf == NULL) {
+        pthread_mutex_unlock(&lws_sse_lock);
+        return -1;
+    }
+
+    for (sub = topic->subs; sub; sub = next) {
+        next = sub->next;
+        c = sub->conn;
+
+        backlog = c->send_shared(c->sockfd, NULL);
+        if (backlog >= LWS_SSE_MAX_BACKLOG && topic->policy == LWS_SSE_SKIP) {
+            sub->skipped++;
+            continue;
+        }
+
+        /* the engine notices the shutdown and releases the connection */
+        if (backlog < 0 || backlog >= LWS_SSE_MAX_BACKLOG || c->send_shared(c->sockfd, buf) < 0) {
+            lws_log(3, "sse sockfd: %d, slow subscriber dropped, backlog: %d\n", c->sockfd, backlog);
+            lws_sse_unlink(sub);
+            shutdown(c->sockfd, SHUT_RDWR);
+            free(sub);
+            continue;
+        }
+        count++;
+    }
+    pthread_mutex_unlock(&lws_sse_lock);
+
+    lws_metrics_bytes(0, (uint64_t)buf->length * count);
+    lws_buf_unref(buf);
+    return count;
+}
+
+void lws_sse_free(lws_http_conn_t *c)
+{
+    lws_sse_sub_t *sub;
+
+    /* a connection subscribes from its own thread, NULL here stays NULL */
+    if (__atomic_load_n(&c->sse, __ATOMIC_ACQUIRE) == NULL)
+        return;
+
+    pthread_mutex_lock(&lws_sse_lock);
+    sub = c->sse;
+    if (sub)
+        lws_sse_unlink(sub);
+    pthread_mutex_unlock(&lws_sse_lock);
+
+    free(sub);
+}
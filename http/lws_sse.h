@@ -0,0 +1,74 @@
+#ifndef _LWS_SSE_H_
+#define _LWS_SSE_H_
+
+#include "lws_http.h"
+
+/* unsent bytes above which a subscriber is slow */
+#ifndef LWS_SSE_MAX_BACKLOG
+#define LWS_SSE_MAX_BACKLOG         (256 * 1024)
+#endif
+
+/* slow subscriber policy */
+#define LWS_SSE_DROP                0   /* close it, the client reconnects */
+#define LWS_SSE_SKIP                1   /* skip events until it catches up */
+
+/**
+ * subscriber, one per connection
+**/
+typedef struct _lws_sse_sub_t_ {
+    struct _lws_sse_sub_t_ *next;
+    struct _lws_sse_sub_t_ *prev;
+    struct _lws_sse_topic_t_ *topic;
+    lws_http_conn_t *conn;
+    uint64_t skipped;                   /* events skipped while slow */
+} lws_sse_sub_t;
+
+/**
+ * topic, named by the uri of its endpoint
+**/
+typedef struct _lws_sse_topic_t_ {
+    struct _lws_sse_topic_t_ *next;
+    char *name;
+    int policy;
+    uint64_t last_id;                   /* id of the last published event */
+    int count;
+    lws_sse_sub_t *subs;
+} lws_sse_topic_t;
+
+/**
+ * @func    lws_sse_endpoint_register
+ * @brief   register an event stream endpoint, every GET of uri subscribes
+ *          the connection to the topic named uri
+ *
+ * @param   uri[in] endpoint uri and topic name
+ * @param   uri_size[in] uri length
+ * @param   policy[in] LWS_SSE_DROP or LWS_SSE_SKIP
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_sse_endpoint_register(const char *uri, int uri_size, int policy);
+
+/**
+ * @func    lws_sse_publish
+ * @brief   broadcast one event to every subscriber of topic. The event is
+ *          serialized once and its buffer shared by all output queues, no
+ *          subscriber is waited for.
+ *
+ * @param   topic[in] topic name
+ * @param   event[in] event type or NULL
+ * @param   data[in] event data, may span lines
+ * @param   size[in] event data size
+ * @return  On success, return the number of subscribers the event was
+ *          queued to, On error, return -1.
+ */
+extern int lws_sse_publish(const char *topic, const char *event, const char *data, int size);
+
+/**
+ * @func    lws_sse_free
+ * @brief   unsubscribe connection
+ *
+ * @param   c[in] http connection
+ * @return  void
+ */
+extern void lws_sse_free(lws_http_conn_t *c);
+
+#endif // _LWS_SSE_H_
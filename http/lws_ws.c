@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "lws_log.h"
+#include "lws_util.h"
+#include "lws_http.h"
+#include "lws_ws.h"
+#include "lws_metrics.h"
+
+#define LWS_WS_FIN                  0x80
+#define LWS_WS_RSV                  0x70
+#define LWS_WS_MASK                 0x80
+#define LWS_WS_MAX_HEADER           14
+
+static int lws_ws_fail(lws_http_conn_t *c, int code)
+{
+    lws_log(2, "websocket sockfd: %d, close: %d\n", c->sockfd, code);
+    lws_ws_close(c, code, NULL);
+    c->close_flag = 1;
+    return -1;
+}
+
+static int lws_ws_append(char **buf, int *length, int *capacity, const char *data, int size)
+{
+    char *p;
+    int n;
+
+    if (*length + size > *capacity) {
+        n = *capacity ? *capacity : 1024;
+        while (n < *length + size)
+            n *= 2;
+        p = realloc(*buf, n);
+        if (p == NULL)
+            return -1;
+        *buf = p;
+        *capacity = n;
+    }
+
+    memcpy(*buf + *length, data, size);
+    *length += size;
+    return 0;
+}
+
+static void lws_ws_release(char **buf, int *length, int *capacity)
+{
+    free(*buf);
+    *buf = NULL;
+    *length = 0;
+    *capacity = 0;
+}
+
+/*
+ * Unmask payload in place. The key repeats every 4 bytes, so it is widened
+ * to 16 and 8 byte words and the bulk of the payload is xor'ed a vector at a
+ * time; the offsets stay multiples of 4 until the byte tail.
+ */
+static void lws_ws_unmask(uint8_t *p, size_t size, const uint8_t *key)
+{
+    uint32_t k32;
+    uint64_t k64, v;
+    size_t i = 0;
+
+    memcpy(&k32, key, 4);
+    k64 = ((uint64_t)k32 << 32) | k32;
+
+#ifdef __SSE2__
+    __m128i k128 = _mm_set1_epi32((int)k32);
+    for (; i + 64 <= size; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(p + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(p + i + 48));
+        _mm_storeu_si128((__m128i *)(p + i), _mm_xor_si128(a, k128));
+        _mm_storeu_si128((__m128i *)(p + i + 16), _mm_xor_si128(b, k128));
+        _mm_storeu_si128((__m128i *)(p + i + 32), _mm_xor_si128(c, k128));
+        _mm_storeu_si128((__m128i *)(p + i + 48), _mm_xor_si128(d, k128));
+    }
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+        _mm_storeu_si128((__m128i *)(p + i), _mm_xor_si128(a, k128));
+    }
+#endif
+
+    for (; i + 8 <= size; i += 8) {
+        memcpy(&v, p + i, 8);
+        v ^= k64;
+        memcpy(p + i, &v, 8);
+    }
+
+    for (; i < size; i++)
+        p[i] ^= key[i & 3];
+}
+
+/* RFC 3629 UTF-8, rejects overlong forms, surrogates and code points above U+10FFFF */
+static int lws_ws_utf8_valid(const uint8_t *p, size_t size)
+{
+    size_t i = 0;
+    uint64_t v;
+    uint32_t cp;
+    int n, k;
+
+    while (i < size) {
+        /* ascii runs 8 bytes at a time */
+        if (i + 8 <= size) {
+            memcpy(&v, p + i, 8);
+            if ((v & 0x8080808080808080ULL) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+
+        if (p[i] < 0x80) {
+            i++;
+            continue;
+        } else if ((p[i] & 0xe0) == 0xc0) {
+            n = 1;
+            cp = p[i] & 0x1f;
+        } else if ((p[i] & 0xf0) == 0xe0) {
+            n = 2;
+            cp = p[i] & 0x0f;
+        } else if ((p[i] & 0xf8) == 0xf0) {
+            n = 3;
+            cp = p[i] & 0x07;
+        } else {
+            return 0;
+        }
+
+        if (i + n >= size)
+            return 0;
+        for (k = 1; k <= n; k++) {
+            if ((p[i + k] & 0xc0) != 0x80)
+                return 0;
+            cp = (cp << 6) | (p[i + k] & 0x3f);
+        }
+
+        if ((n == 1 && cp < 0x80) || (n == 2 && cp < 0x800) || (n == 3 && cp < 0x10000) ||
+            cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+            return 0;
+        i += n + 1;
+    }
+
+    return 1;
+}
+
+static int lws_ws_event(lws_http_conn_t *c, int ev, int op, char *data, int size)
+{
+    lws_ws_conn_t *ws = c->ws;
+    struct websocket_message wm;
+
+    wm.data = (unsigned char *)data;
+    wm.size = size;
+    wm.flags = op;
+    return ws->handler(c, ev, &wm);
+}
+
+static int lws_ws_control(lws_http_conn_t *c, int op, char *data, int size)
+{
+    lws_ws_conn_t *ws = c->ws;
+    int code = LWS_WS_CLOSE_NORMAL;
+
+    switch (op) {
+    case WEBSOCKET_OP_PING:
+        lws_ws_send(c, WEBSOCKET_OP_PONG, data, size);
+        break;
+    case WEBSOCKET_OP_PONG:
+        break;
+    case WEBSOCKET_OP_CLOSE:
+        if (size == 1)
+            return lws_ws_fail(c, LWS_WS_CLOSE_PROTOCOL_ERROR);
+        if (size >= 2) {
+            code = ((uint8_t)data[0] << 8) | (uint8_t)data[1];
+            if (!lws_ws_utf8_valid((uint8_t *)data + 2, size - 2))
+                return lws_ws_fail(c, LWS_WS_CLOSE_INVALID_DATA);
+        }
+        lws_ws_event(c, LWS_EV_WEBSOCKET_CONTROL_FRAME, op, data, size);
+        if (ws->close_sent == 0)
+            lws_ws_close(c, code, NULL);
+        c->close_flag = 1;
+        return 0;
+    default:
+        return lws_ws_fail(c, LWS_WS_CLOSE_PROTOCOL_ERROR);
+    }
+
+    lws_ws_event(c, LWS_EV_WEBSOCKET_CONTROL_FRAME, op, data, size);
+    return 0;
+}
+
+static int lws_ws_message(lws_http_conn_t *c, int op, char *data, int size)
+{
+    if (op == WEBSOCKET_OP_TEXT && !lws_ws_utf8_valid((uint8_t *)data, size))
+        return lws_ws_fail(c, LWS_WS_CLOSE_INVALID_DATA);
+
+    lws_ws_event(c, LWS_EV_WEBSOCKET_FRAME, op, data, size);
+    return 0;
+}
+
+/* handle one complete, unmasked frame */
+static int lws_ws_frame(lws_http_conn_t *c, uint8_t b0, char *data, int size)
+{
+    lws_ws_conn_t *ws = c->ws;
+    int op = b0 & 0x0f;
+    int fin = b0 & LWS_WS_FIN;
+    int ret;
+
+    if (op & 0x08) {
+        if (!fin || size > 125)
+            return lws_ws_fail(c, LWS_WS_CLOSE_PROTOCOL_ERROR);
+        return lws_ws_control(c, op, data, size);
+    }
+
+    if (op == WEBSOCKET_OP_CONTINUE) {
+        if (ws->message_op == 0)
+            return lws_ws_fail(c, LWS_WS_CLOSE_PROTOCOL_ERROR);
+    } else if (op == WEBSOCKET_OP_TEXT || op == WEBSOCKET_OP_BINARY) {
+        if (ws->message_op != 0)
+            return lws_ws_fail(c, LWS_WS_CLOSE_PROTOCOL_ERROR);
+        /* unfragmented message, delivered from the receive buffer */
+        if (fin)
+            return lws_ws_message(c, op, data, size);
+        ws->message_op = op;
+    } else {
+        return lws_ws_fail(c, LWS_WS_CLOSE_PROTOCOL_ERROR);
+    }
+
+    if (ws->message_length + size > LWS_WS_MAX_MESSAGE)
+        return lws_ws_fail(c, LWS_WS_CLOSE_TOO_BIG);
+    if (lws_ws_append(&ws->message, &ws->message_length, &ws->message_capacity, data, size) < 0)
+        return lws_ws_fail(c, LWS_WS_CLOSE_TOO_BIG);
+
+    if (!fin)
+        return 0;
+
+    ret = lws_ws_message(c, ws->message_op, ws->message, ws->message_length);
+    ws->message_op = 0;
+    lws_ws_release(&ws->message, &ws->message_length, &ws->message_capacity);
+    return ret;
+}
+
+/*
+ * Parse frames in data. Return consumed bytes, a trailing partial frame is
+ * left unconsumed, -1 on protocol error.
+ */
+static int lws_ws_parse(lws_http_conn_t *c, char *data, int size)
+{
+    uint8_t *p;
+    uint64_t length;
+    int offset = 0;
+    int header;
+    int i;
+
+    while (offset < size && c->close_flag == 0) {
+        p = (uint8_t *)data + offset;
+        if (size - offset < 2)
+            break;
+
+        if (p[0] & LWS_WS_RSV)
+            return lws_ws_fail(c, LWS_WS_CLOSE_PROTOCOL_ERROR);
+        /* client frames are always masked */
+        if (!(p[1] & LWS_WS_MASK))
+            return lws_ws_fail(c, LWS_WS_CLOSE_PROTOCOL_ERROR);
+
+        length = p[1] & 0x7f;
+        header = 2;
+        if (length == 126) {
+            header = 4;
+            if (size - offset < header)
+                break;
+            length = (p[2] << 8) | p[3];
+        } else if (length == 127) {
+            header = 10;
+            if (size - offset < header)
+                break;
+            length = 0;
+            for (i = 0; i < 8; i++)
+                length = (length << 8) | p[2 + i];
+        }
+        header += 4;
+
+        if (length > LWS_WS_MAX_MESSAGE)
+            return lws_ws_fail(c, LWS_WS_CLOSE_TOO_BIG);
+        if (size - offset < header || (uint64_t)(size - offset - header) < length)
+            break;
+
+        lws_ws_unmask(p + header, length, p + header - 4);
+        if (lws_ws_frame(c, p[0], (char *)p + header, (int)length) < 0)
+            return -1;
+        offset += header + (int)length;
+    }
+
+    return offset;
+}
+
+int lws_ws_recv(lws_http_conn_t *c, char *data, int size)
+{
+    lws_ws_conn_t *ws = c->ws;
+    int len;
+
+    if (ws == NULL)
+        return -1;
+
+    ws->last_recv = (uint32_t)time(NULL);
+    ws->ping_sent = 0;
+
+    /* frames are parsed from the engine buffer, only a partial frame is copied */
+    if (ws->frame_length == 0) {
+        len = lws_ws_parse(c, data, size);
+        if (len < 0)
+            return size;
+        if (len < size && c->close_flag == 0 &&
+            lws_ws_append(&ws->frame, &ws->frame_length, &ws->frame_capacity, data + len, size - len) < 0) {
+            lws_ws_fail(c, LWS_WS_CLOSE_TOO_BIG);
+        }
+        return size;
+    }
+
+    if (ws->frame_length + size > LWS_WS_MAX_MESSAGE + LWS_WS_MAX_HEADER ||
+        lws_ws_append(&ws->frame, &ws->frame_length, &ws->frame_capacity, data, size) < 0) {
+        lws_ws_fail(c, LWS_WS_CLOSE_TOO_BIG);
+        return size;
+    }
+
+    len = lws_ws_parse(c, ws->frame, ws->frame_length);
+    if (len < 0 || c->close_flag) {
+        lws_ws_release(&ws->frame, &ws->frame_length, &ws->frame_capacity);
+    } else if (len == ws->frame_length) {
+        lws_ws_release(&ws->frame, &ws->frame_length, &ws->frame_capacity);
+    } else if (len > 0) {
+        ws->frame_length -= len;
+        memmove(ws->frame, ws->frame + len, ws->frame_length);
+    }
+
+    return size;
+}
+
+int lws_ws_send(lws_http_conn_t *c, int op, const char *data, int size)
+{
+    lws_ws_conn_t *ws = c->ws;
+    char frame[LWS_HTTP_BUF_SIZE];
+    int header = 2;
+    int ret;
+
+    if (ws == NULL || ws->close_sent || c->send == NULL || size < 0)
+        return -1;
+
+    frame[0] = (op & 0x0f) | ((op & WEBSOCKET_DONT_FIN) ? 0 : LWS_WS_FIN);
+    if (size < 126) {
+        frame[1] = size;
+    } else if (size < 65536) {
+        frame[1] = 126;
+        frame[2] = size >> 8;
+        frame[3] = size;
+        header = 4;
+    } else {
+        frame[1] = 127;
+        memset(frame + 2, 0, 4);
+        frame[6] = size >> 24;
+        frame[7] = size >> 16;
+        frame[8] = size >> 8;
+        frame[9] = size;
+        header = 10;
+    }
+
+    /* small frames go out in one send */
+    if (header + size <= (int)sizeof(frame)) {
+        if (size > 0)
+            memcpy(frame + header, data, size);
+        ret = c->send(c->sockfd, frame, header + size);
+        if (ret < header + size)
+            return -1;
+    } else {
+        if (c->send(c->sockfd, frame, header) < header)
+            return -1;
+        if (c->send(c->sockfd, (char *)data, size) < size)
+            return -1;
+    }
+
+    lws_metrics_bytes(0, header + size);
+    return size;
+}
+
+int lws_ws_close(lws_http_conn_t *c, int code, const char *reason)
+{
+    lws_ws_conn_t *ws = c->ws;
+    char payload[125];
+    int len = 0;
+
+    if (ws == NULL || ws->close_sent)
+        return -1;
+
+    payload[0] = code >> 8;
+    payload[1] = code;
+    if (reason) {
+        len = strlen(reason);
+        if (len > (int)sizeof(payload) - 2)
+            len = sizeof(payload) - 2;
+        memcpy(payload + 2, reason, len);
+    }
+
+    if (lws_ws_send(c, WEBSOCKET_OP_CLOSE, payload, len + 2) < 0)
+        return -1;
+    ws->close_sent = 1;
+    return 0;
+}
+
+int lws_ws_keepalive(lws_http_conn_t *c, time_t now)
+{
+    lws_ws_conn_t *ws;
+    uint32_t idle;
+
+    if (c == NULL || c->ws == NULL)
+        return 0;
+
+    ws = c->ws;
+    idle = (uint32_t)now - ws->last_recv;
+    if (ws->ping_sent || ws->close_sent) {
+        if (idle >= 2 * LWS_WS_PING_INTERVAL) {
+            lws_log(3, "websocket sockfd: %d, keepalive timeout\n", c->sockfd);
+            return -1;
+        }
+    } else if (idle >= LWS_WS_PING_INTERVAL) {
+        if (lws_ws_send(c, WEBSOCKET_OP_PING, NULL, 0) < 0)
+            return -1;
+        ws->ping_sent = 1;
+    }
+
+    return 0;
+}
+
+int lws_ws_upgrade(lws_http_conn_t *c, struct http_message *hm)
+{
+    lws_http_plugins_t *plugin;
+    lws_metrics_req_t metrics;
+    lws_ws_conn_t *ws;
+    struct lws_str *key, *version;
+    unsigned char digest[20], nonce[32];
+    char accept[64];
+    char buf[256];
+    uint64_t start;
+    int code = HTTP_BAD_REQUEST;
+    int len;
+
+    plugin = lws_http_get_endpoint(hm->uri.p, hm->uri.len);
+    lws_metrics_request_begin(&metrics, plugin ? plugin->index : 0, 0);
+    start = lws_metrics_now();
+
+    key = lws_get_http_header(hm, "Sec-WebSocket-Key");
+    version = lws_get_http_header(hm, "Sec-WebSocket-Version");
+    if (plugin == NULL) {
+        code = HTTP_NOT_FOUND;
+        goto refuse;
+    } else if (hm->method.len != 3 || strncmp(hm->method.p, "GET", 3) != 0) {
+        code = HTTP_METHOD_NOT_ALLOWED;
+        goto refuse;
+    } else if (key == NULL || key->len > 32 || lws_base64_decode(key->p, key->len, nonce) != 16) {
+        goto refuse;
+    } else if (version == NULL || version->len != 2 || strncmp(version->p, "13", 2) != 0) {
+        /* RFC 6455 4.4, advertise the supported version */
+        len = sprintf(buf, "%s 426 Upgrade Required\r\nSec-WebSocket-Version: 13\r\n"
+                      "Content-Length: 0\r\nConnection: close\r\n\r\n", LWS_HTTP_PROTO);
+        c->send(c->sockfd, buf, len);
+        c->close_flag = 1;
+        lws_metrics_send(426, len, 0);
+        lws_metrics_request_end(&metrics, lws_metrics_now() - start);
+        return -1;
+    }
+
+    /* existing endpoints answer non-request events with an error */
+    code = plugin->handler(c, LWS_EV_WEBSOCKET_HANDSHAKE_REQUEST, hm);
+    if (code != HTTP_OK)
+        goto refuse;
+
+    ws = calloc(1, sizeof(lws_ws_conn_t));
+    if (ws == NULL) {
+        code = HTTP_INTERNAL_SERVER_ERROR;
+        goto refuse;
+    }
+
+    /* Sec-WebSocket-Accept = base64(sha1(key + guid)) */
+    len = sprintf(buf, "%.*s%s", (int)key->len, key->p, LWS_WS_GUID);
+    lws_sha1(buf, len, digest);
+    lws_base64_encode(digest, sizeof(digest), accept);
+
+    len = sprintf(buf, "%s 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                  "Sec-WebSocket-Accept: %s\r\n\r\n", LWS_HTTP_PROTO, accept);
+    if (c->send(c->sockfd, buf, len) < len) {
+        free(ws);
+        c->close_flag = 1;
+        lws_metrics_request_end(&metrics, lws_metrics_now() - start);
+        return -1;
+    }
+    lws_metrics_send(HTTP_SWITCHING_PROCOTOLS, len, 0);
+    lws_metrics_request_end(&metrics, lws_metrics_now() - start);
+
+    ws->handler = plugin->handler;
+    ws->last_recv = (uint32_t)time(NULL);
+    c->ws = ws;
+    lws_log(4, "websocket sockfd: %d, upgraded %.*s\n", c->sockfd, (int)hm->uri.len, hm->uri.p);
+
+    ws->handler(c, LWS_EV_WEBSOCKET_HANDSHAKE_DONE, NULL);
+    return 0;
+
+refuse:
+    lws_http_respond_header(c, code, 1);
+    c->close_flag = 1;
+    lws_metrics_request_end(&metrics, lws_metrics_now() - start);
+    return -1;
+}
+
+void lws_ws_free(lws_http_conn_t *c)
+{
+    lws_ws_conn_t *ws = c->ws;
+
+    if (ws == NULL)
+        return;
+
+    ws->handler(c, LWS_EV_CLOSE, NULL);
+    free(ws->frame);
+    free(ws->message);
+    free(ws);
+    c->ws = NULL;
+}
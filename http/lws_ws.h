@@ -0,0 +1,110 @@
+#ifndef _LWS_WS_H_
+#define _LWS_WS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "lws_http.h"
+
+#define LWS_WS_GUID                 "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#ifndef LWS_WS_MAX_MESSAGE
+#define LWS_WS_MAX_MESSAGE          (1024 * 1024)   /* reassembled message limit */
+#endif
+
+#ifndef LWS_WS_PING_INTERVAL
+#define LWS_WS_PING_INTERVAL        30              /* idle seconds before a keepalive ping */
+#endif
+
+/* close status codes, RFC 6455 7.4.1 */
+#define LWS_WS_CLOSE_NORMAL         1000
+#define LWS_WS_CLOSE_GOING_AWAY     1001
+#define LWS_WS_CLOSE_PROTOCOL_ERROR 1002
+#define LWS_WS_CLOSE_INVALID_DATA   1007
+#define LWS_WS_CLOSE_TOO_BIG        1009
+
+/**
+ * websocket state of an upgraded connection, kept small since idle push
+ * connections hold nothing else once the http buffers are released
+**/
+typedef struct _lws_ws_conn_t_ {
+    lws_event_handler_t handler;        /* endpoint that accepted the upgrade */
+    char *frame;                        /* partial frame */
+    int frame_length;
+    int frame_capacity;
+    char *message;                      /* fragmented message being reassembled */
+    int message_length;
+    int message_capacity;
+    uint32_t last_recv;                 /* seconds, for keepalive */
+    uint8_t message_op;                 /* opcode of the fragmented message, 0 if none */
+    uint8_t ping_sent;
+    uint8_t close_sent;
+} lws_ws_conn_t;
+
+/**
+ * @func    lws_ws_upgrade
+ * @brief   answer "Upgrade: websocket" with 101 if the endpoint accepts it
+ *
+ * @param   c[in] http connection
+ * @param   hm[in] upgrade request
+ * @return  On success, return 0. If refused, an error response is sent,
+ *          close_flag is set and -1 is returned.
+ */
+extern int lws_ws_upgrade(lws_http_conn_t *c, struct http_message *hm);
+
+/**
+ * @func    lws_ws_recv
+ * @brief   process received frames, data is unmasked in place
+ *
+ * @param   c[in] websocket connection
+ * @param   data[in] received data
+ * @param   size[in] received data size
+ * @return  consumed bytes, on protocol error a close frame is sent and
+ *          close_flag is set.
+ */
+extern int lws_ws_recv(lws_http_conn_t *c, char *data, int size);
+
+/**
+ * @func    lws_ws_send
+ * @brief   send one frame
+ *
+ * @param   c[in] websocket connection
+ * @param   op[in] WEBSOCKET_OP_*, or'ed with WEBSOCKET_DONT_FIN for a fragment
+ * @param   data[in] payload
+ * @param   size[in] payload size
+ * @return  On success, return sent payload bytes, On error, return -1.
+ */
+extern int lws_ws_send(lws_http_conn_t *c, int op, const char *data, int size);
+
+/**
+ * @func    lws_ws_close
+ * @brief   send a close frame, the connection closes after the peer answers
+ *          or the keepalive gives up
+ *
+ * @param   c[in] websocket connection
+ * @param   code[in] close status code
+ * @param   reason[in] reason text or NULL
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_ws_close(lws_http_conn_t *c, int code, const char *reason);
+
+/**
+ * @func    lws_ws_keepalive
+ * @brief   ping an idle connection, give up on one that stopped answering
+ *
+ * @param   c[in] http connection
+ * @param   now[in] current time in seconds
+ * @return  0 to keep the connection, -1 if it is dead.
+ */
+extern int lws_ws_keepalive(lws_http_conn_t *c, time_t now);
+
+/**
+ * @func    lws_ws_free
+ * @brief   send LWS_EV_CLOSE to the endpoint and release websocket state
+ *
+ * @param   c[in] http connection
+ * @return  void
+ */
+extern void lws_ws_free(lws_http_conn_t *c);
+
+#endif // _LWS_WS_H_
@@ -0,0 +1,579 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "lws_log.h"
+#include "lws_http.h"
+#include "lws_socket.h"
+#include "lws_event.h"
+#include "lws_tls.h"
+#include "lws_upgrade.h"
+#include "lws_metrics.h"
+#include "lws_admit.h"
+#include "lws_coro.h"
+#include "lws_compute.h"
+#include "lws_disk.h"
+
+#define LWS_EPOLL_MAX_EVENTS    256
+#define LWS_EPOLL_RECV_SIZE     4096
+
+/* lws_event_conn_t pending flags */
+#define LWS_EPOLL_DIRTY         0x01
+#define LWS_EPOLL_CLOSING       0x02
+
+/* event data of an fd a suspended handler waits for, the connection pointer tagged */
+#define LWS_EPOLL_WAIT          0x01
+
+/* per worker thread */
+static __thread int lws_epoll_fd = -1;
+static __thread lws_event_conn_t *lws_epoll_dirty = NULL;  /* conns with queued output */
+static __thread uint64_t lws_epoll_expire_last = 0;         /* last walk for timed out waits */
+static __thread int lws_epoll_compute = 0;                  /* event data address of the compute eventfd */
+static __thread int lws_epoll_disk = 0;                     /* event data address of the disk pool eventfd */
+
+/* output queued outside of the connection's own event is flushed at the end of the loop pass */
+static void lws_epoll_mark(lws_event_conn_t *ec)
+{
+    if (!(ec->pending & LWS_EPOLL_DIRTY)) {
+        ec->pending |= LWS_EPOLL_DIRTY;
+        ec->next = lws_epoll_dirty;
+        lws_epoll_dirty = ec;
+    }
+}
+
+/*
+ * a dirty conn is still linked, it is released from the dirty list, as is
+ * one whose file range the disk pool reads; a suspended handler still uses
+ * its conn, it is closed once the handler returns
+ */
+static void lws_epoll_close(lws_event_conn_t *ec)
+{
+    if (ec->http->coro)
+        ec->http->close_flag = 1;
+    else if ((ec->pending & LWS_EPOLL_DIRTY) || ec->fetch)
+        ec->pending |= LWS_EPOLL_CLOSING;
+    else
+        lws_event_conn_free(ec);
+}
+
+/*
+ * http send callback: small writes (response headers) are only queued and
+ * go out together with the body, large writes are sent at once with the
+ * queued data in front. What the socket does not take is flushed on EPOLLOUT.
+ */
+static int lws_epoll_send(int sockfd, char *data, int size)
+{
+    lws_event_conn_t *ec;
+    struct iovec iov[2];
+    struct msghdr msg;
+    ssize_t nwritten;
+    int queued;
+
+    ec = lws_event_conn_get(sockfd);
+    if (ec == NULL || data == NULL || size < 0)
+        return -1;
+
+    /* TLS and file segments are written by lws_event_conn_flush only */
+    if (size < LWS_OUTSEG_SIZE || (ec->out_head && (ec->out_head->next || ec->out_head->fd >= 0)) ||
+        lws_tls_enabled()) {
+        if (lws_event_conn_queue(ec, data, size))
+            return -1;
+        lws_epoll_mark(ec);
+        return size;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    if (ec->out_head) {
+        iov[msg.msg_iovlen].iov_base = ec->out_head->data + ec->out_head->offset;
+        iov[msg.msg_iovlen].iov_len = ec->out_head->length - ec->out_head->offset;
+        msg.msg_iovlen++;
+    }
+    iov[msg.msg_iovlen].iov_base = data;
+    iov[msg.msg_iovlen].iov_len = size;
+    msg.msg_iovlen++;
+
+    nwritten = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+    if (nwritten < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            lws_log(3, "sockfd[%d] send failed, %s\n", sockfd, strerror(errno));
+            return -1;
+        }
+        nwritten = 0;
+    }
+
+    queued = ec->out_length;
+    if (nwritten <= queued) {
+        lws_event_conn_consume(ec, nwritten);
+        nwritten = 0;
+    } else {
+        lws_event_conn_consume(ec, queued);
+        nwritten -= queued;
+    }
+
+    if (nwritten < size) {
+        if (lws_event_conn_queue(ec, data + nwritten, size - nwritten))
+            return -1;
+        lws_epoll_mark(ec);
+    }
+
+    return size;
+}
+
+/* shared buffer send callback, the reference joins the output queue */
+static int lws_epoll_send_shared(int sockfd, lws_buf_t *buf)
+{
+    lws_event_conn_t *ec;
+
+    ec = lws_event_conn_get(sockfd);
+    if (ec == NULL)
+        return lws_event_conn_post(sockfd, buf);
+
+    if (buf) {
+        lws_event_worker_deliver();
+        if (lws_event_conn_queue_buf(ec, buf))
+            return -1;
+        lws_epoll_mark(ec);
+    }
+
+    return ec->out_length;
+}
+
+/* file send callback, the range is queued behind the response header */
+static int lws_epoll_send_file(int sockfd, int fd, off_t offset, int size)
+{
+    lws_event_conn_t *ec;
+
+    ec = lws_event_conn_get(sockfd);
+    if (ec == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    if (lws_event_conn_queue_file(ec, fd, offset, size))
+        return -1;
+    lws_epoll_mark(ec);
+
+    return size;
+}
+
+/* body chain send callback, the segments are queued behind the header by reference */
+static int lws_epoll_send_chain(int sockfd, const char *head, int head_len, lws_chain_t *chain)
+{
+    lws_event_conn_t *ec;
+    int ret;
+
+    ec = lws_event_conn_get(sockfd);
+    if (ec == NULL)
+        return -1;
+
+    ret = lws_event_conn_queue_chain(ec, head, head_len, chain, 1);
+    lws_epoll_mark(ec);
+    return ret;
+}
+
+/* pipe send callback, the pipe is spliced to the socket like a file segment */
+static int lws_epoll_send_pipe(int sockfd, int pipefd, int size)
+{
+    return lws_epoll_send_file(sockfd, pipefd, -1, size);
+}
+
+/*
+ * body splice of a suspended handler: it waits for its own socket, whose
+ * events resume the handler instead of being read while it is suspended
+ */
+static int lws_epoll_recv_pipe(int sockfd, int pipefd, int size, int timeout_ms)
+{
+    ssize_t nread;
+
+    while (1) {
+        nread = splice(sockfd, NULL, pipefd, NULL, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (nread >= 0)
+            return nread;
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN || lws_coro_wait(sockfd, POLLIN, timeout_ms) <= 0)
+            return -1;
+    }
+}
+
+/* zerocopy completions raise EPOLLERR too, only a socket error closes */
+static int lws_epoll_error(lws_event_conn_t *ec)
+{
+    socklen_t len = sizeof(int);
+    int err = 0;
+
+    if (ec->zc_next == ec->zc_done)
+        return -1;
+
+    if (lws_event_conn_reap(ec) || getsockopt(ec->sockfd, SOL_SOCKET, SO_ERROR, &err, &len) || err)
+        return -1;
+
+    return 0;
+}
+
+static void lws_epoll_accept(int listenfd)
+{
+    struct epoll_event ev;
+    lws_event_conn_t *ec;
+    int cli_fd;
+
+    while (1) {
+        cli_fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cli_fd < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                lws_log(2, "accept failed, ret: %s\n", strerror(errno));
+            return;
+        }
+
+        if (lws_service_admit(cli_fd))
+            continue;
+
+        ec = lws_event_conn_new(cli_fd, lws_epoll_send);
+        if (ec == NULL) {
+            lws_log(2, "lws_event_conn_new failed\n");
+            close(cli_fd);
+            continue;
+        }
+        ec->http->send_shared = lws_epoll_send_shared;
+        ec->http->send_file = lws_epoll_send_file;
+        ec->http->send_chain = lws_epoll_send_chain;
+        if (!lws_tls_enabled()) {
+            ec->http->send_pipe = lws_epoll_send_pipe;
+            ec->http->recv_pipe = lws_epoll_recv_pipe;
+        }
+
+        if (lws_tls_enabled() && lws_tls_accept(cli_fd)) {
+            lws_event_conn_free(ec);
+            continue;
+        }
+
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = ec;
+        if (epoll_ctl(lws_epoll_fd, EPOLL_CTL_ADD, cli_fd, &ev)) {
+            lws_log(2, "epoll_ctl add failed, %s\n", strerror(errno));
+            lws_event_conn_free(ec);
+            continue;
+        }
+
+        lws_log(3, "start http recv sockfd: %d\n", cli_fd);
+    }
+}
+
+/*
+ * Drain the socket (edge triggered) and feed http parser.
+ * Return -1 if connection should be closed now.
+ */
+static int lws_epoll_read(lws_event_conn_t *ec, uint64_t woken)
+{
+    char pread_buf[LWS_EPOLL_RECV_SIZE];
+    ssize_t nread;
+
+    /* a suspended handler holds back the next request, the socket is read once it returns */
+    while (ec->http->close_flag == 0 && ec->http->coro == NULL) {
+        /* data waited at least since the loop woke up, the kernel stamp tells longer */
+        lws_admit_stamp(woken);
+        if (lws_tls_enabled())
+            nread = lws_tls_read(ec->sockfd, pread_buf, sizeof(pread_buf));
+        else
+            nread = lws_socket_recv(ec->sockfd, pread_buf, sizeof(pread_buf));
+        if (nread < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+
+            lws_log(4, "recv, %s\n", strerror(errno));
+            return -1;
+        } else if (nread == 0) {
+            return -1;
+        }
+
+        if (lws_http_conn_recv(ec->http, pread_buf, nread) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * coroutine watch hook: the fd a handler waits for wakes its connection
+ * once, poll and epoll share the event bits. The connection socket itself
+ * is registered already, its next event resumes the handler.
+ */
+static int lws_epoll_watch(lws_coro_t *co, int fd, int events, int timeout_ms)
+{
+    lws_http_conn_t *c = lws_coro_data(co);
+    struct epoll_event ev;
+    lws_event_conn_t *ec;
+
+    ec = c ? lws_event_conn_get(c->sockfd) : NULL;
+    if (ec == NULL || ec->http != c || ec->wait_fd >= 0)
+        return -1;
+
+    if (fd == ec->sockfd) {
+        ec->wait_fd = fd;
+        ec->wait_deadline = lws_metrics_now() + timeout_ms * 1000000ULL;
+        return 0;
+    }
+
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = (char *)ec + LWS_EPOLL_WAIT;
+    if (epoll_ctl(lws_epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+        lws_log(3, "fd[%d] watch failed, %s\n", fd, strerror(errno));
+        return -1;
+    }
+
+    ec->wait_fd = fd;
+    ec->wait_deadline = lws_metrics_now() + timeout_ms * 1000000ULL;
+    return 0;
+}
+
+/*
+ * The fd a suspended handler waits for is ready, the wait timed out, or its
+ * compute job is done: resume the handler, then read what the socket got
+ * meanwhile, its edge triggered events were skipped. Flushing and closing
+ * wait for the end of the loop pass, the socket may have an event of its
+ * own in this one.
+ */
+static void lws_epoll_resume(lws_event_conn_t *ec, uint64_t woken)
+{
+    if (ec->wait_fd >= 0) {
+        if (ec->wait_fd != ec->sockfd)
+            epoll_ctl(lws_epoll_fd, EPOLL_CTL_DEL, ec->wait_fd, NULL);
+        ec->wait_fd = -1;
+    }
+
+    if (lws_http_conn_resume(ec->http) < 0 || (ec->http->coro == NULL && lws_epoll_read(ec, woken) < 0))
+        ec->pending |= LWS_EPOLL_CLOSING;
+    lws_epoll_mark(ec);
+}
+
+/* lws_compute_reap callback, the pool finished the handler of c */
+static void lws_epoll_compute_done(lws_http_conn_t *c)
+{
+    lws_event_conn_t *ec;
+
+    ec = lws_event_conn_get(c->sockfd);
+    if (ec && ec->http == c)
+        lws_epoll_resume(ec, lws_metrics_now());
+}
+
+/*
+ * lws_disk_reap callback: a handler read its file, or a file range is in
+ * the page cache now and the connection flushes again
+ */
+static void lws_epoll_disk_done(lws_disk_job_t *job)
+{
+    lws_http_conn_t *c;
+    lws_event_conn_t *ec;
+
+    if (job->co) {
+        c = lws_coro_data(job->co);
+        ec = c ? lws_event_conn_get(c->sockfd) : NULL;
+        if (ec && ec->http == c)
+            lws_epoll_resume(ec, lws_metrics_now());
+        return;
+    }
+
+    ec = job->arg;
+    ec->fetch = NULL;
+    free(job);
+    lws_epoll_mark(ec);
+}
+
+/* resume the handlers whose wait timed out, once a second */
+static void lws_epoll_expire(lws_event_worker_t *w, uint64_t now)
+{
+    lws_event_conn_t *ec;
+    int fd;
+
+    if (now - lws_epoll_expire_last < LWS_EVENT_TICK_MS * 1000000ULL)
+        return;
+    lws_epoll_expire_last = now;
+
+    for (fd = 0; fd <= w->conns_max; fd++) {
+        ec = w->conns[fd];
+        if (ec && ec->wait_fd >= 0 && ec->wait_deadline <= now)
+            lws_epoll_resume(ec, now);
+    }
+}
+
+/**
+ * @func    lws_epoll_start
+ * @brief   run epoll event loop of worker on its listen sockets
+ *
+ * @param   w[in] worker of the calling thread
+ * @return  On error, return -1. Never return on success.
+ */
+int lws_epoll_start(lws_event_worker_t *w)
+{
+    struct epoll_event events[LWS_EPOLL_MAX_EVENTS];
+    struct epoll_event ev;
+    lws_event_conn_t *ec;
+    uint64_t woken;
+    int nfds, i, n, ret;
+
+    lws_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (lws_epoll_fd < 0) {
+        lws_log(2, "epoll_create1 failed, %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* listeners shared by workers wake one of them */
+    for (i = 0; i < w->listen_count; i++) {
+        fcntl(w->listenfds[i], F_SETFL, fcntl(w->listenfds[i], F_GETFL) | O_NONBLOCK);
+
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(lws_epoll_fd, EPOLL_CTL_ADD, w->listenfds[i], &ev)) {
+            lws_log(2, "epoll_ctl listen failed, %s\n", strerror(errno));
+            close(lws_epoll_fd);
+            return -1;
+        }
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = w;
+    if (epoll_ctl(lws_epoll_fd, EPOLL_CTL_ADD, w->wakefd, &ev)) {
+        lws_log(2, "epoll_ctl wakefd failed, %s\n", strerror(errno));
+        close(lws_epoll_fd);
+        return -1;
+    }
+
+    /* handlers of compute endpoints come back through this eventfd */
+    n = lws_compute_attach();
+    if (n >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &lws_epoll_compute;
+        if (epoll_ctl(lws_epoll_fd, EPOLL_CTL_ADD, n, &ev)) {
+            lws_log(2, "epoll_ctl compute failed, %s\n", strerror(errno));
+            close(lws_epoll_fd);
+            return -1;
+        }
+    }
+
+    /* page cache misses are read on the disk pool and come back here */
+    n = lws_disk_attach();
+    if (n >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &lws_epoll_disk;
+        if (epoll_ctl(lws_epoll_fd, EPOLL_CTL_ADD, n, &ev)) {
+            lws_log(2, "epoll_ctl disk failed, %s\n", strerror(errno));
+            close(lws_epoll_fd);
+            return -1;
+        }
+    }
+
+    /* http/1 handlers run as coroutines, waiting on an upstream suspends them */
+    lws_coro_set_watch(lws_epoll_watch);
+
+    while (1) {
+        /* the listeners stay open, they belong to the new process now */
+        if (lws_event_upgrade_poll() == LWS_UPGRADE_STOP_ACCEPT) {
+            for (i = 0; i < w->listen_count; i++)
+                epoll_ctl(lws_epoll_fd, EPOLL_CTL_DEL, w->listenfds[i], NULL);
+        }
+
+        nfds = epoll_wait(lws_epoll_fd, events, LWS_EPOLL_MAX_EVENTS, LWS_EVENT_TICK_MS);
+        if (nfds < 0) {
+            if (errno == EINTR)
+                continue;
+            lws_log(2, "epoll_wait failed, %s\n", strerror(errno));
+            break;
+        }
+        woken = lws_metrics_now();
+
+        for (i = 0; i < nfds; i++) {
+            ec = events[i].data.ptr;
+            if (ec == NULL) {
+                for (n = 0; n < w->listen_count && !w->stopped; n++)
+                    lws_epoll_accept(w->listenfds[n]);
+                continue;
+            }
+            if ((void *)ec == (void *)w) {
+                lws_event_worker_wake();
+                continue;
+            }
+            if ((void *)ec == (void *)&lws_epoll_compute) {
+                lws_compute_reap(lws_epoll_compute_done);
+                continue;
+            }
+            if ((void *)ec == (void *)&lws_epoll_disk) {
+                lws_disk_reap(lws_epoll_disk_done);
+                continue;
+            }
+            if ((uintptr_t)ec & LWS_EPOLL_WAIT) {
+                lws_epoll_resume((lws_event_conn_t *)((char *)ec - LWS_EPOLL_WAIT), woken);
+                continue;
+            }
+
+            /* freed, still open for the completions of its zerocopy sends */
+            if (ec->http == NULL) {
+                lws_event_conn_linger(ec, 0);
+                continue;
+            }
+
+            ret = 0;
+            if (events[i].events & EPOLLERR)
+                ret = lws_epoll_error(ec);
+
+            /* a handler reading the request body itself waits for this socket */
+            if (ec->wait_fd == ec->sockfd) {
+                lws_epoll_resume(ec, woken);
+                continue;
+            }
+
+            /* a TLS handshake blocked on writing continues on EPOLLOUT */
+            if (ret == 0 && ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) ||
+                             (lws_tls_enabled() && ec->out_head == NULL)))
+                ret = lws_epoll_read(ec, woken);
+
+            if (ret == 0 && ec->out_head)
+                ret = lws_event_conn_flush(ec);
+
+            /* close after the last response is on the wire, and out of zerocopy pages */
+            if (ret < 0 || (ec->http->close_flag && ec->out_head == NULL && ec->zc_head == NULL))
+                lws_epoll_close(ec);
+        }
+
+        lws_event_conn_keepalive(time(NULL));
+        lws_epoll_expire(w, woken);
+
+        while ((ec = lws_epoll_dirty) != NULL) {
+            lws_epoll_dirty = ec->next;
+            ec->next = NULL;
+            ec->pending &= ~LWS_EPOLL_DIRTY;
+
+            ret = (ec->pending & LWS_EPOLL_CLOSING) ? -1 : 0;
+            if (ret == 0 && ec->out_head)
+                ret = lws_event_conn_flush(ec);
+            if (ret < 0 || (ec->http->close_flag && ec->out_head == NULL && ec->zc_head == NULL)) {
+                if (ec->http->coro)
+                    ec->http->close_flag = 1;
+                else if (ec->fetch)
+                    ec->pending |= LWS_EPOLL_CLOSING;
+                else
+                    lws_event_conn_free(ec);
+            }
+        }
+    }
+
+    lws_coro_set_watch(NULL);
+    close(lws_epoll_fd);
+    lws_epoll_fd = -1;
+    return -1;
+}
@@ -0,0 +1,324 @@
+#ifndef _LWS_EVENT_H_
+#define _LWS_EVENT_H_
+
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "lws_http.h"
+#include "lws_buf.h"
+#include "lws_chain.h"
+#include "lws_disk.h"
+
+/* service backends */
+#define LWS_BACKEND_THREAD      0   /* one blocking thread per connection */
+#define LWS_BACKEND_EPOLL       1   /* epoll event loop per worker thread */
+#define LWS_BACKEND_URING       2   /* io_uring event loop, falls back to epoll */
+
+/* event loops wake up at least this often for keepalive */
+#define LWS_EVENT_TICK_MS       1000
+#define LWS_EVENT_KEEPALIVE_SEC 5           /* connection table walk interval */
+#define LWS_EVENT_LINGER_SEC    30          /* a freed conn waits this long for zerocopy completions */
+
+/* listening sockets of one worker, after a hot upgrade to fewer workers */
+#define LWS_EVENT_MAX_LISTEN    16
+
+/* small writes are coalesced into output segments of this size */
+#define LWS_OUTSEG_SIZE         4096
+
+/* pending output segment, owned by the connection */
+typedef struct _lws_outseg_t_ {
+    struct _lws_outseg_t_ *next;
+    char *data;
+    int length;
+    int offset;
+    int capacity;                       /* set to length once pinned by a zerocopy send */
+    lws_buf_t *buf;                     /* shared payload data points into, or NULL */
+    int fd;                             /* file sent with sendfile, data is NULL, or -1 */
+    off_t file_offset;                  /* file position of the segment start, -1 for a pipe */
+    int zerocopy;                       /* read by a MSG_ZEROCOPY send, kept until it completes */
+    uint32_t zc_id;                     /* last zerocopy send reading the segment */
+} lws_outseg_t;
+
+/**
+ * event loop connection, shared by the epoll and io_uring backends
+**/
+typedef struct _lws_event_conn_t_ {
+    struct _lws_event_conn_t_ *next;    /* backend pending list */
+    lws_http_conn_t *http;
+    int sockfd;
+    int pending;                        /* backend private flags */
+    int inflight;                       /* backend operations in flight */
+    lws_outseg_t *out_head;
+    lws_outseg_t *out_tail;
+    int out_length;                     /* bytes queued for sending */
+    uint64_t sndbuf_check;              /* next send buffer estimate, lws_tcpinfo_sndbuf */
+    int zerocopy;                       /* large sends may use MSG_ZEROCOPY */
+    uint32_t zc_next;                   /* id of the next zerocopy send */
+    uint32_t zc_done;                   /* zerocopy sends below this id completed */
+    uint64_t zc_ahead;                  /* completed ids past zc_done + 1, out of order */
+    lws_outseg_t *zc_head;              /* sent segments the kernel may still read */
+    lws_outseg_t *zc_tail;
+    unsigned serial;                    /* tells a reused fd from the connection a post was for */
+    int wait_fd;                        /* fd the suspended handler waits for, or -1 */
+    uint64_t wait_deadline;             /* lws_metrics_now when that wait times out */
+    lws_disk_job_t *fetch;              /* cold file range the disk pool reads ahead of sendfile */
+    time_t linger_until;                /* freed with zerocopy sends in flight, closed by then */
+} lws_event_conn_t;
+
+/* shared buffer handed to the worker owning the connection */
+typedef struct _lws_event_post_t_ {
+    struct _lws_event_post_t_ *next;
+    int sockfd;
+    unsigned serial;
+    lws_buf_t *buf;
+} lws_event_post_t;
+
+/**
+ * event loop worker, one thread of the epoll and io_uring backends. Its
+ * connections are only touched by its own thread, other threads post to it.
+**/
+typedef struct _lws_event_worker_t_ {
+    int id;
+    int cpu;                            /* pinned cpu, -1 if not pinned */
+    int node;                           /* NUMA node of the cpu, -1 if unknown */
+    int listenfds[LWS_EVENT_MAX_LISTEN];
+    int listen_count;
+    int listen_shared;                  /* listeners also polled by other workers */
+    int stopped;                        /* listeners handed over by an upgrade */
+    pthread_t tid;
+    lws_event_conn_t **conns;           /* own connections indexed by socket fd */
+    int conns_max;                      /* highest fd ever bound */
+    time_t keepalive_last;
+    time_t drain_last;
+    int wakefd;                         /* eventfd, readable while posts are pending */
+    pthread_mutex_t post_lock;
+    lws_event_post_t *posts;            /* newest first */
+    int delivering;
+    lws_event_conn_t *lingering;        /* freed conns the kernel may still read pages of */
+} lws_event_worker_t;
+
+/**
+ * @func    lws_event_conn_new
+ * @brief   create event connection and bind it to sockfd
+ *
+ * @param   sockfd[in] accepted socket fd
+ * @param   send[in] backend send callback for the http connection
+ * @return  On success, return connection. On error, return NULL.
+ */
+extern lws_event_conn_t *lws_event_conn_new(int sockfd, int (*send)(int sockfd, char *data, int size));
+
+/**
+ * @func    lws_event_conn_free
+ * @brief   release event connection, pending output and socket. Segments
+ *          zerocopy sends still read are not freed under the kernel: the
+ *          socket is shut down but kept open, its http part released, and
+ *          the connection lingers until lws_event_conn_linger reaps them.
+ *
+ * @param   ec[in] event connection
+ * @return  void
+ */
+extern void lws_event_conn_free(lws_event_conn_t *ec);
+
+/**
+ * @func    lws_event_conn_linger
+ * @brief   reap a lingering connection, on its socket events and from the
+ *          keepalive walk; it is closed and released once its zerocopy
+ *          sends completed, or at linger_until with the unsent data dropped
+ *
+ * @param   ec[in] lingering connection, ec->http is NULL
+ * @param   now[in] current time in seconds, 0 to skip the deadline
+ * @return  1 if released, 0 if it still lingers.
+ */
+extern int lws_event_conn_linger(lws_event_conn_t *ec, time_t now);
+
+/**
+ * @func    lws_event_conn_get
+ * @brief   find event connection of the calling worker by socket fd
+ *
+ * @param   sockfd[in] socket fd
+ * @return  On success, return connection. Or return NULL.
+ */
+extern lws_event_conn_t *lws_event_conn_get(int sockfd);
+
+/**
+ * @func    lws_event_conn_queue
+ * @brief   copy data to the tail of connection output queue, small writes
+ *          are appended to the last segment while it has room
+ *
+ * @param   ec[in] event connection
+ * @param   data[in] output data
+ * @param   size[in] output data size
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_event_conn_queue(lws_event_conn_t *ec, const char *data, int size);
+
+/**
+ * @func    lws_event_conn_queue_ref
+ * @brief   append memory the connection does not own to its output queue,
+ *          a slice of a shared buffer or static data, without copying it
+ *
+ * @param   ec[in] event connection
+ * @param   buf[in] shared buffer data points into, a reference is taken,
+ *          or NULL for memory that outlives the connection
+ * @param   data[in] output data
+ * @param   size[in] output data size
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_event_conn_queue_ref(lws_event_conn_t *ec, lws_buf_t *buf, const char *data, int size);
+
+/**
+ * @func    lws_event_conn_queue_buf
+ * @brief   append a reference to a shared buffer to connection output queue
+ *
+ * @param   ec[in] event connection
+ * @param   buf[in] shared buffer, a reference is taken
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_event_conn_queue_buf(lws_event_conn_t *ec, lws_buf_t *buf);
+
+/**
+ * @func    lws_event_conn_queue_file
+ * @brief   append a file range to connection output queue, it is sent
+ *          with sendfile, or spliced from a pipe, and never copied to user space
+ *
+ * @param   ec[in] event connection
+ * @param   fd[in] file fd or pipe read end, owned by the queue from now on
+ * @param   offset[in] file offset, -1 for a pipe
+ * @param   size[in] bytes to send
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_event_conn_queue_file(lws_event_conn_t *ec, int fd, off_t offset, int size);
+
+/**
+ * @func    lws_event_conn_queue_chain
+ * @brief   append head and a body chain to connection output queue. The
+ *          head is copied, buffer slices and static data are referenced
+ *          and file ranges get their own descriptor, so the chain stays
+ *          with the caller.
+ *
+ * @param   ec[in] event connection
+ * @param   head[in] response header, or NULL
+ * @param   head_len[in] head length
+ * @param   chain[in] body chain
+ * @param   files[in] the backend sends file segments, otherwise file
+ *          ranges are read into memory here
+ * @return  On success, return queued bytes, On error, return -1.
+ */
+extern int lws_event_conn_queue_chain(lws_event_conn_t *ec, const char *head, int head_len, lws_chain_t *chain, int files);
+
+/**
+ * @func    lws_event_conn_consume
+ * @brief   drop sent bytes from the head of connection output queue
+ *
+ * @param   ec[in] event connection
+ * @param   size[in] sent bytes
+ * @return  void
+ */
+extern void lws_event_conn_consume(lws_event_conn_t *ec, int size);
+
+/**
+ * @func    lws_event_conn_flush
+ * @brief   write output queue to non-blocking socket with writev,
+ *          sendfile for file segments, or through the TLS session. On a
+ *          thread attached to the disk pool a file range missing from the
+ *          page cache is read there first, ec->fetch is set meanwhile.
+ *
+ * @param   ec[in] event connection
+ * @return  1 if drained, 0 if socket is full or a fetch runs, -1 on error.
+ */
+extern int lws_event_conn_flush(lws_event_conn_t *ec);
+
+/**
+ * @func    lws_event_conn_reap
+ * @brief   read MSG_ZEROCOPY completions from the socket error queue, the
+ *          backend calls it on EPOLLERR, and release the segments the
+ *          kernel is done with
+ *
+ * @param   ec[in] event connection
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_event_conn_reap(lws_event_conn_t *ec);
+
+/**
+ * @func    lws_event_conn_keepalive
+ * @brief   walk the connection table every LWS_EVENT_KEEPALIVE_SEC, ping
+ *          idle websockets and shut down dead ones, the backend then frees
+ *          them on its normal hangup path; lingering conns are reaped too
+ *
+ * @param   now[in] current time in seconds
+ * @return  void
+ */
+extern void lws_event_conn_keepalive(time_t now);
+
+/**
+ * @func    lws_event_conn_post
+ * @brief   send a shared buffer to a connection of another worker, the
+ *          buffer is queued on the owning worker and its loop woken up.
+ *          The caller keeps the connection open meanwhile, as lws_sse does
+ *          by holding its lock.
+ *
+ * @param   sockfd[in] socket fd
+ * @param   buf[in] shared buffer, a reference is taken, NULL only asks
+ * @return  bytes queued for sending, or -1.
+ */
+extern int lws_event_conn_post(int sockfd, lws_buf_t *buf);
+
+/**
+ * @func    lws_event_worker_self
+ * @brief   worker of the calling thread
+ *
+ * @return  worker, NULL outside of the event loops.
+ */
+extern lws_event_worker_t *lws_event_worker_self(void);
+
+/**
+ * @func    lws_event_worker_wake
+ * @brief   called by the backend when the worker wakefd is readable,
+ *          queue the buffers posted by other workers
+ *
+ * @return  void
+ */
+extern void lws_event_worker_wake(void);
+
+/**
+ * @func    lws_event_worker_deliver
+ * @brief   queue the buffers posted by other workers now, called before a
+ *          shared buffer is queued locally so an event stream keeps its order
+ *
+ * @return  void
+ */
+extern void lws_event_worker_deliver(void);
+
+/**
+ * @func    lws_event_upgrade_poll
+ * @brief   drive a hot upgrade from the event loop, call it at least every
+ *          LWS_EVENT_TICK_MS. After the handoff connections are shut down
+ *          as they become idle, the backend frees them on its hangup path.
+ *
+ * @return  LWS_UPGRADE_SERVING, LWS_UPGRADE_STOP_ACCEPT once per worker,
+ *          the backend must then stop accepting, or LWS_UPGRADE_DRAINING.
+ */
+extern int lws_event_upgrade_poll(void);
+
+/**
+ * @func    lws_epoll_start
+ * @brief   run epoll event loop of worker on its listen sockets
+ *
+ * @param   w[in] worker of the calling thread
+ * @return  On error, return -1. Never return on success.
+ */
+extern int lws_epoll_start(lws_event_worker_t *w);
+
+/**
+ * @func    lws_uring_start
+ * @brief   run io_uring event loop of worker on its listen sockets
+ *
+ * @param   w[in] worker of the calling thread
+ * @return  If kernel lacks required io_uring features, return -1 before
+ *          serving any connection, so caller can fall back to epoll.
+ */
+extern int lws_uring_start(lws_event_worker_t *w);
+
+#endif // _LWS_EVENT_H_
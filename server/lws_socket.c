@@ -1,31 +1,89 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 #include <sys/time.h>
+#include <time.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/sockios.h>
+#include <linux/mempolicy.h>
+#include <linux/errqueue.h>
 
 #include "lws_log.h"
 #include "lws_socket.h"
 #include "lws_http.h"
 #include "lws_http_plugin.h"
+#include "lws_metrics.h"
+#include "lws_event.h"
+#include "lws_ws.h"
+#include "lws_sse.h"
+#include "lws_tls.h"
+#include "lws_http2.h"
+#include "lws_upgrade.h"
+#include "lws_admit.h"
+#include "lws_tcpinfo.h"
+
+/* event loop workers, worker 0 runs on the main thread */
+static lws_event_worker_t *lws_event_workers = NULL;
+static int lws_event_worker_count = 0;
+static __thread lws_event_worker_t *lws_event_self = NULL;
+
+/* owning worker by socket fd, read by threads posting to a connection */
+static int *lws_event_owners = NULL;
+static int lws_event_conns_size = 0;
+static unsigned lws_event_serial = 0;
+
+/* selected service backend */
+static int lws_service_backend = LWS_BACKEND_THREAD;
+
+/* event loop workers and the cpus they are pinned to */
+static int lws_service_workers = 0;         /* 0 is one per pinned cpu */
+static cpu_set_t lws_service_cpus;
+static int lws_service_pinned = 0;
+
+/* open client connections of any backend, an upgrade drains them to 0 */
+static int lws_service_conns = 0;
+
+/* admission limits */
+static int lws_service_max_conns = 0;       /* 0 is unlimited */
+static int lws_service_backlog = LWS_SOCKET_BACKLOG;
+
+/* accept path, applied to the listeners */
+static int lws_service_defer_sec = LWS_SOCKET_DEFER_SEC;
+static int lws_service_fastopen = 0;        /* TFO queue length, 0 is off */
+
+/* writes of at least this many queued bytes use MSG_ZEROCOPY, 0 is off */
+static int lws_service_zerocopy = 0;
 
 /**
  * @func    lws_set_socket_reuse
  * @brief   set socket reuse attribution
  *
  * @param   sockfd[in] local socket fd
+ * @param   reuseport[in] 1 to share the port with other listeners by
+ *          SO_REUSEPORT, 0 to keep it exclusive
  * @return  On success, return 0, On error, return error code.
  */
-int lws_set_socket_reuse(int sockfd)
+int lws_set_socket_reuse(int sockfd, int reuseport)
 {
     int opt = 1;
     int ret;
@@ -36,6 +94,16 @@ int lws_set_socket_reuse(int sockfd)
         return -1;
     }
 
+    /* a second server started by mistake must fail to bind, not take half the connections */
+    if (!reuseport)
+        return 0;
+
+    ret = setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (const void *) &opt, sizeof(opt));
+    if (ret) {
+        lws_log(2, "setsockopt reuseport failed, %s\n", strerror(errno));
+        return -1;
+    }
+
     lws_log(4, "set socket reuse success\n");
     return 0;
 }
@@ -78,42 +146,23 @@ int lws_set_socket_keeplive(int socket_fd, int keep_alive, int keep_idle, int ke
     return 0;
 }
 
-int lws_socket_set_recvbuf_size(int sockfd, int size)
-{
-    int ret;
-
-    if (size < (512 * 1024)) {
-        size = 512 * 1024;
-    } else if (size > (4 * 1024 *1024)) {
-        size = 4 * 1024 *1024;
-    }
-
-    ret = setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
-    if (ret) {
-        lws_log(2, "setsockopt failed, ret: %d\n", ret);
-        return -1;
-    }
-
-    return -1;
-}
-
-int lws_socket_set_sendbuf_size(int sockfd, int size)
+/**
+ * @func    lws_set_socket_nodelay
+ * @brief   disable nagle, responses are written as header + body
+ *
+ * @param   sockfd[in] client socket fd
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_set_socket_nodelay(int sockfd)
 {
-    int ret;
-
-    if (size < (512 * 1024)) {
-        size = 512 * 1024;
-    } else if (size > (4 * 1024 *1024)) {
-        size = 4 * 1024 *1024;
-    }
+    int opt = 1;
 
-    ret = setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
-    if (ret) {
-        lws_log(2, "setsockopt failed, ret: %d\n", ret);
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt))) {
+        lws_log(2, "setsockopt nodelay failed, %s\n", strerror(errno));
         return -1;
     }
 
-    return -1;
+    return 0;
 }
 
 int lws_socket_sent_handler(int sockfd, char *data, int size)
@@ -121,8 +170,8 @@ int lws_socket_sent_handler(int sockfd, char *data, int size)
     int nleft = 0;
     int nwritten = 0;
     char *pwrite_buf = NULL;
-    struct timeval select_timeout;
-    fd_set rset;
+    uint64_t sndbuf_check = 0;
+    struct pollfd pfd;
 
     if ((sockfd <= 0) || (NULL == data) || (size < 0)) {
         printf("writen: param err.\n");
@@ -133,17 +182,20 @@ int lws_socket_sent_handler(int sockfd, char *data, int size)
     nleft = size;
 
     while(nleft > 0) {
-        select_timeout.tv_sec = 10;
-        select_timeout.tv_usec = 0;
-
-        FD_ZERO(&rset);
-        FD_SET((unsigned int)sockfd, &rset);
-        if (select(sockfd + 1, NULL, &rset, NULL, &select_timeout) <= 0) {    
-            printf("writen: select failed, %s\n", strerror(errno));
+        /* poll, select can not wait on fds above FD_SETSIZE */
+        pfd.fd = sockfd;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, 10 * 1000) <= 0) {
+            printf("writen: poll failed, %s\n", strerror(errno));
             return -1;
         }
 
-        if (-1 == (nwritten = send(sockfd, pwrite_buf, nleft, 0))) {
+        lws_tcpinfo_sndbuf(sockfd, nleft, &sndbuf_check);
+        if (lws_tls_enabled())
+            nwritten = lws_tls_write(sockfd, pwrite_buf, nleft);
+        else
+            nwritten = send(sockfd, pwrite_buf, nleft, 0);
+        if (-1 == nwritten) {
             if (EINTR == errno) {
                 printf("EINTR\n");
                 nwritten = 0;
@@ -160,6 +212,345 @@ int lws_socket_sent_handler(int sockfd, char *data, int size)
     return size;
 }
 
+/**
+ * @func    lws_socket_send_shared
+ * @brief   shared buffer send of the thread engine. There is no output
+ *          queue, so the buffer is written without blocking the publisher
+ *          and a connection whose socket cannot take it whole fails
+ *
+ * @param   sockfd[in] connection socket fd
+ * @param   buf[in] shared buffer, NULL only asks for the unsent bytes
+ * @return  bytes in the kernel send queue, or -1.
+ */
+static int lws_socket_send_shared(int sockfd, lws_buf_t *buf)
+{
+    int outq = 0;
+
+    if (buf && send(sockfd, buf->data, buf->length, MSG_DONTWAIT | MSG_NOSIGNAL) != buf->length)
+        return -1;
+
+    if (ioctl(sockfd, SIOCOUTQ, &outq) < 0)
+        return -1;
+
+    return outq;
+}
+
+/*
+ * Blocking file range send of the thread engine. It goes out in slices, the
+ * send buffer is re-tuned between them.
+ */
+static int lws_socket_send_range(int sockfd, int fd, off_t offset, int size)
+{
+    uint64_t sndbuf_check = 0;
+    ssize_t nwritten;
+    int nleft = size;
+    int chunk;
+
+    while (nleft > 0) {
+        lws_tcpinfo_sndbuf(sockfd, nleft, &sndbuf_check);
+        chunk = nleft < LWS_SOCKET_SEND_CHUNK ? nleft : LWS_SOCKET_SEND_CHUNK;
+        if (lws_tls_enabled()) {
+            nwritten = lws_tls_sendfile(sockfd, fd, offset, chunk);
+            if (nwritten > 0)
+                offset += nwritten;
+        } else {
+            nwritten = sendfile(sockfd, fd, &offset, chunk);
+        }
+
+        if (nwritten < 0 && errno == EINTR)
+            continue;
+        if (nwritten <= 0) {
+            lws_log(3, "sockfd[%d] sendfile failed, %s\n", sockfd, strerror(errno));
+            break;
+        }
+        nleft -= nwritten;
+    }
+
+    return nleft ? -1 : size;
+}
+
+/* blocking file send of the thread engine, the file is closed when done */
+static int lws_socket_send_file(int sockfd, int fd, off_t offset, int size)
+{
+    int ret;
+
+    ret = lws_socket_send_range(sockfd, fd, offset, size);
+    close(fd);
+    return ret;
+}
+
+/*
+ * Blocking gather write of the thread engine, iov is consumed. TLS gets one
+ * record per entry.
+ */
+static int lws_socket_writev(int sockfd, struct iovec *iov, int cnt)
+{
+    uint64_t sndbuf_check = 0;
+    struct msghdr msg;
+    ssize_t nwritten;
+    long nleft = 0;
+    int i;
+
+    if (lws_tls_enabled()) {
+        for (i = 0; i < cnt; i++) {
+            if (lws_socket_sent_handler(sockfd, iov[i].iov_base, iov[i].iov_len) < 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    for (i = 0; i < cnt; i++)
+        nleft += iov[i].iov_len;
+
+    while (nleft > 0) {
+        lws_tcpinfo_sndbuf(sockfd, nleft, &sndbuf_check);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        nwritten = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (nwritten < 0 && errno == EINTR)
+            continue;
+        if (nwritten <= 0) {
+            lws_log(3, "sockfd[%d] writev failed, %s\n", sockfd, strerror(errno));
+            return -1;
+        }
+
+        nleft -= nwritten;
+        while (cnt > 0 && (size_t)nwritten >= iov->iov_len) {
+            nwritten -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + nwritten;
+            iov->iov_len -= nwritten;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Blocking body chain send of the thread engine. Memory runs go out with
+ * one writev each, head included, file ranges with sendfile in between.
+ */
+static int lws_socket_send_chain(int sockfd, const char *head, int head_len, lws_chain_t *chain)
+{
+    struct iovec iov[LWS_SOCKET_IOV_MAX];
+    lws_chain_seg_t *cs;
+    int cnt = 0;
+    int i;
+
+    if (head && head_len > 0) {
+        iov[cnt].iov_base = (char *)head;
+        iov[cnt].iov_len = head_len;
+        cnt++;
+    }
+
+    for (i = 0; i < chain->count; i++) {
+        cs = &chain->segs[i];
+        if (cs->length <= 0)
+            continue;
+
+        if (cs->type != LWS_CHAIN_FILE) {
+            if (cnt == LWS_SOCKET_IOV_MAX) {
+                if (lws_socket_writev(sockfd, iov, cnt) < 0)
+                    return -1;
+                cnt = 0;
+            }
+            iov[cnt].iov_base = (char *)cs->data;
+            iov[cnt].iov_len = cs->length;
+            cnt++;
+            continue;
+        }
+
+        if (cnt > 0 && lws_socket_writev(sockfd, iov, cnt) < 0)
+            return -1;
+        cnt = 0;
+        if (lws_socket_send_range(sockfd, cs->fd, cs->offset, cs->length) < 0)
+            return -1;
+    }
+
+    if (cnt > 0 && lws_socket_writev(sockfd, iov, cnt) < 0)
+        return -1;
+
+    return (head ? head_len : 0) + chain->length;
+}
+
+/* blocking pipe send of the thread engine, the pipe is closed when drained */
+static int lws_socket_send_pipe(int sockfd, int pipefd, int size)
+{
+    uint64_t sndbuf_check = 0;
+    ssize_t nwritten;
+    int nleft = size;
+
+    while (nleft > 0) {
+        lws_tcpinfo_sndbuf(sockfd, nleft, &sndbuf_check);
+        nwritten = splice(pipefd, NULL, sockfd, NULL, nleft, SPLICE_F_MOVE);
+        if (nwritten < 0 && errno == EINTR)
+            continue;
+        if (nwritten <= 0) {
+            lws_log(3, "sockfd[%d] splice failed, %s\n", sockfd, strerror(errno));
+            break;
+        }
+        nleft -= nwritten;
+    }
+
+    close(pipefd);
+    return nleft ? -1 : size;
+}
+
+/* body splice of the thread engine, blocks until the first bytes arrive or timeout_ms passed */
+static int lws_socket_recv_pipe(int sockfd, int pipefd, int size, int timeout_ms)
+{
+    struct pollfd pfd;
+    ssize_t nread;
+    int ret;
+
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0) {
+        if (ret == 0)
+            errno = ETIMEDOUT;
+        return -1;
+    }
+
+    do {
+        nread = splice(sockfd, NULL, pipefd, NULL, size, SPLICE_F_MOVE);
+    } while (nread < 0 && errno == EINTR);
+
+    return nread;
+}
+
+/*
+ * Wind a connection down after the listeners were handed over. Websockets
+ * get a going away close, event streams are cut, the client reconnects to
+ * the new binary. Returns 1 if the connection is between requests and can
+ * be shut down now.
+ */
+static int lws_socket_drain(lws_http_conn_t *c)
+{
+    lws_http2_conn_t *h2 = c->h2;
+    lws_ws_conn_t *ws = c->ws;
+    int unread = 0;
+
+    if (c->close_flag)
+        return 0;
+
+    if (ws) {
+        if (!ws->close_sent)
+            lws_ws_close(c, LWS_WS_CLOSE_GOING_AWAY, "server upgrade");
+        return 0;
+    }
+
+    if (c->sse)
+        return 1;
+
+    /* a request already in the socket is answered first */
+    if (ioctl(c->sockfd, FIONREAD, &unread) || unread > 0)
+        return 0;
+
+    if (h2)
+        return h2->stream_count == 0 && h2->in_length == 0;
+
+    return c->recv_length == 0;
+}
+
+/**
+ * @func    lws_socket_recv
+ * @brief   recv() of a plain socket. While the adaptive admission limit runs
+ *          the data is stamped with lws_admit_stamp as of its arrival in the
+ *          kernel, so the time it waited for the service counts as queueing.
+ *
+ * @param   sockfd[in] client socket fd
+ * @param   data[out] receive buffer
+ * @param   size[in] buffer size
+ * @return  as recv().
+ */
+ssize_t lws_socket_recv(int sockfd, char *data, int size)
+{
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct timespec ts, now;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    int64_t age;
+    ssize_t n;
+
+    if (!lws_admit_delay_enabled())
+        return recv(sockfd, data, size, 0);
+
+    iov.iov_base = data;
+    iov.iov_len = size;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    n = recvmsg(sockfd, &msg, 0);
+    if (n <= 0)
+        return n;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPNS)
+            continue;
+
+        /* the stamp is wall clock time, its age carries over to the monotonic clock */
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+        clock_gettime(CLOCK_REALTIME, &now);
+        age = (int64_t)(now.tv_sec - ts.tv_sec) * 1000000000LL + (now.tv_nsec - ts.tv_nsec);
+        if (age > 0)
+            lws_admit_stamp(lws_metrics_now() - age);
+    }
+
+    return n;
+}
+
+/**
+ * @func    lws_service_admit
+ * @brief   admit a connection just accepted by any backend. Past the
+ *          connection limit the client gets the prebuilt 503 and the socket
+ *          is closed before any connection state is allocated.
+ *
+ * @param   cli_fd[in] accepted socket fd
+ * @return  On admit, return 0, Or return -1 with cli_fd closed.
+ */
+int lws_service_admit(int cli_fd)
+{
+    const char *resp;
+    char buf[1024];
+    int one = 1;
+    int len;
+
+    if (lws_service_max_conns == 0 ||
+        __atomic_load_n(&lws_service_conns, __ATOMIC_RELAXED) < lws_service_max_conns) {
+        if (lws_admit_delay_enabled() && !lws_tls_enabled())
+            setsockopt(cli_fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+        return 0;
+    }
+
+    lws_metrics_shed(LWS_METRICS_SHED_CONNS);
+
+    /* a TLS client cannot read it before a handshake, the socket is only closed */
+    if (!lws_tls_enabled()) {
+        resp = lws_admit_response(1, &len);
+        if (len > 0)
+            send(cli_fd, resp, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        /* an unread request would turn the close into a reset discarding the 503 */
+        while (recv(cli_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+            ;
+    }
+
+    lws_log(4, "sockfd[%d] over %d connections, refused\n", cli_fd, lws_service_max_conns);
+    close(cli_fd);
+    return -1;
+}
+
 /**
  * @func    lws_accept_handler
  * @brief   recv remote socket data
@@ -171,9 +562,9 @@ int lws_socket_recv_handler(int sockfd)
 {
     lws_http_conn_t *lws_http_conn;
 	int nread = 0;
-	fd_set rset;
+	struct pollfd pfd;
 	char pread_buf[4096];
-	struct timeval select_timeout;
+	int timeout_ms;
 	int ret;
 
 	if (sockfd < 0) {
@@ -181,39 +572,64 @@ int lws_socket_recv_handler(int sockfd)
 		return -1;
 	}
 
-    /* set clinet keepalive */
-	lws_set_socket_keeplive(sockfd, 1, 60, 20, 6);
-    lws_socket_set_recvbuf_size(sockfd, 2 * 1024 * 1024);
-    lws_socket_set_sendbuf_size(sockfd, 2 * 1024 * 1024);
+	if (lws_tls_enabled() && lws_tls_accept(sockfd)) {
+	    lws_log(2, "lws_tls_accept failed\n");
+	    return -1;
+	}
 
 	lws_http_conn = lws_http_conn_init(sockfd);
 	if (lws_http_conn == NULL) {
 	    lws_log(2, "lws_http_conn_init failed\n");
+	    lws_tls_free(sockfd);
 	    return -1;
 	}
 
-    /* set socket callback */
+    /* set socket callback, a TLS session must not be written by publishers */
 	lws_http_conn->send = lws_socket_sent_handler;
+	lws_http_conn->send_shared = lws_tls_enabled() ? NULL : lws_socket_send_shared;
+	lws_http_conn->send_file = lws_socket_send_file;
+	lws_http_conn->send_pipe = lws_tls_enabled() ? NULL : lws_socket_send_pipe;
+	lws_http_conn->recv_pipe = lws_tls_enabled() ? NULL : lws_socket_recv_pipe;
+	lws_http_conn->send_chain = lws_socket_send_chain;
+	lws_http_conn->blocking = 1;
 	lws_http_conn->close_flag = 0;
 
 	while (lws_http_conn->close_flag == 0) {
-		select_timeout.tv_sec = 10;
-		select_timeout.tv_usec = 0;
+		/* idle connections notice a handed over listener within a second */
+		timeout_ms = lws_upgrade_draining() ? 1000 : 10 * 1000;
 
-		FD_ZERO(&rset);
-		FD_SET(sockfd, &rset);
-		ret = select(sockfd + 1, &rset, NULL, NULL, &select_timeout);
+		/* poll, one thread per connection goes past FD_SETSIZE fds */
+		pfd.fd = sockfd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		/* records decrypted ahead are not signaled by the socket */
+		if (lws_tls_pending(sockfd) > 0) {
+			pfd.revents = POLLIN;
+			ret = 1;
+		} else {
+			ret = poll(&pfd, 1, timeout_ms);
+		}
 		if (ret < 0) {
-			lws_log(2, "select failed, fd: %d, err: %s\n", sockfd, strerror(errno));
+			if (errno == EINTR)
+				continue;
+			lws_log(2, "poll failed, fd: %d, err: %s\n", sockfd, strerror(errno));
 			break;
 		} else if (ret == 0) {
-			lws_log(4, "sockfd[%d] select timeout\n", sockfd);
+			lws_log(4, "sockfd[%d] poll timeout\n", sockfd);
+			if (lws_ws_keepalive(lws_http_conn, time(NULL)) < 0)
+				break;
+			if (lws_upgrade_draining() && lws_socket_drain(lws_http_conn))
+				break;
 			continue;
 		}
 
-		if (FD_ISSET(sockfd, &rset)) {
+		if (pfd.revents) {
 			memset(pread_buf, 0, 4096);
-			nread = recv(sockfd, pread_buf, 4096, 0);
+			lws_admit_stamp(lws_metrics_now());
+			if (lws_tls_enabled())
+				nread = lws_tls_read(sockfd, pread_buf, 4096);
+			else
+				nread = lws_socket_recv(sockfd, pread_buf, 4096);
 			if (nread < 0) {
 			    perror("recv");
 			    if (EINTR == errno) {
@@ -227,124 +643,1432 @@ int lws_socket_recv_handler(int sockfd)
 			} else {
 				lws_log(4, "recv: %s\n", pread_buf);
 				lws_http_conn_recv(lws_http_conn, pread_buf, nread);
+				if (lws_upgrade_draining() && lws_socket_drain(lws_http_conn))
+					break;
 			}
 		}
 	}
 
 	lws_http_conn_exit(lws_http_conn);
+	lws_tls_free(sockfd);
 	lws_log(3, "exit http connect sockfd: %d\n", sockfd);
 	return 0;
 }
 
-static void *lws_accept_thread(void *arg)
+static void lws_outseg_free(lws_outseg_t *seg)
 {
-    int sockfd = (int)arg;
-    int ret;
+    lws_buf_unref(seg->buf);
+    if (seg->fd >= 0)
+        close(seg->fd);
+    free(seg);
+}
 
-    if (arg == NULL) {
-        lws_log(2, "lws accept thread arg invalid\n");
+/**
+ * @func    lws_event_conn_new
+ * @brief   create event connection and bind it to sockfd
+ *
+ * @param   sockfd[in] accepted socket fd
+ * @param   send[in] backend send callback for the http connection
+ * @return  On success, return connection. On error, return NULL.
+ */
+lws_event_conn_t *lws_event_conn_new(int sockfd, int (*send)(int sockfd, char *data, int size))
+{
+    lws_event_worker_t *w = lws_event_self;
+    lws_event_conn_t *ec;
+
+    if (w == NULL || sockfd < 0 || sockfd >= lws_event_conns_size) {
+        lws_log(2, "sockfd[%d] out of range\n", sockfd);
         return NULL;
     }
 
-    lws_log(3, "start http recv sockfd: %d\n", sockfd);
-    ret = lws_socket_recv_handler(sockfd);
-    if (ret) {
-        lws_log(2, "accept handler failed, ret: %d\n", ret);
+    ec = calloc(1, sizeof(lws_event_conn_t));
+    if (ec == NULL)
+        return NULL;
+
+    ec->http = lws_http_conn_init(sockfd);
+    if (ec->http == NULL) {
+        free(ec);
+        return NULL;
     }
 
-    close(sockfd);
-    return NULL;
+    ec->sockfd = sockfd;
+    ec->wait_fd = -1;
+    ec->serial = __atomic_add_fetch(&lws_event_serial, 1, __ATOMIC_RELAXED);
+    ec->zerocopy = lws_service_zerocopy && !lws_tls_enabled();
+    ec->http->send = send;
+    w->conns[sockfd] = ec;
+    lws_event_owners[sockfd] = w->id;
+    if (sockfd > w->conns_max)
+        w->conns_max = sockfd;
+    __atomic_add_fetch(&lws_service_conns, 1, __ATOMIC_RELAXED);
+    return ec;
 }
 
 /**
- * @func    lws_service_init
- * @brief   init module resource
+ * @func    lws_event_conn_free
+ * @brief   release event connection, pending output and socket. Segments
+ *          zerocopy sends still read are not freed under the kernel: the
+ *          socket is shut down but kept open, its http part released, and
+ *          the connection lingers until lws_event_conn_linger reaps them.
  *
- * @param   void
- * @return  On success, return 0, On error, return error code.
+ * @param   ec[in] event connection
+ * @return  void
  */
-int lws_service_init(void)
+void lws_event_conn_free(lws_event_conn_t *ec)
 {
-    /* http endpoint */
-    lws_http_endpoint_register("/", 1, lws_default_handler);
-    lws_http_endpoint_register("/hello", 6, lws_hello_handler);
-    lws_http_endpoint_register("/version", 8, lws_version_handler);
+    lws_event_worker_t *w = lws_event_self;
 
-    /* load file */
-    lws_http_endpoint_register("/download", 9, lws_download_handler);
+    if (ec == NULL)
+        return;
 
-    return 0;
+    lws_event_conn_consume(ec, ec->out_length);
+    if (ec->zc_head)
+        lws_event_conn_reap(ec);
+
+    w->conns[ec->sockfd] = NULL;
+    lws_http_conn_exit(ec->http);
+    ec->http = NULL;
+    lws_tls_free(ec->sockfd);
+    lws_log(3, "exit http connect sockfd: %d\n", ec->sockfd);
+    __atomic_sub_fetch(&lws_service_conns, 1, __ATOMIC_RELAXED);
+
+    /*
+     * close() would keep transmitting from the pinned pages, the error
+     * queue of the open socket still tells when they may be freed
+     */
+    if (ec->zc_head) {
+        shutdown(ec->sockfd, SHUT_RDWR);
+        ec->linger_until = time(NULL) + LWS_EVENT_LINGER_SEC;
+        ec->next = w->lingering;
+        w->lingering = ec;
+        return;
+    }
+
+    close(ec->sockfd);
+    free(ec);
 }
 
 /**
- * @func    lws_service_start
- * @brief   start lite-web-server service
+ * @func    lws_event_conn_linger
+ * @brief   reap a lingering connection, on its socket events and from the
+ *          keepalive walk; it is closed and released once its zerocopy
+ *          sends completed, or at linger_until with the unsent data dropped
  *
- * @param   port[in] bind local port
- * @return  On success, return 0, On error, return error code.
+ * @param   ec[in] lingering connection, ec->http is NULL
+ * @param   now[in] current time in seconds, 0 to skip the deadline
+ * @return  1 if released, 0 if it still lingers.
  */
-int lws_service_start(short port)
+int lws_event_conn_linger(lws_event_conn_t *ec, time_t now)
 {
-    int sockfd, cli_fd;
-	struct sockaddr_in sockaddr;
-	struct sockaddr_in cli_addr;
-	unsigned int cli_addrlen = 0;
-	pthread_t tid;
-	int ret;
+    struct linger lg = {1, 0};
+    lws_event_conn_t **p;
+    lws_outseg_t *seg;
 
-    /* create local socket */
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-		lws_log(2, "socket failed: %s\n", strerror(errno));
-		return -1;
-	}
+    if (lws_event_conn_reap(ec) == 0 && ec->zc_head && (now == 0 || now < ec->linger_until))
+        return 0;
 
-	lws_log(4, "socket success, fd: %d\n", sockfd);
+    /* a reset purges the send queue, nothing is read from the segments afterwards */
+    if (ec->zc_head) {
+        lws_log(3, "sockfd[%d] zerocopy sends not completed, reset\n", ec->sockfd);
+        setsockopt(ec->sockfd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    close(ec->sockfd);
 
-    /* socket attribution before start accept */
-	lws_set_socket_reuse(sockfd);
+    while ((seg = ec->zc_head) != NULL) {
+        ec->zc_head = seg->next;
+        lws_outseg_free(seg);
+    }
 
-    /* bind local port */
-	sockaddr.sin_family = AF_INET;
-	sockaddr.sin_port = htons(port);
-	sockaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	ret = bind(sockfd, (struct sockaddr *)&sockaddr, sizeof(sockaddr));
-	if (ret) {
-		lws_log(2, "bind failed, ret: %s\n", strerror(errno));
-		close(sockfd);
-		return -1;
-	}
+    for (p = &lws_event_self->lingering; *p; p = &(*p)->next) {
+        if (*p == ec) {
+            *p = ec->next;
+            break;
+        }
+    }
+    free(ec);
+    return 1;
+}
 
-    lws_log(4, "bind success, start listen\n");
+/**
+ * @func    lws_event_conn_get
+ * @brief   find event connection by socket fd
+ *
+ * @param   sockfd[in] socket fd
+ * @return  On success, return connection. Or return NULL.
+ */
+lws_event_conn_t *lws_event_conn_get(int sockfd)
+{
+    if (lws_event_self == NULL || sockfd < 0 || sockfd >= lws_event_conns_size)
+        return NULL;
 
-    /* set listen client count */
-	ret = listen(sockfd, 128);
-	if (ret) {
-		lws_log(2, "listen failed, ret: %s\n", strerror(errno));
-		close(sockfd);
-		return -1;
-	}
+    return lws_event_self->conns[sockfd];
+}
 
-	lws_log(4, "listen succes, start accept\n");
+/**
+ * @func    lws_event_conn_keepalive
+ * @brief   walk the connection table every LWS_EVENT_KEEPALIVE_SEC, ping
+ *          idle websockets and shut down dead ones, the backend then frees
+ *          them on its normal hangup path; lingering conns are reaped too
+ *
+ * @param   now[in] current time in seconds
+ * @return  void
+ */
+void lws_event_conn_keepalive(time_t now)
+{
+    lws_event_worker_t *w = lws_event_self;
+    lws_event_conn_t *ec, *next;
+    int fd;
 
-	while (1) {
-	    /* start accept linkage */
-		cli_fd = accept(sockfd, (struct sockaddr *)&cli_addr, &cli_addrlen);
-		if (cli_fd < 0) {
-			lws_log(2, "accept failed, ret: %s\n", strerror(errno));
-			continue;
-		}
+    if (now - w->keepalive_last < LWS_EVENT_KEEPALIVE_SEC)
+        return;
+    w->keepalive_last = now;
 
-        /* create thread to handle clinet message */
-		ret = pthread_create(&tid, NULL, (void *)lws_accept_thread, (void *)cli_fd);
-		if (ret) {
-			lws_log(2, "create thread failed, ret: %d-%s\n", ret, strerror(errno));
-			close(cli_fd);
-			continue;
-		}
-	}
+    for (ec = w->lingering; ec; ec = next) {
+        next = ec->next;
+        lws_event_conn_linger(ec, now);
+    }
 
-	close(sockfd);
-    return 0;
+    for (fd = 0; fd <= w->conns_max; fd++) {
+        ec = w->conns[fd];
+        if (ec == NULL || ec->http->ws == NULL || ec->http->close_flag)
+            continue;
+
+        if (lws_ws_keepalive(ec->http, now) < 0)
+            shutdown(fd, SHUT_RDWR);
+    }
 }
 
+/* shut down connections between requests once a second while draining */
+static void lws_event_conn_drain(lws_event_worker_t *w, time_t now)
+{
+    lws_event_conn_t *ec;
+    int fd;
+
+    if (now == w->drain_last)
+        return;
+    w->drain_last = now;
+
+    for (fd = 0; fd <= w->conns_max; fd++) {
+        ec = w->conns[fd];
+        if (ec && ec->out_head == NULL && lws_socket_drain(ec->http))
+            shutdown(fd, SHUT_RDWR);
+    }
+}
+
+/**
+ * @func    lws_event_upgrade_poll
+ * @brief   drive a hot upgrade from the event loop, call it at least every
+ *          LWS_EVENT_TICK_MS. After the handoff connections are shut down
+ *          as they become idle, the backend frees them on its hangup path.
+ *
+ * @return  LWS_UPGRADE_SERVING, LWS_UPGRADE_STOP_ACCEPT once per worker,
+ *          the backend must then stop accepting, or LWS_UPGRADE_DRAINING.
+ */
+int lws_event_upgrade_poll(void)
+{
+    lws_event_worker_t *w = lws_event_self;
+
+    /* the first worker drives the upgrade, all of them drain their connections */
+    if (w->id == 0)
+        lws_upgrade_poll(__atomic_load_n(&lws_service_conns, __ATOMIC_RELAXED));
+
+    if (!lws_upgrade_draining())
+        return LWS_UPGRADE_SERVING;
+
+    lws_event_conn_drain(w, time(NULL));
+    if (w->stopped)
+        return LWS_UPGRADE_DRAINING;
+
+    w->stopped = 1;
+    return LWS_UPGRADE_STOP_ACCEPT;
+}
+
+/**
+ * @func    lws_event_conn_post
+ * @brief   send a shared buffer to a connection of another worker, the
+ *          buffer is queued on the owning worker and its loop woken up.
+ *          The caller keeps the connection open meanwhile, as lws_sse does
+ *          by holding its lock.
+ *
+ * @param   sockfd[in] socket fd
+ * @param   buf[in] shared buffer, a reference is taken, NULL only asks
+ * @return  bytes queued for sending, or -1.
+ */
+int lws_event_conn_post(int sockfd, lws_buf_t *buf)
+{
+    lws_event_worker_t *w;
+    lws_event_conn_t *ec;
+    lws_event_post_t *post;
+    uint64_t one = 1;
+
+    if (lws_event_owners == NULL || sockfd < 0 || sockfd >= lws_event_conns_size)
+        return -1;
+
+    w = &lws_event_workers[lws_event_owners[sockfd]];
+    ec = w->conns[sockfd];
+    if (w == lws_event_self || ec == NULL)
+        return -1;
+
+    if (buf) {
+        post = malloc(sizeof(lws_event_post_t));
+        if (post == NULL)
+            return -1;
+
+        post->sockfd = sockfd;
+        post->serial = ec->serial;
+        post->buf = lws_buf_ref(buf);
+
+        pthread_mutex_lock(&w->post_lock);
+        post->next = w->posts;
+        w->posts = post;
+        pthread_mutex_unlock(&w->post_lock);
+
+        if (write(w->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            lws_log(2, "worker %d wake failed, %s\n", w->id, strerror(errno));
+    }
+
+    /* changed by the owner meanwhile, good enough to spot a slow reader */
+    return __atomic_load_n(&ec->out_length, __ATOMIC_RELAXED);
+}
+
+/**
+ * @func    lws_event_worker_self
+ * @brief   worker of the calling thread
+ *
+ * @return  worker, NULL outside of the event loops.
+ */
+lws_event_worker_t *lws_event_worker_self(void)
+{
+    return lws_event_self;
+}
+
+/**
+ * @func    lws_event_worker_deliver
+ * @brief   queue the buffers posted by other workers now, called before a
+ *          shared buffer is queued locally so an event stream keeps its order
+ *
+ * @return  void
+ */
+void lws_event_worker_deliver(void)
+{
+    lws_event_worker_t *w = lws_event_self;
+    lws_event_post_t *post, *next, *list = NULL;
+    lws_event_conn_t *ec;
+
+    if (w == NULL || w->delivering || __atomic_load_n(&w->posts, __ATOMIC_RELAXED) == NULL)
+        return;
+
+    pthread_mutex_lock(&w->post_lock);
+    post = w->posts;
+    w->posts = NULL;
+    pthread_mutex_unlock(&w->post_lock);
+
+    /* oldest first */
+    for (; post; post = next) {
+        next = post->next;
+        post->next = list;
+        list = post;
+    }
+
+    w->delivering = 1;
+    for (post = list; post; post = next) {
+        next = post->next;
+        ec = w->conns[post->sockfd];
+        if (ec && ec->serial == post->serial && ec->http->send_shared(post->sockfd, post->buf) < 0)
+            shutdown(post->sockfd, SHUT_RDWR);
+        lws_buf_unref(post->buf);
+        free(post);
+    }
+    w->delivering = 0;
+}
+
+/**
+ * @func    lws_event_worker_wake
+ * @brief   called by the backend when the worker wakefd is readable,
+ *          queue the buffers posted by other workers
+ *
+ * @return  void
+ */
+void lws_event_worker_wake(void)
+{
+    uint64_t count;
+
+    if (read(lws_event_self->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        lws_log(2, "worker %d wakefd read failed, %s\n", lws_event_self->id, strerror(errno));
+
+    lws_event_worker_deliver();
+}
+
+/**
+ * @func    lws_event_conn_queue
+ * @brief   copy data to the tail of connection output queue, small writes
+ *          are appended to the last segment while it has room
+ *
+ * @param   ec[in] event connection
+ * @param   data[in] output data
+ * @param   size[in] output data size
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_event_conn_queue(lws_event_conn_t *ec, const char *data, int size)
+{
+    lws_outseg_t *seg;
+    int capacity;
+
+    if (size <= 0)
+        return 0;
+
+    seg = ec->out_tail;
+    if (seg && seg->capacity - seg->length >= size) {
+        memcpy(seg->data + seg->length, data, size);
+        seg->length += size;
+        ec->out_length += size;
+        return 0;
+    }
+
+    capacity = (size < LWS_OUTSEG_SIZE) ? LWS_OUTSEG_SIZE : size;
+    seg = malloc(sizeof(lws_outseg_t) + capacity);
+    if (seg == NULL) {
+        lws_log(2, "malloc output segment failed, size: %d\n", size);
+        return -1;
+    }
+
+    seg->next = NULL;
+    seg->data = (char *)(seg + 1);
+    seg->length = size;
+    seg->offset = 0;
+    seg->capacity = capacity;
+    seg->buf = NULL;
+    seg->fd = -1;
+    seg->zerocopy = 0;
+    memcpy(seg->data, data, size);
+
+    if (ec->out_tail)
+        ec->out_tail->next = seg;
+    else
+        ec->out_head = seg;
+    ec->out_tail = seg;
+    ec->out_length += size;
+
+    return 0;
+}
+
+/**
+ * @func    lws_event_conn_queue_ref
+ * @brief   append memory the connection does not own to its output queue,
+ *          a slice of a shared buffer or static data, without copying it
+ *
+ * @param   ec[in] event connection
+ * @param   buf[in] shared buffer data points into, a reference is taken,
+ *          or NULL for memory that outlives the connection
+ * @param   data[in] output data
+ * @param   size[in] output data size
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_event_conn_queue_ref(lws_event_conn_t *ec, lws_buf_t *buf, const char *data, int size)
+{
+    lws_outseg_t *seg;
+
+    if (size <= 0)
+        return 0;
+
+    seg = malloc(sizeof(lws_outseg_t));
+    if (seg == NULL)
+        return -1;
+
+    /* full capacity, nothing is ever appended to shared data */
+    seg->next = NULL;
+    seg->data = (char *)data;
+    seg->length = size;
+    seg->offset = 0;
+    seg->capacity = size;
+    seg->buf = buf ? lws_buf_ref(buf) : NULL;
+    seg->fd = -1;
+    seg->zerocopy = 0;
+
+    if (ec->out_tail)
+        ec->out_tail->next = seg;
+    else
+        ec->out_head = seg;
+    ec->out_tail = seg;
+    ec->out_length += size;
+
+    return 0;
+}
+
+/**
+ * @func    lws_event_conn_queue_buf
+ * @brief   append a reference to a shared buffer to connection output queue
+ *
+ * @param   ec[in] event connection
+ * @param   buf[in] shared buffer, a reference is taken
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_event_conn_queue_buf(lws_event_conn_t *ec, lws_buf_t *buf)
+{
+    return lws_event_conn_queue_ref(ec, buf, buf->data, buf->length);
+}
+
+/**
+ * @func    lws_event_conn_queue_file
+ * @brief   append a file range to connection output queue, it is sent
+ *          with sendfile, or spliced from a pipe, and never copied to user space
+ *
+ * @param   ec[in] event connection
+ * @param   fd[in] file fd or pipe read end, owned by the queue from now on
+ * @param   offset[in] file offset, -1 for a pipe
+ * @param   size[in] bytes to send
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_event_conn_queue_file(lws_event_conn_t *ec, int fd, off_t offset, int size)
+{
+    lws_outseg_t *seg;
+
+    if (size <= 0) {
+        close(fd);
+        return 0;
+    }
+
+    seg = malloc(sizeof(lws_outseg_t));
+    if (seg == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    seg->next = NULL;
+    seg->data = NULL;
+    seg->length = size;
+    seg->offset = 0;
+    seg->capacity = size;
+    seg->buf = NULL;
+    seg->fd = fd;
+    seg->file_offset = offset;
+    seg->zerocopy = 0;
+
+    if (ec->out_tail)
+        ec->out_tail->next = seg;
+    else
+        ec->out_head = seg;
+    ec->out_tail = seg;
+    ec->out_length += size;
+
+    return 0;
+}
+
+/**
+ * @func    lws_event_conn_queue_chain
+ * @brief   append head and a body chain to connection output queue. The
+ *          head is copied, buffer slices and static data are referenced
+ *          and file ranges get their own descriptor, so the chain stays
+ *          with the caller.
+ *
+ * @param   ec[in] event connection
+ * @param   head[in] response header, or NULL
+ * @param   head_len[in] head length
+ * @param   chain[in] body chain
+ * @param   files[in] the backend sends file segments, otherwise file
+ *          ranges are read into memory here
+ * @return  On success, return queued bytes, On error, return -1.
+ */
+int lws_event_conn_queue_chain(lws_event_conn_t *ec, const char *head, int head_len, lws_chain_t *chain, int files)
+{
+    lws_chain_seg_t *cs;
+    lws_buf_t *buf;
+    int i, fd, ret;
+
+    if (head && lws_event_conn_queue(ec, head, head_len))
+        return -1;
+
+    for (i = 0; i < chain->count; i++) {
+        cs = &chain->segs[i];
+        if (cs->length <= 0)
+            continue;
+
+        if (cs->type != LWS_CHAIN_FILE) {
+            ret = lws_event_conn_queue_ref(ec, cs->buf, cs->data, cs->length);
+        } else if (files) {
+            fd = fcntl(cs->fd, F_DUPFD_CLOEXEC, 0);
+            ret = (fd < 0) ? -1 : lws_event_conn_queue_file(ec, fd, cs->offset, cs->length);
+        } else {
+            buf = lws_buf_new(cs->length);
+            ret = -1;
+            if (buf && lws_chain_pread(cs->fd, buf->data, cs->offset, cs->length) == cs->length) {
+                buf->length = cs->length;
+                ret = lws_event_conn_queue_buf(ec, buf);
+            }
+            lws_buf_unref(buf);
+        }
+
+        if (ret < 0) {
+            lws_log(2, "sockfd[%d] queue body chain failed\n", ec->sockfd);
+            return -1;
+        }
+    }
+
+    return (head ? head_len : 0) + chain->length;
+}
+
+/**
+ * @func    lws_event_conn_consume
+ * @brief   drop sent bytes from the head of connection output queue
+ *
+ * @param   ec[in] event connection
+ * @param   size[in] sent bytes
+ * @return  void
+ */
+void lws_event_conn_consume(lws_event_conn_t *ec, int size)
+{
+    lws_outseg_t *seg;
+    int left;
+
+    ec->out_length -= size;
+    while (size > 0 && (seg = ec->out_head) != NULL) {
+        left = seg->length - seg->offset;
+        if (size < left) {
+            seg->offset += size;
+            break;
+        }
+
+        size -= left;
+        ec->out_head = seg->next;
+        if (ec->out_head == NULL)
+            ec->out_tail = NULL;
+
+        /* the kernel reads it until the zerocopy send completes */
+        if (seg->zerocopy && (int32_t)(seg->zc_id - ec->zc_done) >= 0) {
+            seg->next = NULL;
+            if (ec->zc_tail)
+                ec->zc_tail->next = seg;
+            else
+                ec->zc_head = seg;
+            ec->zc_tail = seg;
+            continue;
+        }
+        lws_outseg_free(seg);
+    }
+}
+
+/* completed zerocopy sends lo to hi, in order unless a retransmit held one back */
+static void lws_event_conn_complete(lws_event_conn_t *ec, uint32_t lo, uint32_t hi)
+{
+    uint32_t id;
+
+    for (id = lo; (int32_t)(hi - id) >= 0; id++) {
+        if ((int32_t)(id - ec->zc_done) < 0)
+            continue;
+
+        if (id - ec->zc_done > 64) {
+            /* too far out of order to track, assume the ones before are done too */
+            lws_log(3, "sockfd[%d] zerocopy completion %u far ahead of %u\n", ec->sockfd, id, ec->zc_done);
+            ec->zc_done = id + 1;
+            ec->zc_ahead = 0;
+            continue;
+        }
+
+        if (id == ec->zc_done) {
+            ec->zc_done++;
+            while (ec->zc_ahead & 1) {
+                ec->zc_ahead >>= 1;
+                ec->zc_done++;
+            }
+            ec->zc_ahead >>= 1;
+        } else {
+            ec->zc_ahead |= 1ULL << (id - ec->zc_done - 1);
+        }
+    }
+}
+
+/**
+ * @func    lws_event_conn_reap
+ * @brief   read MSG_ZEROCOPY completions from the socket error queue, the
+ *          backend calls it on EPOLLERR, and release the segments the
+ *          kernel is done with
+ *
+ * @param   ec[in] event connection
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_event_conn_reap(lws_event_conn_t *ec)
+{
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+    struct sock_extended_err *serr;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    lws_outseg_t *seg;
+
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(ec->sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                break;
+            lws_log(3, "sockfd[%d] read error queue failed, %s\n", ec->sockfd, strerror(errno));
+            return -1;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+
+            serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+                continue;
+
+            /* the kernel copied after all, loopback does, pinning pages only costs then */
+            if ((serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && ec->zerocopy) {
+                lws_log(4, "sockfd[%d] zerocopy sends were copied, send with copies\n", ec->sockfd);
+                ec->zerocopy = 0;
+            }
+            lws_event_conn_complete(ec, serr->ee_info, serr->ee_data);
+        }
+    }
+
+    /* parked in send order, a segment waits for the last send reading it */
+    while ((seg = ec->zc_head) != NULL && (int32_t)(seg->zc_id - ec->zc_done) < 0) {
+        ec->zc_head = seg->next;
+        if (ec->zc_head == NULL)
+            ec->zc_tail = NULL;
+        lws_outseg_free(seg);
+    }
+
+    return 0;
+}
+
+/* hand a cold file range of the queue head to the disk pool, the backend resumes flushing once it is back */
+static int lws_event_conn_fetch(lws_event_conn_t *ec, int fd, off_t offset, int size)
+{
+    lws_disk_job_t *job;
+
+    job = malloc(sizeof(lws_disk_job_t));
+    if (job == NULL)
+        return -1;
+
+    job->fd = fd;
+    job->buf = NULL;
+    job->offset = offset;
+    job->size = size;
+    job->co = NULL;
+    job->arg = ec;
+    if (lws_disk_submit(job)) {
+        free(job);
+        return -1;
+    }
+
+    ec->fetch = job;
+    return 0;
+}
+
+/* mark the segments a zerocopy send of size bytes read, from the queue head */
+static void lws_event_conn_pin(lws_event_conn_t *ec, ssize_t size)
+{
+    lws_outseg_t *seg;
+
+    for (seg = ec->out_head; seg && size > 0; seg = seg->next) {
+        seg->zerocopy = 1;
+        seg->zc_id = ec->zc_next;
+        seg->capacity = seg->length;    /* pinned, no more appends */
+        size -= seg->length - seg->offset;
+    }
+    ec->zc_next++;
+}
+
+/**
+ * @func    lws_event_conn_flush
+ * @brief   write output queue to non-blocking socket with writev,
+ *          sendfile for file segments, or through the TLS session. On a
+ *          thread attached to the disk pool a file range missing from the
+ *          page cache is read there first, ec->fetch is set meanwhile.
+ *
+ * @param   ec[in] event connection
+ * @return  1 if drained, 0 if socket is full or a fetch runs, -1 on error.
+ */
+int lws_event_conn_flush(lws_event_conn_t *ec)
+{
+    struct iovec iov[16];
+    struct msghdr msg;
+    lws_outseg_t *seg;
+    ssize_t nwritten;
+    off_t offset;
+    int cnt, bytes, flags;
+
+    while ((seg = ec->out_head) != NULL) {
+        if (seg->fd >= 0 && seg->file_offset < 0) {
+            /* pipe segment, never queued on TLS connections */
+            nwritten = splice(seg->fd, NULL, ec->sockfd, NULL, seg->length - seg->offset,
+                              SPLICE_F_MOVE | SPLICE_F_NONBLOCK | (seg->next ? SPLICE_F_MORE : 0));
+            if (nwritten == 0) {
+                lws_log(3, "sockfd[%d] pipe segment truncated\n", ec->sockfd);
+                return -1;
+            }
+        } else if (seg->fd >= 0) {
+            /* file segment, zero-copy unless TLS is encrypted in user space */
+            offset = seg->file_offset + seg->offset;
+            bytes = seg->length - seg->offset;
+            if (lws_disk_attached()) {
+                if (ec->fetch)
+                    return 0;
+                /* sendfile blocks the loop on a page cache miss, a window at a time is probed */
+                if (bytes > LWS_DISK_WINDOW)
+                    bytes = LWS_DISK_WINDOW;
+                if (!lws_disk_resident(seg->fd, offset, bytes) && lws_event_conn_fetch(ec, seg->fd, offset, bytes) == 0)
+                    return 0;
+            }
+            if (lws_tls_enabled())
+                nwritten = lws_tls_sendfile(ec->sockfd, seg->fd, offset, bytes);
+            else
+                nwritten = sendfile(ec->sockfd, seg->fd, &offset, bytes);
+            if (nwritten == 0) {
+                lws_log(3, "sockfd[%d] file segment truncated\n", ec->sockfd);
+                return -1;
+            }
+        } else if (lws_tls_enabled()) {
+            /* one record per segment, a retry must pass the same data again */
+            nwritten = lws_tls_write(ec->sockfd, seg->data + seg->offset, seg->length - seg->offset);
+        } else {
+            cnt = 0;
+            bytes = 0;
+            for (; seg && seg->fd < 0 && cnt < ARRAY_SIZE(iov); seg = seg->next) {
+                iov[cnt].iov_base = seg->data + seg->offset;
+                iov[cnt].iov_len = seg->length - seg->offset;
+                bytes += iov[cnt].iov_len;
+                cnt++;
+            }
+
+            /* pinning pages only beats copying them for large sends */
+            flags = MSG_NOSIGNAL;
+            if (ec->zerocopy && bytes >= lws_service_zerocopy)
+                flags |= MSG_ZEROCOPY;
+
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = cnt;
+            nwritten = sendmsg(ec->sockfd, &msg, flags);
+
+            /* out of locked memory or notification space, copy this one */
+            if (nwritten < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY))
+                nwritten = sendmsg(ec->sockfd, &msg, MSG_NOSIGNAL);
+            else if (nwritten > 0 && (flags & MSG_ZEROCOPY))
+                lws_event_conn_pin(ec, nwritten);
+        }
+        if (nwritten < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                lws_tcpinfo_sndbuf(ec->sockfd, ec->out_length, &ec->sndbuf_check);
+                return 0;
+            }
+
+            lws_log(3, "sockfd[%d] send failed, %s\n", ec->sockfd, strerror(errno));
+            return -1;
+        }
+
+        lws_event_conn_consume(ec, (int)nwritten);
+    }
+
+    return 1;
+}
+
+static void *lws_accept_thread(void *arg)
+{
+    int sockfd = (int)arg;
+    int ret;
+
+    if (arg == NULL) {
+        lws_log(2, "lws accept thread arg invalid\n");
+        return NULL;
+    }
+
+    /* buffers of the connection come from the node it runs on */
+    if (lws_service_pinned)
+        syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0);
+
+    lws_log(3, "start http recv sockfd: %d\n", sockfd);
+    ret = lws_socket_recv_handler(sockfd);
+    if (ret) {
+        lws_log(2, "accept handler failed, ret: %d\n", ret);
+    }
+
+    close(sockfd);
+    __atomic_sub_fetch(&lws_service_conns, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/* endpoints any client could misuse, off until lws_service_enable */
+static const struct {
+    const char *uri;
+    lws_event_handler_t handler;
+} lws_service_optional[] = {
+    {"/publish", lws_publish_handler},
+    {"/tcpinfo", lws_tcpinfo_handler},
+    {"/upload", lws_upload_handler},
+};
+
+/**
+ * @func    lws_service_enable
+ * @brief   register an optional endpoint, unauthenticated clients can use
+ *          it once enabled
+ *
+ * @param   uri[in] "/publish", "/tcpinfo" or "/upload"
+ * @return  On success, return 0. If uri is not an optional endpoint, return -1.
+ */
+int lws_service_enable(const char *uri)
+{
+    int i;
+
+    for (i = 0; i < (int)ARRAY_SIZE(lws_service_optional); i++) {
+        if (strcmp(uri, lws_service_optional[i].uri) == 0) {
+            lws_http_endpoint_register(lws_service_optional[i].uri, strlen(lws_service_optional[i].uri),
+                                       lws_service_optional[i].handler);
+            return 0;
+        }
+    }
+
+    lws_log(2, "no optional endpoint: %s\n", uri);
+    return -1;
+}
+
+/**
+ * @func    lws_service_init
+ * @brief   init module resource
+ *
+ * @param   void
+ * @return  On success, return 0, On error, return error code.
+ */
+int lws_service_init(void)
+{
+    /* http endpoint */
+    lws_http_endpoint_register("/", 1, lws_default_handler);
+    lws_http_endpoint_register("/hello", 6, lws_hello_handler);
+    lws_http_endpoint_register("/version", 8, lws_version_handler);
+
+    /* load file */
+    lws_http_endpoint_register("/download", 9, lws_download_handler);
+
+    /* websocket echo */
+    lws_http_endpoint_register("/echo", 5, lws_echo_handler);
+
+    /* event stream, fed by /publish once enabled */
+    lws_sse_endpoint_register("/events", 7, LWS_SSE_SKIP);
+
+    /* service metrics */
+    lws_http_endpoint_register("/metrics", 8, lws_metrics_handler);
+
+    return 0;
+}
+
+/**
+ * @func    lws_service_set_backend
+ * @brief   select service backend before lws_service_start
+ *
+ * @param   backend[in] LWS_BACKEND_THREAD, LWS_BACKEND_EPOLL or LWS_BACKEND_URING
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_service_set_backend(int backend)
+{
+    if (backend < LWS_BACKEND_THREAD || backend > LWS_BACKEND_URING) {
+        lws_log(2, "unknown backend: %d\n", backend);
+        return -1;
+    }
+
+    lws_service_backend = backend;
+    return 0;
+}
+
+/**
+ * @func    lws_service_set_limits
+ * @brief   set connection admission before lws_service_start
+ *
+ * @param   max_conns[in] open connections, later ones get a 503, 0 is unlimited
+ * @param   backlog[in] listen queue length, 0 is LWS_SOCKET_BACKLOG
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_service_set_limits(int max_conns, int backlog)
+{
+    FILE *fp;
+    int somaxconn = 0;
+
+    if (max_conns < 0 || backlog < 0)
+        return -1;
+
+    lws_service_max_conns = max_conns;
+    lws_service_backlog = backlog ? backlog : LWS_SOCKET_BACKLOG;
+
+    /* the kernel silently caps the queue */
+    fp = fopen("/proc/sys/net/core/somaxconn", "r");
+    if (fp) {
+        if (fscanf(fp, "%d", &somaxconn) == 1 && somaxconn < lws_service_backlog)
+            lws_log(3, "listen backlog %d capped by net.core.somaxconn %d\n", lws_service_backlog, somaxconn);
+        fclose(fp);
+    }
+
+    return 0;
+}
+
+/**
+ * @func    lws_service_set_accept
+ * @brief   set accept path options of the listeners before lws_service_start
+ *
+ * @param   defer_sec[in] wait for the request up to defer_sec before a
+ *          connection is accepted, 0 accepts on handshake
+ * @param   fastopen[in] TCP Fast Open queue length, 0 is off
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_service_set_accept(int defer_sec, int fastopen)
+{
+    FILE *fp;
+    int mode = 0;
+
+    if (defer_sec < 0 || fastopen < 0)
+        return -1;
+
+    lws_service_defer_sec = defer_sec;
+    lws_service_fastopen = fastopen;
+
+    /* the server side needs bit 2 of the sysctl, distributions only set the client bit */
+    fp = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r");
+    if (fp) {
+        if (fastopen && fscanf(fp, "%i", &mode) == 1 && !(mode & 2))
+            lws_log(3, "fast open needs net.ipv4.tcp_fastopen=3, it is %d\n", mode);
+        fclose(fp);
+    }
+
+    return 0;
+}
+
+/**
+ * @func    lws_service_set_zerocopy
+ * @brief   send queued responses of at least threshold bytes with
+ *          MSG_ZEROCOPY before lws_service_start, epoll backend only
+ *
+ * @param   threshold[in] bytes per send, 0 is off
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_service_set_zerocopy(int threshold)
+{
+    if (threshold < 0)
+        return -1;
+
+    lws_service_zerocopy = threshold;
+    return 0;
+}
+
+/**
+ * @func    lws_service_set_workers
+ * @brief   set event loop threads and their cpus before lws_service_start.
+ *          Workers are pinned one per cpu and get their own listener, steered
+ *          with SO_INCOMING_CPU, connection threads of the thread engine run
+ *          on the cpu that received their packets.
+ *
+ * @param   workers[in] epoll/io_uring workers, 0 is one per cpu, or 1
+ * @param   cpus[in] "0-3,8" cpu list, NULL to leave placement to the scheduler
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_service_set_workers(int workers, const char *cpus)
+{
+    cpu_set_t allowed;
+    const char *p = cpus;
+    char *end;
+    long first, last;
+
+    if (workers < 0) {
+        lws_log(2, "invalid workers: %d\n", workers);
+        return -1;
+    }
+    lws_service_workers = workers;
+
+    if (cpus == NULL)
+        return 0;
+
+    CPU_ZERO(&lws_service_cpus);
+    while (*p) {
+        first = strtol(p, &end, 10);
+        last = first;
+        if (end != p && *end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        if (end == p || first < 0 || last < first || last >= CPU_SETSIZE || (*end && *end != ',')) {
+            lws_log(2, "invalid cpu list: %s\n", cpus);
+            return -1;
+        }
+        for (; first <= last; first++)
+            CPU_SET(first, &lws_service_cpus);
+        p = *end ? end + 1 : end;
+    }
+
+    /* drop cpus outside of the process mask, e.g. of a container */
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        CPU_AND(&lws_service_cpus, &lws_service_cpus, &allowed);
+    if (CPU_COUNT(&lws_service_cpus) == 0) {
+        lws_log(2, "no usable cpu in list: %s\n", cpus);
+        return -1;
+    }
+
+    lws_service_pinned = 1;
+    return 0;
+}
+
+/* n-th cpu of the pinned set, round robin */
+static int lws_service_cpu(int n)
+{
+    int cpu;
+
+    n %= CPU_COUNT(&lws_service_cpus);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &lws_service_cpus) && n-- == 0)
+            return cpu;
+    }
+
+    return -1;
+}
+
+/*
+ * Pin the calling worker, its table, buffers and ring are then allocated
+ * on the local NUMA node. Runs on the worker thread before the loop starts.
+ */
+static int lws_event_worker_place(lws_event_worker_t *w)
+{
+    cpu_set_t set;
+    unsigned cpu, node;
+    const char *memory = "default";
+    int steered = 0;
+    int i;
+
+    lws_event_self = w;
+    w->node = -1;
+
+    if (w->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+            lws_log(2, "worker %d pin to cpu %d failed\n", w->id, w->cpu);
+            w->cpu = -1;
+        }
+    }
+
+    if (w->cpu >= 0) {
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+            w->node = (int)node;
+        if (syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0) == 0)
+            memory = "node-local";
+
+        /* connections received on this cpu are queued to this worker's listener */
+        for (i = 0; i < w->listen_count && !w->listen_shared; i++) {
+            if (setsockopt(w->listenfds[i], SOL_SOCKET, SO_INCOMING_CPU, &w->cpu, sizeof(w->cpu)) == 0)
+                steered++;
+        }
+    }
+
+    w->conns = calloc(lws_event_conns_size, sizeof(lws_event_conn_t *));
+    w->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (w->conns == NULL || w->wakefd < 0) {
+        lws_log(2, "worker %d init failed, %s\n", w->id, strerror(errno));
+        return -1;
+    }
+
+    if (w->cpu >= 0)
+        lws_log(3, "worker %d: cpu %d, node %d, memory %s, %d listeners%s\n", w->id, w->cpu, w->node,
+                memory, w->listen_count, steered ? ", steered by SO_INCOMING_CPU" : (w->listen_shared ? " shared" : ""));
+    else
+        lws_log(3, "worker %d: unpinned, %d listeners%s\n", w->id, w->listen_count, w->listen_shared ? " shared" : "");
+    return 0;
+}
+
+static void *lws_event_worker_run(void *arg)
+{
+    lws_event_worker_t *w = arg;
+
+    if (lws_event_worker_place(w))
+        exit(1);
+
+    if (lws_service_backend == LWS_BACKEND_URING) {
+        lws_uring_start(w);
+        lws_log(3, "worker %d io_uring unavailable, fall back to epoll\n", w->id);
+    }
+
+    lws_epoll_start(w);
+    lws_log(2, "worker %d event loop failed\n", w->id);
+    exit(1);
+    return NULL;
+}
+
+/*
+ * Split the listeners among the workers. Each gets its own unless an
+ * upgrade handed over fewer than there are workers, then they share.
+ */
+static int lws_event_workers_start(const int *fds, int count, int workers)
+{
+    struct rlimit rlim;
+    lws_event_worker_t *w;
+    int i;
+
+    if (getrlimit(RLIMIT_NOFILE, &rlim) || rlim.rlim_cur == RLIM_INFINITY)
+        rlim.rlim_cur = 65536;
+    lws_event_conns_size = (int)rlim.rlim_cur;
+
+    lws_event_owners = calloc(lws_event_conns_size, sizeof(int));
+    lws_event_workers = calloc(workers, sizeof(lws_event_worker_t));
+    if (lws_event_owners == NULL || lws_event_workers == NULL)
+        return -1;
+    lws_event_worker_count = workers;
+
+    for (i = 0; i < workers; i++) {
+        w = &lws_event_workers[i];
+        w->id = i;
+        w->cpu = lws_service_pinned ? lws_service_cpu(i) : -1;
+        w->conns_max = -1;
+        w->wakefd = -1;
+        pthread_mutex_init(&w->post_lock, NULL);
+    }
+
+    for (i = 0; i < count; i++) {
+        w = &lws_event_workers[i % workers];
+        if (w->listen_count < LWS_EVENT_MAX_LISTEN)
+            w->listenfds[w->listen_count++] = fds[i];
+    }
+    for (i = count; i < workers; i++) {
+        w = &lws_event_workers[i];
+        w->listenfds[w->listen_count++] = fds[i % count];
+        w->listen_shared = 1;
+        lws_event_workers[i % count].listen_shared = 1;
+    }
+
+    for (i = 1; i < workers; i++) {
+        w = &lws_event_workers[i];
+        if (pthread_create(&w->tid, NULL, lws_event_worker_run, w)) {
+            lws_log(2, "create worker %d failed, %s\n", i, strerror(errno));
+            return -1;
+        }
+    }
+
+    lws_event_worker_run(&lws_event_workers[0]);
+    return -1;
+}
+
+/*
+ * Options of the accepted sockets are set once on the listener, a new
+ * connection is cloned from it with keepalive and nodelay already on.
+ * Deferred accept leaves connections in the kernel until the request
+ * arrives, fast open lets repeat clients send it with the SYN.
+ * MSG_ZEROCOPY is ignored by sockets without SO_ZEROCOPY.
+ */
+static void lws_socket_accept_opts(int sockfd)
+{
+    int on = 1;
+
+    lws_set_socket_keeplive(sockfd, 1, 60, 20, 6);
+    lws_set_socket_nodelay(sockfd);
+
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &lws_service_defer_sec, sizeof(lws_service_defer_sec)))
+        lws_log(3, "setsockopt defer accept failed, %s\n", strerror(errno));
+
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN, &lws_service_fastopen, sizeof(lws_service_fastopen)) &&
+        lws_service_fastopen)
+        lws_log(3, "setsockopt fast open failed, %s\n", strerror(errno));
+
+    if (lws_service_zerocopy && setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)))
+        lws_log(3, "setsockopt zerocopy failed, %s\n", strerror(errno));
+}
+
+/**
+ * @func    lws_socket_listen
+ * @brief   create local socket listening on port
+ *
+ * @param   port[in] bind local port
+ * @param   reuseport[in] 1 if other listeners of this service share the port
+ * @return  On success, return listen fd, On error, return -1.
+ */
+int lws_socket_listen(short port, int reuseport)
+{
+    int sockfd;
+	struct sockaddr_in sockaddr;
+	int ret;
+
+    /* create local socket */
+    /* never leaked into a binary exec'd by an upgrade, it is handed over */
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+		lws_log(2, "socket failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	lws_log(4, "socket success, fd: %d\n", sockfd);
+
+    /* socket attribution before start accept */
+	lws_set_socket_reuse(sockfd, reuseport);
+	lws_socket_accept_opts(sockfd);
+
+    /* bind local port */
+	sockaddr.sin_family = AF_INET;
+	sockaddr.sin_port = htons(port);
+	sockaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	ret = bind(sockfd, (struct sockaddr *)&sockaddr, sizeof(sockaddr));
+	if (ret) {
+		lws_log(2, "bind failed, ret: %s\n", strerror(errno));
+		close(sockfd);
+		return -1;
+	}
+
+    lws_log(4, "bind success, start listen\n");
+
+    /* set listen client count */
+	ret = listen(sockfd, lws_service_backlog);
+	if (ret) {
+		lws_log(2, "listen failed, ret: %s\n", strerror(errno));
+		close(sockfd);
+		return -1;
+	}
+
+	lws_log(4, "listen succes, start accept\n");
+    return sockfd;
+}
+
+/* start the thread of an accepted connection, placed on the cpu that received it */
+static void lws_service_spawn(int cli_fd, sigset_t *mask)
+{
+	pthread_attr_t attr;
+	sigset_t omask;
+	socklen_t len;
+	cpu_set_t set;
+	pthread_t tid;
+	int cpu, ret;
+
+	/* nobody joins it, a joinable thread would keep its stack after exit */
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	/* run on the cpu whose queue received the connection, if it is in the set */
+	if (lws_service_pinned) {
+		len = sizeof(cpu);
+		set = lws_service_cpus;
+		if (getsockopt(cli_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 &&
+		    cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &lws_service_cpus)) {
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+		}
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+	}
+
+	/* create thread to handle clinet message */
+	__atomic_add_fetch(&lws_service_conns, 1, __ATOMIC_RELAXED);
+	pthread_sigmask(SIG_BLOCK, mask, &omask);
+	ret = pthread_create(&tid, &attr, (void *)lws_accept_thread, (void *)cli_fd);
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	pthread_attr_destroy(&attr);
+	if (ret) {
+		lws_log(2, "create thread failed, ret: %d-%s\n", ret, strerror(errno));
+		__atomic_sub_fetch(&lws_service_conns, 1, __ATOMIC_RELAXED);
+		close(cli_fd);
+	}
+}
+
+/**
+ * @func    lws_service_start
+ * @brief   start lite-web-server service
+ *
+ * @param   port[in] bind local port
+ * @return   On success, return 0, On error, return error code.
+ */
+int lws_service_start(short port)
+{
+    int fds[LWS_UPGRADE_MAX_FDS];
+	struct pollfd pfd[LWS_UPGRADE_MAX_FDS];
+    int cli_fd, i, n;
+	sigset_t mask;
+	int count, want, reuseport;
+
+    /* peer reset must not kill the service */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* io_uring reads and writes the socket itself, TLS records need the epoll path */
+    if (lws_service_backend == LWS_BACKEND_URING && lws_tls_enabled()) {
+        lws_log(3, "io_uring backend has no tls, use epoll\n");
+        lws_service_backend = LWS_BACKEND_EPOLL;
+    }
+
+    want = 1;
+    if (lws_service_backend != LWS_BACKEND_THREAD)
+        want = lws_service_workers ? lws_service_workers :
+               (lws_service_pinned ? CPU_COUNT(&lws_service_cpus) : 1);
+
+    /* started by a hot upgrade, the old process keeps the port bound */
+    count = lws_upgrade_inherit(fds, LWS_UPGRADE_MAX_FDS);
+    if (count < 0)
+        return -1;
+
+    /* listen again on a listening socket only resizes its queue */
+    for (i = 0; i < count; i++) {
+        lws_socket_accept_opts(fds[i]);
+        listen(fds[i], lws_service_backlog);
+    }
+
+    /*
+     * a listener per worker in one SO_REUSEPORT group, the inherited ones of
+     * an upgrade to more workers join it; a single listener is exclusive
+     */
+    reuseport = (want > 1);
+    for (i = 0; i < count && count < want; i++)
+        lws_set_socket_reuse(fds[i], 1);
+    for (; count < want && count < LWS_UPGRADE_MAX_FDS; count++) {
+        fds[count] = lws_socket_listen(port, reuseport);
+        if (fds[count] < 0)
+            break;
+    }
+    if (count == 0)
+        return -1;
+
+    /* file status flags are shared with the other process of an upgrade */
+    for (i = 0; i < count; i++)
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    lws_upgrade_listen(fds, count);
+
+    if (lws_service_backend != LWS_BACKEND_THREAD) {
+        lws_log(3, "start %s backend, %d listeners\n",
+                lws_service_backend == LWS_BACKEND_URING ? "io_uring" : "epoll", count);
+        return lws_event_workers_start(fds, count, want);
+    }
+
+    if (lws_service_pinned)
+        lws_log(3, "connection threads on %d cpus, placed by SO_INCOMING_CPU\n", CPU_COUNT(&lws_service_cpus));
+
+    /* connection threads inherit the mask, an upgrade signal must not break their poll */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR2);
+
+    for (i = 0; i < count; i++) {
+        pfd[i].fd = fds[i];
+        pfd[i].events = POLLIN;
+    }
+
+	while (1) {
+	    if (lws_upgrade_poll(__atomic_load_n(&lws_service_conns, __ATOMIC_RELAXED)) == LWS_UPGRADE_STOP_ACCEPT) {
+	        for (i = 0; i < count; i++)
+	            close(fds[i]);
+	        count = 0;
+	    }
+
+	    /* the kernel spreads connections over all listeners of the group */
+	    if (poll(pfd, count, LWS_EVENT_TICK_MS) <= 0)
+	        continue;
+
+	    for (i = 0; i < count; i++) {
+	        if (!(pfd[i].revents & POLLIN))
+	            continue;
+
+	        /* drain the queue with one wake up, the other process of an upgrade may win some */
+	        for (n = 0; n < LWS_SOCKET_ACCEPT_BATCH; n++) {
+	            cli_fd = accept4(fds[i], NULL, NULL, SOCK_CLOEXEC);
+	            if (cli_fd < 0) {
+	                if (errno != EAGAIN && errno != EINTR)
+	                    lws_log(2, "accept failed, ret: %s\n", strerror(errno));
+	                break;
+	            }
+
+	            if (lws_service_admit(cli_fd) == 0)
+	                lws_service_spawn(cli_fd, &mask);
+	        }
+	    }
+	}
+
+    return 0;
+}
@@ -1,14 +1,24 @@
 #ifndef _LWS_SOCKET_H_
 #define _LWS_SOCKET_H_
 
+#include <sys/types.h>
+
+#define LWS_SOCKET_BACKLOG      128         /* default listen queue length */
+#define LWS_SOCKET_DEFER_SEC    5           /* default deferred accept wait for the request */
+#define LWS_SOCKET_ACCEPT_BATCH 64          /* connections accepted per listener wake up */
+#define LWS_SOCKET_SEND_CHUNK   (1024 * 1024) /* blocking sendfile slice, the send buffer is re-tuned between */
+#define LWS_SOCKET_IOV_MAX      16          /* body chain entries per blocking writev */
+
 /**
  * @func    lws_set_socket_reuse
  * @brief   set socket reuse attribution
  *
  * @param   sockfd[in] local socket fd
+ * @param   reuseport[in] 1 to share the port with other listeners by
+ *          SO_REUSEPORT, 0 to keep it exclusive
  * @return  On success, return 0, On error, return error code.
  */
-extern int lws_set_socket_reuse(int sockfd);
+extern int lws_set_socket_reuse(int sockfd, int reuseport);
 
 /**
  * @func    lws_set_socket_keeplive
@@ -19,6 +29,15 @@ extern int lws_set_socket_reuse(int sockfd);
  */
 extern int lws_set_socket_keeplive(int socket_fd, int keep_alive, int keep_idle, int keep_interval, int keep_count);
 
+/**
+ * @func    lws_set_socket_nodelay
+ * @brief   disable nagle, responses are written as header + body
+ *
+ * @param   sockfd[in] client socket fd
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_set_socket_nodelay(int sockfd);
+
 /**
  * @func    lws_accept_handler
  * @brief   recv remote socket data
@@ -28,6 +47,93 @@ extern int lws_set_socket_keeplive(int socket_fd, int keep_alive, int keep_idle,
  */
 extern int lws_accept_handler(int sockfd);
 
+/**
+ * @func    lws_socket_listen
+ * @brief   create local socket listening on port
+ *
+ * @param   port[in] bind local port
+ * @param   reuseport[in] 1 if other listeners of this service share the port
+ * @return  On success, return listen fd, On error, return -1.
+ */
+extern int lws_socket_listen(short port, int reuseport);
+
+/**
+ * @func    lws_socket_recv
+ * @brief   recv() of a plain socket. While the adaptive admission limit runs
+ *          the data is stamped with lws_admit_stamp as of its arrival in the
+ *          kernel, so the time it waited for the service counts as queueing.
+ *
+ * @param   sockfd[in] client socket fd
+ * @param   data[out] receive buffer
+ * @param   size[in] buffer size
+ * @return  as recv().
+ */
+extern ssize_t lws_socket_recv(int sockfd, char *data, int size);
+
+/**
+ * @func    lws_service_admit
+ * @brief   admit a connection just accepted by any backend. Past the
+ *          connection limit the client gets the prebuilt 503 and the socket
+ *          is closed before any connection state is allocated.
+ *
+ * @param   cli_fd[in] accepted socket fd
+ * @return  On admit, return 0, Or return -1 with cli_fd closed.
+ */
+extern int lws_service_admit(int cli_fd);
+
+/**
+ * @func    lws_service_set_backend
+ * @brief   select service backend before lws_service_start
+ *
+ * @param   backend[in] LWS_BACKEND_THREAD, LWS_BACKEND_EPOLL or LWS_BACKEND_URING
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_service_set_backend(int backend);
+
+/**
+ * @func    lws_service_set_limits
+ * @brief   set connection admission before lws_service_start
+ *
+ * @param   max_conns[in] open connections, later ones get a 503, 0 is unlimited
+ * @param   backlog[in] listen queue length, 0 is LWS_SOCKET_BACKLOG
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_service_set_limits(int max_conns, int backlog);
+
+/**
+ * @func    lws_service_set_accept
+ * @brief   set accept path options of the listeners before lws_service_start
+ *
+ * @param   defer_sec[in] wait for the request up to defer_sec before a
+ *          connection is accepted, 0 accepts on handshake
+ * @param   fastopen[in] TCP Fast Open queue length, 0 is off
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_service_set_accept(int defer_sec, int fastopen);
+
+/**
+ * @func    lws_service_set_zerocopy
+ * @brief   send queued responses of at least threshold bytes with
+ *          MSG_ZEROCOPY before lws_service_start, epoll backend only
+ *
+ * @param   threshold[in] bytes per send, 0 is off
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_service_set_zerocopy(int threshold);
+
+/**
+ * @func    lws_service_set_workers
+ * @brief   set event loop threads and their cpus before lws_service_start.
+ *          Workers are pinned one per cpu and get their own listener, steered
+ *          with SO_INCOMING_CPU, connection threads of the thread engine run
+ *          on the cpu that received their packets.
+ *
+ * @param   workers[in] epoll/io_uring workers, 0 is one per cpu, or 1
+ * @param   cpus[in] "0-3,8" cpu list, NULL to leave placement to the scheduler
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_service_set_workers(int workers, const char *cpus);
+
 /**
  * @func    lws_service_start
  * @brief   start lite-web-server service
@@ -37,6 +143,16 @@ extern int lws_accept_handler(int sockfd);
  */
 extern int lws_service_start(short port);
 
+/**
+ * @func    lws_service_enable
+ * @brief   register an optional endpoint, unauthenticated clients can use
+ *          it once enabled
+ *
+ * @param   uri[in] "/publish", "/tcpinfo" or "/upload"
+ * @return  On success, return 0. If uri is not an optional endpoint, return -1.
+ */
+extern int lws_service_enable(const char *uri);
+
 /**
  * @func    lws_service_init
  * @brief   init module resource
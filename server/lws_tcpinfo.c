@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/tcp.h>      /* struct tcp_info of the kernel, glibc lags behind */
+
+#include "lws_log.h"
+#include "lws_http.h"
+#include "lws_metrics.h"
+#include "lws_tcpinfo.h"
+
+/* send buffer limits of the host, read once */
+static pthread_once_t lws_tcpinfo_once = PTHREAD_ONCE_INIT;
+static long lws_tcpinfo_wmem_max = 0;           /* net.core.wmem_max, SO_SNDBUF limit */
+static long lws_tcpinfo_autotune_max = 0;       /* net.ipv4.tcp_wmem max, autotuning limit */
+
+static void lws_tcpinfo_limits(void)
+{
+    long min, def;
+    FILE *fp;
+
+    fp = fopen("/proc/sys/net/core/wmem_max", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld", &lws_tcpinfo_wmem_max) != 1)
+            lws_tcpinfo_wmem_max = 0;
+        fclose(fp);
+    }
+
+    fp = fopen("/proc/sys/net/ipv4/tcp_wmem", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld %ld", &min, &def, &lws_tcpinfo_autotune_max) != 3)
+            lws_tcpinfo_autotune_max = 0;
+        fclose(fp);
+    }
+
+    /* the kernel doubles SO_SNDBUF for its overhead, autotuning counts it in */
+    if (lws_tcpinfo_wmem_max * 2 <= lws_tcpinfo_autotune_max)
+        lws_log(4, "net.core.wmem_max %ld is within autotuning, send buffers are never grown\n",
+                lws_tcpinfo_wmem_max);
+}
+
+/**
+ * @func    lws_tcpinfo_get
+ * @brief   read TCP_INFO and the send buffer size of a socket
+ *
+ * @param   sockfd[in] tcp socket fd
+ * @param   ti[out] connection info
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_tcpinfo_get(int sockfd, lws_tcpinfo_t *ti)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    /* an older kernel fills less, the rest reads 0 */
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &info, &len))
+        return -1;
+
+    memset(ti, 0, sizeof(*ti));
+    ti->state = info.tcpi_state;
+    ti->ca_state = info.tcpi_ca_state;
+    ti->retransmits = info.tcpi_retransmits;
+    ti->rtt_us = info.tcpi_rtt;
+    ti->rttvar_us = info.tcpi_rttvar;
+    ti->min_rtt_us = info.tcpi_min_rtt;
+    ti->snd_cwnd = info.tcpi_snd_cwnd;
+    ti->snd_ssthresh = info.tcpi_snd_ssthresh;
+    ti->snd_mss = info.tcpi_snd_mss;
+    ti->unacked = info.tcpi_unacked;
+    ti->lost = info.tcpi_lost;
+    ti->total_retrans = info.tcpi_total_retrans;
+    ti->notsent_bytes = info.tcpi_notsent_bytes;
+    ti->pacing_rate = info.tcpi_pacing_rate;
+    ti->delivery_rate = info.tcpi_delivery_rate;
+    ti->bytes_acked = info.tcpi_bytes_acked;
+    ti->bytes_received = info.tcpi_bytes_received;
+    ti->busy_us = info.tcpi_busy_time;
+    ti->rwnd_limited_us = info.tcpi_rwnd_limited;
+    ti->sndbuf_limited_us = info.tcpi_sndbuf_limited;
+    ti->app_limited = info.tcpi_delivery_rate_app_limited;
+
+    len = sizeof(ti->sndbuf);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &ti->sndbuf, &len))
+        return -1;
+
+    return 0;
+}
+
+/**
+ * @func    lws_tcpinfo_sndbuf
+ * @brief   grow the send buffer of a connection streaming a large response
+ *          beyond the autotuning limit, net.ipv4.tcp_wmem max, when its
+ *          bandwidth-delay product measured by TCP_INFO needs more and the
+ *          send buffer rather than a slow reader held it back. Up to that
+ *          limit the kernel autotunes, setting SO_SNDBUF would stop it, so
+ *          the buffer is only ever grown and never below it. Cheap while
+ *          little is pending, call it whenever the socket fills up.
+ *
+ * @param   sockfd[in] tcp socket fd
+ * @param   pending[in] response bytes not yet written to the socket
+ * @param   next_check[in,out] lws_metrics_now of the next estimate, 0 at first
+ * @return  granted SO_SNDBUF, or 0 if left as is.
+ */
+int lws_tcpinfo_sndbuf(int sockfd, long pending, uint64_t *next_check)
+{
+    lws_tcpinfo_t ti;
+    uint64_t now, bdp, pipe;
+    long target, limit;
+    int size;
+    socklen_t len = sizeof(size);
+
+    pthread_once(&lws_tcpinfo_once, lws_tcpinfo_limits);
+
+    /* a buffer over the pending bytes is never filled */
+    limit = pending < lws_tcpinfo_wmem_max ? pending : lws_tcpinfo_wmem_max;
+    if (limit * 2 <= lws_tcpinfo_autotune_max)
+        return 0;
+
+    now = lws_metrics_now();
+    if (now < *next_check || lws_tcpinfo_get(sockfd, &ti) || ti.rtt_us == 0)
+        return 0;
+
+    /* the window changes once per round trip */
+    *next_check = now + (ti.rtt_us > LWS_TCPINFO_CHECK_MS * 1000 ?
+                         ti.rtt_us : LWS_TCPINFO_CHECK_MS * 1000) * 1000ULL;
+
+    /* a reader slower than the path gains nothing from a deeper queue */
+    if (ti.rwnd_limited_us > ti.sndbuf_limited_us)
+        return 0;
+
+    /* what is in flight, or what the path delivers per round trip, and as much again to grow */
+    bdp = (uint64_t)ti.snd_cwnd * ti.snd_mss;
+    pipe = ti.delivery_rate * ti.rtt_us / 1000000;
+    if (pipe > bdp)
+        bdp = pipe;
+    target = bdp * 2 < (uint64_t)limit ? (long)(bdp * 2) : limit;
+
+    if (target * 2 <= ti.sndbuf || target * 2 <= lws_tcpinfo_autotune_max)
+        return 0;
+
+    size = (int)target;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) ||
+        getsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &size, &len)) {
+        lws_log(3, "sockfd[%d] set sndbuf failed, %s\n", sockfd, strerror(errno));
+        return 0;
+    }
+
+    lws_log(4, "sockfd[%d] sndbuf %d, rtt: %u us, cwnd: %u, delivery rate: %llu B/s\n",
+            sockfd, size, ti.rtt_us, ti.snd_cwnd, (unsigned long long)ti.delivery_rate);
+    return size;
+}
+
+static void lws_tcpinfo_addr(struct sockaddr_storage *ss, char *out, int size)
+{
+    char host[INET6_ADDRSTRLEN] = "?";
+
+    if (ss->ss_family == AF_INET6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+        inet_ntop(AF_INET6, &sin6->sin6_addr, host, sizeof(host));
+        snprintf(out, size, "[%s]:%d", host, ntohs(sin6->sin6_port));
+    } else {
+        struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+        inet_ntop(AF_INET, &sin->sin_addr, host, sizeof(host));
+        snprintf(out, size, "%s:%d", host, ntohs(sin->sin_port));
+    }
+}
+
+/* connected tcp socket, neither a listener nor anything else the process holds */
+static int lws_tcpinfo_is_conn(int fd)
+{
+    int domain = 0, type = 0, listening = 1;
+    socklen_t len = sizeof(int);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) || (domain != AF_INET && domain != AF_INET6))
+        return 0;
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) || type != SOCK_STREAM)
+        return 0;
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) || listening)
+        return 0;
+
+    return 1;
+}
+
+/**
+ * @func    lws_tcpinfo_handler
+ * @brief   /tcpinfo endpoint, TCP_INFO of every open tcp connection of the
+ *          process, client and upstream, one line each
+ */
+int lws_tcpinfo_handler(lws_http_conn_t *c, int ev, void *p)
+{
+    struct http_message *hm = p;
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+    char local[64], peer[64];
+    struct dirent *de;
+    lws_tcpinfo_t ti;
+    char *data = NULL;
+    size_t size = 0;
+    FILE *fp;
+    DIR *dp;
+    int fd;
+
+    if (hm == NULL || ev != LWS_EV_HTTP_REQUEST)
+        return HTTP_BAD_REQUEST;
+
+    /* the connections are owned by many threads, the fd table sees them all */
+    dp = opendir("/proc/self/fd");
+    if (dp == NULL)
+        return HTTP_INTERNAL_SERVER_ERROR;
+
+    fp = open_memstream(&data, &size);
+    if (fp == NULL) {
+        closedir(dp);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    while ((de = readdir(dp)) != NULL) {
+        if (de->d_name[0] < '0' || de->d_name[0] > '9')
+            continue;
+
+        /* a connection closed meanwhile fails below, a reused fd is just listed */
+        fd = atoi(de->d_name);
+        if (fd == dirfd(dp) || !lws_tcpinfo_is_conn(fd) || lws_tcpinfo_get(fd, &ti))
+            continue;
+
+        sslen = sizeof(ss);
+        memset(&ss, 0, sizeof(ss));
+        getsockname(fd, (struct sockaddr *)&ss, &sslen);
+        lws_tcpinfo_addr(&ss, local, sizeof(local));
+        sslen = sizeof(ss);
+        memset(&ss, 0, sizeof(ss));
+        getpeername(fd, (struct sockaddr *)&ss, &sslen);
+        lws_tcpinfo_addr(&ss, peer, sizeof(peer));
+
+        fprintf(fp, "fd=%d local=%s peer=%s state=%d ca_state=%d rtt_us=%u rttvar_us=%u min_rtt_us=%u "
+                "cwnd=%u ssthresh=%u mss=%u unacked=%u lost=%u retrans=%d/%u notsent=%u "
+                "pacing_rate=%llu delivery_rate=%llu%s bytes_acked=%llu bytes_received=%llu "
+                "busy_us=%llu rwnd_limited_us=%llu sndbuf_limited_us=%llu sndbuf=%d\n",
+                fd, local, peer, ti.state, ti.ca_state, ti.rtt_us, ti.rttvar_us, ti.min_rtt_us,
+                ti.snd_cwnd, ti.snd_ssthresh, ti.snd_mss, ti.unacked, ti.lost, ti.retransmits, ti.total_retrans,
+                ti.notsent_bytes, (unsigned long long)ti.pacing_rate, (unsigned long long)ti.delivery_rate,
+                ti.app_limited ? ",app_limited" : "", (unsigned long long)ti.bytes_acked,
+                (unsigned long long)ti.bytes_received, (unsigned long long)ti.busy_us,
+                (unsigned long long)ti.rwnd_limited_us, (unsigned long long)ti.sndbuf_limited_us, ti.sndbuf);
+    }
+    closedir(dp);
+
+    if (fclose(fp)) {
+        free(data);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    lws_http_respond(c, HTTP_OK, c->close_flag, "text/plain", data, (int)size);
+    free(data);
+
+    return HTTP_OK;
+}
@@ -0,0 +1,72 @@
+#ifndef _LWS_TCPINFO_H_
+#define _LWS_TCPINFO_H_
+
+#include <stdint.h>
+
+#include "lws_http.h"
+
+#define LWS_TCPINFO_CHECK_MS        10          /* sndbuf re-estimated at most once per srtt, or this */
+
+/**
+ * TCP_INFO of a connection, fields the running kernel does not report are 0
+**/
+typedef struct _lws_tcpinfo_t_ {
+    int state;
+    int ca_state;
+    int retransmits;                    /* unrecovered retransmits of the head */
+    uint32_t rtt_us;                    /* smoothed rtt */
+    uint32_t rttvar_us;
+    uint32_t min_rtt_us;
+    uint32_t snd_cwnd;                  /* segments */
+    uint32_t snd_ssthresh;
+    uint32_t snd_mss;
+    uint32_t unacked;
+    uint32_t lost;
+    uint32_t total_retrans;
+    uint32_t notsent_bytes;
+    uint64_t pacing_rate;               /* bytes per second */
+    uint64_t delivery_rate;             /* bytes per second */
+    uint64_t bytes_acked;
+    uint64_t bytes_received;
+    uint64_t busy_us;                   /* time spent sending data */
+    uint64_t rwnd_limited_us;           /* of it, waiting for the peer receive window */
+    uint64_t sndbuf_limited_us;         /* of it, waiting for room in the send buffer */
+    int app_limited;                    /* delivery_rate was limited by the sender */
+    int sndbuf;                         /* SO_SNDBUF, kernel accounting including overhead */
+} lws_tcpinfo_t;
+
+/**
+ * @func    lws_tcpinfo_get
+ * @brief   read TCP_INFO and the send buffer size of a socket
+ *
+ * @param   sockfd[in] tcp socket fd
+ * @param   ti[out] connection info
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_tcpinfo_get(int sockfd, lws_tcpinfo_t *ti);
+
+/**
+ * @func    lws_tcpinfo_sndbuf
+ * @brief   grow the send buffer of a connection streaming a large response
+ *          beyond the autotuning limit, net.ipv4.tcp_wmem max, when its
+ *          bandwidth-delay product measured by TCP_INFO needs more and the
+ *          send buffer rather than a slow reader held it back. Up to that
+ *          limit the kernel autotunes, setting SO_SNDBUF would stop it, so
+ *          the buffer is only ever grown and never below it. Cheap while
+ *          little is pending, call it whenever the socket fills up.
+ *
+ * @param   sockfd[in] tcp socket fd
+ * @param   pending[in] response bytes not yet written to the socket
+ * @param   next_check[in,out] lws_metrics_now of the next estimate, 0 at first
+ * @return  granted SO_SNDBUF, or 0 if left as is.
+ */
+extern int lws_tcpinfo_sndbuf(int sockfd, long pending, uint64_t *next_check);
+
+/**
+ * @func    lws_tcpinfo_handler
+ * @brief   /tcpinfo endpoint, TCP_INFO of every open tcp connection of the
+ *          process, client and upstream, one line each
+ */
+extern int lws_tcpinfo_handler(lws_http_conn_t *c, int ev, void *p);
+
+#endif // _LWS_TCPINFO_H_
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "lws_log.h"
+#include "lws_tls.h"
+
+#define LWS_TLS_SENDFILE_CHUNK      16384       /* one record without kTLS */
+
+static SSL_CTX *lws_tls_ctx = NULL;
+
+/* TLS sessions indexed by socket fd, each slot is used by its owner only */
+static SSL **lws_tls_conns = NULL;
+static int lws_tls_conns_size = 0;
+
+static void lws_tls_log_error(const char *what)
+{
+    unsigned long err = ERR_get_error();
+    char buf[256];
+
+    if (err) {
+        ERR_error_string_n(err, buf, sizeof(buf));
+        lws_log(4, "%s: %s\n", what, buf);
+    }
+    ERR_clear_error();
+}
+
+static SSL *lws_tls_get(int sockfd)
+{
+    if (sockfd < 0 || sockfd >= lws_tls_conns_size)
+        return NULL;
+
+    return lws_tls_conns[sockfd];
+}
+
+/* turn SSL_get_error into recv/send conventions */
+static int lws_tls_error(SSL *ssl, int ret, const char *what)
+{
+    switch (SSL_get_error(ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_SYSCALL:
+        if (errno == 0)
+            return 0;
+        lws_tls_log_error(what);
+        return -1;
+    default:
+        lws_tls_log_error(what);
+        errno = EPROTO;
+        return -1;
+    }
+}
+
+/* prefer h2, the preface that follows is detected like cleartext h2 */
+static int lws_tls_alpn_select(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                               const unsigned char *in, unsigned int inlen, void *arg)
+{
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+
+    if (SSL_select_next_proto((unsigned char **)out, outlen, protos, sizeof(protos) - 1,
+                              in, inlen) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static int lws_tls_load_ticket_key(SSL_CTX *ctx, const char *path)
+{
+    unsigned char keys[LWS_TLS_TICKET_KEY_SIZE];
+    FILE *fp;
+    size_t n;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        lws_log(2, "open ticket key %s failed, %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    n = fread(keys, 1, sizeof(keys), fp);
+    fclose(fp);
+    if (n != sizeof(keys)) {
+        lws_log(2, "ticket key %s must be %d bytes\n", path, LWS_TLS_TICKET_KEY_SIZE);
+        return -1;
+    }
+
+    if (SSL_CTX_set_tlsext_ticket_keys(ctx, keys, sizeof(keys)) != 1) {
+        lws_log(2, "set ticket key failed\n");
+        return -1;
+    }
+
+    OPENSSL_cleanse(keys, sizeof(keys));
+    return 0;
+}
+
+/**
+ * @func    lws_tls_init
+ * @brief   create the listener TLS context, every accepted connection is TLS
+ *          afterwards. kTLS is requested and used where the kernel has it.
+ *
+ * @param   cert[in] certificate chain file, PEM
+ * @param   key[in] private key file, PEM
+ * @param   ticket_key[in] file of LWS_TLS_TICKET_KEY_SIZE random bytes shared
+ *          by every server resuming the same sessions, NULL for a
+ *          process local key
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_tls_init(const char *cert, const char *key, const char *ticket_key)
+{
+    struct rlimit rlim;
+    SSL_CTX *ctx;
+
+    ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == NULL) {
+        lws_tls_log_error("SSL_CTX_new");
+        return -1;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE |
+                        SSL_OP_IGNORE_UNEXPECTED_EOF);
+
+    /* non-blocking engines retry and consume partial writes, idle sessions drop their record buffers */
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                     SSL_MODE_RELEASE_BUFFERS);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        lws_log(2, "load certificate %s or key %s failed\n", cert, key);
+        lws_tls_log_error("certificate");
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+
+    /* resumption: session ids from the cache, tickets under the shared key */
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, LWS_TLS_SESSION_CACHE);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"lws", 3);
+    SSL_CTX_set_timeout(ctx, LWS_TLS_SESSION_TIMEOUT);
+    if (ticket_key && lws_tls_load_ticket_key(ctx, ticket_key)) {
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+
+    SSL_CTX_set_alpn_select_cb(ctx, lws_tls_alpn_select, NULL);
+
+    if (getrlimit(RLIMIT_NOFILE, &rlim) || rlim.rlim_cur == RLIM_INFINITY)
+        rlim.rlim_cur = 65536;
+
+    lws_tls_conns = calloc(rlim.rlim_cur, sizeof(SSL *));
+    if (lws_tls_conns == NULL) {
+        SSL_CTX_free(ctx);
+        return -1;
+    }
+
+    lws_tls_conns_size = (int)rlim.rlim_cur;
+    lws_tls_ctx = ctx;
+    lws_log(3, "tls enabled, certificate: %s, ticket key: %s\n", cert, ticket_key ? ticket_key : "local");
+    return 0;
+}
+
+/**
+ * @func    lws_tls_enabled
+ * @brief   check if the listener speaks TLS
+ *
+ * @return  1 if lws_tls_init succeeded, or 0.
+ */
+int lws_tls_enabled(void)
+{
+    return lws_tls_ctx != NULL;
+}
+
+/**
+ * @func    lws_tls_accept
+ * @brief   attach a server TLS session to accepted socket, the handshake
+ *          runs within the first lws_tls_read
+ *
+ * @param   sockfd[in] accepted socket fd
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_tls_accept(int sockfd)
+{
+    SSL *ssl;
+
+    if (lws_tls_ctx == NULL || sockfd < 0 || sockfd >= lws_tls_conns_size)
+        return -1;
+
+    ssl = SSL_new(lws_tls_ctx);
+    if (ssl == NULL) {
+        lws_tls_log_error("SSL_new");
+        return -1;
+    }
+
+    SSL_set_fd(ssl, sockfd);
+    SSL_set_accept_state(ssl);
+    lws_tls_conns[sockfd] = ssl;
+    return 0;
+}
+
+/**
+ * @func    lws_tls_read
+ * @brief   recv() of a TLS socket
+ *
+ * @param   sockfd[in] socket fd
+ * @param   data[out] plaintext buffer
+ * @param   size[in] buffer size
+ * @return  plaintext bytes, 0 on close, -1 on error with errno EAGAIN
+ *          if the socket would block.
+ */
+int lws_tls_read(int sockfd, char *data, int size)
+{
+    SSL *ssl = lws_tls_get(sockfd);
+    int ret;
+
+    if (ssl == NULL)
+        return -1;
+
+    ERR_clear_error();
+    errno = 0;
+    ret = SSL_read(ssl, data, size);
+    if (ret > 0)
+        return ret;
+
+    return lws_tls_error(ssl, ret, "SSL_read");
+}
+
+/**
+ * @func    lws_tls_write
+ * @brief   send() of a TLS socket, may write part of data
+ *
+ * @param   sockfd[in] socket fd
+ * @param   data[in] plaintext
+ * @param   size[in] plaintext size
+ * @return  written bytes, -1 on error with errno EAGAIN if the socket
+ *          would block, the same data must be retried then.
+ */
+int lws_tls_write(int sockfd, const char *data, int size)
+{
+    SSL *ssl = lws_tls_get(sockfd);
+    int ret;
+
+    if (ssl == NULL)
+        return -1;
+
+    ERR_clear_error();
+    errno = 0;
+    ret = SSL_write(ssl, data, size);
+    if (ret > 0)
+        return ret;
+
+    ret = lws_tls_error(ssl, ret, "SSL_write");
+    if (ret == 0) {
+        errno = EPIPE;
+        ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * @func    lws_tls_sendfile
+ * @brief   sendfile() of a TLS socket, zero-copy with kTLS, otherwise the
+ *          file is read and encrypted in user space
+ *
+ * @param   sockfd[in] socket fd
+ * @param   fd[in] file fd
+ * @param   offset[in] file offset
+ * @param   size[in] bytes to send
+ * @return  written bytes, -1 on error with errno EAGAIN if the socket
+ *          would block.
+ */
+ssize_t lws_tls_sendfile(int sockfd, int fd, off_t offset, size_t size)
+{
+    SSL *ssl = lws_tls_get(sockfd);
+    char buf[LWS_TLS_SENDFILE_CHUNK];
+    ssize_t ret;
+
+    if (ssl == NULL)
+        return -1;
+
+    if (BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+        ERR_clear_error();
+        errno = 0;
+        ret = SSL_sendfile(ssl, fd, offset, size, 0);
+        if (ret >= 0)
+            return ret;
+        if (lws_tls_error(ssl, (int)ret, "SSL_sendfile") == 0)
+            errno = EPIPE;
+        return -1;
+    }
+
+    /* a retry after EAGAIN reads the same bytes again, as SSL_write requires */
+    if (size > sizeof(buf))
+        size = sizeof(buf);
+    ret = pread(fd, buf, size, offset);
+    if (ret <= 0)
+        return -1;
+
+    return lws_tls_write(sockfd, buf, (int)ret);
+}
+
+/**
+ * @func    lws_tls_pending
+ * @brief   plaintext already decrypted and buffered, not signaled by the socket
+ *
+ * @param   sockfd[in] socket fd
+ * @return  buffered bytes.
+ */
+int lws_tls_pending(int sockfd)
+{
+    SSL *ssl = lws_tls_get(sockfd);
+
+    return ssl ? SSL_pending(ssl) : 0;
+}
+
+/**
+ * @func    lws_tls_free
+ * @brief   send close_notify and release TLS session of socket
+ *
+ * @param   sockfd[in] socket fd
+ * @return  void
+ */
+void lws_tls_free(int sockfd)
+{
+    SSL *ssl = lws_tls_get(sockfd);
+
+    if (ssl == NULL)
+        return;
+
+    /* best effort, never waits for the peer */
+    if (SSL_is_init_finished(ssl))
+        SSL_shutdown(ssl);
+    ERR_clear_error();
+
+    lws_log(4, "tls sockfd: %d, ktls send: %d, recv: %d, reused: %d\n", sockfd,
+            (int)BIO_get_ktls_send(SSL_get_wbio(ssl)), (int)BIO_get_ktls_recv(SSL_get_rbio(ssl)),
+            SSL_session_reused(ssl));
+    SSL_free(ssl);
+    lws_tls_conns[sockfd] = NULL;
+}
@@ -0,0 +1,99 @@
+#ifndef _LWS_TLS_H_
+#define _LWS_TLS_H_
+
+#include <sys/types.h>
+
+/* server side session cache entries */
+#define LWS_TLS_SESSION_CACHE       20480
+#define LWS_TLS_SESSION_TIMEOUT     3600        /* seconds */
+#define LWS_TLS_TICKET_KEY_SIZE     80          /* name, hmac and aes keys */
+
+/**
+ * @func    lws_tls_init
+ * @brief   create the listener TLS context, every accepted connection is TLS
+ *          afterwards. kTLS is requested and used where the kernel has it.
+ *
+ * @param   cert[in] certificate chain file, PEM
+ * @param   key[in] private key file, PEM
+ * @param   ticket_key[in] file of LWS_TLS_TICKET_KEY_SIZE random bytes shared
+ *          by every server resuming the same sessions, NULL for a
+ *          process local key
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_tls_init(const char *cert, const char *key, const char *ticket_key);
+
+/**
+ * @func    lws_tls_enabled
+ * @brief   check if the listener speaks TLS
+ *
+ * @return  1 if lws_tls_init succeeded, or 0.
+ */
+extern int lws_tls_enabled(void);
+
+/**
+ * @func    lws_tls_accept
+ * @brief   attach a server TLS session to accepted socket, the handshake
+ *          runs within the first lws_tls_read
+ *
+ * @param   sockfd[in] accepted socket fd
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_tls_accept(int sockfd);
+
+/**
+ * @func    lws_tls_read
+ * @brief   recv() of a TLS socket
+ *
+ * @param   sockfd[in] socket fd
+ * @param   data[out] plaintext buffer
+ * @param   size[in] buffer size
+ * @return  plaintext bytes, 0 on close, -1 on error with errno EAGAIN
+ *          if the socket would block.
+ */
+extern int lws_tls_read(int sockfd, char *data, int size);
+
+/**
+ * @func    lws_tls_write
+ * @brief   send() of a TLS socket, may write part of data
+ *
+ * @param   sockfd[in] socket fd
+ * @param   data[in] plaintext
+ * @param   size[in] plaintext size
+ * @return  written bytes, -1 on error with errno EAGAIN if the socket
+ *          would block, the same data must be retried then.
+ */
+extern int lws_tls_write(int sockfd, const char *data, int size);
+
+/**
+ * @func    lws_tls_sendfile
+ * @brief   sendfile() of a TLS socket, zero-copy with kTLS, otherwise the
+ *          file is read and encrypted in user space
+ *
+ * @param   sockfd[in] socket fd
+ * @param   fd[in] file fd
+ * @param   offset[in] file offset
+ * @param   size[in] bytes to send
+ * @return  written bytes, -1 on error with errno EAGAIN if the socket
+ *          would block.
+ */
+extern ssize_t lws_tls_sendfile(int sockfd, int fd, off_t offset, size_t size);
+
+/**
+ * @func    lws_tls_pending
+ * @brief   plaintext already decrypted and buffered, not signaled by the socket
+ *
+ * @param   sockfd[in] socket fd
+ * @return  buffered bytes.
+ */
+extern int lws_tls_pending(int sockfd);
+
+/**
+ * @func    lws_tls_free
+ * @brief   send close_notify and release TLS session of socket
+ *
+ * @param   sockfd[in] socket fd
+ * @return  void
+ */
+extern void lws_tls_free(int sockfd);
+
+#endif // _LWS_TLS_H_
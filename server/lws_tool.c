@@ -5,6 +5,17 @@
 
 #include "lws_log.h"
 #include "lws_socket.h"
+#include "lws_event.h"
+#include "lws_tls.h"
+#include "lws_proxy.h"
+#include "lws_cache.h"
+#include "lws_upgrade.h"
+#include "lws_admit.h"
+#include "lws_compute.h"
+#include "lws_disk.h"
+
+#define LWS_TOOL_MAX_ROUTES     16
+#define LWS_TOOL_DISK_THREADS   4           /* disk pool of the epoll workers */
 
 void print_usage(void)
 {
@@ -12,6 +23,38 @@ void print_usage(void)
     printf("Options:\n");
     printf("    -s start  local service\n");
     printf("    -p port  select local port, default is 8000\n");
+    printf("    -e engine  select service engine, thread|epoll|uring\n");
+    printf("              default is thread, uring falls back to epoll\n");
+    printf("    -w workers  event loop threads of epoll/uring, default is one per -a cpu, or 1\n");
+    printf("    -a cpus  pin workers one per cpu of a list like 0-3,8, thread engine\n");
+    printf("              connections run on the cpu that received them\n");
+    printf("    -c cert  serve TLS with PEM certificate chain, needs -k\n");
+    printf("    -k key  PEM private key of the certificate\n");
+    printf("    -K file  80 byte session ticket key shared by servers, default is random\n");
+    printf("    -x uri=host:port[,host:port...]  proxy requests under uri to upstreams\n");
+    printf("    -b policy  upstream choice of the following -x, leastconn|hash\n");
+    printf("              default is leastconn\n");
+    printf("    -C size  cache cacheable handler responses in size MB of memory\n");
+    printf("    -V header[,header...]  request headers the cached responses may vary on\n");
+    printf("    -S uri  identical concurrent requests to endpoint uri share one handler run\n");
+    printf("    -E uri  enable an optional endpoint open to any client:\n");
+    printf("              /publish, /tcpinfo, /upload\n");
+    printf("    -O uri  run the handler of endpoint uri on the compute pool, epoll engine\n");
+    printf("    -P threads  compute pool threads, default is 1 once -O is given\n");
+    printf("    -I threads  disk threads reading files missing from the page cache,\n");
+    printf("              epoll engine, 0 reads on the event loop, default is 4\n");
+    printf("    -m conns  open connections, later ones get a 503 and are closed, default unlimited\n");
+    printf("    -r requests  requests in handlers at once, excess ones get a 503, default unlimited\n");
+    printf("    -q ms  shed requests queued over ms once queueing stays above it, default off\n");
+    printf("    -R sec  Retry-After of the 503 responses, default is 1\n");
+    printf("    -B backlog  listen queue length, default is 128\n");
+    printf("    -d sec  accept a connection once its request arrived, or after sec\n");
+    printf("              seconds, 0 accepts on handshake, default is 5\n");
+    printf("    -F qlen  TCP Fast Open with qlen pending handshakes, default off\n");
+    printf("    -Z bytes  send queued output of at least bytes with MSG_ZEROCOPY, epoll\n");
+    printf("              engine, default off\n");
+    printf("    -D sec  after SIGUSR2 hands the port to a new binary, drain connections\n");
+    printf("              for at most sec seconds, default is 30\n");
     printf("    -l level  set syslog level, 0-all,1-sys,2-error,3-warning,4-info\n");
     printf("              default log level is 3-warning\n");
     printf("    -h  print usage information\n");
@@ -28,7 +71,38 @@ int main(int argc, char *argv[])
 {
     int port = 8000;
     int service = 0;
+    int backend = LWS_BACKEND_THREAD;
     log_level_t log_level = LOG_LEVEL_WARN;
+    char *tls_cert = NULL;
+    char *tls_key = NULL;
+    char *tls_ticket_key = NULL;
+    char *routes[LWS_TOOL_MAX_ROUTES];
+    int route_policy[LWS_TOOL_MAX_ROUTES];
+    int route_count = 0;
+    int policy = LWS_PROXY_LEAST_CONN;
+    long cache_size = 0;
+    char *coalesce[LWS_TOOL_MAX_ROUTES];
+    int coalesce_count = 0;
+    char *enable[LWS_TOOL_MAX_ROUTES];
+    int enable_count = 0;
+    char *compute[LWS_TOOL_MAX_ROUTES];
+    int compute_count = 0;
+    int compute_threads = 0;
+    int disk_threads = LWS_TOOL_DISK_THREADS;
+    char *cache_vary = NULL;
+    int drain_sec = LWS_UPGRADE_DRAIN_SEC;
+    int max_conns = 0;
+    int max_requests = 0;
+    int target_ms = 0;
+    int retry_after = LWS_ADMIT_RETRY_AFTER;
+    int backlog = LWS_SOCKET_BACKLOG;
+    int defer_sec = LWS_SOCKET_DEFER_SEC;
+    int fastopen = 0;
+    int zerocopy = 0;
+    int workers = 0;
+    char *cpus = NULL;
+    char *eq;
+    int i;
     char ch;
     int ret;
 
@@ -37,7 +111,7 @@ int main(int argc, char *argv[])
         goto usage;
     }
 
-    while ((ch = getopt(argc, argv, "sp:l:h")) != -1) {
+    while ((ch = getopt(argc, argv, "sp:e:w:a:c:k:K:x:b:C:V:S:E:O:P:I:m:r:q:R:B:d:F:Z:D:l:h")) != -1) {
         switch (ch) {
             case 's':
                 service = 1;
@@ -47,6 +121,179 @@ int main(int argc, char *argv[])
                 port = atoi(optarg);
                 break;
 
+            case 'e':
+                if (strcmp(optarg, "thread") == 0) {
+                    backend = LWS_BACKEND_THREAD;
+                } else if (strcmp(optarg, "epoll") == 0) {
+                    backend = LWS_BACKEND_EPOLL;
+                } else if (strcmp(optarg, "uring") == 0) {
+                    backend = LWS_BACKEND_URING;
+                } else {
+                    lws_log(2, "unknown engine: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
+            case 'w':
+                workers = atoi(optarg);
+                if (workers <= 0) {
+                    lws_log(2, "invalid workers: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
+            case 'a':
+                cpus = optarg;
+                break;
+
+            case 'c':
+                tls_cert = optarg;
+                break;
+
+            case 'k':
+                tls_key = optarg;
+                break;
+
+            case 'K':
+                tls_ticket_key = optarg;
+                break;
+
+            case 'x':
+                if (route_count == LWS_TOOL_MAX_ROUTES || strchr(optarg, '=') == NULL) {
+                    lws_log(2, "invalid proxy route: %s\n", optarg);
+                    goto usage;
+                }
+                route_policy[route_count] = policy;
+                routes[route_count++] = optarg;
+                break;
+
+            case 'b':
+                if (strcmp(optarg, "leastconn") == 0) {
+                    policy = LWS_PROXY_LEAST_CONN;
+                } else if (strcmp(optarg, "hash") == 0) {
+                    policy = LWS_PROXY_HASH;
+                } else {
+                    lws_log(2, "unknown policy: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
+            case 'C':
+                cache_size = atol(optarg);
+                if (cache_size <= 0) {
+                    lws_log(2, "invalid cache size: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
+            case 'V':
+                cache_vary = optarg;
+                break;
+
+            case 'S':
+                if (coalesce_count == LWS_TOOL_MAX_ROUTES) {
+                    lws_log(2, "too many coalesced endpoints: %s\n", optarg);
+                    goto usage;
+                }
+                coalesce[coalesce_count++] = optarg;
+                break;
+
+            case 'E':
+                if (enable_count == LWS_TOOL_MAX_ROUTES) {
+                    lws_log(2, "too many optional endpoints: %s\n", optarg);
+                    goto usage;
+                }
+                enable[enable_count++] = optarg;
+                break;
+
+            case 'O':
+                if (compute_count == LWS_TOOL_MAX_ROUTES) {
+                    lws_log(2, "too many compute endpoints: %s\n", optarg);
+                    goto usage;
+                }
+                compute[compute_count++] = optarg;
+                break;
+
+            case 'P':
+                compute_threads = atoi(optarg);
+                break;
+
+            case 'I':
+                disk_threads = atoi(optarg);
+                break;
+
+            case 'm':
+                max_conns = atoi(optarg);
+                if (max_conns <= 0) {
+                    lws_log(2, "invalid connection limit: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
+            case 'r':
+                max_requests = atoi(optarg);
+                if (max_requests <= 0) {
+                    lws_log(2, "invalid request limit: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
+            case 'q':
+                target_ms = atoi(optarg);
+                if (target_ms <= 0) {
+                    lws_log(2, "invalid queueing delay target: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
+            case 'R':
+                retry_after = atoi(optarg);
+                if (retry_after < 0) {
+                    lws_log(2, "invalid retry after: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
+            case 'B':
+                backlog = atoi(optarg);
+                if (backlog <= 0) {
+                    lws_log(2, "invalid backlog: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
+            case 'd':
+                defer_sec = atoi(optarg);
+                if (defer_sec < 0) {
+                    lws_log(2, "invalid defer accept: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
+            case 'F':
+                fastopen = atoi(optarg);
+                if (fastopen <= 0) {
+                    lws_log(2, "invalid fast open queue: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
+            case 'Z':
+                zerocopy = atoi(optarg);
+                if (zerocopy <= 0) {
+                    lws_log(2, "invalid zerocopy threshold: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
+            case 'D':
+                drain_sec = atoi(optarg);
+                if (drain_sec <= 0) {
+                    lws_log(2, "invalid drain deadline: %s\n", optarg);
+                    goto usage;
+                }
+                break;
+
             case 'l':
                 log_level = atoi(optarg);
                 break;
@@ -77,6 +324,66 @@ int main(int argc, char *argv[])
             return -1;
         }
 
+        for (i = 0; i < enable_count; i++) {
+            if (lws_service_enable(enable[i]))
+                goto usage;
+        }
+
+        for (i = 0; i < route_count; i++) {
+            eq = strchr(routes[i], '=');
+            if (lws_proxy_endpoint_register(routes[i], eq - routes[i], eq + 1, route_policy[i])) {
+                lws_log(2, "register proxy route failed: %s\n", routes[i]);
+                return -1;
+            }
+        }
+
+        for (i = 0; i < coalesce_count; i++) {
+            if (lws_http_endpoint_set_flags(coalesce[i], strlen(coalesce[i]), LWS_ENDPOINT_COALESCE))
+                return -1;
+        }
+
+        for (i = 0; i < compute_count; i++) {
+            if (lws_http_endpoint_set_flags(compute[i], strlen(compute[i]), LWS_ENDPOINT_COMPUTE))
+                return -1;
+        }
+
+        if ((compute_count || compute_threads) && lws_compute_init(compute_threads ? compute_threads : 1)) {
+            lws_log(2, "init compute pool failed\n");
+            return -1;
+        }
+
+        if (lws_disk_init(disk_threads)) {
+            lws_log(2, "init disk pool failed\n");
+            goto usage;
+        }
+
+        if (cache_size && lws_cache_init(cache_size * 1024 * 1024, cache_vary)) {
+            lws_log(2, "init response cache failed\n");
+            return -1;
+        }
+
+        if ((tls_cert || tls_key) && (tls_cert == NULL || tls_key == NULL)) {
+            lws_log(2, "tls needs both certificate and key\n");
+            goto usage;
+        }
+
+        if (tls_cert && lws_tls_init(tls_cert, tls_key, tls_ticket_key)) {
+            lws_log(2, "init tls failed\n");
+            return -1;
+        }
+
+        /* kill -USR2 re-executes this binary with the same options */
+        if (lws_upgrade_init(argv, drain_sec))
+            lws_log(3, "hot upgrade unavailable\n");
+
+        lws_admit_init(max_requests, target_ms, retry_after);
+        lws_service_set_limits(max_conns, backlog);
+        lws_service_set_accept(defer_sec, fastopen);
+        lws_service_set_zerocopy(zerocopy);
+
+        lws_service_set_backend(backend);
+        if (lws_service_set_workers(workers, cpus))
+            goto usage;
         lws_log(3, "start lws service, port: %d\n", port);
         lws_service_start(port);
     }
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "lws_log.h"
+#include "lws_upgrade.h"
+
+/* upgrade states of the old process */
+#define LWS_UPGRADE_IDLE            0
+#define LWS_UPGRADE_SPAWNED         1           /* new binary starting, both accept */
+#define LWS_UPGRADE_DRAIN           2           /* listeners handed over */
+
+static volatile sig_atomic_t lws_upgrade_requested = 0;
+static char **lws_upgrade_argv = NULL;
+static char lws_upgrade_exe[PATH_MAX];
+static int lws_upgrade_drain_sec = LWS_UPGRADE_DRAIN_SEC;
+
+static int lws_upgrade_fds[LWS_UPGRADE_MAX_FDS];
+static int lws_upgrade_fd_count = 0;
+
+static int lws_upgrade_state = LWS_UPGRADE_IDLE;
+static int lws_upgrade_parent = -1;             /* handoff socket to report readiness on */
+static int lws_upgrade_child = -1;              /* handoff socket of the spawned binary */
+static pid_t lws_upgrade_pid = -1;
+static time_t lws_upgrade_deadline = 0;
+
+static void lws_upgrade_signal(int sig)
+{
+    lws_upgrade_requested = 1;
+}
+
+static int lws_upgrade_send_fds(int sockfd, const int *fds, int count)
+{
+    char control[CMSG_SPACE(sizeof(int) * LWS_UPGRADE_MAX_FDS)];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    char n = (char)count;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    iov.iov_base = &n;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+    return sendmsg(sockfd, &msg, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+static int lws_upgrade_recv_fds(int sockfd, int *fds, int max)
+{
+    char control[CMSG_SPACE(sizeof(int) * LWS_UPGRADE_MAX_FDS)];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    int i, count;
+    char n;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &n;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC) != 1)
+        return -1;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return -1;
+
+    count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (count != n || count > max) {
+        for (i = 0; i < count; i++)
+            close(((int *)CMSG_DATA(cmsg))[i]);
+        return -1;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+    return count;
+}
+
+/* fork and exec the binary on disk, which is the new version after a deploy */
+static int lws_upgrade_spawn(void)
+{
+    char env[32];
+    int sv[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) {
+        lws_log(2, "upgrade socketpair failed, %s\n", strerror(errno));
+        return -1;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        lws_log(2, "upgrade fork failed, %s\n", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        fcntl(sv[1], F_SETFD, 0);
+        snprintf(env, sizeof(env), "%d", sv[1]);
+        setenv(LWS_UPGRADE_ENV, env, 1);
+        execv(lws_upgrade_exe, lws_upgrade_argv);
+        _exit(127);
+    }
+
+    close(sv[1]);
+    if (lws_upgrade_send_fds(sv[0], lws_upgrade_fds, lws_upgrade_fd_count)) {
+        lws_log(2, "upgrade handoff failed, %s\n", strerror(errno));
+        close(sv[0]);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    lws_upgrade_child = sv[0];
+    lws_upgrade_pid = pid;
+    lws_upgrade_deadline = time(NULL) + LWS_UPGRADE_READY_SEC;
+    lws_log(3, "upgrade started, pid: %d, binary: %s\n", (int)pid, lws_upgrade_exe);
+    return 0;
+}
+
+/* the spawned binary died or never got ready, keep serving */
+static void lws_upgrade_abort(const char *reason)
+{
+    lws_log(2, "upgrade failed, %s, keep serving\n", reason);
+    close(lws_upgrade_child);
+    lws_upgrade_child = -1;
+    kill(lws_upgrade_pid, SIGKILL);
+    waitpid(lws_upgrade_pid, NULL, 0);
+    lws_upgrade_pid = -1;
+    lws_upgrade_state = LWS_UPGRADE_IDLE;
+}
+
+/**
+ * @func    lws_upgrade_init
+ * @brief   arm hot upgrade, SIGUSR2 makes the service exec its binary again
+ *          and hand its listening sockets over
+ *
+ * @param   argv[in] command line, reused for the new binary
+ * @param   drain_sec[in] deadline for connections to finish after handoff
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_upgrade_init(char *argv[], int drain_sec)
+{
+    struct sigaction sa;
+    ssize_t n;
+
+    /* resolved now, a deploy replaces the file behind this path */
+    n = readlink("/proc/self/exe", lws_upgrade_exe, sizeof(lws_upgrade_exe) - 1);
+    if (n <= 0) {
+        lws_log(2, "upgrade cannot resolve binary, %s\n", strerror(errno));
+        return -1;
+    }
+    lws_upgrade_exe[n] = '\0';
+
+    lws_upgrade_argv = argv;
+    lws_upgrade_drain_sec = drain_sec > 0 ? drain_sec : LWS_UPGRADE_DRAIN_SEC;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = lws_upgrade_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(SIGUSR2, &sa, NULL);
+}
+
+/**
+ * @func    lws_upgrade_inherit
+ * @brief   receive listening sockets from the process being upgraded
+ *
+ * @param   fds[out] listening sockets
+ * @param   max[in] fds capacity
+ * @return  number of inherited sockets, 0 if not started by an upgrade,
+ *          -1 on error.
+ */
+int lws_upgrade_inherit(int *fds, int max)
+{
+    char *env = getenv(LWS_UPGRADE_ENV);
+    int sockfd, count;
+
+    if (env == NULL)
+        return 0;
+
+    sockfd = atoi(env);
+    unsetenv(LWS_UPGRADE_ENV);
+    fcntl(sockfd, F_SETFD, FD_CLOEXEC);
+
+    count = lws_upgrade_recv_fds(sockfd, fds, max);
+    if (count <= 0) {
+        lws_log(2, "upgrade receive listeners failed\n");
+        close(sockfd);
+        return -1;
+    }
+
+    lws_upgrade_parent = sockfd;
+    lws_log(3, "upgrade inherited %d listeners\n", count);
+    return count;
+}
+
+/**
+ * @func    lws_upgrade_listen
+ * @brief   record listening sockets handed over by the next upgrade
+ *
+ * @param   fds[in] listening sockets
+ * @param   count[in] socket count
+ * @return  void
+ */
+void lws_upgrade_listen(const int *fds, int count)
+{
+    if (count > LWS_UPGRADE_MAX_FDS)
+        count = LWS_UPGRADE_MAX_FDS;
+
+    memcpy(lws_upgrade_fds, fds, sizeof(int) * count);
+    lws_upgrade_fd_count = count;
+}
+
+/**
+ * @func    lws_upgrade_poll
+ * @brief   drive the upgrade from the accepting loop, at least every
+ *          LWS_EVENT_TICK_MS. The first call reports readiness to the
+ *          process being upgraded. The process exits once drained.
+ *
+ * @param   conns[in] open client connections
+ * @return  LWS_UPGRADE_SERVING, LWS_UPGRADE_STOP_ACCEPT or LWS_UPGRADE_DRAINING.
+ */
+int lws_upgrade_poll(int conns)
+{
+    char ready = 'R';
+    ssize_t n;
+
+    /* the event loop runs, the old process may stop accepting */
+    if (lws_upgrade_parent >= 0) {
+        if (write(lws_upgrade_parent, &ready, 1) != 1)
+            lws_log(2, "upgrade ready report failed, %s\n", strerror(errno));
+        close(lws_upgrade_parent);
+        lws_upgrade_parent = -1;
+    }
+
+    switch (lws_upgrade_state) {
+    case LWS_UPGRADE_IDLE:
+        if (!lws_upgrade_requested)
+            return LWS_UPGRADE_SERVING;
+
+        lws_upgrade_requested = 0;
+        if (lws_upgrade_argv == NULL || lws_upgrade_fd_count == 0 || lws_upgrade_spawn())
+            return LWS_UPGRADE_SERVING;
+        lws_upgrade_state = LWS_UPGRADE_SPAWNED;
+        return LWS_UPGRADE_SERVING;
+
+    case LWS_UPGRADE_SPAWNED:
+        lws_upgrade_requested = 0;
+        n = read(lws_upgrade_child, &ready, 1);
+        if (n == 1 && ready == 'R') {
+            close(lws_upgrade_child);
+            lws_upgrade_child = -1;
+            __atomic_store_n(&lws_upgrade_state, LWS_UPGRADE_DRAIN, __ATOMIC_RELAXED);
+            lws_upgrade_deadline = time(NULL) + lws_upgrade_drain_sec;
+            lws_log(3, "upgrade handed over to pid %d, draining %d connections\n", (int)lws_upgrade_pid, conns);
+            return LWS_UPGRADE_STOP_ACCEPT;
+        }
+
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+            lws_upgrade_abort("new binary exited");
+        else if (time(NULL) >= lws_upgrade_deadline)
+            lws_upgrade_abort("new binary not ready");
+        return LWS_UPGRADE_SERVING;
+
+    default:
+        if (conns <= 0 || time(NULL) >= lws_upgrade_deadline) {
+            lws_log(3, "upgrade drained, %d connections left, exit\n", conns);
+            exit(0);
+        }
+        return LWS_UPGRADE_DRAINING;
+    }
+}
+
+/**
+ * @func    lws_upgrade_draining
+ * @brief   check if the listeners were handed over and connections drain
+ *
+ * @return  1 if draining, or 0.
+ */
+int lws_upgrade_draining(void)
+{
+    /* read by connection threads of the thread engine */
+    return __atomic_load_n(&lws_upgrade_state, __ATOMIC_RELAXED) == LWS_UPGRADE_DRAIN;
+}
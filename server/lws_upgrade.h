@@ -0,0 +1,68 @@
+#ifndef _LWS_UPGRADE_H_
+#define _LWS_UPGRADE_H_
+
+#define LWS_UPGRADE_ENV             "LWS_UPGRADE_FD"    /* handoff socket of the new binary */
+#define LWS_UPGRADE_MAX_FDS         16
+#define LWS_UPGRADE_READY_SEC       10          /* the new binary must be serving by then */
+
+#ifndef LWS_UPGRADE_DRAIN_SEC
+#define LWS_UPGRADE_DRAIN_SEC       30          /* default connection drain deadline */
+#endif
+
+/* lws_upgrade_poll results */
+#define LWS_UPGRADE_SERVING         0
+#define LWS_UPGRADE_STOP_ACCEPT     1           /* once, the new binary accepts from now on */
+#define LWS_UPGRADE_DRAINING        2
+
+/**
+ * @func    lws_upgrade_init
+ * @brief   arm hot upgrade, SIGUSR2 makes the service exec its binary again
+ *          and hand its listening sockets over
+ *
+ * @param   argv[in] command line, reused for the new binary
+ * @param   drain_sec[in] deadline for connections to finish after handoff
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_upgrade_init(char *argv[], int drain_sec);
+
+/**
+ * @func    lws_upgrade_inherit
+ * @brief   receive listening sockets from the process being upgraded
+ *
+ * @param   fds[out] listening sockets
+ * @param   max[in] fds capacity
+ * @return  number of inherited sockets, 0 if not started by an upgrade,
+ *          -1 on error.
+ */
+extern int lws_upgrade_inherit(int *fds, int max);
+
+/**
+ * @func    lws_upgrade_listen
+ * @brief   record listening sockets handed over by the next upgrade
+ *
+ * @param   fds[in] listening sockets
+ * @param   count[in] socket count
+ * @return  void
+ */
+extern void lws_upgrade_listen(const int *fds, int count);
+
+/**
+ * @func    lws_upgrade_poll
+ * @brief   drive the upgrade from the accepting loop, at least every
+ *          LWS_EVENT_TICK_MS. The first call reports readiness to the
+ *          process being upgraded. The process exits once drained.
+ *
+ * @param   conns[in] open client connections
+ * @return  LWS_UPGRADE_SERVING, LWS_UPGRADE_STOP_ACCEPT or LWS_UPGRADE_DRAINING.
+ */
+extern int lws_upgrade_poll(int conns);
+
+/**
+ * @func    lws_upgrade_draining
+ * @brief   check if the listeners were handed over and connections drain
+ *
+ * @return  1 if draining, or 0.
+ */
+extern int lws_upgrade_draining(void);
+
+#endif // _LWS_UPGRADE_H_
@@ -0,0 +1,712 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/io_uring.h>
+
+#include "lws_log.h"
+#include "lws_http.h"
+#include "lws_socket.h"
+#include "lws_event.h"
+#include "lws_upgrade.h"
+#include "lws_metrics.h"
+#include "lws_admit.h"
+#include "lws_tcpinfo.h"
+
+#define LWS_URING_ENTRIES       1024
+#define LWS_URING_BUF_COUNT     1024        /* power of 2 */
+#define LWS_URING_BUF_SIZE      4096
+#define LWS_URING_BUF_GROUP     0
+
+/* user_data: fd << 8 | op, accept carries the registered file index of its listener */
+#define LWS_URING_OP_ACCEPT     1
+#define LWS_URING_OP_RECV       2
+#define LWS_URING_OP_SEND       3
+#define LWS_URING_OP_CANCEL     4           /* completion ignored */
+#define LWS_URING_OP_WAKE       5           /* worker wakefd readable */
+#define LWS_URING_DATA(fd, op)  (((__u64)(fd) << 8) | (op))
+
+/* lws_event_conn_t pending flags */
+#define LWS_URING_RECV_ARMED    0x01
+#define LWS_URING_SEND_BROKEN   0x02
+#define LWS_URING_DIRTY         0x04
+#define LWS_URING_CLOSING       0x08
+
+typedef struct _lws_uring_t_ {
+    int ring_fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *bufs;
+    lws_event_conn_t *dirty;            /* conns with new output */
+} lws_uring_t;
+
+/* per worker thread */
+static __thread lws_uring_t lws_uring;
+
+static int lws_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int lws_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+                           void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int lws_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * Multishot recv needs 6.0, multishot accept and provided buffer rings 5.19.
+ * The probe only reports opcodes, so check the release as well.
+ */
+static int lws_uring_kernel_supported(void)
+{
+    struct utsname uts;
+    int major = 0, minor = 0;
+
+    if (uname(&uts) || sscanf(uts.release, "%d.%d", &major, &minor) != 2)
+        return 0;
+
+    return (major >= 6) ? 1 : 0;
+}
+
+static int lws_uring_probe(lws_uring_t *ring)
+{
+    struct io_uring_probe *probe;
+    int ops[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_POLL_ADD};
+    size_t size;
+    int i, ret = 0;
+
+    size = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+    probe = calloc(1, size);
+    if (probe == NULL)
+        return -1;
+
+    if (lws_uring_register(ring->ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        lws_log(3, "io_uring probe failed, %s\n", strerror(errno));
+        free(probe);
+        return -1;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(ops); i++) {
+        if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+            lws_log(3, "io_uring opcode %d unsupported\n", ops[i]);
+            ret = -1;
+        }
+    }
+
+    free(probe);
+    return ret;
+}
+
+static void lws_uring_exit(lws_uring_t *ring)
+{
+    if (ring->bufs)
+        free(ring->bufs);
+    if (ring->buf_ring)
+        munmap(ring->buf_ring, ring->buf_ring_size);
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr)
+        munmap(ring->sq_ptr, ring->sq_size);
+    if (ring->ring_fd >= 0)
+        close(ring->ring_fd);
+
+    memset(ring, 0, sizeof(lws_uring_t));
+    ring->ring_fd = -1;
+}
+
+/* register recv buffers as provided buffer ring */
+static int lws_uring_init_buffers(lws_uring_t *ring)
+{
+    struct io_uring_buf_reg reg;
+    struct io_uring_buf *buf;
+    int i;
+
+    ring->buf_ring_size = LWS_URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring->buf_ring == MAP_FAILED) {
+        ring->buf_ring = NULL;
+        return -1;
+    }
+
+    ring->bufs = malloc(LWS_URING_BUF_COUNT * LWS_URING_BUF_SIZE);
+    if (ring->bufs == NULL)
+        return -1;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring->buf_ring;
+    reg.ring_entries = LWS_URING_BUF_COUNT;
+    reg.bgid = LWS_URING_BUF_GROUP;
+    if (lws_uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        lws_log(3, "io_uring register buffer ring failed, %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < LWS_URING_BUF_COUNT; i++) {
+        buf = &ring->buf_ring->bufs[i];
+        buf->addr = (unsigned long)(ring->bufs + i * LWS_URING_BUF_SIZE);
+        buf->len = LWS_URING_BUF_SIZE;
+        buf->bid = i;
+    }
+    __atomic_store_n(&ring->buf_ring->tail, LWS_URING_BUF_COUNT, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static int lws_uring_init(lws_uring_t *ring, lws_event_worker_t *w)
+{
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(lws_uring_t));
+    ring->ring_fd = -1;
+
+    if (!lws_uring_kernel_supported()) {
+        lws_log(3, "io_uring needs linux 6.0 or later\n");
+        return -1;
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = LWS_URING_ENTRIES * 4;
+    ring->ring_fd = lws_uring_setup(LWS_URING_ENTRIES, &p);
+    if (ring->ring_fd < 0) {
+        lws_log(3, "io_uring_setup failed, %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (!(p.features & IORING_FEAT_NODROP) || lws_uring_probe(ring)) {
+        lws_uring_exit(ring);
+        return -1;
+    }
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        lws_uring_exit(ring);
+        return -1;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            lws_uring_exit(ring);
+            return -1;
+        }
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        lws_uring_exit(ring);
+        return -1;
+    }
+
+    ring->sq_head = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+    ring->cq_head = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + p.cq_off.cqes);
+    ring->sq_local_tail = *ring->sq_tail;
+
+    /* listen sockets as registered files, indexed like w->listenfds */
+    if (lws_uring_register(ring->ring_fd, IORING_REGISTER_FILES, w->listenfds, w->listen_count) < 0) {
+        lws_log(3, "io_uring register files failed, %s\n", strerror(errno));
+        lws_uring_exit(ring);
+        return -1;
+    }
+
+    if (lws_uring_init_buffers(ring)) {
+        lws_uring_exit(ring);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* waits for min_complete completions, at most LWS_EVENT_TICK_MS */
+static int lws_uring_submit(lws_uring_t *ring, unsigned min_complete)
+{
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0;
+    struct __kernel_timespec ts = {LWS_EVENT_TICK_MS / 1000, (LWS_EVENT_TICK_MS % 1000) * 1000000};
+    struct io_uring_getevents_arg arg;
+    int ret;
+
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (__u64)(uintptr_t)&ts;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    do {
+        ret = lws_uring_enter(ring->ring_fd, ring->to_submit, min_complete, flags,
+                              min_complete ? &arg : NULL, min_complete ? sizeof(arg) : 0);
+    } while (ret < 0 && errno == EINTR);
+
+    /* timed out, submitted entries were consumed all the same */
+    if (ret < 0 && errno == ETIME)
+        ret = 0;
+
+    if (ret >= 0)
+        ring->to_submit = 0;
+
+    return ret;
+}
+
+static struct io_uring_sqe *lws_uring_get_sqe(lws_uring_t *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned head, index;
+
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= *ring->sq_mask + 1) {
+        /* ring full, hand queued entries to kernel first */
+        if (lws_uring_submit(ring, 0) < 0)
+            return NULL;
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sq_local_tail - head >= *ring->sq_mask + 1)
+            return NULL;
+    }
+
+    index = ring->sq_local_tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    ring->to_submit++;
+
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static int lws_uring_arm_accept(lws_uring_t *ring, int index)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = lws_uring_get_sqe(ring);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = index;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = LWS_URING_DATA(index, LWS_URING_OP_ACCEPT);
+    return 0;
+}
+
+/* stop the multishot accept, the listener was handed over by an upgrade */
+static int lws_uring_cancel_accept(lws_uring_t *ring, int index)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = lws_uring_get_sqe(ring);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = LWS_URING_DATA(index, LWS_URING_OP_ACCEPT);
+    sqe->user_data = LWS_URING_DATA(0, LWS_URING_OP_CANCEL);
+    return 0;
+}
+
+/* one shot poll of the worker wakefd, re-armed after each wake up */
+static int lws_uring_arm_wake(lws_uring_t *ring, int wakefd)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = lws_uring_get_sqe(ring);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wakefd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = LWS_URING_DATA(0, LWS_URING_OP_WAKE);
+    return 0;
+}
+
+static int lws_uring_arm_recv(lws_uring_t *ring, lws_event_conn_t *ec)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = lws_uring_get_sqe(ring);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = ec->sockfd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = LWS_URING_BUF_GROUP;
+    sqe->user_data = LWS_URING_DATA(ec->sockfd, LWS_URING_OP_RECV);
+    ec->pending |= LWS_URING_RECV_ARMED;
+    ec->inflight++;
+    return 0;
+}
+
+/* give provided buffer back to kernel */
+static void lws_uring_recycle_buffer(lws_uring_t *ring, int bid)
+{
+    struct io_uring_buf *buf;
+    unsigned short tail;
+
+    tail = ring->buf_ring->tail;
+    buf = &ring->buf_ring->bufs[tail & (LWS_URING_BUF_COUNT - 1)];
+    buf->addr = (unsigned long)(ring->bufs + bid * LWS_URING_BUF_SIZE);
+    buf->len = LWS_URING_BUF_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&ring->buf_ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* submit the whole output queue as one chain of linked sends */
+static int lws_uring_flush(lws_uring_t *ring, lws_event_conn_t *ec)
+{
+    struct io_uring_sqe *sqe = NULL;
+    lws_outseg_t *seg;
+
+    if (ec->inflight > ((ec->pending & LWS_URING_RECV_ARMED) ? 1 : 0))
+        return 0;   /* previous chain still running, resubmit on completion */
+
+    /* sends wait for room in the socket, resubmits are where it ran full */
+    lws_tcpinfo_sndbuf(ec->sockfd, ec->out_length, &ec->sndbuf_check);
+
+    ec->pending &= ~LWS_URING_SEND_BROKEN;
+    for (seg = ec->out_head; seg; seg = seg->next) {
+        sqe = lws_uring_get_sqe(ring);
+        if (sqe == NULL)
+            break;
+
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = ec->sockfd;
+        sqe->addr = (unsigned long)(seg->data + seg->offset);
+        sqe->len = seg->length - seg->offset;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = LWS_URING_DATA(ec->sockfd, LWS_URING_OP_SEND);
+        seg->capacity = seg->length;    /* in flight, no more appends */
+        ec->inflight++;
+    }
+
+    /* terminate the chain */
+    if (sqe)
+        sqe->flags &= ~IOSQE_IO_LINK;
+
+    return (seg != NULL) ? -1 : 0;
+}
+
+static void lws_uring_mark(lws_event_conn_t *ec)
+{
+    if (!(ec->pending & LWS_URING_DIRTY)) {
+        ec->pending |= LWS_URING_DIRTY;
+        ec->next = lws_uring.dirty;
+        lws_uring.dirty = ec;
+    }
+}
+
+static int lws_uring_send(int sockfd, char *data, int size)
+{
+    lws_event_conn_t *ec;
+
+    ec = lws_event_conn_get(sockfd);
+    if (ec == NULL || data == NULL || size < 0)
+        return -1;
+
+    /* handler buffers are released after return, keep a copy until sent */
+    if (lws_event_conn_queue(ec, data, size))
+        return -1;
+
+    lws_uring_mark(ec);
+    return size;
+}
+
+/* shared buffer send callback, the reference joins the output queue */
+static int lws_uring_send_shared(int sockfd, lws_buf_t *buf)
+{
+    lws_event_conn_t *ec;
+
+    ec = lws_event_conn_get(sockfd);
+    if (ec == NULL)
+        return lws_event_conn_post(sockfd, buf);
+
+    if (buf) {
+        lws_event_worker_deliver();
+        if (lws_event_conn_queue_buf(ec, buf))
+            return -1;
+        lws_uring_mark(ec);
+    }
+
+    return ec->out_length;
+}
+
+/* body chain send callback, file ranges are read as the ring only sends memory */
+static int lws_uring_send_chain(int sockfd, const char *head, int head_len, lws_chain_t *chain)
+{
+    lws_event_conn_t *ec;
+    int ret;
+
+    ec = lws_event_conn_get(sockfd);
+    if (ec == NULL)
+        return -1;
+
+    ret = lws_event_conn_queue_chain(ec, head, head_len, chain, 0);
+    lws_uring_mark(ec);
+    return ret;
+}
+
+/* stop receiving, release connection once nothing is in flight */
+static void lws_uring_close(lws_event_conn_t *ec)
+{
+    if (!(ec->pending & LWS_URING_CLOSING)) {
+        ec->pending |= LWS_URING_CLOSING;
+        shutdown(ec->sockfd, SHUT_RDWR);
+    }
+
+    if (ec->inflight == 0 && !(ec->pending & LWS_URING_DIRTY))
+        lws_event_conn_free(ec);
+}
+
+static void lws_uring_handle_accept(lws_uring_t *ring, struct io_uring_cqe *cqe)
+{
+    lws_event_conn_t *ec;
+    int cli_fd = cqe->res;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE) && !lws_upgrade_draining())
+        lws_uring_arm_accept(ring, cqe->user_data >> 8);
+
+    if (cli_fd < 0) {
+        if (cli_fd != -ECANCELED)
+            lws_log(2, "accept failed, ret: %s\n", strerror(-cli_fd));
+        return;
+    }
+
+    if (lws_service_admit(cli_fd))
+        return;
+
+    ec = lws_event_conn_new(cli_fd, lws_uring_send);
+    if (ec == NULL) {
+        lws_log(2, "lws_event_conn_new failed\n");
+        close(cli_fd);
+        return;
+    }
+    ec->http->send_shared = lws_uring_send_shared;
+    ec->http->send_chain = lws_uring_send_chain;
+
+    lws_log(3, "start http recv sockfd: %d\n", cli_fd);
+    if (lws_uring_arm_recv(ring, ec))
+        lws_uring_close(ec);
+}
+
+static void lws_uring_handle_recv(lws_uring_t *ring, lws_event_conn_t *ec, struct io_uring_cqe *cqe)
+{
+    int more = cqe->flags & IORING_CQE_F_MORE;
+    int bid;
+
+    if (!more) {
+        ec->inflight--;
+        ec->pending &= ~LWS_URING_RECV_ARMED;
+    }
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe->res > 0 && !(ec->pending & LWS_URING_CLOSING) &&
+            lws_http_conn_recv(ec->http, ring->bufs + bid * LWS_URING_BUF_SIZE, cqe->res) < 0) {
+            ec->http->close_flag = 1;
+            ec->pending |= LWS_URING_CLOSING;
+        }
+        lws_uring_recycle_buffer(ring, bid);
+    }
+
+    if (ec->pending & LWS_URING_CLOSING) {
+        lws_uring_close(ec);
+        return;
+    }
+
+    if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS)) {
+        lws_uring_close(ec);
+    } else if (!more && !ec->http->close_flag) {
+        /* multishot ended, ENOBUFS or kernel limit */
+        if (lws_uring_arm_recv(ring, ec))
+            lws_uring_close(ec);
+    }
+}
+
+static void lws_uring_handle_send(lws_uring_t *ring, lws_event_conn_t *ec, struct io_uring_cqe *cqe)
+{
+    int left;
+
+    ec->inflight--;
+
+    if (cqe->res == -ECANCELED) {
+        ec->pending |= LWS_URING_SEND_BROKEN;
+    } else if (cqe->res < 0) {
+        lws_log(3, "sockfd[%d] send failed, %s\n", ec->sockfd, strerror(-cqe->res));
+        ec->pending |= LWS_URING_CLOSING;
+    } else if (!(ec->pending & LWS_URING_SEND_BROKEN) && ec->out_head) {
+        left = ec->out_head->length - ec->out_head->offset;
+        if (cqe->res < left)
+            ec->pending |= LWS_URING_SEND_BROKEN;   /* short send, rest of chain cancelled */
+        lws_event_conn_consume(ec, cqe->res);
+    }
+
+    if (ec->pending & LWS_URING_CLOSING) {
+        lws_uring_close(ec);
+        return;
+    }
+
+    /* chain finished: resubmit leftover or close after last response */
+    if (ec->inflight <= ((ec->pending & LWS_URING_RECV_ARMED) ? 1 : 0)) {
+        if (ec->out_head) {
+            lws_uring_flush(ring, ec);
+        } else if (ec->http->close_flag) {
+            lws_uring_close(ec);
+        }
+    }
+}
+
+/**
+ * @func    lws_uring_start
+ * @brief   run io_uring event loop of worker on its listen sockets
+ *
+ * @param   w[in] worker of the calling thread
+ * @return  If kernel lacks required io_uring features, return -1 before
+ *          serving any connection, so caller can fall back to epoll.
+ */
+int lws_uring_start(lws_event_worker_t *w)
+{
+    lws_uring_t *ring = &lws_uring;
+    struct io_uring_cqe *cqe;
+    lws_event_conn_t *ec;
+    unsigned head, tail;
+    int op, fd, i;
+
+    if (lws_uring_init(ring, w))
+        return -1;
+
+    lws_log(3, "io_uring ready, multishot accept/recv, %d provided buffers\n", LWS_URING_BUF_COUNT);
+
+    for (i = 0; i < w->listen_count; i++) {
+        if (lws_uring_arm_accept(ring, i)) {
+            lws_uring_exit(ring);
+            return -1;
+        }
+    }
+    if (lws_uring_arm_wake(ring, w->wakefd)) {
+        lws_uring_exit(ring);
+        return -1;
+    }
+
+    while (1) {
+        if (lws_uring_submit(ring, 1) < 0) {
+            lws_log(2, "io_uring_enter failed, %s\n", strerror(errno));
+            break;
+        }
+
+        /* received data completed before the wake up, it queued since at least then */
+        lws_admit_stamp(lws_metrics_now());
+
+        head = *ring->cq_head;
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            cqe = &ring->cqes[head & *ring->cq_mask];
+            op = cqe->user_data & 0xff;
+            fd = cqe->user_data >> 8;
+
+            if (op == LWS_URING_OP_ACCEPT) {
+                lws_uring_handle_accept(ring, cqe);
+                continue;
+            }
+            if (op == LWS_URING_OP_CANCEL)
+                continue;
+            if (op == LWS_URING_OP_WAKE) {
+                lws_event_worker_wake();
+                lws_uring_arm_wake(ring, w->wakefd);
+                continue;
+            }
+
+            ec = lws_event_conn_get(fd);
+            if (ec == NULL) {
+                if ((cqe->flags & IORING_CQE_F_BUFFER) && op == LWS_URING_OP_RECV)
+                    lws_uring_recycle_buffer(ring, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                continue;
+            }
+
+            if (op == LWS_URING_OP_RECV)
+                lws_uring_handle_recv(ring, ec, cqe);
+            else if (op == LWS_URING_OP_SEND)
+                lws_uring_handle_send(ring, ec, cqe);
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        /* the listeners stay open, they belong to the new process now */
+        if (lws_event_upgrade_poll() == LWS_UPGRADE_STOP_ACCEPT) {
+            for (i = 0; i < w->listen_count; i++)
+                lws_uring_cancel_accept(ring, i);
+        }
+        lws_event_conn_keepalive(time(NULL));
+
+        /* turn handler output into linked sends */
+        while ((ec = ring->dirty) != NULL) {
+            ring->dirty = ec->next;
+            ec->next = NULL;
+            ec->pending &= ~LWS_URING_DIRTY;
+
+            if (ec->pending & LWS_URING_CLOSING)
+                lws_uring_close(ec);
+            else
+                lws_uring_flush(ring, ec);
+        }
+    }
+
+    lws_uring_exit(ring);
+    return -1;
+}
@@ -0,0 +1,49 @@
+#include <stdlib.h>
+
+#include "lws_buf.h"
+
+/**
+ * @func    lws_buf_new
+ * @brief   allocate a buffer with one reference
+ *
+ * @param   size[in] data capacity
+ * @return  On success, return buffer, length is 0. On error, return NULL.
+ **/
+lws_buf_t *lws_buf_new(int size)
+{
+    lws_buf_t *buf;
+
+    buf = malloc(sizeof(lws_buf_t) + size);
+    if (buf == NULL)
+        return NULL;
+
+    buf->refcount = 1;
+    buf->length = 0;
+    return buf;
+}
+
+/**
+ * @func    lws_buf_ref
+ * @brief   take a reference, safe from any thread
+ *
+ * @param   buf[in] buffer
+ * @return  buf.
+ **/
+lws_buf_t *lws_buf_ref(lws_buf_t *buf)
+{
+    __atomic_add_fetch(&buf->refcount, 1, __ATOMIC_RELAXED);
+    return buf;
+}
+
+/**
+ * @func    lws_buf_unref
+ * @brief   drop a reference, safe from any thread
+ *
+ * @param   buf[in] buffer or NULL
+ * @return  void
+ **/
+void lws_buf_unref(lws_buf_t *buf)
+{
+    if (buf && __atomic_sub_fetch(&buf->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+        free(buf);
+}
@@ -0,0 +1,41 @@
+#ifndef _LWS_BUF_H_
+#define _LWS_BUF_H_
+
+/**
+ * refcounted immutable buffer, shared by the output queues of many
+ * connections, the last reference frees it
+**/
+typedef struct _lws_buf_t_ {
+    int refcount;
+    int length;
+    char data[];
+} lws_buf_t;
+
+/**
+ * @func    lws_buf_new
+ * @brief   allocate a buffer with one reference
+ *
+ * @param   size[in] data capacity
+ * @return  On success, return buffer, length is 0. On error, return NULL.
+ **/
+extern lws_buf_t *lws_buf_new(int size);
+
+/**
+ * @func    lws_buf_ref
+ * @brief   take a reference, safe from any thread
+ *
+ * @param   buf[in] buffer
+ * @return  buf.
+ **/
+extern lws_buf_t *lws_buf_ref(lws_buf_t *buf);
+
+/**
+ * @func    lws_buf_unref
+ * @brief   drop a reference, safe from any thread
+ *
+ * @param   buf[in] buffer or NULL
+ * @return  void
+ **/
+extern void lws_buf_unref(lws_buf_t *buf);
+
+#endif // _LWS_BUF_H_
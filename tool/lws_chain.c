@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "lws_disk.h"
+#include "lws_chain.h"
+
+/* room for one more segment, the local array moves to the heap once full */
+static lws_chain_seg_t *lws_chain_append(lws_chain_t *chain, int type, int length)
+{
+    lws_chain_seg_t *segs;
+    int capacity;
+
+    if (length < 0 || length > INT_MAX - chain->length)
+        return NULL;
+
+    if (chain->count == chain->capacity) {
+        capacity = chain->capacity * 2;
+        if (chain->segs == chain->local) {
+            segs = malloc(capacity * sizeof(lws_chain_seg_t));
+            if (segs)
+                memcpy(segs, chain->local, sizeof(chain->local));
+        } else {
+            segs = realloc(chain->segs, capacity * sizeof(lws_chain_seg_t));
+        }
+        if (segs == NULL)
+            return NULL;
+
+        chain->segs = segs;
+        chain->capacity = capacity;
+    }
+
+    chain->length += length;
+    segs = &chain->segs[chain->count++];
+    memset(segs, 0, sizeof(*segs));
+    segs->type = type;
+    segs->length = length;
+    segs->fd = -1;
+    return segs;
+}
+
+/**
+ * @func    lws_chain_init
+ * @brief   initialize an empty chain
+ *
+ * @param   chain[out] chain
+ * @return  void
+ **/
+void lws_chain_init(lws_chain_t *chain)
+{
+    chain->segs = chain->local;
+    chain->count = 0;
+    chain->capacity = LWS_CHAIN_LOCAL;
+    chain->length = 0;
+}
+
+/**
+ * @func    lws_chain_free
+ * @brief   drop the buffer references and close the files of a chain, it is
+ *          empty afterwards
+ *
+ * @param   chain[in] chain
+ * @return  void
+ **/
+void lws_chain_free(lws_chain_t *chain)
+{
+    int i;
+
+    for (i = 0; i < chain->count; i++) {
+        lws_buf_unref(chain->segs[i].buf);
+        if (chain->segs[i].fd >= 0)
+            close(chain->segs[i].fd);
+    }
+
+    if (chain->segs != chain->local)
+        free(chain->segs);
+    lws_chain_init(chain);
+}
+
+/**
+ * @func    lws_chain_add_buf
+ * @brief   append a slice of a refcounted buffer, a reference is taken
+ *
+ * @param   chain[in] chain
+ * @param   buf[in] buffer
+ * @param   offset[in] slice start in buf->data
+ * @param   length[in] slice length
+ * @return  On success, return 0, On error, return -1.
+ **/
+int lws_chain_add_buf(lws_chain_t *chain, lws_buf_t *buf, int offset, int length)
+{
+    lws_chain_seg_t *seg;
+
+    if (buf == NULL || offset < 0 || length < 0 || offset > buf->length - length)
+        return -1;
+
+    seg = lws_chain_append(chain, LWS_CHAIN_BUF, length);
+    if (seg == NULL)
+        return -1;
+
+    seg->data = buf->data + offset;
+    seg->buf = lws_buf_ref(buf);
+    return 0;
+}
+
+/**
+ * @func    lws_chain_add_static
+ * @brief   append memory that outlives every response, string literals and
+ *          templates built at startup
+ *
+ * @param   chain[in] chain
+ * @param   data[in] memory, never released
+ * @param   length[in] data length
+ * @return  On success, return 0, On error, return -1.
+ **/
+int lws_chain_add_static(lws_chain_t *chain, const char *data, int length)
+{
+    lws_chain_seg_t *seg;
+
+    if (data == NULL && length > 0)
+        return -1;
+
+    seg = lws_chain_append(chain, LWS_CHAIN_STATIC, length);
+    if (seg == NULL)
+        return -1;
+
+    seg->data = data;
+    return 0;
+}
+
+/**
+ * @func    lws_chain_add_copy
+ * @brief   append a heap copy of short-lived memory
+ *
+ * @param   chain[in] chain
+ * @param   data[in] memory
+ * @param   length[in] data length
+ * @return  On success, return 0, On error, return -1.
+ **/
+int lws_chain_add_copy(lws_chain_t *chain, const char *data, int length)
+{
+    lws_buf_t *buf;
+    int ret;
+
+    if ((data == NULL && length > 0) || length < 0)
+        return -1;
+
+    buf = lws_buf_new(length);
+    if (buf == NULL)
+        return -1;
+
+    memcpy(buf->data, data, length);
+    buf->length = length;
+    ret = lws_chain_add_buf(chain, buf, 0, length);
+    lws_buf_unref(buf);
+    return ret;
+}
+
+/**
+ * @func    lws_chain_add_file
+ * @brief   append a file range, fd is always consumed
+ *
+ * @param   chain[in] chain
+ * @param   fd[in] file fd, closed by lws_chain_free
+ * @param   offset[in] range start
+ * @param   length[in] range length
+ * @return  On success, return 0, On error, return -1.
+ **/
+int lws_chain_add_file(lws_chain_t *chain, int fd, off_t offset, int length)
+{
+    lws_chain_seg_t *seg;
+
+    if (fd < 0 || offset < 0) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    seg = lws_chain_append(chain, LWS_CHAIN_FILE, length);
+    if (seg == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    seg->fd = fd;
+    seg->offset = offset;
+    return 0;
+}
+
+/**
+ * @func    lws_chain_pread
+ * @brief   read a whole file range, retrying short reads, a handler
+ *          coroutine waits for a cold range on the disk pool
+ *
+ * @param   fd[in] file fd
+ * @param   out[out] length bytes
+ * @param   offset[in] range start
+ * @param   length[in] range length
+ * @return  On success, return length, On error or truncated file, return -1.
+ **/
+int lws_chain_pread(int fd, char *out, off_t offset, int length)
+{
+    ssize_t ret;
+    int nread = 0;
+
+    while (nread < length) {
+        ret = lws_disk_pread(fd, out + nread, length - nread, offset + nread);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+        nread += ret;
+    }
+
+    return length;
+}
+
+/**
+ * @func    lws_chain_copy
+ * @brief   flatten the chain into memory, file ranges are read
+ *
+ * @param   chain[in] chain
+ * @param   out[out] chain->length bytes
+ * @return  On success, return chain->length, On error, return -1.
+ **/
+int lws_chain_copy(lws_chain_t *chain, char *out)
+{
+    lws_chain_seg_t *seg;
+    int i;
+
+    for (i = 0; i < chain->count; i++) {
+        seg = &chain->segs[i];
+        if (seg->type == LWS_CHAIN_FILE) {
+            if (lws_chain_pread(seg->fd, out, seg->offset, seg->length) < 0)
+                return -1;
+        } else if (seg->length > 0) {
+            memcpy(out, seg->data, seg->length);
+        }
+        out += seg->length;
+    }
+
+    return chain->length;
+}
@@ -0,0 +1,128 @@
+#ifndef _LWS_CHAIN_H_
+#define _LWS_CHAIN_H_
+
+#include <sys/types.h>
+
+#include "lws_buf.h"
+
+#define LWS_CHAIN_LOCAL         8           /* segments held in the chain itself, more are allocated */
+
+/* segment types */
+#define LWS_CHAIN_BUF           0           /* slice of a refcounted buffer, heap or shared cache */
+#define LWS_CHAIN_STATIC        1           /* memory outliving every response, never released */
+#define LWS_CHAIN_FILE          2           /* file range, sent with sendfile where the backend can */
+
+typedef struct _lws_chain_seg_t_ {
+    int type;
+    int length;
+    const char *data;                       /* BUF and STATIC */
+    lws_buf_t *buf;                         /* BUF, one reference held */
+    int fd;                                 /* FILE, owned by the chain */
+    off_t offset;                           /* FILE */
+} lws_chain_seg_t;
+
+/**
+ * response body as a chain of segments, sent with writev and sendfile
+ * without being flattened. The backend takes its own buffer references and
+ * file descriptors, so a chain can be released, or reused by the next
+ * response, as soon as the send call returns. Chains live on the stack or
+ * in handler state and are never copied by value.
+**/
+typedef struct _lws_chain_t_ {
+    lws_chain_seg_t *segs;
+    int count;
+    int capacity;
+    int length;                             /* body bytes */
+    lws_chain_seg_t local[LWS_CHAIN_LOCAL];
+} lws_chain_t;
+
+/**
+ * @func    lws_chain_init
+ * @brief   initialize an empty chain
+ *
+ * @param   chain[out] chain
+ * @return  void
+ **/
+extern void lws_chain_init(lws_chain_t *chain);
+
+/**
+ * @func    lws_chain_free
+ * @brief   drop the buffer references and close the files of a chain, it is
+ *          empty afterwards
+ *
+ * @param   chain[in] chain
+ * @return  void
+ **/
+extern void lws_chain_free(lws_chain_t *chain);
+
+/**
+ * @func    lws_chain_add_buf
+ * @brief   append a slice of a refcounted buffer, a reference is taken
+ *
+ * @param   chain[in] chain
+ * @param   buf[in] buffer
+ * @param   offset[in] slice start in buf->data
+ * @param   length[in] slice length
+ * @return  On success, return 0, On error, return -1.
+ **/
+extern int lws_chain_add_buf(lws_chain_t *chain, lws_buf_t *buf, int offset, int length);
+
+/**
+ * @func    lws_chain_add_static
+ * @brief   append memory that outlives every response, string literals and
+ *          templates built at startup
+ *
+ * @param   chain[in] chain
+ * @param   data[in] memory, never released
+ * @param   length[in] data length
+ * @return  On success, return 0, On error, return -1.
+ **/
+extern int lws_chain_add_static(lws_chain_t *chain, const char *data, int length);
+
+/**
+ * @func    lws_chain_add_copy
+ * @brief   append a heap copy of short-lived memory
+ *
+ * @param   chain[in] chain
+ * @param   data[in] memory
+ * @param   length[in] data length
+ * @return  On success, return 0, On error, return -1.
+ **/
+extern int lws_chain_add_copy(lws_chain_t *chain, const char *data, int length);
+
+/**
+ * @func    lws_chain_add_file
+ * @brief   append a file range, fd is always consumed
+ *
+ * @param   chain[in] chain
+ * @param   fd[in] file fd, closed by lws_chain_free
+ * @param   offset[in] range start
+ * @param   length[in] range length
+ * @return  On success, return 0, On error, return -1.
+ **/
+extern int lws_chain_add_file(lws_chain_t *chain, int fd, off_t offset, int length);
+
+/**
+ * @func    lws_chain_copy
+ * @brief   flatten the chain into memory, file ranges are read
+ *
+ * @param   chain[in] chain
+ * @param   out[out] chain->length bytes
+ * @return  On success, return chain->length, On error, return -1.
+ **/
+extern int lws_chain_copy(lws_chain_t *chain, char *out);
+
+/**
+ * @func    lws_chain_pread
+ * @brief   read a whole file range, retrying short reads, a handler
+ *          coroutine waits for a cold range on the disk pool
+ *
+ * @param   fd[in] file fd
+ * @param   out[out] length bytes
+ * @param   offset[in] range start
+ * @param   length[in] range length
+ * @return  On success, return length, On error or truncated file, return -1.
+ **/
+extern int lws_chain_pread(int fd, char *out, off_t offset, int length);
+
+#endif // _LWS_CHAIN_H_
@@ -0,0 +1,356 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+#include "lws_log.h"
+#include "lws_coro.h"
+
+struct _lws_coro_t_ {
+    struct _lws_coro_t_ *next;              /* pool free list */
+    char *base;                             /* mapping, guard page first */
+    lws_coro_fn_t fn;
+    void *arg;
+    void *data;
+    int done;
+#if defined(__x86_64__)
+    void *sp;                               /* stack pointer of the coroutine while suspended */
+    void *caller_sp;                        /* stack pointer of the resumer while running */
+#else
+    ucontext_t ctx;
+    ucontext_t caller;
+#endif
+};
+
+/* per thread, coroutines never migrate */
+static __thread lws_coro_t *lws_coro_running = NULL;
+static __thread lws_coro_t *lws_coro_pool = NULL;
+static __thread int lws_coro_pool_count = 0;
+static __thread lws_coro_watch_t lws_coro_watch = NULL;
+
+#if defined(__x86_64__)
+/*
+ * Save the callee-saved registers and the fpu control words on the current
+ * stack, store its pointer in *save, then continue on stack load as saved
+ * by an earlier switch. Everything else is caller-saved in the SysV ABI.
+ */
+extern void lws_coro_switch(void **save, void *load) __attribute__((visibility("hidden")));
+__asm__(
+    ".text\n"
+    ".globl lws_coro_switch\n"
+    ".hidden lws_coro_switch\n"
+    ".type lws_coro_switch, @function\n"
+    "lws_coro_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size lws_coro_switch, .-lws_coro_switch\n");
+#endif
+
+static void lws_coro_enter(lws_coro_t *co)
+{
+#if defined(__x86_64__)
+    lws_coro_switch(&co->caller_sp, co->sp);
+#else
+    swapcontext(&co->caller, &co->ctx);
+#endif
+}
+
+static void lws_coro_leave(lws_coro_t *co)
+{
+#if defined(__x86_64__)
+    lws_coro_switch(&co->sp, co->caller_sp);
+#else
+    swapcontext(&co->ctx, &co->caller);
+#endif
+}
+
+/* first frame of every coroutine, it is left for good once fn returns */
+static void lws_coro_entry(void)
+{
+    lws_coro_t *co = lws_coro_running;
+
+    co->fn(co->arg);
+    co->done = 1;
+    lws_coro_leave(co);
+}
+
+static size_t lws_coro_map_size(void)
+{
+    return LWS_CORO_STACK_SIZE + sysconf(_SC_PAGESIZE);
+}
+
+/* coroutine at the top of its mapping, the stack grows down from below it to the guard page */
+static lws_coro_t *lws_coro_alloc(void)
+{
+    lws_coro_t *co;
+    size_t size;
+    char *base;
+
+    co = lws_coro_pool;
+    if (co) {
+        lws_coro_pool = co->next;
+        lws_coro_pool_count--;
+        return co;
+    }
+
+    size = lws_coro_map_size();
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED) {
+        lws_log(2, "coroutine stack mmap failed, %s\n", strerror(errno));
+        return NULL;
+    }
+
+    /* an overflow faults instead of overwriting a neighbour */
+    if (mprotect(base, sysconf(_SC_PAGESIZE), PROT_NONE)) {
+        lws_log(2, "coroutine guard page failed, %s\n", strerror(errno));
+        munmap(base, size);
+        return NULL;
+    }
+
+    co = (lws_coro_t *)((uintptr_t)(base + size - sizeof(lws_coro_t)) & ~(uintptr_t)63);
+    co->base = base;
+    return co;
+}
+
+static void lws_coro_release(lws_coro_t *co)
+{
+    if (lws_coro_pool_count >= LWS_CORO_POOL_MAX) {
+        munmap(co->base, lws_coro_map_size());
+        return;
+    }
+
+    co->next = lws_coro_pool;
+    lws_coro_pool = co;
+    lws_coro_pool_count++;
+}
+
+/**
+ * @func    lws_coro_new
+ * @brief   create a coroutine on a pooled stack, it starts on the first resume
+ *
+ * @param   fn[in] coroutine body, arg is only valid until its first yield
+ * @param   arg[in] argument of fn
+ * @return  On success, return coroutine. On error, return NULL.
+ */
+lws_coro_t *lws_coro_new(lws_coro_fn_t fn, void *arg)
+{
+    lws_coro_t *co;
+    char *base;
+#if defined(__x86_64__)
+    uint64_t *sp;
+#endif
+
+    co = lws_coro_alloc();
+    if (co == NULL)
+        return NULL;
+
+    base = co->base;
+    memset(co, 0, sizeof(*co));
+    co->base = base;
+    co->fn = fn;
+    co->arg = arg;
+
+#if defined(__x86_64__)
+    /*
+     * the frame lws_coro_switch pops: control words, six registers, then
+     * lws_coro_entry as return address, which then sees the stack aligned
+     * as after a call
+     */
+    sp = (uint64_t *)((uintptr_t)co & ~(uintptr_t)15) - 9;
+    memset(sp, 0, 9 * sizeof(uint64_t));
+    sp[0] = 0x1f80 | ((uint64_t)0x037f << 32);
+    sp[7] = (uint64_t)(uintptr_t)lws_coro_entry;
+    co->sp = sp;
+#else
+    if (getcontext(&co->ctx)) {
+        lws_coro_release(co);
+        return NULL;
+    }
+    co->ctx.uc_stack.ss_sp = base + sysconf(_SC_PAGESIZE);
+    co->ctx.uc_stack.ss_size = (char *)co - (char *)co->ctx.uc_stack.ss_sp;
+    co->ctx.uc_link = NULL;
+    makecontext(&co->ctx, lws_coro_entry, 0);
+#endif
+
+    return co;
+}
+
+/**
+ * @func    lws_coro_resume
+ * @brief   run coroutine until it yields or returns, a returned coroutine is
+ *          released and its stack goes back to the pool
+ *
+ * @param   co[in] coroutine of the calling thread
+ * @return  1 if the coroutine returned, 0 if it yielded.
+ */
+int lws_coro_resume(lws_coro_t *co)
+{
+    lws_coro_t *prev = lws_coro_running;
+
+    lws_coro_running = co;
+    lws_coro_enter(co);
+    lws_coro_running = prev;
+
+    if (!co->done)
+        return 0;
+
+    lws_coro_release(co);
+    return 1;
+}
+
+/**
+ * @func    lws_coro_yield
+ * @brief   suspend the running coroutine, return to its resumer
+ *
+ * @return  void
+ */
+void lws_coro_yield(void)
+{
+    lws_coro_t *co = lws_coro_running;
+
+    if (co)
+        lws_coro_leave(co);
+}
+
+/**
+ * @func    lws_coro_self
+ * @brief   running coroutine of the calling thread
+ *
+ * @return  coroutine, or NULL outside of coroutines.
+ */
+lws_coro_t *lws_coro_self(void)
+{
+    return lws_coro_running;
+}
+
+/**
+ * @func    lws_coro_data
+ * @brief   user pointer of a coroutine, NULL until set
+ *
+ * @param   co[in] coroutine
+ * @return  user pointer
+ */
+void *lws_coro_data(lws_coro_t *co)
+{
+    return co->data;
+}
+
+/**
+ * @func    lws_coro_set_data
+ * @brief   set user pointer of a coroutine
+ *
+ * @param   co[in] coroutine
+ * @param   data[in] user pointer
+ * @return  void
+ */
+void lws_coro_set_data(lws_coro_t *co, void *data)
+{
+    co->data = data;
+}
+
+/**
+ * @func    lws_coro_set_watch
+ * @brief   install the event loop hook of the calling thread, coroutines
+ *          only suspend on threads that have one
+ *
+ * @param   watch[in] hook, or NULL to block in lws_coro_wait
+ * @return  void
+ */
+void lws_coro_set_watch(lws_coro_watch_t watch)
+{
+    lws_coro_watch = watch;
+}
+
+/**
+ * @func    lws_coro_enabled
+ * @brief   check if coroutines can suspend on the calling thread
+ *
+ * @return  1 if a watch hook is installed, or 0.
+ */
+int lws_coro_enabled(void)
+{
+    return lws_coro_watch != NULL;
+}
+
+static uint64_t lws_coro_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @func    lws_coro_wait
+ * @brief   wait for poll events on fd, a coroutine yields to the event loop
+ *          meanwhile, anything else blocks in poll
+ *
+ * @param   fd[in] file descriptor
+ * @param   events[in] poll events
+ * @param   timeout_ms[in] timeout
+ * @return  > 0 if ready, 0 with errno ETIMEDOUT, -1 on error.
+ */
+int lws_coro_wait(int fd, int events, int timeout_ms)
+{
+    lws_coro_t *co = lws_coro_running;
+    struct pollfd pfd;
+    uint64_t deadline, now;
+    int ret;
+
+    pfd.fd = fd;
+    pfd.events = events;
+
+    /* callers wait after EAGAIN, so watch first; a resume is only a hint, poll tells */
+    if (co && lws_coro_watch) {
+        deadline = lws_coro_now_ms() + timeout_ms;
+        while (lws_coro_watch(co, fd, events, timeout_ms) == 0) {
+            lws_coro_yield();
+
+            do {
+                ret = poll(&pfd, 1, 0);
+            } while (ret < 0 && errno == EINTR);
+            if (ret != 0)
+                return ret;
+
+            now = lws_coro_now_ms();
+            if (now >= deadline) {
+                errno = ETIMEDOUT;
+                return 0;
+            }
+            timeout_ms = deadline - now;
+        }
+    }
+
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret == 0)
+        errno = ETIMEDOUT;
+    return ret;
+}
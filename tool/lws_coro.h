@@ -0,0 +1,110 @@
+#ifndef _LWS_CORO_H_
+#define _LWS_CORO_H_
+
+#include <stdint.h>
+
+#define LWS_CORO_STACK_SIZE     (64 * 1024) /* per coroutine, a guard page below it */
+#define LWS_CORO_POOL_MAX       1024        /* idle stacks kept per thread, more are unmapped */
+
+/**
+ * stackful coroutine, runs a function on its own small stack until it
+ * yields, then continues where it left off on the next resume. A coroutine
+ * belongs to the thread that created it and is only resumed there.
+**/
+typedef struct _lws_coro_t_ lws_coro_t;
+
+typedef void (*lws_coro_fn_t)(void *arg);
+
+/*
+ * event loop hook: resume co with lws_coro_resume once fd has one of the
+ * poll events, or once timeout_ms passed. Return 0 if watched, -1 if the
+ * wait has to block the thread instead.
+ */
+typedef int (*lws_coro_watch_t)(lws_coro_t *co, int fd, int events, int timeout_ms);
+
+/**
+ * @func    lws_coro_new
+ * @brief   create a coroutine on a pooled stack, it starts on the first resume
+ *
+ * @param   fn[in] coroutine body, arg is only valid until its first yield
+ * @param   arg[in] argument of fn
+ * @return  On success, return coroutine. On error, return NULL.
+ */
+extern lws_coro_t *lws_coro_new(lws_coro_fn_t fn, void *arg);
+
+/**
+ * @func    lws_coro_resume
+ * @brief   run coroutine until it yields or returns, a returned coroutine is
+ *          released and its stack goes back to the pool
+ *
+ * @param   co[in] coroutine of the calling thread
+ * @return  1 if the coroutine returned, 0 if it yielded.
+ */
+extern int lws_coro_resume(lws_coro_t *co);
+
+/**
+ * @func    lws_coro_yield
+ * @brief   suspend the running coroutine, return to its resumer
+ *
+ * @return  void
+ */
+extern void lws_coro_yield(void);
+
+/**
+ * @func    lws_coro_self
+ * @brief   running coroutine of the calling thread
+ *
+ * @return  coroutine, or NULL outside of coroutines.
+ */
+extern lws_coro_t *lws_coro_self(void);
+
+/**
+ * @func    lws_coro_data
+ * @brief   user pointer of a coroutine, NULL until set
+ *
+ * @param   co[in] coroutine
+ * @return  user pointer
+ */
+extern void *lws_coro_data(lws_coro_t *co);
+
+/**
+ * @func    lws_coro_set_data
+ * @brief   set user pointer of a coroutine
+ *
+ * @param   co[in] coroutine
+ * @param   data[in] user pointer
+ * @return  void
+ */
+extern void lws_coro_set_data(lws_coro_t *co, void *data);
+
+/**
+ * @func    lws_coro_set_watch
+ * @brief   install the event loop hook of the calling thread, coroutines
+ *          only suspend on threads that have one
+ *
+ * @param   watch[in] hook, or NULL to block in lws_coro_wait
+ * @return  void
+ */
+extern void lws_coro_set_watch(lws_coro_watch_t watch);
+
+/**
+ * @func    lws_coro_enabled
+ * @brief   check if coroutines can suspend on the calling thread
+ *
+ * @return  1 if a watch hook is installed, or 0.
+ */
+extern int lws_coro_enabled(void);
+
+/**
+ * @func    lws_coro_wait
+ * @brief   wait for poll events on fd, a coroutine yields to the event loop
+ *          meanwhile, anything else blocks in poll
+ *
+ * @param   fd[in] file descriptor
+ * @param   events[in] poll events
+ * @param   timeout_ms[in] timeout
+ * @return  > 0 if ready, 0 with errno ETIMEDOUT, -1 on error.
+ */
+extern int lws_coro_wait(int fd, int events, int timeout_ms);
+
+#endif // _LWS_CORO_H_
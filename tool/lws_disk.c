@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+
+#include "lws_log.h"
+#include "lws_coro.h"
+#include "lws_disk.h"
+
+/* finished reads of one event loop thread, pushed by pool threads, newest first */
+typedef struct _lws_disk_queue_t_ {
+    lws_disk_job_t *head;
+    int eventfd;                            /* written when head was empty */
+} lws_disk_queue_t;
+
+/* submission queue, bounded, pool threads take from the head */
+static pthread_mutex_t lws_disk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lws_disk_cond = PTHREAD_COND_INITIALIZER;
+static lws_disk_job_t *lws_disk_head = NULL;
+static lws_disk_job_t *lws_disk_tail = NULL;
+static int lws_disk_queued = 0;
+static int lws_disk_queue_max = 0;
+static int lws_disk_threads = 0;            /* configured */
+static int lws_disk_started = 0;            /* running */
+static int lws_disk_nowait = 1;             /* cleared if the kernel lacks RWF_NOWAIT */
+
+static __thread lws_disk_queue_t *lws_disk_self = NULL;
+
+/* non-blocking read, -1 with EAGAIN where the page cache misses */
+static ssize_t lws_disk_read_nowait(int fd, void *buf, size_t size, off_t offset)
+{
+    struct iovec iov;
+    ssize_t ret;
+
+    iov.iov_base = buf;
+    iov.iov_len = size;
+    do {
+        ret = preadv2(fd, &iov, 1, offset, RWF_NOWAIT);
+    } while (ret < 0 && errno == EINTR);
+
+    /* an old kernel, or a file system that cannot tell, reads blocking from now on */
+    if (ret < 0 && (errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)) {
+        if (lws_disk_nowait)
+            lws_log(3, "preadv2 RWF_NOWAIT unsupported, %s\n", strerror(errno));
+        lws_disk_nowait = 0;
+        ret = pread(fd, buf, size, offset);
+    }
+
+    return ret;
+}
+
+static void lws_disk_run(lws_disk_job_t *job, char *scratch)
+{
+    ssize_t ret;
+    int nread = 0;
+
+    /* a fetch reads through the scratch buffer, the page cache keeps the data */
+    while (nread < job->size) {
+        if (job->buf)
+            ret = pread(job->fd, job->buf + nread, job->size - nread, job->offset + nread);
+        else
+            ret = pread(job->fd, scratch, job->size - nread, job->offset + nread);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            job->err = errno;
+        if (ret <= 0)
+            break;
+        nread += ret;
+    }
+    job->result = (nread == 0 && job->err) ? -1 : nread;
+
+    /* a sequential reader comes back for the next window, start it early */
+    if (job->buf == NULL && nread == job->size)
+        posix_fadvise(job->fd, job->offset + nread, LWS_DISK_WINDOW, POSIX_FADV_WILLNEED);
+}
+
+/*
+ * Lock-free push onto the completion queue of the owner thread. Only the
+ * owner takes from it, all at once, so a push cannot race a pop of the same
+ * node. The job belongs to its submitter again once it is pushed.
+ */
+static void lws_disk_complete(lws_disk_job_t *job)
+{
+    lws_disk_queue_t *q = job->owner;
+    lws_disk_job_t *head;
+    uint64_t one = 1;
+
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELAXED);
+    head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    do {
+        job->next = head;
+    } while (!__atomic_compare_exchange_n(&q->head, &head, job, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    if (head == NULL && write(q->eventfd, &one, sizeof(one)) < 0)
+        lws_log(2, "disk wakeup failed, %s\n", strerror(errno));
+}
+
+static void *lws_disk_thread(void *arg)
+{
+    lws_disk_job_t *job;
+    char *scratch = arg;
+
+    while (1) {
+        pthread_mutex_lock(&lws_disk_lock);
+        while (lws_disk_head == NULL)
+            pthread_cond_wait(&lws_disk_cond, &lws_disk_lock);
+
+        job = lws_disk_head;
+        lws_disk_head = job->next;
+        if (lws_disk_head == NULL)
+            lws_disk_tail = NULL;
+        lws_disk_queued--;
+        pthread_mutex_unlock(&lws_disk_lock);
+
+        lws_disk_run(job, scratch);
+        lws_disk_complete(job);
+    }
+
+    return NULL;
+}
+
+/* start the pool threads once, with every signal blocked, under lws_disk_lock */
+static int lws_disk_start(void)
+{
+    sigset_t mask, omask;
+    pthread_t tid;
+    char *scratch;
+    int i;
+
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, &omask);
+    for (i = 0; i < lws_disk_threads; i++) {
+        scratch = malloc(LWS_DISK_WINDOW);
+        if (scratch == NULL)
+            break;
+        if (pthread_create(&tid, NULL, lws_disk_thread, scratch)) {
+            lws_log(2, "create disk thread failed, %s\n", strerror(errno));
+            free(scratch);
+            break;
+        }
+        pthread_detach(tid);
+    }
+    pthread_sigmask(SIG_SETMASK, &omask, NULL);
+
+    if (i == 0)
+        return -1;
+
+    lws_disk_started = i;
+    lws_disk_queue_max = i * LWS_DISK_QUEUE_PER_THREAD;
+    lws_log(3, "disk pool: %d threads, queue: %d\n", i, lws_disk_queue_max);
+    return 0;
+}
+
+/**
+ * @func    lws_disk_init
+ * @brief   size the disk pool, its threads start with the first read
+ *          submitted to it, a run whose files stay cached never starts them
+ *
+ * @param   threads[in] pool threads, 0 reads inline
+ * @return  On success, return 0, On error, return -1.
+ */
+int lws_disk_init(int threads)
+{
+    if (threads < 0 || threads > LWS_DISK_MAX_THREADS) {
+        lws_log(2, "disk threads out of range: %d\n", threads);
+        return -1;
+    }
+
+    lws_disk_threads = threads;
+    return 0;
+}
+
+/**
+ * @func    lws_disk_attach
+ * @brief   create the completion queue of the calling event loop thread,
+ *          its eventfd turns readable when reads finished
+ *
+ * @return  eventfd, or -1 if there is no pool.
+ */
+int lws_disk_attach(void)
+{
+    lws_disk_queue_t *q;
+
+    if (lws_disk_threads == 0)
+        return -1;
+
+    if (lws_disk_self)
+        return lws_disk_self->eventfd;
+
+    q = calloc(1, sizeof(lws_disk_queue_t));
+    if (q == NULL)
+        return -1;
+
+    q->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (q->eventfd < 0) {
+        lws_log(2, "disk eventfd failed, %s\n", strerror(errno));
+        free(q);
+        return -1;
+    }
+
+    lws_disk_self = q;
+    return q->eventfd;
+}
+
+/**
+ * @func    lws_disk_attached
+ * @brief   check if the calling thread hands cold reads to the pool
+ *
+ * @return  1 if attached, or 0.
+ */
+int lws_disk_attached(void)
+{
+    return lws_disk_self != NULL && lws_disk_nowait;
+}
+
+/**
+ * @func    lws_disk_reap
+ * @brief   take the finished reads of the calling thread, done is called
+ *          with each job, oldest first
+ *
+ * @param   done[in] completion callback, a job waited on by a coroutine is
+ *          released once the coroutine resumes
+ * @return  void
+ */
+void lws_disk_reap(void (*done)(lws_disk_job_t *job))
+{
+    lws_disk_queue_t *q = lws_disk_self;
+    lws_disk_job_t *job, *next, *list = NULL;
+    uint64_t count;
+
+    if (q == NULL)
+        return;
+
+    /* reset the eventfd first, a push after the exchange writes it again */
+    if (read(q->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        lws_log(2, "disk eventfd read failed, %s\n", strerror(errno));
+
+    job = __atomic_exchange_n(&q->head, NULL, __ATOMIC_ACQUIRE);
+    while (job) {
+        next = job->next;
+        job->next = list;
+        list = job;
+        job = next;
+    }
+
+    while (list) {
+        next = list->next;
+        done(list);
+        list = next;
+    }
+}
+
+/**
+ * @func    lws_disk_resident
+ * @brief   check without blocking if a file range is in the page cache,
+ *          its first and last page are probed
+ *
+ * @param   fd[in] file fd
+ * @param   offset[in] range start
+ * @param   size[in] range length
+ * @return  1 if resident or unknown, 0 if a read would go to disk.
+ */
+int lws_disk_resident(int fd, off_t offset, int size)
+{
+    char probe;
+
+    if (!lws_disk_nowait || size <= 0)
+        return 1;
+
+    /* readahead fills ranges front to back, holes in the middle are rare */
+    if (lws_disk_read_nowait(fd, &probe, 1, offset) < 0 && errno == EAGAIN)
+        return 0;
+    if (size > 1 && lws_disk_read_nowait(fd, &probe, 1, offset + size - 1) < 0 && errno == EAGAIN)
+        return 0;
+
+    return 1;
+}
+
+/**
+ * @func    lws_disk_submit
+ * @brief   queue job on the pool, the caller fills fd, buf, offset, size,
+ *          co and arg; it is returned by lws_disk_reap of this thread
+ *
+ * @param   job[in] read, kept until reaped
+ * @return  On success, return 0. If the queue is full or the thread is not
+ *          attached, return -1.
+ */
+int lws_disk_submit(lws_disk_job_t *job)
+{
+    if (lws_disk_self == NULL)
+        return -1;
+
+    job->owner = lws_disk_self;
+    job->result = -1;
+    job->err = 0;
+    job->done = 0;
+
+    /* the first page cache miss starts the threads */
+    pthread_mutex_lock(&lws_disk_lock);
+    if ((lws_disk_started == 0 && lws_disk_start()) || lws_disk_queued >= lws_disk_queue_max) {
+        pthread_mutex_unlock(&lws_disk_lock);
+        return -1;
+    }
+
+    job->next = NULL;
+    if (lws_disk_tail)
+        lws_disk_tail->next = job;
+    else
+        lws_disk_head = job;
+    lws_disk_tail = job;
+    lws_disk_queued++;
+    pthread_cond_signal(&lws_disk_cond);
+    pthread_mutex_unlock(&lws_disk_lock);
+    return 0;
+}
+
+/**
+ * @func    lws_disk_pread
+ * @brief   pread that does not stall the event loop: a handler coroutine
+ *          whose read misses the page cache yields while the pool reads,
+ *          other callers read in place
+ *
+ * @param   fd[in] file fd
+ * @param   buf[out] destination
+ * @param   size[in] bytes to read
+ * @param   offset[in] file offset
+ * @return  bytes read, 0 at end of file, -1 on error.
+ */
+ssize_t lws_disk_pread(int fd, void *buf, size_t size, off_t offset)
+{
+    lws_disk_job_t job;
+    ssize_t ret;
+
+    if (!lws_disk_attached() || lws_coro_self() == NULL)
+        return pread(fd, buf, size, offset);
+
+    ret = lws_disk_read_nowait(fd, buf, size, offset);
+    if (ret >= 0 || errno != EAGAIN)
+        return ret;
+
+    job.fd = fd;
+    job.buf = buf;
+    job.offset = offset;
+    job.size = size;
+    job.co = lws_coro_self();
+    job.arg = NULL;
+    if (lws_disk_submit(&job))
+        return pread(fd, buf, size, offset);
+
+    /* resumed by the event loop once the job is on the completion queue */
+    while (!__atomic_load_n(&job.done, __ATOMIC_ACQUIRE))
+        lws_coro_yield();
+
+    errno = job.err;
+    return job.result;
+}
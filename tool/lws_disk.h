@@ -0,0 +1,108 @@
+#ifndef _LWS_DISK_H_
+#define _LWS_DISK_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "lws_coro.h"
+
+#define LWS_DISK_MAX_THREADS        64
+#define LWS_DISK_QUEUE_PER_THREAD   64          /* queued reads per pool thread, more run inline */
+#define LWS_DISK_WINDOW             (512 * 1024) /* file bytes probed and fetched at once */
+
+/**
+ * read on the disk pool, handed over when the page cache misses. A read
+ * with a buffer fills it, one without only brings the range into the page
+ * cache for a later sendfile. Completed reads go back to the event loop
+ * thread that submitted them.
+**/
+typedef struct _lws_disk_job_t_ {
+    struct _lws_disk_job_t_ *next;
+    struct _lws_disk_queue_t_ *owner;
+    int fd;
+    char *buf;                          /* destination, or NULL to fetch only */
+    off_t offset;
+    int size;
+    ssize_t result;                     /* bytes read, or -1 */
+    int err;                            /* errno of a failed read */
+    int done;
+    lws_coro_t *co;                     /* coroutine waiting in lws_disk_pread, or NULL */
+    void *arg;                          /* submitter data */
+} lws_disk_job_t;
+
+/**
+ * @func    lws_disk_init
+ * @brief   size the disk pool, its threads start with the first read
+ *          submitted to it, a run whose files stay cached never starts them
+ *
+ * @param   threads[in] pool threads, 0 reads inline
+ * @return  On success, return 0, On error, return -1.
+ */
+extern int lws_disk_init(int threads);
+
+/**
+ * @func    lws_disk_attach
+ * @brief   create the completion queue of the calling event loop thread,
+ *          its eventfd turns readable when reads finished
+ *
+ * @return  eventfd, or -1 if there is no pool.
+ */
+extern int lws_disk_attach(void);
+
+/**
+ * @func    lws_disk_attached
+ * @brief   check if the calling thread hands cold reads to the pool
+ *
+ * @return  1 if attached, or 0.
+ */
+extern int lws_disk_attached(void);
+
+/**
+ * @func    lws_disk_reap
+ * @brief   take the finished reads of the calling thread, done is called
+ *          with each job, oldest first
+ *
+ * @param   done[in] completion callback, a job waited on by a coroutine is
+ *          released once the coroutine resumes
+ * @return  void
+ */
+extern void lws_disk_reap(void (*done)(lws_disk_job_t *job));
+
+/**
+ * @func    lws_disk_resident
+ * @brief   check without blocking if a file range is in the page cache,
+ *          its first and last page are probed
+ *
+ * @param   fd[in] file fd
+ * @param   offset[in] range start
+ * @param   size[in] range length
+ * @return  1 if resident or unknown, 0 if a read would go to disk.
+ */
+extern int lws_disk_resident(int fd, off_t offset, int size);
+
+/**
+ * @func    lws_disk_submit
+ * @brief   queue job on the pool, the caller fills fd, buf, offset, size,
+ *          co and arg; it is returned by lws_disk_reap of this thread
+ *
+ * @param   job[in] read, kept until reaped
+ * @return  On success, return 0. If the queue is full or the thread is not
+ *          attached, return -1.
+ */
+extern int lws_disk_submit(lws_disk_job_t *job);
+
+/**
+ * @func    lws_disk_pread
+ * @brief   pread that does not stall the event loop: a handler coroutine
+ *          whose read misses the page cache yields while the pool reads,
+ *          other callers read in place
+ *
+ * @param   fd[in] file fd
+ * @param   buf[out] destination
+ * @param   size[in] bytes to read
+ * @param   offset[in] file offset
+ * @return  bytes read, 0 at end of file, -1 on error.
+ */
+extern ssize_t lws_disk_pread(int fd, void *buf, size_t size, off_t offset);
+
+#endif // _LWS_DISK_H_
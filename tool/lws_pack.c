@@ -0,0 +1,375 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ftw.h>
+#include <zlib.h>
+#include <sys/stat.h>
+
+#include "lws_bundle.h"
+
+/*
+ * lws_pack - pack a directory tree into the binary
+ *
+ * Reads every regular file below a directory and writes a C source with
+ * the contents as one read-only blob, plus the lws_bundle index: a minimal
+ * perfect hash over the paths (hash and displace), strong ETags, content
+ * types and gzip variants where they save at least an eighth. Runs on the
+ * build host, the server then serves the files without touching the file
+ * system. Output is sorted, the same tree always gives the same source.
+ */
+
+#define PACK_MAX_FILE       (4 * 1024 * 1024)   /* larger files stay on disk */
+#define PACK_MAX_DISP       (1 << 24)           /* displacements tried per bucket */
+
+typedef struct _pack_file_t_ {
+    char *path;                             /* "/picture/show.jpg" */
+    int path_len;
+    unsigned char *data;
+    int size;
+    unsigned char *gzip;
+    int gzip_size;
+    uint64_t hash;
+    int bucket;
+} pack_file_t;
+
+static pack_file_t *pack_files = NULL;
+static int pack_count = 0;
+static int pack_capacity = 0;
+static int pack_root_len = 0;
+
+static struct content_type_t {
+    char *extension;
+    char *type;
+} pack_types[] = {
+    LWS_HTTP_CONTENT_TYPES
+};
+
+static const char *pack_content_type(const char *path)
+{
+    size_t len = strlen(path), ext;
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(pack_types); i++) {
+        ext = strlen(pack_types[i].extension);
+        if (len >= ext && strcasecmp(path + len - ext, pack_types[i].extension) == 0)
+            return pack_types[i].type;
+    }
+
+    return LWS_HTTP_OCTET_STREAM;
+}
+
+/* 64 bit FNV-1a of the content, the ETag */
+static uint64_t pack_hash(const unsigned char *data, int size)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i;
+
+    for (i = 0; i < size; i++)
+        h = (h ^ data[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+static int pack_read(const char *name, int size, unsigned char **out)
+{
+    unsigned char *data;
+    FILE *fp;
+
+    data = malloc(size > 0 ? size : 1);
+    fp = fopen(name, "rb");
+    if (data == NULL || fp == NULL || (int)fread(data, 1, size, fp) != size) {
+        fprintf(stderr, "lws_pack: read %s failed, %s\n", name, strerror(errno));
+        if (fp)
+            fclose(fp);
+        free(data);
+        return -1;
+    }
+
+    fclose(fp);
+    *out = data;
+    return 0;
+}
+
+/* gzip at the best level, kept only if it is at least an eighth smaller */
+static void pack_gzip(pack_file_t *f)
+{
+    z_stream zs;
+    unsigned long bound;
+
+    memset(&zs, 0, sizeof(zs));
+    if (f->size < 64 || deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+
+    bound = deflateBound(&zs, f->size);
+    f->gzip = malloc(bound);
+    if (f->gzip == NULL) {
+        deflateEnd(&zs);
+        return;
+    }
+
+    zs.next_in = f->data;
+    zs.avail_in = f->size;
+    zs.next_out = f->gzip;
+    zs.avail_out = bound;
+    if (deflate(&zs, Z_FINISH) == Z_STREAM_END && (int)zs.total_out <= f->size - f->size / 8)
+        f->gzip_size = zs.total_out;
+    deflateEnd(&zs);
+
+    if (f->gzip_size == 0) {
+        free(f->gzip);
+        f->gzip = NULL;
+    }
+}
+
+static int pack_visit(const char *name, const struct stat *st, int type, struct FTW *ftw)
+{
+    pack_file_t *f;
+
+    if (type != FTW_F || !S_ISREG(st->st_mode))
+        return 0;
+
+    if (st->st_size > PACK_MAX_FILE) {
+        fprintf(stderr, "lws_pack: %s is larger than %d bytes, left on disk\n", name, PACK_MAX_FILE);
+        return 0;
+    }
+
+    if (pack_count == pack_capacity) {
+        pack_capacity = pack_capacity ? pack_capacity * 2 : 64;
+        pack_files = realloc(pack_files, pack_capacity * sizeof(pack_file_t));
+        if (pack_files == NULL)
+            return -1;
+    }
+
+    f = &pack_files[pack_count];
+    memset(f, 0, sizeof(*f));
+    f->path = strdup(name + pack_root_len);
+    f->path_len = strlen(f->path);
+    f->size = st->st_size;
+    if (f->path == NULL || f->path[0] != '/' || pack_read(name, f->size, &f->data))
+        return -1;
+
+    f->hash = pack_hash(f->data, f->size);
+    pack_gzip(f);
+    pack_count++;
+    return 0;
+}
+
+static int pack_compare(const void *a, const void *b)
+{
+    return strcmp(((const pack_file_t *)a)->path, ((const pack_file_t *)b)->path);
+}
+
+/* bucket indexes, largest bucket first */
+static int *pack_bucket_sizes;
+static int pack_bucket_compare(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+
+    if (pack_bucket_sizes[x] != pack_bucket_sizes[y])
+        return pack_bucket_sizes[y] - pack_bucket_sizes[x];
+    return x - y;
+}
+
+/*
+ * Hash and displace: paths are grouped into n buckets by the seed 0 hash,
+ * then, largest bucket first, a displacement is searched that sends every
+ * path of the bucket to a free slot. Buckets of one path take the next free
+ * slot directly, stored as -slot - 1. slots[i] is the file of slot i.
+ */
+static int pack_index(int *disp, int *slots)
+{
+    int n = pack_count;
+    int *sizes, *order, *members, *taken;
+    int b, i, j, k, d, count, free_slot = 0;
+
+    sizes = calloc(n, sizeof(int));
+    order = malloc(n * sizeof(int));
+    members = malloc(n * sizeof(int));
+    taken = malloc(n * sizeof(int));
+    if (sizes == NULL || order == NULL || members == NULL || taken == NULL)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        pack_files[i].bucket = lws_bundle_hash(0, pack_files[i].path, pack_files[i].path_len) % n;
+        sizes[pack_files[i].bucket]++;
+        order[i] = i;
+        slots[i] = -1;
+        disp[i] = 0;
+    }
+    pack_bucket_sizes = sizes;
+    qsort(order, n, sizeof(int), pack_bucket_compare);
+
+    for (i = 0; i < n && sizes[order[i]] > 0; i++) {
+        b = order[i];
+        count = 0;
+        for (j = 0; j < n; j++) {
+            if (pack_files[j].bucket == b)
+                members[count++] = j;
+        }
+
+        if (count == 1) {
+            while (slots[free_slot] >= 0)
+                free_slot++;
+            slots[free_slot] = members[0];
+            disp[b] = -free_slot - 1;
+            continue;
+        }
+
+        for (d = 1; d < PACK_MAX_DISP; d++) {
+            for (j = 0; j < count; j++) {
+                taken[j] = lws_bundle_hash(d, pack_files[members[j]].path, pack_files[members[j]].path_len) % n;
+                if (slots[taken[j]] >= 0)
+                    break;
+                for (k = 0; k < j && taken[k] != taken[j]; k++)
+                    ;
+                if (k < j)
+                    break;
+            }
+            if (j == count)
+                break;
+        }
+        if (d == PACK_MAX_DISP) {
+            fprintf(stderr, "lws_pack: no displacement for bucket %d\n", b);
+            return -1;
+        }
+
+        for (j = 0; j < count; j++)
+            slots[taken[j]] = members[j];
+        disp[b] = d;
+    }
+
+    free(sizes);
+    free(order);
+    free(members);
+    free(taken);
+    return 0;
+}
+
+/* C string literal, quotes, backslashes and anything unprintable escaped */
+static void pack_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(fp, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20 || (unsigned char)*s >= 0x7f)
+            fprintf(fp, "\\%03o", (unsigned char)*s);
+        else
+            fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+static void pack_bytes(FILE *fp, const unsigned char *data, int size, long *column)
+{
+    int i;
+
+    for (i = 0; i < size; i++)
+        fprintf(fp, "0x%02x,%s", data[i], (++*column % 16) ? "" : "\n");
+}
+
+static int pack_write(FILE *fp, const char *dir, int *disp, int *slots)
+{
+    pack_file_t *f;
+    long column = 0;
+    int offset = 0;
+    int i;
+
+    fprintf(fp, "/* generated by lws_pack from %s, do not edit */\n", dir);
+    fprintf(fp, "#include \"lws_bundle.h\"\n\n");
+
+    fprintf(fp, "const unsigned char lws_bundle_blob[] __attribute__((aligned(64))) = {\n");
+    for (i = 0; i < pack_count; i++) {
+        f = &pack_files[slots[i]];
+        pack_bytes(fp, f->data, f->size, &column);
+        pack_bytes(fp, f->gzip, f->gzip_size, &column);
+    }
+    if (column == 0)
+        fprintf(fp, "0x00,");
+    fprintf(fp, "\n};\n\n");
+
+    fprintf(fp, "const lws_bundle_entry_t lws_bundle_entries[] = {\n");
+    for (i = 0; i < pack_count; i++) {
+        f = &pack_files[slots[i]];
+        fprintf(fp, "    {");
+        pack_string(fp, f->path);
+        fprintf(fp, ", %d, ", f->path_len);
+        pack_string(fp, pack_content_type(f->path));
+        fprintf(fp, ", \"\\\"%x-%016llx\\\"\", ", f->size, (unsigned long long)f->hash);
+        if (f->gzip_size)
+            fprintf(fp, "\"\\\"%x-%016llx-gz\\\"\"", f->size, (unsigned long long)f->hash);
+        else
+            fprintf(fp, "NULL");
+        fprintf(fp, ", %d, %d, %d, %d},\n", offset, f->size, offset + f->size, f->gzip_size);
+        offset += f->size + f->gzip_size;
+    }
+    if (pack_count == 0)
+        fprintf(fp, "    {NULL, 0, NULL, NULL, NULL, 0, 0, 0, 0},\n");
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "const int lws_bundle_disp[] = {\n");
+    for (i = 0; i < pack_count; i++)
+        fprintf(fp, "    %d,\n", disp[i]);
+    if (pack_count == 0)
+        fprintf(fp, "    0,\n");
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "const int lws_bundle_count = %d;\n", pack_count);
+    return ferror(fp) ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    char tmp[4096];
+    int *disp, *slots;
+    long total = 0;
+    FILE *fp;
+    int i;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: lws_pack dir out.c\n");
+        return 1;
+    }
+
+    pack_root_len = strlen(argv[1]);
+    while (pack_root_len > 1 && argv[1][pack_root_len - 1] == '/')
+        pack_root_len--;
+
+    if (nftw(argv[1], pack_visit, 16, FTW_PHYS)) {
+        fprintf(stderr, "lws_pack: walk %s failed\n", argv[1]);
+        return 1;
+    }
+    qsort(pack_files, pack_count, sizeof(pack_file_t), pack_compare);
+
+    for (i = 0; i < pack_count; i++) {
+        total += pack_files[i].size + pack_files[i].gzip_size;
+        if (total > INT32_MAX) {
+            fprintf(stderr, "lws_pack: bundle over 2 GB\n");
+            return 1;
+        }
+    }
+
+    disp = malloc((pack_count + 1) * sizeof(int));
+    slots = malloc((pack_count + 1) * sizeof(int));
+    if (disp == NULL || slots == NULL || (pack_count && pack_index(disp, slots)))
+        return 1;
+
+    /* a failed run leaves no output behind that make takes as up to date */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", argv[2]);
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "lws_pack: open %s failed, %s\n", tmp, strerror(errno));
+        return 1;
+    }
+    if (pack_write(fp, argv[1], disp, slots) || fclose(fp) || rename(tmp, argv[2])) {
+        fprintf(stderr, "lws_pack: write %s failed\n", argv[2]);
+        unlink(tmp);
+        return 1;
+    }
+
+    return 0;
+}
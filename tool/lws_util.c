@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdint.h>
 
 #include "lws_log.h"
 #include "lws_util.h"
@@ -92,3 +93,177 @@ int lws_read_file(char *filename, void *data, int size)
 }
 
 
+
+/**
+ * @func    lws_base64_decode
+ * @brief   decode base64, standard or url alphabet, padding is optional
+ *
+ * @param   src[in] encoded data
+ * @param   size[in] encoded data size
+ * @param   dst[out] decoded data, at least size * 3 / 4 bytes
+ * @return  On success, return decoded size. On error, return -1.
+ **/
+int lws_base64_decode(const char *src, int size, unsigned char *dst)
+{
+    unsigned int acc = 0;
+    int bits = 0;
+    int n = 0;
+    int i, v;
+    char c;
+
+    while (size > 0 && src[size - 1] == '=')
+        size--;
+
+    for (i = 0; i < size; i++) {
+        c = src[i];
+        if (c >= 'A' && c <= 'Z')
+            v = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            v = c - '0' + 52;
+        else if (c == '+' || c == '-')
+            v = 62;
+        else if (c == '/' || c == '_')
+            v = 63;
+        else
+            return -1;
+
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            dst[n++] = acc >> bits;
+        }
+    }
+
+    /* a single leftover character can not encode a byte */
+    if (bits >= 6)
+        return -1;
+
+    return n;
+}
+
+/**
+ * @func    lws_base64_encode
+ * @brief   encode base64, standard alphabet with padding
+ *
+ * @param   src[in] input data
+ * @param   size[in] input data size
+ * @param   dst[out] encoded string, at least (size + 2) / 3 * 4 + 1 bytes
+ * @return  encoded length.
+ **/
+int lws_base64_encode(const unsigned char *src, int size, char *dst)
+{
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    unsigned int v;
+    int i, n = 0;
+
+    for (i = 0; i + 2 < size; i += 3) {
+        v = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+        dst[n++] = table[(v >> 18) & 0x3f];
+        dst[n++] = table[(v >> 12) & 0x3f];
+        dst[n++] = table[(v >> 6) & 0x3f];
+        dst[n++] = table[v & 0x3f];
+    }
+
+    if (i < size) {
+        v = src[i] << 16;
+        if (i + 1 < size)
+            v |= src[i + 1] << 8;
+        dst[n++] = table[(v >> 18) & 0x3f];
+        dst[n++] = table[(v >> 12) & 0x3f];
+        dst[n++] = (i + 1 < size) ? table[(v >> 6) & 0x3f] : '=';
+        dst[n++] = '=';
+    }
+
+    dst[n] = '\0';
+    return n;
+}
+
+#define LWS_SHA1_ROL(v, n)  (((v) << (n)) | ((v) >> (32 - (n))))
+
+static void lws_sha1_block(uint32_t state[5], const unsigned char *p)
+{
+    uint32_t w[80];
+    uint32_t a, b, c, d, e, f, k, t;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) | ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+    for (; i < 80; i++)
+        w[i] = LWS_SHA1_ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+
+    for (i = 0; i < 80; i++) {
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+
+        t = LWS_SHA1_ROL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = LWS_SHA1_ROL(b, 30);
+        b = a;
+        a = t;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+/**
+ * @func    lws_sha1
+ * @brief   SHA-1 digest
+ *
+ * @param   data[in] input data
+ * @param   size[in] input data size
+ * @param   digest[out] 20 byte digest
+ * @return  void
+ **/
+void lws_sha1(const void *data, size_t size, unsigned char digest[20])
+{
+    uint32_t state[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    const unsigned char *p = data;
+    unsigned char last[128];
+    uint64_t bits = (uint64_t)size * 8;
+    size_t rest;
+    int i, n;
+
+    for (; size >= 64; size -= 64, p += 64)
+        lws_sha1_block(state, p);
+
+    /* pad with 0x80, zeros and the bit length to one or two blocks */
+    rest = size;
+    memset(last, 0, sizeof(last));
+    memcpy(last, p, rest);
+    last[rest] = 0x80;
+    n = (rest < 56) ? 64 : 128;
+    for (i = 0; i < 8; i++)
+        last[n - 1 - i] = bits >> (i * 8);
+
+    lws_sha1_block(state, last);
+    if (n == 128)
+        lws_sha1_block(state, last + 64);
+
+    for (i = 0; i < 20; i++)
+        digest[i] = state[i / 4] >> (24 - (i % 4) * 8);
+}
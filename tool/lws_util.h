@@ -30,5 +30,38 @@ extern long lws_ftell_file(char *filename);
  **/
 extern int lws_read_file(char *filename, void *data, int size);
 
+/**
+ * @func    lws_base64_decode
+ * @brief   decode base64, standard or url alphabet, padding is optional
+ *
+ * @param   src[in] encoded data
+ * @param   size[in] encoded data size
+ * @param   dst[out] decoded data, at least size * 3 / 4 bytes
+ * @return  On success, return decoded size. On error, return -1.
+ **/
+extern int lws_base64_decode(const char *src, int size, unsigned char *dst);
+
+/**
+ * @func    lws_base64_encode
+ * @brief   encode base64, standard alphabet with padding
+ *
+ * @param   src[in] input data
+ * @param   size[in] input data size
+ * @param   dst[out] encoded string, at least (size + 2) / 3 * 4 + 1 bytes
+ * @return  encoded length.
+ **/
+extern int lws_base64_encode(const unsigned char *src, int size, char *dst);
+
+/**
+ * @func    lws_sha1
+ * @brief   SHA-1 digest
+ *
+ * @param   data[in] input data
+ * @param   size[in] input data size
+ * @param   digest[out] 20 byte digest
+ * @return  void
+ **/
+extern void lws_sha1(const void *data, size_t size, unsigned char digest[20]);
+
 #endif // _LWS_UTIL_H_
 